@@ -0,0 +1,259 @@
+#include "FSFILE.h"
+#include "FSFILE_buffer.h"
+#include "capture_trace.h"
+#include "host.h"
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Host FSFILE backend. Same interface as the Switch one, but backed by POSIX file descriptors so every write that reaches
+// the file is exactly one write call we can count. Buffering and growth are the shared code in FSFILE_buffer.c.
+
+/// @brief Same as the Switch version.
+enum FileModes
+{
+    Reading,
+    Writing
+};
+
+// clang-format off
+struct FSFILE
+{
+    /// @brief File descriptor.
+    int handle;
+
+    /// @brief The mode in which the file is opened.
+    uint8_t mode;
+
+    /// @brief Size, offset and write buffer.
+    FSFILEState state;
+};
+// clang-format on
+
+/// @brief Counters read by the harness.
+static HostFsStats stats = {0};
+
+/// @brief Joins the root of the filesystem and the path passed.
+static inline void host_path(const FsFileSystem *filesystem, const char *path, char *pathOut)
+{
+    snprintf(pathOut, HOST_MAX_PATH, "%s%s", filesystem->root, path);
+}
+
+bool host_fs_open(FsFileSystem *filesystem, const char *root)
+{
+    // Trailing slashes are trimmed since every path passed in starts with one.
+    snprintf(filesystem->root, FS_MAX_PATH, "%s", root);
+    size_t rootLength = strlen(filesystem->root);
+    while (rootLength > 1 && filesystem->root[rootLength - 1] == '/') { filesystem->root[--rootLength] = '\0'; }
+
+    struct stat rootStat;
+    return stat(filesystem->root, &rootStat) == 0 && S_ISDIR(rootStat.st_mode);
+}
+
+void host_fs_reset_stats(void) { memset(&stats, 0, sizeof(HostFsStats)); }
+
+const HostFsStats *host_fs_get_stats(void) { return &stats; }
+
+void host_fs_count_directory_call(void) { ++stats.directoryCalls; }
+
+bool FSFILE_Exists(FsFileSystem *filesystem, const char *path)
+{
+    char fullPath[HOST_MAX_PATH];
+    host_path(filesystem, path, fullPath);
+
+    // The Switch opens and closes it.
+    capture_trace_count_ipc(2);
+    struct stat fileStat;
+    return stat(fullPath, &fileStat) == 0 && S_ISREG(fileStat.st_mode);
+}
+
+bool FSFILE_Delete(FsFileSystem *filesystem, const char *path)
+{
+    char fullPath[HOST_MAX_PATH];
+    host_path(filesystem, path, fullPath);
+    capture_trace_count_ipc(1);
+    return unlink(fullPath) == 0;
+}
+
+bool FSFILE_Rename(FsFileSystem *filesystem, const char *oldPath, const char *newPath)
+{
+    char fullOld[HOST_MAX_PATH];
+    char fullNew[HOST_MAX_PATH];
+    host_path(filesystem, oldPath, fullOld);
+    host_path(filesystem, newPath, fullNew);
+    capture_trace_count_ipc(1);
+
+    // fsFsRenameFile won't replace an existing file.
+    const bool renamed = access(fullNew, F_OK) != 0 && rename(fullOld, fullNew) == 0;
+    // Spills and thumbnails get renamed too. Only count the ones that finish a capture.
+    const char *extension = strrchr(newPath, '.');
+    const bool thumbnail  = strstr(newPath, "_thumb.png") != NULL;
+    if (renamed && extension && strcmp(extension, ".png") == 0 && !thumbnail)
+    {
+        ++stats.renames;
+        snprintf(stats.lastRenamed, HOST_MAX_PATH, "%s", fullNew);
+    }
+
+    return renamed;
+}
+
+bool FSFILE_GetTimeStamp(FsFileSystem *filesystem, const char *path, uint64_t *timestampOut)
+{
+    char fullPath[HOST_MAX_PATH];
+    host_path(filesystem, path, fullPath);
+
+    capture_trace_count_ipc(1);
+    struct stat fileStat;
+    if (stat(fullPath, &fileStat) != 0) { return false; }
+
+    *timestampOut = (uint64_t)fileStat.st_mtime;
+    return true;
+}
+
+static FSFILE *host_open(FsFileSystem *filesystem, const char *path, int flags, uint8_t mode)
+{
+    char fullPath[HOST_MAX_PATH];
+    host_path(filesystem, path, fullPath);
+
+    FSFILE *file = calloc(1, sizeof(FSFILE));
+    if (!file) { return NULL; }
+
+    file->handle = open(fullPath, flags, 0644);
+    capture_trace_count_ipc(2);
+    if (file->handle < 0)
+    {
+        free(file);
+        return NULL;
+    }
+
+    struct stat fileStat;
+    fstat(file->handle, &fileStat);
+    file->state.size   = fileStat.st_size;
+    file->state.offset = 0;
+    file->mode         = mode;
+
+    return file;
+}
+
+FSFILE *FSFILE_OpenRead(FsFileSystem *filesystem, const char *path)
+{
+    return host_open(filesystem, path, O_RDONLY, Reading);
+}
+
+FSFILE *FSFILE_OpenWrite(FsFileSystem *filesystem, const char *path, int64_t size)
+{
+    FSFILE *file = host_open(filesystem, path, O_WRONLY | O_CREAT | O_TRUNC, Writing);
+    if (!file) { return NULL; }
+
+    // Match the Switch backend creating the file at full size.
+    if (ftruncate(file->handle, size) != 0)
+    {
+        FSFILE_Close(file);
+        return NULL;
+    }
+    file->state.size = size;
+
+    return file;
+}
+
+FSFILE *FSFILE_OpenWriteBuffered(FsFileSystem *filesystem, const char *path, int64_t size, size_t bufferSize)
+{
+    FSFILE *file = FSFILE_OpenWrite(filesystem, path, size);
+    if (!file) { return NULL; }
+
+    fsfile_buffer_open(&file->state, bufferSize);
+    return file;
+}
+
+FSFILE *FSFILE_OpenAppend(FsFileSystem *filesystem, const char *path)
+{
+    FSFILE *file = host_open(filesystem, path, O_WRONLY | O_CREAT, Writing);
+    if (!file) { return NULL; }
+
+    file->state.offset = file->state.size;
+    return file;
+}
+
+ssize_t FSFILE_Read(FSFILE *file, void *buffer, size_t size)
+{
+    if (!file || !buffer || file->mode != Reading) { return -1; }
+
+    const ssize_t bytesRead = pread(file->handle, buffer, size, file->state.offset);
+    capture_trace_count_read(bytesRead > 0 ? bytesRead : 0);
+    if (bytesRead < 0) { return -1; }
+
+    file->state.offset += bytesRead;
+    return bytesRead;
+}
+
+ssize_t FSFILE_Write(FSFILE *file, const void *buffer, size_t size)
+{
+    if (!file || !buffer || file->mode != Writing) { return -1; }
+
+    return fsfile_buffer_write(file, &file->state, buffer, size);
+}
+
+bool FSFILE_WriteAt(FSFILE *file, int64_t offset, const void *buffer, size_t size)
+{
+    if (!file || !buffer || file->mode != Writing) { return false; }
+
+    return fsfile_buffer_write_at(file, &file->state, offset, buffer, size);
+}
+
+ssize_t FSFILE_GetSize(FSFILE *file) { return file->state.size; }
+
+ssize_t FSFILE_Tell(FSFILE *file) { return file->state.offset; }
+
+bool FSFILE_SetSize(FSFILE *file, int64_t size)
+{
+    capture_trace_count_ipc(1);
+    return ftruncate(file->handle, size) == 0;
+}
+
+bool FSFILE_Flush(FSFILE *file)
+{
+    if (!file || !fsfile_buffer_flush(file, &file->state)) { return false; }
+
+    capture_trace_count_ipc(1);
+    return fsync(file->handle) == 0;
+}
+
+void FSFILE_Close(FSFILE *file)
+{
+    if (!file) { return; }
+
+    fsfile_buffer_flush(file, &file->state);
+    close(file->handle);
+    capture_trace_count_ipc(1);
+    fsfile_buffer_close(&file->state);
+    free(file);
+}
+
+void FSFILE_Finalize(FSFILE *file)
+{
+    if (!file) { return; }
+
+    // The Switch flushes here too. fsync would only measure the host's disk.
+    fsfile_buffer_flush(file, &file->state);
+    FSFILE_SetSize(file, file->state.offset);
+    FSFILE_Close(file);
+}
+
+bool fsfile_backend_write(FSFILE *file, int64_t offset, const void *data, size_t size)
+{
+    if (pwrite(file->handle, data, size, offset) != (ssize_t)size) { return false; }
+
+    ++stats.writeCalls;
+    stats.bytesWritten += size;
+    return true;
+}
+
+bool fsfile_backend_grow(FSFILE *file, int64_t size)
+{
+    ++stats.resizes;
+    return ftruncate(file->handle, size) == 0;
+}
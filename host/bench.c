@@ -0,0 +1,1156 @@
+#include "capture.h"
+#include "capture_queue.h"
+#include "capture_trace.h"
+#include "config.h"
+#include "frame_hash.h"
+#include "frames.h"
+#include "directory_cache.h"
+#include "encode_governor.h"
+#include "host.h"
+#include "png_capture.h"
+#include "png_filter.h"
+#include "png_idat.h"
+#include "png_optimize.h"
+#include "png_record.h"
+#include "png_timelapse.h"
+#include "raw_spill.h"
+#include "row_pipeline.h"
+
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Host benchmark harness. Feeds a frame through the real png_capture() and reports what it cost.
+
+/// @brief Prints usage.
+static void print_usage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+           "  -o <dir>      Output directory. Default is the current directory.\n"
+           "  -f <file>     Recorded raw 1280x720 RGBA frame to capture.\n"
+           "  -s <pattern>  Synthetic frame to capture. Default is menu.\n"
+           "  -n <count>    Number of captures. Default is 5.\n"
+           "  -l <level>    Compression level. Default is 4.\n"
+           "  -F <filter>   Row filter: none, sub, up, average, paeth or adaptive. Default is adaptive.\n"
+           "  -w <count>    Deflate workers. 1 is the serial path, and so is anything without -G. Default is 1.\n"
+           "  -e <encoder>  Encoder: native or libpng. Default is native.\n"
+           "  -m <mode>     Encode mode: normal, speed or adaptive. Default is normal.\n"
+           "  -B <ms>       Milliseconds adaptive mode aims to deflate in. Default is 500.\n"
+           "  -R <rows>     Rows read from the stream per call: 1, 2 or 4. Default is 4.\n"
+           "  -d <us>       Delay added to every read call to simulate the IPC round trip. Default is 0.\n"
+           "  -r <storage>  Raw-first: spill each capture as raw or lz4, then encode the spill. Default is off.\n"
+           "  -D            Skip captures identical to a recent one.\n"
+           "  -P            Write captures with few enough colors as grayscale or indexed.\n"
+           "  -S            Run the suite: every pattern through every encode path and level. -n is the number of runs\n"
+           "                per result, -w the parallel workers and -f replaces the patterns with a recorded frame.\n"
+           "  -T            Trace every capture to <dir>" CAPTURE_TRACE_PATH ".\n"
+           "  -q            Push every capture through the capture queue at once instead of one at a time.\n"
+           "  -k            Keep the PNGs instead of deleting each one after it's measured.\n"
+           "  -O            After capturing, recompress every PNG under <dir>/PNGs like the idle optimizer does. Implies -k.\n"
+           "  -v            Decode every capture and compare it to the source frame.\n"
+           "  -A <fps>      Record -n frames at <fps> like holding the button does, with a box moving over the frame.\n"
+           "                -v decodes every frame of the animation.\n"
+           "  -L <ms>       Take -n timelapse shots <ms> apart, held to the budgets below.\n"
+           "  -C <ms>       Milliseconds of CPU time timelapse shots can take per minute. Default is 3000.\n"
+           "  -W <kb>       Kilobytes timelapse shots can write per minute. Default is 8192.\n"
+           "  -c            Free the warm zlib stream before every capture, so each one sets up zlib like the first.\n"
+           "  -t <scale>    Write a 1/<scale> thumbnail next to every capture: 2 or 4. -v decodes those too. Default is off.\n"
+           "  -b <backend>  Deflate backend: zlib or libdeflate. libdeflate needs a LIBDEFLATE=1 build. Default is zlib.\n"
+           "  -p <prio>     Priority to encode at, 45 to 63. Mapped onto nice 1 to 19. Default is 45.\n"
+           "  -x <cpu>      Pin the encoding threads and the latency probe to one CPU. 0 to 2 need -G. Default is unpinned.\n"
+           "  -G            Let the encoding threads onto CPUs 0 to 2 like a GAME_CORES=1 build.\n"
+           "  -y <rows>     Give up the CPU every <rows> rows while encoding. Default is 0, never.\n"
+           "  -g            Run the latency probe on the encode CPU and report how late it woke up during and between\n"
+           "                captures.\n"
+           "Patterns:",
+           name);
+
+    for (const char *const *pattern = frames_patterns(); *pattern; pattern++) { printf(" %s", *pattern); }
+    printf("\n");
+}
+
+/// @brief Row filter names in the same order as PngFilterModes.
+static const char *FILTER_NAMES[] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+
+/// @brief zlib strategy names in the same order as their values.
+static const char *STRATEGY_NAMES[] = {"default", "filtered", "huffman", "rle", "fixed"};
+
+/// @brief Content class names in the same order as PngContentClasses.
+static const char *CONTENT_NAMES[] = {"runs", "detailed", "noise"};
+
+/// @brief Deflate backend names in the same order as PngDeflateBackends.
+static const char *BACKEND_NAMES[] = {"zlib", "libdeflate", "fast"};
+
+/// @brief Returns the PngFilterModes value for the name passed. -1 if it isn't one.
+static int parse_filter(const char *name)
+{
+    for (int i = 0; i <= PngFilterAdaptive; i++)
+    {
+        if (strcmp(name, FILTER_NAMES[i]) == 0) { return i; }
+    }
+
+    return -1;
+}
+
+/// @brief Returns the PngEncodeModes value for the name passed. Unknown names are normal.
+static int parse_mode(const char *name)
+{
+    if (strcmp(name, "speed") == 0) { return PngEncodeSpeed; }
+    if (strcmp(name, "adaptive") == 0) { return PngEncodeAdaptive; }
+
+    return PngEncodeNormal;
+}
+
+/// @brief Writes the settings the native encoder used as level/strategy/filter. Speed mode doesn't use zlib at all.
+static void format_settings(const PngCaptureStats *captureStats, int encodeMode, char *buffer, size_t bufferSize)
+{
+    const PngEncodeChoice *settings = &captureStats->settings;
+    if (settings->level < 0)
+    {
+        snprintf(buffer, bufferSize, "-");
+        return;
+    }
+
+    if (captureStats->encoder != PngEncoderNative || encodeMode == PngEncodeSpeed)
+    {
+        snprintf(buffer, bufferSize, captureStats->encoder == PngEncoderNative ? "fast/sub" : "-");
+        return;
+    }
+
+    snprintf(buffer,
+             bufferSize,
+             "%d/%s/%s",
+             settings->level,
+             STRATEGY_NAMES[settings->strategy],
+             FILTER_NAMES[settings->rowFilter]);
+}
+
+/// @brief Writes the color type the capture was written as. Indexed captures get the number of colors.
+static void format_color(const PngCaptureStats *captureStats, char *buffer, size_t bufferSize)
+{
+    if (captureStats->colorType < 0) { snprintf(buffer, bufferSize, "-"); }
+    else if (captureStats->colorType == PngColorIndexed) { snprintf(buffer, bufferSize, "pal:%d", captureStats->paletteColors); }
+    else { snprintf(buffer, bufferSize, captureStats->colorType == PngColorGray ? "gray" : "rgb"); }
+}
+
+/// @brief Prints how often adaptive mode used each setting.
+static void print_adaptive_usage(void)
+{
+    const PngAdaptiveUsage *usage = png_adaptive_get_usage();
+
+    printf("adaptive levels:");
+    for (int i = 0; i < 10; i++) { printf(" %d=%u", i, usage->levels[i]); }
+    printf("\nadaptive strategies:");
+    for (int i = 0; i < PNG_ADAPTIVE_STRATEGIES; i++) { printf(" %s=%u", STRATEGY_NAMES[i], usage->strategies[i]); }
+    printf("\nadaptive filters:");
+    for (int i = 0; i <= PngFilterAdaptive; i++) { printf(" %s=%u", FILTER_NAMES[i], usage->rowFilters[i]); }
+    printf("\nadaptive content:");
+    for (int i = 0; i < PngContentClassCount; i++) { printf(" %s=%u", CONTENT_NAMES[i], usage->contentClasses[i]); }
+    printf("\n");
+}
+
+/// @brief Adds up the latency of one stretch of probe wakes into another.
+static void add_latency(EncodeLatency *total, const EncodeLatency *latency)
+{
+    total->wakes += latency->wakes;
+    total->missedFrames += latency->missedFrames;
+    total->lateTicks += latency->lateTicks;
+    if (latency->maxLateTicks > total->maxLateTicks) { total->maxLateTicks = latency->maxLateTicks; }
+}
+
+/// @brief Prints how late the probe woke up over a stretch.
+static void print_latency(const char *name, const EncodeLatency *latency)
+{
+    const double averageMs = latency->wakes ? armTicksToNs(latency->lateTicks) / 1e6 / latency->wakes : 0.0;
+    printf("probe %s: wakes: %d, late_avg_ms: %.3f, late_max_ms: %.3f, missed_frames: %d\n",
+           name,
+           latency->wakes,
+           averageMs,
+           armTicksToNs(latency->maxLateTicks) / 1e6,
+           latency->missedFrames);
+}
+
+/// @brief Returns the monotonic clock in nanoseconds.
+static inline uint64_t time_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/// @brief Pushes every capture into the queue back to back and waits for the worker to finish them.
+static void run_queued(int captureCount)
+{
+    host_fs_reset_stats();
+
+    int queued           = 0;
+    const uint64_t begin = time_now();
+    for (int i = 0; i < captureCount; i++) { queued += capture_queue_push() ? 1 : 0; }
+    const double pushMs = (time_now() - begin) / 1e6;
+
+    capture_queue_stop();
+    const double wallMs = (time_now() - begin) / 1e6;
+
+    const HostFsStats *stats = host_fs_get_stats();
+    printf("pushed: %d, queued: %d, dropped: %d, saved: %llu, push_ms: %.3f, wall_ms: %.3f\n",
+           captureCount,
+           queued,
+           captureCount - queued,
+           (unsigned long long)stats->renames,
+           pushMs,
+           wallMs);
+}
+
+/// @brief Returns how much of the heap is in use, not counting the warm zlib stream. Peaks measured from here count the
+/// stream as part of whatever held it, like it is on the Switch.
+static size_t heap_base(void) { return host_heap_current() - idat_writer_warm_size(); }
+
+/// @brief Decodes the PNG passed and compares it to the RGB of the frame.
+static bool verify_capture(const char *path, const uint8_t *frame)
+{
+    png_image image = {.version = PNG_IMAGE_VERSION};
+    if (!png_image_begin_read_from_file(&image, path)) { return false; }
+
+    image.format = PNG_FORMAT_RGB;
+    if (image.width != CAPTURE_WIDTH || image.height != CAPTURE_HEIGHT)
+    {
+        png_image_free(&image);
+        return false;
+    }
+
+    uint8_t *decoded = malloc(PNG_IMAGE_SIZE(image));
+    if (!decoded || !png_image_finish_read(&image, NULL, decoded, 0, NULL))
+    {
+        free(decoded);
+        png_image_free(&image);
+        return false;
+    }
+
+    bool matches = true;
+    for (size_t i = 0, j = 0; matches && i < FRAME_SIZE; i += 4, j += 3) { matches = memcmp(frame + i, decoded + j, 3) == 0; }
+
+    free(decoded);
+    return matches;
+}
+
+/// @brief Writes the path of the thumbnail that goes with the PNG passed.
+static void thumbnail_path(const char *pngPath, char *pathOut, size_t pathSize)
+{
+    const size_t length = strlen(pngPath);
+    snprintf(pathOut, pathSize, "%.*s_thumb.png", (int)(length > 4 ? length - 4 : length), pngPath);
+}
+
+/// @brief Decodes the thumbnail passed and compares it to the frame scaled down the same way: every scale x scale block
+/// averaged, rounding halves up.
+static bool verify_thumbnail(const char *path, const uint8_t *frame, int scale)
+{
+    png_image image = {.version = PNG_IMAGE_VERSION};
+    if (!png_image_begin_read_from_file(&image, path)) { return false; }
+
+    image.format = PNG_FORMAT_RGB;
+    if (image.width != (uint32_t)(CAPTURE_WIDTH / scale) || image.height != (uint32_t)(CAPTURE_HEIGHT / scale))
+    {
+        png_image_free(&image);
+        return false;
+    }
+
+    uint8_t *decoded = malloc(PNG_IMAGE_SIZE(image));
+    if (!decoded || !png_image_finish_read(&image, NULL, decoded, 0, NULL))
+    {
+        free(decoded);
+        png_image_free(&image);
+        return false;
+    }
+
+    const int shift = scale == 2 ? 2 : 4;
+    bool matches    = true;
+    for (uint32_t y = 0; matches && y < image.height; y++)
+    {
+        for (uint32_t x = 0; matches && x < image.width; x++)
+        {
+            for (int channel = 0; matches && channel < 3; channel++)
+            {
+                int sum = 0;
+                for (int i = 0; i < scale * scale; i++)
+                {
+                    const size_t pixel = (y * scale + i / scale) * CAPTURE_WIDTH + x * scale + i % scale;
+                    sum += frame[pixel * 4 + channel];
+                }
+
+                const int expected = (sum + (1 << (shift - 1))) >> shift;
+                matches            = decoded[(y * image.width + x) * 3 + channel] == expected;
+            }
+        }
+    }
+
+    free(decoded);
+    return matches;
+}
+
+/// @brief Runs the idle optimizer until it's been through every PNG and prints a line for each. With verify, every replaced
+/// PNG is decoded and compared to the frame.
+static bool run_optimize(FsFileSystem *albumDir, const uint8_t *frame, bool verify)
+{
+    static const char *RESULT_NAMES[] = {"done", "replaced", "kept", "skipped", "cancelled", "failed"};
+
+    if (!png_optimize_start(albumDir))
+    {
+        fprintf(stderr, "Unable to start the optimizer.\n");
+        return false;
+    }
+
+    printf("%-40s %-9s %10s %10s %7s %-16s %6s %10s %10s %8s\n",
+           "file",
+           "result",
+           "old_bytes",
+           "new_bytes",
+           "saved",
+           "settings",
+           "passes",
+           "ms",
+           "peak_heap",
+           "verify");
+
+    bool allVerified     = true;
+    int64_t totalSaved   = 0;
+    PngOptimizeStats stats;
+    int result;
+    host_heap_reset_peak();
+    size_t heapBase = heap_base();
+    while ((result = png_optimize_next(albumDir, &stats)) != PngOptimizeDone)
+    {
+        const size_t peakHeap = host_heap_peak() - heapBase;
+
+        char settings[32] = "-";
+        if (stats.rowFilter >= 0)
+        {
+            snprintf(settings, sizeof(settings), "%s/%s", STRATEGY_NAMES[stats.strategy], FILTER_NAMES[stats.rowFilter]);
+        }
+
+        const char *verifyResult = "-";
+        if (verify && result == PngOptimizeReplaced)
+        {
+            char fullPath[HOST_MAX_PATH];
+            snprintf(fullPath, sizeof(fullPath), "%s%s", albumDir->root, stats.path);
+            const bool verified = verify_capture(fullPath, frame);
+            verifyResult        = verified ? "ok" : "FAIL";
+            allVerified         = allVerified && verified;
+        }
+
+        const int64_t saved = stats.oldSize - stats.newSize;
+        printf("%-40s %-9s %10lld %10lld %6.1f%% %-16s %6d %10.3f %10zu %8s\n",
+               stats.path,
+               RESULT_NAMES[result],
+               (long long)stats.oldSize,
+               (long long)stats.newSize,
+               stats.oldSize > 0 ? saved * 100.0 / stats.oldSize : 0.0,
+               settings,
+               stats.passes,
+               armTicksToNs(stats.ticks) / 1e6,
+               peakHeap,
+               verifyResult);
+        totalSaved += saved;
+
+        host_heap_reset_peak();
+        heapBase = heap_base();
+    }
+    printf("optimized bytes saved: %lld\n", (long long)totalSaved);
+
+    return allVerified;
+}
+
+/// @brief Frames the recording bench animates and checks against.
+static struct
+{
+    /// @brief Frame being served, the frame it started as, and a copy of the first frame that was recorded.
+    uint8_t *frame, *base, *first;
+
+    /// @brief Number of times the stream has been opened, and after how many the recording is stopped.
+    int opens, frameCount;
+} animation = {0};
+
+/// @brief Moves a box over the frame every time the stream is opened, like something moving in a game. Every fourth time
+/// it stays put, so some frames don't change at all. The rest of the frame never does.
+static void animate_frame(void)
+{
+    static const int BOX_WIDTH  = 72;
+    static const int BOX_HEIGHT = 48;
+
+    // Put back what the box covered last time, then draw it somewhere else.
+    const int step     = animation.opens++;
+    const int moves    = step - (step + 1) / 4;
+    const int previous = step > 0 ? step - 1 - step / 4 : -1;
+    for (int pass = 0; pass < 2 && moves != previous; pass++)
+    {
+        const int n = pass == 0 ? previous : moves;
+        if (n < 0) { continue; }
+
+        const int boxX = 40 + n * 37 % (CAPTURE_WIDTH - BOX_WIDTH - 80);
+        const int boxY = 60 + n * 23 % (CAPTURE_HEIGHT - BOX_HEIGHT - 120);
+        for (int y = boxY; y < boxY + BOX_HEIGHT; y++)
+        {
+            uint8_t *row        = animation.frame + (size_t)y * CAPTURE_ROW_SIZE + boxX * 4;
+            const uint8_t *base = animation.base + (size_t)y * CAPTURE_ROW_SIZE + boxX * 4;
+            if (pass == 0) { memcpy(row, base, BOX_WIDTH * 4); }
+            else
+            {
+                for (int x = 0; x < BOX_WIDTH * 4; x += 4)
+                {
+                    row[x]     = 255 - n * 11;
+                    row[x + 1] = x + y;
+                    row[x + 2] = n * 29;
+                }
+            }
+        }
+    }
+
+    if (step == 0) { memcpy(animation.first, animation.frame, FRAME_SIZE); }
+    if (animation.opens >= animation.frameCount) { png_record_set_stopped(true); }
+}
+
+/// @brief Compares the RGB of a decoded canvas to the RGBA frame passed.
+static bool canvas_matches(const uint8_t *canvas, const uint8_t *frame)
+{
+    for (size_t i = 0, j = 0; i < FRAME_SIZE; i += 4, j += 3)
+    {
+        if (memcmp(frame + i, canvas + j, 3) != 0) { return false; }
+    }
+
+    return true;
+}
+
+/// @brief Unfilters a frame's worth of inflated rows onto the canvas.
+static bool draw_animation_frame(uint8_t *canvas, const uint8_t *data, size_t size, const uint32_t box[4])
+{
+    const uint32_t width = box[0], height = box[1], boxX = box[2], boxY = box[3];
+    const size_t rowSize = (size_t)width * 3;
+    if (size != (rowSize + 1) * height || boxX + width > CAPTURE_WIDTH || boxY + height > CAPTURE_HEIGHT) { return false; }
+
+    uint8_t rows[2][CAPTURE_WIDTH * 3];
+    for (uint32_t y = 0; y < height; y++)
+    {
+        uint8_t *row = rows[y % 2];
+        if (!png_unfilter_row(data + y * (rowSize + 1), y > 0 ? rows[(y + 1) % 2] : NULL, row, rowSize, 3)) { return false; }
+        memcpy(canvas + ((size_t)(boxY + y) * CAPTURE_WIDTH + boxX) * 3, row, rowSize);
+    }
+
+    return true;
+}
+
+/// @brief Decodes every frame of the APNG passed onto one canvas, the way a player would, checking every CRC on the way.
+/// The canvas has to match first after the first frame and last after the last one.
+static bool verify_animation(const char *path, const uint8_t *first, const uint8_t *last)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) { return false; }
+
+    fseek(file, 0, SEEK_END);
+    const long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *png    = malloc(fileSize);
+    uint8_t *canvas = calloc(1, (size_t)CAPTURE_WIDTH * CAPTURE_HEIGHT * 3);
+    uint8_t *data   = malloc((size_t)(CAPTURE_WIDTH * 3 + 1) * CAPTURE_HEIGHT);
+    const bool read = png && canvas && data && fread(png, 1, fileSize, file) == (size_t)fileSize;
+    fclose(file);
+
+    static const uint8_t SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    bool valid = read && fileSize > 8 && memcmp(png, SIGNATURE, 8) == 0;
+
+    z_stream stream    = {0};
+    bool inflating     = false;
+    uint32_t box[4]    = {0};
+    uint32_t sequence  = 0;
+    int frames = 0, frameCount = -1;
+    for (long offset = 8; valid && offset + 12 <= fileSize;)
+    {
+        const uint8_t *chunk = png + offset;
+        const uint32_t size  = (uint32_t)chunk[0] << 24 | chunk[1] << 16 | chunk[2] << 8 | chunk[3];
+        const uint8_t *body  = chunk + 8;
+        if (offset + 12 + (long)size > fileSize) { valid = false; break; }
+
+        const uint32_t crc = (uint32_t)body[size] << 24 | body[size + 1] << 16 | body[size + 2] << 8 | body[size + 3];
+        valid              = crc32(0, chunk + 4, size + 4) == crc;
+        offset += 12 + size;
+
+        const bool frameControl = memcmp(chunk + 4, "fcTL", 4) == 0;
+        const bool end          = memcmp(chunk + 4, "IEND", 4) == 0;
+        const bool frameData    = memcmp(chunk + 4, "IDAT", 4) == 0 || memcmp(chunk + 4, "fdAT", 4) == 0;
+
+        // A frame ends where the next one's fcTL or IEND starts.
+        if (valid && inflating && (frameControl || end))
+        {
+            valid = inflate(&stream, Z_FINISH) == Z_STREAM_END &&
+                    draw_animation_frame(canvas, data, stream.total_out, box);
+            inflateEnd(&stream);
+            inflating = false;
+            if (valid && ++frames == 1) { valid = canvas_matches(canvas, first); }
+        }
+
+        if (!valid) { break; }
+        if (memcmp(chunk + 4, "acTL", 4) == 0) { frameCount = body[0] << 24 | body[1] << 16 | body[2] << 8 | body[3]; }
+        else if (frameControl)
+        {
+            // Sequence numbers run across fcTL and fdAT.
+            const uint32_t number = (uint32_t)body[0] << 24 | body[1] << 16 | body[2] << 8 | body[3];
+            valid                 = size == 26 && number == sequence++;
+            for (int i = 0; i < 4; i++)
+            {
+                const uint8_t *field = body + 4 + i * 4;
+                box[i]               = (uint32_t)field[0] << 24 | field[1] << 16 | field[2] << 8 | field[3];
+            }
+
+            inflating = valid && inflateInit(&stream) == Z_OK;
+            valid     = inflating;
+            if (valid)
+            {
+                stream.next_out  = data;
+                stream.avail_out = (CAPTURE_WIDTH * 3 + 1) * CAPTURE_HEIGHT;
+            }
+        }
+        else if (frameData && inflating)
+        {
+            const bool sequenced = chunk[4] == 'f';
+            if (sequenced)
+            {
+                const uint32_t number = (uint32_t)body[0] << 24 | body[1] << 16 | body[2] << 8 | body[3];
+                valid                 = number == sequence++;
+            }
+
+            stream.next_in  = (uint8_t *)body + (sequenced ? 4 : 0);
+            stream.avail_in = size - (sequenced ? 4 : 0);
+            const int result = inflate(&stream, Z_NO_FLUSH);
+            valid            = valid && (result == Z_OK || result == Z_STREAM_END || result == Z_BUF_ERROR);
+        }
+        if (end) { break; }
+    }
+
+    if (inflating) { inflateEnd(&stream); }
+    valid = valid && frames > 0 && frames == frameCount && canvas_matches(canvas, last);
+
+    free(png);
+    free(canvas);
+    free(data);
+    return valid;
+}
+
+/// @brief Records frameCount frames at rate frames a second with a box moving over the frame, then prints how it went.
+static bool run_record(FsFileSystem *albumDir, uint8_t *frame, int rate, int frameCount, bool verify)
+{
+    animation.frame      = frame;
+    animation.base       = malloc(FRAME_SIZE);
+    animation.first      = malloc(FRAME_SIZE);
+    animation.opens      = 0;
+    animation.frameCount = frameCount;
+    if (!animation.base || !animation.first)
+    {
+        free(animation.base);
+        free(animation.first);
+        return false;
+    }
+    memcpy(animation.base, frame, FRAME_SIZE);
+
+    // Long enough that the frame count is what stops it.
+    host_config_set_record(rate, 60);
+    host_capture_set_open_hook(animate_frame);
+    host_fs_reset_stats();
+    host_heap_reset_peak();
+    const size_t heapBase = heap_base();
+
+    png_record_set_stopped(false);
+    const bool recorded      = png_record(albumDir, "/PNGs/temp.png");
+    const size_t peakHeap    = host_heap_peak() - heapBase;
+    host_capture_set_open_hook(NULL);
+
+    const HostFsStats *stats         = host_fs_get_stats();
+    const PngRecordStats *recordStats = png_record_get_stats();
+    const char *verifyResult          = "-";
+    bool verified                     = recorded;
+    if (verify && recorded)
+    {
+        // libpng only sees the first frame, which is the check that players without APNG get it right.
+        verified     = verify_capture(stats->lastRenamed, animation.first) &&
+                   verify_animation(stats->lastRenamed, animation.first, frame);
+        verifyResult = verified ? "ok" : "FAIL";
+    }
+
+    const int frames   = recordStats->frames > 0 ? recordStats->frames : 1;
+    const double total = (double)CAPTURE_WIDTH * CAPTURE_HEIGHT * (recordStats->written > 0 ? recordStats->written : 1);
+    printf("%-8s %7s %7s %5s %8s %10s %10s %10s %10s %10s %8s\n",
+           "recorded",
+           "frames",
+           "written",
+           "late",
+           "area",
+           "hash_ms",
+           "encode_ms",
+           "wall_ms",
+           "bytes",
+           "peak_heap",
+           "verify");
+    printf("%-8s %7d %7d %5d %7.1f%% %10.3f %10.3f %10.3f %10lld %10zu %8s\n",
+           recorded ? "yes" : "no",
+           recordStats->frames,
+           recordStats->written,
+           recordStats->late,
+           recordStats->pixels * 100.0 / total,
+           armTicksToNs(recordStats->hashTicks) / 1e6 / frames,
+           armTicksToNs(recordStats->encodeTicks) / 1e6 / frames,
+           armTicksToNs(recordStats->totalTicks) / 1e6,
+           (long long)recordStats->size,
+           peakHeap,
+           verifyResult);
+
+    free(animation.base);
+    free(animation.first);
+    return verified;
+}
+
+/// @brief Takes timelapse shots the way the event loop's timer does and prints what the budget made of each.
+static bool run_timelapse(FsFileSystem *albumDir, const uint8_t *frame, int intervalMs, int shotCount, bool verify, bool keep)
+{
+    static const char *RESULT_NAMES[] = {"full", "reduced", "skipped"};
+
+    printf("%-8s %-8s %10s %10s %12s %12s %8s\n", "shot", "result", "cpu_ms", "bytes", "cpu_left_ms", "bytes_left", "verify");
+
+    bool allVerified     = true;
+    const uint64_t begin = time_now();
+    for (int i = 0; i < shotCount; i++)
+    {
+        // Shots are due on a fixed schedule however long the last one took, like nextTimelapse in main.
+        const uint64_t due = begin + (uint64_t)i * intervalMs * 1000000;
+        const uint64_t now = time_now();
+        if (due > now) { usleep((due - now) / 1000); }
+
+        host_fs_reset_stats();
+        const PngTimelapseStats before = *png_timelapse_get_stats();
+        const int result               = png_timelapse_capture(albumDir, "/PNGs/temp.png");
+        const PngTimelapseStats *after = png_timelapse_get_stats();
+        const HostFsStats *stats       = host_fs_get_stats();
+
+        const bool saved         = after->saved > before.saved;
+        const char *verifyResult = result == PngTimelapseSkipped ? "skip" : saved ? "-" : "dup";
+        if (verify && saved)
+        {
+            const bool verified = verify_capture(stats->lastRenamed, frame);
+            verifyResult        = verified ? "ok" : "FAIL";
+            allVerified         = allVerified && verified;
+        }
+
+        // cpuLeft can be negative, so it doesn't go through armTicksToNs. Ticks are nanoseconds here anyway.
+        printf("%-8d %-8s %10.3f %10lld %12.3f %12lld %8s\n",
+               i,
+               RESULT_NAMES[result],
+               armTicksToNs(after->cpuTicks - before.cpuTicks) / 1e6,
+               (long long)(after->bytes - before.bytes),
+               (double)after->cpuLeft / 1e6,
+               (long long)after->bytesLeft,
+               verifyResult);
+
+        capture_trace_flush();
+        if (!keep && saved) { unlink(stats->lastRenamed); }
+    }
+
+    const PngTimelapseStats *timelapseStats = png_timelapse_get_stats();
+    printf("due: %d, full: %d, reduced: %d, skipped: %d, saved: %d, cpu_ms: %.3f, bytes: %lld, wall_ms: %.3f\n",
+           timelapseStats->due,
+           timelapseStats->full,
+           timelapseStats->reduced,
+           timelapseStats->skipped,
+           timelapseStats->saved,
+           armTicksToNs(timelapseStats->cpuTicks) / 1e6,
+           (long long)timelapseStats->bytes,
+           (time_now() - begin) / 1e6);
+    return allVerified;
+}
+
+// clang-format off
+/// @brief Encode paths the suite runs.
+static const struct
+{
+    const char *name;
+    int encoder, encodeMode;
+    bool parallel, reduceColors;
+
+    /// @brief Whether CompressionLevel means anything to this path.
+    bool usesLevel;
+} SUITE_PATHS[] = {{"serial",   PngEncoderNative, PngEncodeNormal,   false, false, true},
+                   {"reduced",  PngEncoderNative, PngEncodeNormal,   false, true,  true},
+                   {"parallel", PngEncoderNative, PngEncodeNormal,   true,  false, true},
+                   {"speed",    PngEncoderNative, PngEncodeSpeed,    false, false, false},
+                   {"adaptive", PngEncoderNative, PngEncodeAdaptive, false, false, false},
+                   {"libpng",   PngEncoderLibpng, PngEncodeNormal,   false, false, true}};
+// clang-format on
+
+/// @brief Runs every frame through every path and level and prints one line for each. Every line starts with a capture
+/// that isn't counted, so adaptive mode has something to go by and the PNG size prediction is warm. Time is the fastest
+/// of the runs, everything else is from the last. Only the last run is verified, decoding takes longer than encoding.
+static bool run_suite(FsFileSystem *albumDir, const char *const *frameNames, bool recorded, int runs, int workers, bool verify)
+{
+    uint8_t *frame = malloc(FRAME_SIZE);
+    if (!frame) { return false; }
+
+    host_capture_set_frame(frame);
+    host_config_set_row_filter(PngFilterAdaptive);
+
+    printf("%-10s %-9s %5s %-18s %-8s %10s %10s %10s %8s %10s %10s %8s\n",
+           "frame",
+           "path",
+           "level",
+           "settings",
+           "color",
+           "best_ms",
+           "avg_ms",
+           "bytes",
+           "ratio",
+           "peak_heap",
+           "arena_over",
+           "verify");
+
+    bool allVerified = true;
+    for (const char *const *frameName = frameNames; *frameName; frameName++)
+    {
+        const bool frameReady = recorded ? frames_load(*frameName, frame) : frames_generate(*frameName, frame);
+        if (!frameReady)
+        {
+            fprintf(stderr, "Unable to load frame %s.\n", *frameName);
+            allVerified = false;
+            continue;
+        }
+
+        for (size_t path = 0; path < sizeof(SUITE_PATHS) / sizeof(SUITE_PATHS[0]); path++)
+        {
+            host_config_set_encoder(SUITE_PATHS[path].encoder);
+            host_config_set_encode_mode(SUITE_PATHS[path].encodeMode);
+            host_config_set_encode_workers(SUITE_PATHS[path].parallel ? workers : 1);
+            host_switch_allow_game_cores(SUITE_PATHS[path].parallel);
+            host_config_set_reduce_colors(SUITE_PATHS[path].reduceColors);
+
+            const int lastLevel = SUITE_PATHS[path].usesLevel ? 9 : 0;
+            for (int level = 0; level <= lastLevel; level++)
+            {
+                host_config_set_compression_level(level);
+
+                double bestMs = 0.0, totalMs = 0.0;
+                uint64_t bytes = 0;
+                size_t peakHeap = 0, arenaOverflow = 0;
+                char settings[32] = "-";
+                char color[16]    = "-";
+                const char *verifyResult = "-";
+                png_capture(albumDir, "/PNGs/temp.png");
+                if (host_fs_get_stats()->lastRenamed[0]) { unlink(host_fs_get_stats()->lastRenamed); }
+
+                for (int run = 0; run < runs; run++)
+                {
+                    host_fs_reset_stats();
+                    host_heap_reset_peak();
+                    const size_t heapBase = heap_base();
+
+                    const uint64_t begin = time_now();
+                    png_capture(albumDir, "/PNGs/temp.png");
+                    const double wallMs = (time_now() - begin) / 1e6;
+
+                    const HostFsStats *stats = host_fs_get_stats();
+                    bestMs                   = run == 0 || wallMs < bestMs ? wallMs : bestMs;
+                    totalMs += wallMs;
+                    if (run == runs - 1)
+                    {
+                        bytes         = stats->bytesWritten;
+                        peakHeap      = host_heap_peak() - heapBase;
+                        arenaOverflow = png_capture_get_stats()->arenaOverflow;
+                        format_settings(png_capture_get_stats(), SUITE_PATHS[path].encodeMode, settings, sizeof(settings));
+                        format_color(png_capture_get_stats(), color, sizeof(color));
+                    }
+
+                    if (verify && run == runs - 1)
+                    {
+                        const bool verified = stats->lastRenamed[0] && verify_capture(stats->lastRenamed, frame);
+                        verifyResult        = verified ? "ok" : "FAIL";
+                        allVerified         = allVerified && verified;
+                    }
+
+                    if (stats->lastRenamed[0]) { unlink(stats->lastRenamed); }
+                }
+
+                // Paths that ignore the level only get one line.
+                const char *name = recorded ? strrchr(*frameName, '/') : NULL;
+                char levelName[4] = "-";
+                if (SUITE_PATHS[path].usesLevel) { snprintf(levelName, sizeof(levelName), "%d", level); }
+
+                printf("%-10s %-9s %5s %-18s %-8s %10.3f %10.3f %10llu %7.2fx %10zu %10zu %8s\n",
+                       name ? name + 1 : *frameName,
+                       SUITE_PATHS[path].name,
+                       levelName,
+                       settings,
+                       color,
+                       bestMs,
+                       totalMs / runs,
+                       (unsigned long long)bytes,
+                       bytes > 0 ? (double)(CAPTURE_WIDTH * CAPTURE_HEIGHT * 3) / bytes : 0.0,
+                       peakHeap,
+                       arenaOverflow,
+                       verifyResult);
+            }
+        }
+    }
+
+    print_adaptive_usage();
+
+    free(frame);
+    return allVerified;
+}
+
+int main(int argc, char **argv)
+{
+    const char *outputDir = ".";
+    const char *framePath = NULL;
+    const char *pattern   = "menu";
+    int captureCount      = 5;
+    int level             = 4;
+    bool verify           = false;
+    bool queue            = false;
+    bool keep             = false;
+    bool skipDuplicates   = false;
+    bool trace            = false;
+    bool suite            = false;
+    bool reduceColors     = false;
+    bool optimize         = false;
+    bool cold             = false;
+    int rawFirst          = -1;
+    int readDelay         = 0;
+    int readRows          = 4;
+    int workers           = 1;
+    int rowFilter         = PngFilterAdaptive;
+    int encoder           = PngEncoderNative;
+    int encodeMode        = PngEncodeNormal;
+    int encodeBudget      = 500;
+    int recordRate        = 0;
+    int timelapseInterval = 0;
+    int timelapseCpu      = 3000;
+    int timelapseWrites   = 8192;
+    int thumbnailScale    = 0;
+    int backend           = PngDeflateZlib;
+    int encodePriority    = 0x2D;
+    int encodeCore        = -1;
+    int sliceRows         = 0;
+    bool probe            = false;
+    bool gameCores        = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "o:f:s:n:l:d:R:w:F:e:m:B:r:A:L:C:W:t:b:p:x:y:gGcDPSTOqkvh")) != -1)
+    {
+        switch (option)
+        {
+            case 'o': outputDir = optarg; break;
+            case 'f': framePath = optarg; break;
+            case 's': pattern = optarg; break;
+            case 'n': captureCount = atoi(optarg); break;
+            case 'l': level = atoi(optarg); break;
+            case 'w': workers = atoi(optarg); break;
+            case 'F': rowFilter = parse_filter(optarg); break;
+            case 'e': encoder = strcmp(optarg, "libpng") == 0 ? PngEncoderLibpng : PngEncoderNative; break;
+            case 'm': encodeMode = parse_mode(optarg); break;
+            case 'B': encodeBudget = atoi(optarg); break;
+            case 'd': readDelay = atoi(optarg); break;
+            case 'R': readRows = atoi(optarg); break;
+            case 'A': recordRate = atoi(optarg); break;
+            case 'L': timelapseInterval = atoi(optarg); break;
+            case 'C': timelapseCpu = atoi(optarg); break;
+            case 'W': timelapseWrites = atoi(optarg); break;
+            case 't': thumbnailScale = atoi(optarg); break;
+            case 'p': encodePriority = atoi(optarg); break;
+            case 'x': encodeCore = atoi(optarg); break;
+            case 'y': sliceRows = atoi(optarg); break;
+            case 'g': probe = true; break;
+            case 'G': gameCores = true; break;
+            case 'b': backend = strcmp(optarg, "libdeflate") == 0 ? PngDeflateLibdeflate : PngDeflateZlib; break;
+            case 'r': rawFirst = strcmp(optarg, "lz4") == 0 ? RawSpillLZ4 : RawSpillNone; break;
+            case 'c': cold = true; break;
+            case 'D': skipDuplicates = true; break;
+            case 'P': reduceColors = true; break;
+            case 'S': suite = true; break;
+            case 'T': trace = true; break;
+            case 'O': optimize = keep = true; break;
+            case 'q': queue = true; break;
+            case 'k': keep = true; break;
+            case 'v': verify = true; break;
+            default: print_usage(argv[0]); return option == 'h' ? 0 : 1;
+        }
+    }
+
+    FsFileSystem albumDir;
+    if (!host_fs_open(&albumDir, outputDir))
+    {
+        fprintf(stderr, "%s is not a directory.\n", outputDir);
+        return 1;
+    }
+
+    // The PNGShot folder normally exists before the first capture. This is what init_create_pngshot_directory does.
+    directory_cache_ensure(&albumDir, "/PNGs");
+
+    host_config_set_encode_budget(encodeBudget);
+
+    // The suite defaults to the most workers EncodeWorkers allows, since 1 would just be the serial path again.
+    if (suite)
+    {
+        const char *recordedFrame[] = {framePath, NULL};
+        const bool recorded         = framePath != NULL;
+        return run_suite(&albumDir, recorded ? recordedFrame : frames_patterns(), recorded, captureCount, workers > 1 ? workers : 4, verify)
+                   ? 0
+                   : 2;
+    }
+
+    uint8_t *frame = malloc(FRAME_SIZE);
+    if (!frame) { return 1; }
+
+    const bool frameReady = framePath ? frames_load(framePath, frame) : frames_generate(pattern, frame);
+    if (!frameReady)
+    {
+        fprintf(stderr, "Unable to load frame %s.\n", framePath ? framePath : pattern);
+        print_usage(argv[0]);
+        free(frame);
+        return 1;
+    }
+
+    host_capture_set_frame(frame);
+    host_config_set_compression_level(level);
+    const bool thumbnailValid = thumbnailScale == 0 || thumbnailScale == 2 || thumbnailScale == 4;
+    const bool governorValid  = encodePriority >= 0x2D && encodePriority <= 0x3F && encodeCore >= -1 && sliceRows >= 0;
+    if (rowFilter < 0 || readRows < 1 || readRows > ROW_PIPELINE_MAX_BLOCK || ROW_PIPELINE_SLOTS % readRows != 0 ||
+        !thumbnailValid || !governorValid)
+    {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    host_config_set_encode_workers(workers);
+    host_config_set_row_filter(rowFilter);
+    host_config_set_encoder(encoder);
+    host_config_set_encode_mode(encodeMode);
+    host_config_set_raw_first(rawFirst >= 0, rawFirst >= 0 ? rawFirst : RawSpillNone);
+    host_capture_set_read_delay((uint64_t)readDelay * 1000);
+    host_config_set_duplicate_captures(skipDuplicates ? FrameDuplicateSkip : FrameDuplicateKeep);
+    host_config_set_trace_captures(trace);
+    host_config_set_reduce_colors(reduceColors);
+    host_config_set_read_rows(readRows);
+    host_config_set_timelapse(0, timelapseCpu, timelapseWrites);
+    host_config_set_thumbnail_scale(thumbnailScale);
+    host_config_set_deflate_backend(backend);
+    host_config_set_governor(encodePriority, encodeCore, sliceRows, probe);
+    host_switch_allow_game_cores(gameCores);
+
+    // Captures are encoded right here unless -q is passed, so this thread stands in for the capture worker.
+    svcSetThreadPriority(CUR_THREAD_HANDLE, config_encode_priority());
+    svcSetThreadCoreMask(CUR_THREAD_HANDLE, encode_governor_core(), 0);
+
+    // Same as main, with the output directory standing in for the SD card.
+    if (config_trace_captures() && !capture_trace_start(&albumDir))
+    {
+        fprintf(stderr, "Unable to create the trace directory.\n");
+        free(frame);
+        return 1;
+    }
+
+    printf("frame: %s, level: %d, workers: %d, read_rows: %d, encoder: %s, mode: %s, zlib: %s\n",
+           framePath ? framePath : pattern,
+           level,
+           workers,
+           readRows,
+           encoder == PngEncoderLibpng ? "libpng" : "native",
+           (const char *[]){"normal", "speed", "adaptive"}[encodeMode],
+           zlibVersion());
+    if (recordRate > 0)
+    {
+        const bool recorded = run_record(&albumDir, frame, recordRate, captureCount, verify);
+        free(frame);
+        return recorded ? 0 : 2;
+    }
+
+    if (timelapseInterval > 0)
+    {
+        const bool verified = run_timelapse(&albumDir, frame, timelapseInterval, captureCount, verify, keep);
+        free(frame);
+        return verified ? 0 : 2;
+    }
+
+    if (queue)
+    {
+        const bool started = capture_queue_start(&albumDir);
+        if (started) { run_queued(captureCount); }
+
+        free(frame);
+        return started ? 0 : 1;
+    }
+
+    printf("%-8s %10s %10s %10s %10s %10s %10s %6s %10s %10s %10s %8s %10s %8s %8s %10s %8s %10s %10s %10s %10s %10s %-10s %6s %8s %8s %6s %-18s %-8s "
+           "%8s\n",
+           "capture",
+           "spill_ms",
+           "dup_ms",
+           "color_ms",
+           "setup_ms",
+           "wall_ms",
+           "read_ms",
+           "reads",
+           "filter_ms",
+           "deflate_ms",
+           "stall_ms",
+           "overlap",
+           "bytes",
+           "writes",
+           "resizes",
+           "prealloc",
+           "dir_ops",
+           "peak_heap",
+           "arena_peak",
+           "arena_over",
+           "thumb",
+           "thumb_ms",
+           "backend",
+           "yields",
+           "late_ms",
+           "idle_ms",
+           "missed",
+           "settings",
+           "color",
+           "verify");
+
+    // Every wake of the probe, over all the captures and the gaps between them.
+    EncodeLatency encodingLatency = {0}, idleLatency = {0};
+    if (probe && !encode_governor_start_probe())
+    {
+        fprintf(stderr, "Unable to start the latency probe.\n");
+        free(frame);
+        return 1;
+    }
+
+    double totalMs   = 0.0;
+    bool allVerified = true;
+    for (int i = 0; i < captureCount; i++)
+    {
+        // So the probe has a stretch of nothing going on to compare the capture against.
+        if (probe) { usleep(100000); }
+
+        host_fs_reset_stats();
+        if (cold) { idat_writer_warm_release(); }
+        host_heap_reset_peak();
+        const size_t heapBase = heap_base();
+
+        // Raw-first splits the capture in two. spill_ms is how long the stream is held, wall_ms is the encode after it.
+        double spillMs = 0.0;
+        if (rawFirst >= 0)
+        {
+            const uint64_t spillBegin = time_now();
+            raw_spill_capture(&albumDir, rawFirst);
+            spillMs = (time_now() - spillBegin) / 1e6;
+            host_fs_reset_stats();
+            host_heap_reset_peak();
+        }
+
+        const uint64_t begin = time_now();
+        char spillPath[FS_MAX_PATH];
+        if (rawFirst < 0) { png_capture(&albumDir, "/PNGs/temp.png"); }
+        else if (raw_spill_find_pending(&albumDir, spillPath, sizeof(spillPath)))
+        {
+            png_capture_spill(&albumDir, spillPath, "/PNGs/temp.png");
+        }
+        const double wallMs = (time_now() - begin) / 1e6;
+
+        const HostFsStats *stats                 = host_fs_get_stats();
+        const PngCaptureStats *captureStats      = png_capture_get_stats();
+        const EncodeGovernorStats *governorStats = encode_governor_get_stats();
+        const size_t peakHeap                    = host_heap_peak() - heapBase;
+        add_latency(&encodingLatency, &governorStats->encoding);
+        add_latency(&idleLatency, &governorStats->idle);
+
+        // Skipped duplicates don't write anything to check.
+        // Thumbnails are only written by the serial native encoder, which speed mode always uses.
+        char thumbnailPath[HOST_MAX_PATH] = {0};
+        if (stats->lastRenamed[0]) { thumbnail_path(stats->lastRenamed, thumbnailPath, sizeof(thumbnailPath)); }
+        const bool serial            = workers <= 1 || encodeMode == PngEncodeSpeed;
+        const bool thumbnailExpected = thumbnailScale > 0 && serial && encoder == PngEncoderNative;
+
+        const char *verifyResult = captureStats->duplicate ? "dup" : "-";
+        if (verify && !captureStats->duplicate)
+        {
+            bool verified = stats->lastRenamed[0] && verify_capture(stats->lastRenamed, frame);
+            if (thumbnailExpected) { verified = verified && verify_thumbnail(thumbnailPath, frame, thumbnailScale); }
+            verifyResult = verified ? "ok" : "FAIL";
+            allVerified         = allVerified && verified;
+        }
+
+        // How much of the read time was hidden behind encoding.
+        const double readMs    = armTicksToNs(captureStats->readTicks) / 1e6;
+        const double stallMs   = armTicksToNs(captureStats->stallTicks) / 1e6;
+        const double overlap   = readMs > 0.0 && readMs > stallMs ? (readMs - stallMs) / readMs * 100.0 : 0.0;
+        const double filterMs  = armTicksToNs(captureStats->filterTicks) / 1e6;
+        const double deflateMs = armTicksToNs(captureStats->deflateTicks) / 1e6;
+        const double dupMs     = armTicksToNs(captureStats->duplicateTicks) / 1e6;
+        const double colorMs   = armTicksToNs(captureStats->colorTicks) / 1e6;
+        const double thumbMs   = armTicksToNs(captureStats->thumbnailTicks) / 1e6;
+        const double setupMs   = armTicksToNs(captureStats->setupTicks) / 1e6;
+
+        char settings[32], color[16];
+        format_settings(captureStats, encodeMode, settings, sizeof(settings));
+        format_color(captureStats, color, sizeof(color));
+
+        printf("%-8d %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %6d %10.3f %10.3f %10.3f %7.1f%% %10llu %8llu %8llu %10lld %8llu %10zu %10zu %10zu %10lld %10.3f %-10s %6d %8.3f %8.3f %6d %-18s %-8s %8s\n",
+               i,
+               spillMs,
+               dupMs,
+               colorMs,
+               setupMs,
+               wallMs,
+               readMs,
+               captureStats->readCalls,
+               filterMs,
+               deflateMs,
+               stallMs,
+               overlap,
+               (unsigned long long)stats->bytesWritten,
+               (unsigned long long)stats->writeCalls,
+               (unsigned long long)stats->resizes,
+               (long long)captureStats->preallocatedSize,
+               (unsigned long long)stats->directoryCalls,
+               peakHeap,
+               captureStats->arenaPeak,
+               captureStats->arenaOverflow,
+               (long long)captureStats->thumbnailSize,
+               thumbMs,
+               captureStats->backend < 0 ? "-" : BACKEND_NAMES[captureStats->backend],
+               governorStats->yields,
+               armTicksToNs(governorStats->encoding.maxLateTicks) / 1e6,
+               armTicksToNs(governorStats->idle.maxLateTicks) / 1e6,
+               governorStats->encoding.missedFrames,
+               settings,
+               color,
+               verifyResult);
+        totalMs += wallMs;
+
+        // The worker does this once the queue is empty. Here that's after every capture.
+        capture_trace_flush();
+
+        // Captures in the same second get numbered names, so don't let them pile up.
+        if (!keep && !captureStats->duplicate && stats->lastRenamed[0])
+        {
+            unlink(stats->lastRenamed);
+            if (captureStats->thumbnailSize > 0) { unlink(thumbnailPath); }
+        }
+    }
+
+    if (captureCount > 0) { printf("average: %.3f ms\n", totalMs / captureCount); }
+    if (probe)
+    {
+        encode_governor_stop_probe();
+        print_latency("idle", &idleLatency);
+        print_latency("encoding", &encodingLatency);
+    }
+    if (encodeMode == PngEncodeAdaptive) { print_adaptive_usage(); }
+    if (optimize) { allVerified = run_optimize(&albumDir, frame, verify) && allVerified; }
+
+    free(frame);
+    return allVerified ? 0 : 2;
+}
@@ -0,0 +1,86 @@
+#include "capture.h"
+#include "capture_trace.h"
+#include "host.h"
+#include "raw_spill.h"
+
+#include <switch.h>
+
+#include <string.h>
+
+// Host capture backend. Serves whatever frame the harness handed over.
+
+/// @brief Frame currently being served.
+static const uint8_t *frameBuffer = NULL;
+
+/// @brief Whether or not the "stream" is open.
+static bool streamOpen = false;
+
+/// @brief Whether or not reads are coming from a spill. Same as capture.c.
+static bool spillOpen = false;
+
+/// @brief Simulated IPC latency per read call.
+static uint64_t readDelay = 0;
+
+/// @brief Called every time the stream is opened. NULL if there isn't one.
+static void (*openHook)(void) = NULL;
+
+void host_capture_set_frame(const uint8_t *frame) { frameBuffer = frame; }
+
+void host_capture_set_open_hook(void (*hook)(void)) { openHook = hook; }
+
+void host_capture_set_read_delay(uint64_t nano) { readDelay = nano; }
+
+bool capture_open_stream(uint64_t *widthOut, uint64_t *heightOut)
+{
+    // Only one stream at a time. Same as capssc.
+    if (!frameBuffer || streamOpen) { return false; }
+
+    // Opening the stream is what takes a new capture, so this is where the harness gets to change the frame.
+    if (openHook) { openHook(); }
+
+    if (widthOut) { *widthOut = CAPTURE_WIDTH; }
+    if (heightOut) { *heightOut = CAPTURE_HEIGHT; }
+
+    streamOpen = true;
+    return true;
+}
+
+bool capture_open_spill(FsFileSystem *filesystem, const char *path, uint64_t *widthOut, uint64_t *heightOut)
+{
+    spillOpen = raw_spill_open(filesystem, path, widthOut, heightOut);
+    return spillOpen;
+}
+
+bool capture_read(void *buffer, size_t size, size_t offset)
+{
+    if (spillOpen) { return raw_spill_read(buffer, size, offset); }
+
+    static const size_t FRAME_SIZE = (size_t)CAPTURE_ROW_SIZE * CAPTURE_HEIGHT;
+    if (!streamOpen || offset + size > FRAME_SIZE) { return false; }
+
+    // The delay is per call. The round trip is what costs, not the size of the read.
+    if (readDelay) { svcSleepThread(readDelay); }
+
+    memcpy(buffer, frameBuffer + offset, size);
+    capture_trace_count_read(size);
+    return true;
+}
+
+bool capture_read_row(void *buffer, int rowIndex) { return capture_read_rows(buffer, rowIndex, 1); }
+
+bool capture_read_rows(void *buffer, int firstRow, int rowCount)
+{
+    return capture_read(buffer, (size_t)rowCount * CAPTURE_ROW_SIZE, (size_t)firstRow * CAPTURE_ROW_SIZE);
+}
+
+void capture_close_stream(void)
+{
+    if (spillOpen)
+    {
+        raw_spill_close();
+        spillOpen = false;
+        return;
+    }
+
+    streamOpen = false;
+}
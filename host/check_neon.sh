@@ -0,0 +1,49 @@
+#!/bin/sh
+# Runs the same captures through a scalar build and a NEON=1 build of the benchmark and checks they write the same PNGs.
+# NEON=1 swaps in include/arm_neon.h, so this checks the NEON paths themselves, not the compiler's intrinsics.
+set -e
+cd "$(dirname "$0")"
+
+make -s
+make -s NEON=1 BUILD=build_neon TARGET=pngshot_bench_neon
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+runs=0
+failed=0
+check()
+{
+    for bench in pngshot_bench pngshot_bench_neon; do
+        rm -rf "${out:?}/$bench"
+        mkdir -p "$out/$bench"
+        if ! "./$bench" -o "$out/$bench" -k -v "$@" > "$out/$bench.log" 2>&1 || grep -q FAIL "$out/$bench.log"; then
+            echo "FAIL $bench $*"
+            failed=$((failed + 1))
+        fi
+
+        # File names come from the clock, so only what's in them is compared.
+        find "$out/$bench" -name '*.png' -exec cksum {} + | cut -d ' ' -f 1,2 | sort > "$out/$bench.sums"
+    done
+
+    runs=$((runs + 1))
+    if ! cmp -s "$out/pngshot_bench.sums" "$out/pngshot_bench_neon.sums"; then
+        echo "FAIL differs: $*"
+        failed=$((failed + 1))
+    fi
+}
+
+# Every filter on every pattern, with the color count and both thumbnail scales along for the ride.
+for pattern in document gradient gameplay menu noise pixelart; do
+    for filter in none sub up average paeth adaptive; do
+        check -s "$pattern" -n 1 -F "$filter" -t 2
+    done
+    check -s "$pattern" -n 1 -P -t 4
+done
+
+# The duplicate check has to hash the same frame to the same thing. Animations aren't compared, their frame delays come
+# from the clock.
+check -s menu -n 3 -D
+
+echo "runs=$runs failed=$failed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,180 @@
+#include "host.h"
+
+#include "config.h"
+#include "frame_hash.h"
+#include "png_capture.h"
+#include "png_filter.h"
+#include "raw_spill.h"
+
+// Host config. There's no config.json here, the harness sets everything directly.
+
+/// @brief Never delete anything on the host.
+static bool allowJpegs = true;
+
+/// @brief Same default as the real config.
+static int compressionLevel = 4;
+
+/// @brief Adaptive by default.
+static int rowFilter = PngFilterAdaptive;
+
+/// @brief Serial by default.
+static int encodeWorkers = 1;
+
+/// @brief Native by default.
+static int encoder = PngEncoderNative;
+
+/// @brief Normal by default.
+static int encodeMode = PngEncodeNormal;
+
+/// @brief Same default as the real config.
+static int encodeBudget = 500;
+
+/// @brief Off by default.
+static bool rawFirst = false;
+
+/// @brief Uncompressed by default.
+static int rawCompression = RawSpillNone;
+
+/// @brief Kept by default.
+static int duplicateCaptures = FrameDuplicateKeep;
+
+/// @brief Off by default.
+static bool traceCaptures = false;
+
+/// @brief Off by default.
+static bool reduceColors = false;
+
+/// @brief Same default as the real config.
+static int readRows = 4;
+
+/// @brief Off by default.
+static int recordRate = 0;
+
+/// @brief Same default as the real config.
+static int recordLength = 10;
+
+/// @brief Off by default.
+static int timelapseInterval = 0;
+
+/// @brief Same defaults as the real config.
+static int timelapseCpuBudget = 3000, timelapseWriteBudget = 8192;
+
+/// @brief Off by default.
+static int thumbnailScale = 0;
+
+/// @brief zlib by default.
+static int deflateBackend = PngDeflateZlib;
+
+/// @brief Same defaults as the real config.
+static int encodePriority = 0x2D, encodeCore = -1;
+
+/// @brief Off by default.
+static int encodeSliceRows = 0;
+
+/// @brief Off by default.
+static bool latencyProbe = false;
+
+void host_config_set_compression_level(int level) { compressionLevel = level; }
+
+void host_config_set_encode_workers(int workers) { encodeWorkers = workers; }
+
+void host_config_set_row_filter(int filter) { rowFilter = filter; }
+
+void host_config_set_encoder(int preferred) { encoder = preferred; }
+
+void host_config_set_encode_mode(int mode) { encodeMode = mode; }
+
+void host_config_set_encode_budget(int budget) { encodeBudget = budget; }
+
+void host_config_set_raw_first(bool enabled, int compression)
+{
+    rawFirst       = enabled;
+    rawCompression = compression;
+}
+
+void host_config_set_duplicate_captures(int mode) { duplicateCaptures = mode; }
+
+void host_config_set_trace_captures(bool enabled) { traceCaptures = enabled; }
+
+void host_config_set_reduce_colors(bool enabled) { reduceColors = enabled; }
+
+void host_config_set_read_rows(int rows) { readRows = rows; }
+
+void host_config_set_record(int rate, int length)
+{
+    recordRate   = rate;
+    recordLength = length;
+}
+
+void host_config_set_timelapse(int interval, int cpuBudget, int writeBudget)
+{
+    timelapseInterval    = interval;
+    timelapseCpuBudget   = cpuBudget;
+    timelapseWriteBudget = writeBudget;
+}
+
+void host_config_set_thumbnail_scale(int scale) { thumbnailScale = scale; }
+
+void host_config_set_deflate_backend(int backend) { deflateBackend = backend; }
+
+void host_config_set_governor(int priority, int core, int sliceRows, bool probe)
+{
+    encodePriority  = priority;
+    encodeCore      = core;
+    encodeSliceRows = sliceRows;
+    latencyProbe    = probe;
+}
+
+void config_load(void) {}
+
+bool config_allow_jpeg(void) { return allowJpegs; }
+
+int config_compression_level(void) { return compressionLevel; }
+
+int config_row_filter(void) { return rowFilter; }
+
+int config_encode_workers(void) { return encodeWorkers; }
+
+
+int config_encoder(void) { return encoder; }
+
+int config_encode_mode(void) { return encodeMode; }
+
+int config_encode_budget(void) { return encodeBudget; }
+
+bool config_raw_first(void) { return rawFirst; }
+
+int config_raw_compression(void) { return rawCompression; }
+
+int config_duplicate_captures(void) { return duplicateCaptures; }
+
+bool config_trace_captures(void) { return traceCaptures; }
+
+bool config_reduce_colors(void) { return reduceColors; }
+
+int config_read_rows(void) { return readRows; }
+
+// The bench runs the optimizer itself instead of waiting for the queue to go idle.
+int config_optimize_idle(void) { return 0; }
+
+int config_record_rate(void) { return recordRate; }
+
+int config_record_length(void) { return recordLength; }
+
+int config_timelapse_interval(void) { return timelapseInterval; }
+
+int config_timelapse_cpu_budget(void) { return timelapseCpuBudget; }
+
+int config_timelapse_write_budget(void) { return timelapseWriteBudget; }
+
+int config_thumbnail_scale(void) { return thumbnailScale; }
+
+int config_deflate_backend(void) { return deflateBackend; }
+
+int config_encode_priority(void) { return encodePriority; }
+
+int config_encode_core(void) { return encodeCore; }
+
+int config_encode_slice_rows(void) { return encodeSliceRows; }
+
+bool config_latency_probe(void) { return latencyProbe; }
@@ -0,0 +1,330 @@
+#include "frames.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Synthetic frames. These are deterministic so numbers can be compared from run to run.
+
+/// @brief Simple xorshift so every run generates the same frames.
+static inline uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static inline void set_pixel(uint8_t *frame, int x, int y, uint8_t r, uint8_t g, uint8_t b)
+{
+    uint8_t *pixel = frame + ((size_t)y * CAPTURE_WIDTH + x) * 4;
+    pixel[0]       = r;
+    pixel[1]       = g;
+    pixel[2]       = b;
+    pixel[3]       = 0xFF;
+}
+
+/// @brief Smooth diagonal gradient.
+static void generate_gradient(uint8_t *frame)
+{
+    for (int y = 0; y < CAPTURE_HEIGHT; y++)
+    {
+        for (int x = 0; x < CAPTURE_WIDTH; x++)
+        {
+            set_pixel(frame, x, y, x * 255 / CAPTURE_WIDTH, y * 255 / CAPTURE_HEIGHT, (x + y) & 0xFF);
+        }
+    }
+}
+
+/// @brief Full random noise. Worst case for deflate.
+static void generate_noise(uint8_t *frame)
+{
+    uint32_t state = 0x12345678;
+    for (int y = 0; y < CAPTURE_HEIGHT; y++)
+    {
+        for (int x = 0; x < CAPTURE_WIDTH; x++)
+        {
+            const uint32_t random = next_random(&state);
+            set_pixel(frame, x, y, random, random >> 8, random >> 16);
+        }
+    }
+}
+
+/// @brief Flat background, panels and rows of glyph-like blocks. Roughly what the HOME menu looks like.
+static void generate_menu(uint8_t *frame)
+{
+    uint32_t state = 0xCAFEBABE;
+
+    for (int y = 0; y < CAPTURE_HEIGHT; y++)
+    {
+        for (int x = 0; x < CAPTURE_WIDTH; x++) { set_pixel(frame, x, y, 0xEB, 0xEB, 0xEB); }
+    }
+
+    // Panels.
+    for (int panel = 0; panel < 6; panel++)
+    {
+        const int panelX = 64 + panel * 192;
+        for (int y = 200; y < 456; y++)
+        {
+            for (int x = panelX; x < panelX + 176; x++) { set_pixel(frame, x, y, 0x2D + panel * 16, 0x50, 0x9E - panel * 8); }
+        }
+    }
+
+    // Text lines made of 8x12 glyph blocks.
+    for (int line = 0; line < 8; line++)
+    {
+        const int lineY = 500 + line * 24;
+        for (int glyph = 0; glyph < 100; glyph++)
+        {
+            const uint32_t bits = next_random(&state);
+            for (int y = 0; y < 12; y++)
+            {
+                for (int x = 0; x < 8; x++)
+                {
+                    if (!((bits >> ((y * 8 + x) & 31)) & 1)) { continue; }
+                    set_pixel(frame, 80 + glyph * 11 + x, lineY + y, 0x32, 0x32, 0x32);
+                }
+            }
+        }
+    }
+}
+
+/// @brief Grayscale page of text with a photo in it. Roughly what an e-reader or a manga viewer looks like.
+static void generate_document(uint8_t *frame)
+{
+    uint32_t state = 0xB00C5EED;
+
+    // Paper with a dark title bar.
+    for (int y = 0; y < CAPTURE_HEIGHT; y++)
+    {
+        const uint8_t shade = y < 48 ? 0x30 : 0xF4;
+        for (int x = 0; x < CAPTURE_WIDTH; x++) { set_pixel(frame, x, y, shade, shade, shade); }
+    }
+
+    // Photo with a soft vertical falloff and some grain.
+    for (int y = 96; y < 416; y++)
+    {
+        for (int x = 720; x < 1200; x++)
+        {
+            const int base      = 0x40 + (y - 96) * 0x90 / 320 + ((x - 720) / 40 % 2) * 0x10;
+            const int grain     = (int)(next_random(&state) % 9) - 4;
+            const uint8_t shade = base + grain;
+            set_pixel(frame, x, y, shade, shade, shade);
+        }
+    }
+
+    // Text lines made of 8x12 glyph blocks. Edge pixels are blended with the paper like anti-aliased text.
+    for (int line = 0; line < 22; line++)
+    {
+        const int lineY = 96 + line * 26;
+        for (int glyph = 0; glyph < 56; glyph++)
+        {
+            const uint32_t bits = next_random(&state);
+            for (int y = 0; y < 12; y++)
+            {
+                for (int x = 0; x < 8; x++)
+                {
+                    if (!((bits >> ((y * 8 + x) & 31)) & 1)) { continue; }
+
+                    const bool edge     = x == 0 || x == 7 || y == 0 || y == 11;
+                    const uint8_t shade = edge ? 0x80 + (bits >> 24) % 0x40 : 0x28;
+                    set_pixel(frame, 64 + glyph * 11 + x, lineY + y, shade, shade, shade);
+                }
+            }
+        }
+    }
+}
+
+/// @brief 320x180 tile map scaled up 4x with a 16 colour palette. Roughly what a 2D pixel art game looks like.
+static void generate_pixelart(uint8_t *frame)
+{
+    static const uint8_t PALETTE[16][3] = {{0x00, 0x00, 0x00}, {0x1D, 0x2B, 0x53}, {0x7E, 0x25, 0x53}, {0x00, 0x87, 0x51},
+                                           {0xAB, 0x52, 0x36}, {0x5F, 0x57, 0x4F}, {0xC2, 0xC3, 0xC7}, {0xFF, 0xF1, 0xE8},
+                                           {0xFF, 0x00, 0x4D}, {0xFF, 0xA3, 0x00}, {0xFF, 0xEC, 0x27}, {0x00, 0xE4, 0x36},
+                                           {0x29, 0xAD, 0xFF}, {0x83, 0x76, 0x9C}, {0xFF, 0x77, 0xA8}, {0xFF, 0xCC, 0xAA}};
+    static const int SCALE = 4, WIDTH = CAPTURE_WIDTH / 4, HEIGHT = CAPTURE_HEIGHT / 4, TILE = 16;
+
+    uint32_t state = 0x0DDBA11;
+
+    // Random 8x8 sprites, made symmetrical like most are. Index 0 is transparent.
+    uint8_t sprites[4][8][8];
+    for (int sprite = 0; sprite < 4; sprite++)
+    {
+        for (int y = 0; y < 8; y++)
+        {
+            for (int x = 0; x < 4; x++)
+            {
+                const uint32_t random  = next_random(&state);
+                const uint8_t colour   = random & 1 ? 8 + (random >> 1) % 8 : 0;
+                sprites[sprite][y][x]     = colour;
+                sprites[sprite][y][7 - x] = colour;
+            }
+        }
+    }
+
+    uint8_t *screen = malloc(WIDTH * HEIGHT);
+    if (!screen) { return; }
+
+    for (int y = 0; y < HEIGHT; y++)
+    {
+        for (int x = 0; x < WIDTH; x++)
+        {
+            const int tileX = x / TILE, tileY = y / TILE, inX = x % TILE, inY = y % TILE;
+            uint8_t colour;
+            if (tileY < 7)
+            {
+                // Sky with a band of clouds.
+                colour = tileY == 2 && ((tileX * 7 + inX / 4) % 5) < 2 ? 7 : 12;
+            }
+            else if (tileY == 7)
+            {
+                // Grass on top of the ground.
+                colour = inY < 3 ? 11 : inY < 5 ? 3 : 4;
+            }
+            else
+            {
+                // Bricks with mortar lines.
+                const int offset = (inY / 8) & 1 ? TILE / 2 : 0;
+                colour           = inY % 8 == 0 || (inX + offset) % TILE == 0 ? 5 : 4;
+            }
+            screen[y * WIDTH + x] = colour;
+        }
+    }
+
+    // Scatter sprites.
+    for (int i = 0; i < 40; i++)
+    {
+        const uint32_t random = next_random(&state);
+        const int sprite = random & 3, spriteX = (random >> 2) % (WIDTH - 8), spriteY = (random >> 12) % (HEIGHT - 8);
+        for (int y = 0; y < 8; y++)
+        {
+            for (int x = 0; x < 8; x++)
+            {
+                if (sprites[sprite][y][x]) { screen[(spriteY + y) * WIDTH + spriteX + x] = sprites[sprite][y][x]; }
+            }
+        }
+    }
+
+    for (int y = 0; y < CAPTURE_HEIGHT; y++)
+    {
+        for (int x = 0; x < CAPTURE_WIDTH; x++)
+        {
+            const uint8_t *colour = PALETTE[screen[(y / SCALE) * WIDTH + x / SCALE]];
+            set_pixel(frame, x, y, colour[0], colour[1], colour[2]);
+        }
+    }
+
+    free(screen);
+}
+
+/// @brief Sky, a textured floor in perspective with fog, shaded boxes and a HUD bar. Every pixel has a little grain on
+/// it the way rendered and upscaled frames do. Roughly what 3D gameplay looks like.
+static void generate_gameplay(uint8_t *frame)
+{
+    static const int HORIZON = 300;
+    uint32_t state = 0xFEEDF00D;
+
+    for (int y = 0; y < CAPTURE_HEIGHT; y++)
+    {
+        for (int x = 0; x < CAPTURE_WIDTH; x++)
+        {
+            const int grain = (int)(next_random(&state) % 7) - 3;
+            int r, g, b;
+            if (y < HORIZON)
+            {
+                r = 90 + y / 6;
+                g = 140 + y / 5;
+                b = 230 - y / 10;
+            }
+            else
+            {
+                // Project the pixel onto the floor and sample a stone texture there.
+                const double depth = 400.0 / (y - HORIZON + 1);
+                const double u     = (x - CAPTURE_WIDTH / 2) * depth / 200.0;
+                const double v     = depth;
+                const int checker  = ((int)floor(u) + (int)floor(v)) & 1;
+                const double ripple = sin(u * 6.0) * cos(v * 5.0);
+                const double fog    = depth > 40.0 ? 1.0 : depth / 40.0;
+                const int stone     = (checker ? 120 : 95) + (int)(ripple * 20.0);
+                r = stone + (int)((170 - stone) * fog);
+                g = stone - 10 + (int)((190 - stone + 10) * fog);
+                b = stone - 25 + (int)((220 - stone + 25) * fog);
+            }
+            r += grain;
+            g += grain;
+            b += grain;
+            set_pixel(frame, x, y, r < 0 ? 0 : r > 255 ? 255 : r, g < 0 ? 0 : g > 255 ? 255 : g, b < 0 ? 0 : b > 255 ? 255 : b);
+        }
+    }
+
+    // Boxes lit from the left.
+    for (int box = 0; box < 5; box++)
+    {
+        const int boxX = 100 + box * 230, boxY = 260 + (box % 2) * 90, boxWidth = 140 - box * 10, boxHeight = 180 - box * 15;
+        for (int y = boxY; y < boxY + boxHeight; y++)
+        {
+            for (int x = boxX; x < boxX + boxWidth; x++)
+            {
+                const int shade = 200 - (x - boxX) * 120 / boxWidth + (int)(next_random(&state) % 5) - 2;
+                set_pixel(frame, x, y, shade, shade * 3 / 4, shade / 2);
+            }
+        }
+    }
+
+    // HUD bar.
+    for (int y = 650; y < 690; y++)
+    {
+        for (int x = 40; x < 440; x++) { set_pixel(frame, x, y, x < 340 ? 0xD0 : 0x40, x < 340 ? 0x20 : 0x10, 0x20); }
+    }
+}
+
+// clang-format off
+/// @brief Pattern names and their generators.
+static const struct
+{
+    const char *name;
+    void (*generate)(uint8_t *frame);
+} PATTERNS[] = {{"document", generate_document},
+                {"gradient", generate_gradient},
+                {"gameplay", generate_gameplay},
+                {"menu",     generate_menu},
+                {"noise",    generate_noise},
+                {"pixelart", generate_pixelart}};
+// clang-format on
+
+static const int PATTERN_COUNT = sizeof(PATTERNS) / sizeof(PATTERNS[0]);
+
+bool frames_generate(const char *name, uint8_t *frame)
+{
+    for (int i = 0; i < PATTERN_COUNT; i++)
+    {
+        if (strcmp(name, PATTERNS[i].name) != 0) { continue; }
+
+        PATTERNS[i].generate(frame);
+        return true;
+    }
+
+    return false;
+}
+
+bool frames_load(const char *path, uint8_t *frame)
+{
+    FILE *rawFile = fopen(path, "rb");
+    if (!rawFile) { return false; }
+
+    const bool read = fread(frame, 1, FRAME_SIZE, rawFile) == FRAME_SIZE;
+    fclose(rawFile);
+
+    return read;
+}
+
+const char *const *frames_patterns(void)
+{
+    static const char *names[sizeof(PATTERNS) / sizeof(PATTERNS[0]) + 1] = {NULL};
+    for (int i = 0; i < PATTERN_COUNT; i++) { names[i] = PATTERNS[i].name; }
+
+    return names;
+}
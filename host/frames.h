@@ -0,0 +1,23 @@
+#pragma once
+#include "capture.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// @brief Size of a full RGBA frame.
+#define FRAME_SIZE (CAPTURE_WIDTH * CAPTURE_HEIGHT * 4)
+
+/// @brief Fills the frame passed with the synthetic pattern named.
+/// @param name Name of the pattern.
+/// @param frame Buffer of FRAME_SIZE bytes.
+/// @return False if the name isn't known.
+bool frames_generate(const char *name, uint8_t *frame);
+
+/// @brief Loads a recorded raw RGBA frame from the path passed.
+/// @param path Path to the raw frame.
+/// @param frame Buffer of FRAME_SIZE bytes.
+/// @return True on success. False on failure.
+bool frames_load(const char *path, uint8_t *frame);
+
+/// @brief Returns the list of pattern names, terminated by NULL.
+const char *const *frames_patterns(void);
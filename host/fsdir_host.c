@@ -0,0 +1,152 @@
+#include "fsdir.h"
+#include "host.h"
+
+#include <dirent.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Host version of fsdir.c.
+
+/// @brief Same as fsdir.c.
+#define READ_BATCH 8
+#define NAMES_START_SIZE 0x400
+
+// Defined at bottom.
+
+/// @brief Adds a name to the end of the buffer passed, growing it if it has to.
+static bool append_name(char **names, size_t *size, size_t *capacity, const char *name);
+
+bool directory_exists(FsFileSystem *filesystem, const char *path)
+{
+    char fullPath[HOST_MAX_PATH];
+    snprintf(fullPath, HOST_MAX_PATH, "%s%s", filesystem->root, path);
+
+    host_fs_count_directory_call();
+    DIR *testDir = opendir(fullPath);
+    if (!testDir) { return false; }
+
+    closedir(testDir);
+    return true;
+}
+
+bool create_directory(FsFileSystem *filesystem, const char *path)
+{
+    char fullPath[HOST_MAX_PATH];
+    snprintf(fullPath, HOST_MAX_PATH, "%s%s", filesystem->root, path);
+
+    host_fs_count_directory_call();
+    return mkdir(fullPath, 0755) == 0;
+}
+
+bool create_directory_recursively(FsFileSystem *filesystem, const char *path)
+{
+    const size_t pathLength = strlen(path);
+    if (pathLength <= 1) { return false; }
+
+    char subPath[HOST_MAX_PATH];
+    const char *pathOffset = path;
+    while ((pathOffset = strchr(pathOffset + 1, '/')))
+    {
+        snprintf(subPath, HOST_MAX_PATH, "%s%.*s", filesystem->root, (int)(pathOffset - path), path);
+
+        // Same as the Switch version, a check and maybe a create for every level.
+        struct stat dirStat;
+        const bool exists      = stat(subPath, &dirStat) == 0 && S_ISDIR(dirStat.st_mode);
+        const bool createError = !exists && mkdir(subPath, 0755) != 0;
+        host_fs_count_directory_call();
+        if (!exists) { host_fs_count_directory_call(); }
+        if (createError) { return false; }
+    }
+
+    return true;
+}
+
+bool directory_find_file(FsFileSystem *filesystem, const char *path, const char *extension, char *nameOut, size_t nameSize)
+{
+    char fullPath[HOST_MAX_PATH];
+    snprintf(fullPath, HOST_MAX_PATH, "%s%s", filesystem->root, path);
+
+    host_fs_count_directory_call();
+    DIR *searchDir = opendir(fullPath);
+    if (!searchDir) { return false; }
+
+    bool found = false;
+    struct dirent *entry;
+    while (!found && (entry = readdir(searchDir)))
+    {
+        const char *entryExtension = strrchr(entry->d_name, '.');
+        found = entry->d_type == DT_REG && entryExtension && strcmp(entryExtension + 1, extension) == 0;
+        if (found) { snprintf(nameOut, nameSize, "%s", entry->d_name); }
+    }
+
+    closedir(searchDir);
+    return found;
+}
+
+bool directory_list(FsFileSystem *filesystem,
+                    const char *path,
+                    const char *extension,
+                    const char *after,
+                    char **namesOut,
+                    size_t *countOut)
+{
+    char fullPath[HOST_MAX_PATH];
+    snprintf(fullPath, HOST_MAX_PATH, "%s%s", filesystem->root, path);
+
+    host_fs_count_directory_call();
+    DIR *listDir = opendir(fullPath);
+    if (!listDir) { return false; }
+
+    char *names     = NULL;
+    size_t size     = 0;
+    size_t capacity = 0;
+    size_t count    = 0;
+    size_t read     = 0;
+    bool appended   = true;
+    struct dirent *entry;
+    while (appended && (entry = readdir(listDir)))
+    {
+        // Counted like the Switch's batches.
+        if (read++ % READ_BATCH == 0) { host_fs_count_directory_call(); }
+
+        // readdir has . and .. too, which the Switch doesn't.
+        const char *entryExtension = strrchr(entry->d_name, '.');
+        const bool isFile          = extension && entry->d_type == DT_REG && entryExtension &&
+                            strcmp(entryExtension + 1, extension) == 0;
+        const bool isDirectory = !extension && entry->d_type == DT_DIR && entry->d_name[0] != '.';
+        if ((!isFile && !isDirectory) || strcmp(entry->d_name, after) <= 0) { continue; }
+
+        appended = append_name(&names, &size, &capacity, entry->d_name);
+        ++count;
+    }
+
+    closedir(listDir);
+    if (!appended)
+    {
+        free(names);
+        return false;
+    }
+
+    *namesOut = names;
+    *countOut = count;
+    return true;
+}
+
+static bool append_name(char **names, size_t *size, size_t *capacity, const char *name)
+{
+    const size_t length = strlen(name) + 1;
+    if (*size + length > *capacity)
+    {
+        const size_t newCapacity = *capacity ? *capacity * 2 : NAMES_START_SIZE;
+        char *newNames           = realloc(*names, newCapacity);
+        if (!newNames) { return false; }
+        *names    = newNames;
+        *capacity = newCapacity;
+    }
+
+    memcpy(*names + *size, name, length);
+    *size += length;
+    return true;
+}
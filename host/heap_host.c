@@ -0,0 +1,100 @@
+#include "host.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <string.h>
+
+// Tracks heap usage by interposing the malloc family. libpng and zlib are linked dynamically and still resolve to these, so
+// their allocations are counted too. The Switch build has a fixed 384KB heap, so the peak is the number that matters.
+
+// glibc's real allocator.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *pointer);
+
+/// @brief Bytes currently allocated.
+static atomic_size_t currentBytes = 0;
+
+/// @brief Highest value currentBytes has reached since the last reset.
+static atomic_size_t peakBytes = 0;
+
+static inline void heap_count(size_t size)
+{
+    const size_t current = atomic_fetch_add(&currentBytes, size) + size;
+    size_t peak          = atomic_load(&peakBytes);
+    while (current > peak && !atomic_compare_exchange_weak(&peakBytes, &peak, current)) {}
+}
+
+static inline void heap_add(void *pointer)
+{
+    if (!pointer) { return; }
+
+    heap_count(malloc_usable_size(pointer));
+}
+
+static inline void heap_remove(void *pointer)
+{
+    if (!pointer) { return; }
+
+    atomic_fetch_sub(&currentBytes, malloc_usable_size(pointer));
+}
+
+void host_heap_reset_peak(void) { atomic_store(&peakBytes, atomic_load(&currentBytes)); }
+
+size_t host_heap_current(void) { return atomic_load(&currentBytes); }
+
+size_t host_heap_peak(void) { return atomic_load(&peakBytes); }
+
+void host_heap_take_stack(size_t size) { heap_count(size); }
+
+void host_heap_give_stack(size_t size) { atomic_fetch_sub(&currentBytes, size); }
+
+void *malloc(size_t size)
+{
+    void *pointer = __libc_malloc(size);
+    heap_add(pointer);
+    return pointer;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *pointer = __libc_calloc(count, size);
+    heap_add(pointer);
+    return pointer;
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    heap_remove(pointer);
+    void *newPointer = __libc_realloc(pointer, size);
+    // Failure leaves the old block alive.
+    heap_add(newPointer ? newPointer : (size ? pointer : NULL));
+    return newPointer;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *pointer = __libc_memalign(alignment, size);
+    heap_add(pointer);
+    return pointer;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) { return memalign(alignment, size); }
+
+int posix_memalign(void **pointerOut, size_t alignment, size_t size)
+{
+    void *pointer = memalign(alignment, size);
+    if (!pointer) { return ENOMEM; }
+
+    *pointerOut = pointer;
+    return 0;
+}
+
+void free(void *pointer)
+{
+    heap_remove(pointer);
+    __libc_free(pointer);
+}
@@ -0,0 +1,150 @@
+#pragma once
+#include "switch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// @brief Room for the root of the host filesystem plus a full Switch path.
+#define HOST_MAX_PATH (FS_MAX_PATH * 2)
+
+// Hooks only the host benchmark build provides. These are how the harness feeds frames in and reads numbers out.
+
+/// @brief Counters kept by the host FSFILE backend.
+typedef struct
+{
+    /// @brief Number of write calls that reached the file.
+    uint64_t writeCalls;
+
+    /// @brief Total bytes written.
+    uint64_t bytesWritten;
+
+    /// @brief Number of times a file had to be grown to fit a write. Each one is an extra IPC call on the Switch.
+    uint64_t resizes;
+
+    /// @brief Number of PNGs renamed into place. One per finished capture.
+    uint64_t renames;
+
+    /// @brief Number of directories opened or created. Each one is an IPC round-trip on the Switch.
+    uint64_t directoryCalls;
+
+    /// @brief Path the last capture was renamed to.
+    char lastRenamed[HOST_MAX_PATH];
+} HostFsStats;
+
+/// @brief Points the host filesystem at the directory passed.
+/// @param filesystem Filesystem to init.
+/// @param root Directory to use as the root.
+/// @return True on success. False on failure.
+bool host_fs_open(FsFileSystem *filesystem, const char *root);
+
+/// @brief Resets the FSFILE counters.
+void host_fs_reset_stats(void);
+
+/// @brief Returns the FSFILE counters.
+const HostFsStats *host_fs_get_stats(void);
+
+/// @brief Counts a directory open or create. Called by the host fsdir backend.
+void host_fs_count_directory_call(void);
+
+/// @brief Sets the RGBA frame the capture backend serves. The buffer must stay valid while capturing.
+/// @param frame CAPTURE_WIDTH * CAPTURE_HEIGHT RGBA pixels.
+void host_capture_set_frame(const uint8_t *frame);
+
+/// @brief Sets a function that's called every time the capture stream is opened, before anything is read from it.
+/// @param hook Function to call. NULL removes it.
+void host_capture_set_open_hook(void (*hook)(void));
+
+/// @brief Adds a delay to every read call to stand in for the capssc IPC round-trip.
+/// @param nano Delay in nanoseconds. 0 disables it.
+void host_capture_set_read_delay(uint64_t nano);
+
+/// @brief Sets the values the host config returns.
+/// @param compressionLevel Compression level to use.
+void host_config_set_compression_level(int compressionLevel);
+
+/// @brief Sets the number of deflate workers the host config returns.
+/// @param encodeWorkers Number of workers. 1 is the serial path.
+void host_config_set_encode_workers(int encodeWorkers);
+
+/// @brief Sets the row filter mode the host config returns.
+/// @param rowFilter One of PngFilterModes.
+void host_config_set_row_filter(int rowFilter);
+
+/// @brief Sets the encoder the host config returns.
+/// @param encoder One of PngEncoders.
+void host_config_set_encoder(int encoder);
+
+/// @brief Sets the encode mode the host config returns.
+/// @param encodeMode One of PngEncodeModes.
+void host_config_set_encode_mode(int encodeMode);
+
+/// @brief Sets the adaptive mode budget the host config returns.
+/// @param encodeBudget Milliseconds to aim to deflate in.
+void host_config_set_encode_budget(int encodeBudget);
+
+/// @brief Sets the raw-first settings the host config returns.
+/// @param rawFirst Whether or not to spill captures raw.
+/// @param rawCompression One of RawSpillCompression.
+void host_config_set_raw_first(bool rawFirst, int rawCompression);
+
+/// @brief Sets what the host config does with duplicate captures.
+/// @param mode One of FrameDuplicateModes.
+void host_config_set_duplicate_captures(int mode);
+
+/// @brief Sets whether the host config traces captures.
+/// @param enabled Whether or not to trace.
+void host_config_set_trace_captures(bool enabled);
+
+/// @brief Sets whether the host config reduces low color captures to grayscale or a palette.
+/// @param enabled Whether or not to reduce.
+void host_config_set_reduce_colors(bool enabled);
+
+/// @brief Sets how many rows the host config reads per call.
+/// @param readRows Rows per call. Must divide ROW_PIPELINE_SLOTS and be at most ROW_PIPELINE_MAX_BLOCK.
+void host_config_set_read_rows(int readRows);
+
+/// @brief Sets the recording settings the host config returns.
+/// @param recordRate Frames per second.
+/// @param recordLength Most seconds a recording lasts.
+void host_config_set_record(int recordRate, int recordLength);
+
+/// @brief Sets the timelapse settings the host config returns.
+/// @param interval Seconds between captures. Only main goes by this. The bench times captures itself.
+/// @param cpuBudget Milliseconds of CPU time per minute.
+/// @param writeBudget Kilobytes written per minute.
+void host_config_set_timelapse(int interval, int cpuBudget, int writeBudget);
+
+/// @brief Sets how many times smaller than the capture the host config's thumbnails are.
+/// @param scale 2 or 4. 0 turns them off.
+void host_config_set_thumbnail_scale(int scale);
+
+/// @brief Sets what deflates the host config's captures.
+/// @param backend PngDeflateZlib or PngDeflateLibdeflate.
+void host_config_set_deflate_backend(int backend);
+
+/// @brief Sets the encode priority, core and slicing the host config returns, and whether the latency probe is on.
+/// @param priority 0x2D to 0x3F. The host maps it onto a nice value.
+/// @param core Host CPU the encoding threads are pinned to. -1 doesn't pin them.
+/// @param sliceRows Rows encoded between yields. 0 never yields.
+/// @param probe Whether or not to run the latency probe.
+void host_config_set_governor(int priority, int core, int sliceRows, bool probe);
+
+/// @brief Lets the process use cores 0 to 2 as well as 3, like a GAME_CORES=1 build does.
+/// @param allowed Whether or not the game's cores are allowed.
+void host_switch_allow_game_cores(bool allowed);
+
+/// @brief Resets the heap peak to the current usage.
+void host_heap_reset_peak(void);
+
+/// @brief Returns the number of bytes currently allocated.
+size_t host_heap_current(void);
+
+/// @brief Returns the highest number of bytes allocated since the last reset.
+size_t host_heap_peak(void);
+
+/// @brief Counts a thread stack libnx would have taken from the heap. Host threads get theirs from pthreads.
+void host_heap_take_stack(size_t size);
+
+/// @brief Stops counting a stack host_heap_take_stack counted.
+void host_heap_give_stack(size_t size);
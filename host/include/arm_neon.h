@@ -0,0 +1,395 @@
+#pragma once
+// Plain C stand-in for the NEON intrinsics the shared sources use, so their NEON paths can be built and run on the host with
+// make NEON=1. Every intrinsic does what the Arm reference says it does, one lane at a time. It's slow. It's only here so the
+// NEON paths can be compared against the scalar ones.
+#include <stdint.h>
+
+// clang-format off
+typedef struct { uint8_t  lane[8];  } uint8x8_t;
+typedef struct { uint8_t  lane[16]; } uint8x16_t;
+typedef struct { int8_t   lane[16]; } int8x16_t;
+typedef struct { uint16_t lane[4];  } uint16x4_t;
+typedef struct { uint16_t lane[8];  } uint16x8_t;
+typedef struct { uint32_t lane[2];  } uint32x2_t;
+typedef struct { uint64_t lane[2];  } uint64x2_t;
+
+typedef struct { uint8x16_t val[3]; } uint8x16x3_t;
+typedef struct { uint8x16_t val[4]; } uint8x16x4_t;
+typedef struct { uint16x4_t val[3]; } uint16x4x3_t;
+typedef struct { uint16x8_t val[3]; } uint16x8x3_t;
+// clang-format on
+
+// Loads, stores and moving lanes around.
+
+static inline uint8x16_t vdupq_n_u8(uint8_t value)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = value; }
+    return result;
+}
+
+static inline uint16x8_t vdupq_n_u16(uint16_t value)
+{
+    uint16x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = value; }
+    return result;
+}
+
+static inline uint8x16_t vld1q_u8(const uint8_t *data)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = data[i]; }
+    return result;
+}
+
+static inline void vst1q_u8(uint8_t *data, uint8x16_t value)
+{
+    for (int i = 0; i < 16; i++) { data[i] = value.lane[i]; }
+}
+
+static inline void vst1_u8(uint8_t *data, uint8x8_t value)
+{
+    for (int i = 0; i < 8; i++) { data[i] = value.lane[i]; }
+}
+
+static inline uint16x8_t vld1q_u16(const uint16_t *data)
+{
+    uint16x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = data[i]; }
+    return result;
+}
+
+static inline uint64x2_t vld1q_u64(const uint64_t *data)
+{
+    uint64x2_t result;
+    for (int i = 0; i < 2; i++) { result.lane[i] = data[i]; }
+    return result;
+}
+
+static inline void vst1q_u64(uint64_t *data, uint64x2_t value)
+{
+    for (int i = 0; i < 2; i++) { data[i] = value.lane[i]; }
+}
+
+static inline uint8x16x3_t vld3q_u8(const uint8_t *data)
+{
+    uint8x16x3_t result;
+    for (int i = 0; i < 48; i++) { result.val[i % 3].lane[i / 3] = data[i]; }
+    return result;
+}
+
+static inline void vst3q_u8(uint8_t *data, uint8x16x3_t value)
+{
+    for (int i = 0; i < 48; i++) { data[i] = value.val[i % 3].lane[i / 3]; }
+}
+
+static inline uint8x16x4_t vld4q_u8(const uint8_t *data)
+{
+    uint8x16x4_t result;
+    for (int i = 0; i < 64; i++) { result.val[i % 4].lane[i / 4] = data[i]; }
+    return result;
+}
+
+static inline uint16x4x3_t vld3_u16(const uint16_t *data)
+{
+    uint16x4x3_t result;
+    for (int i = 0; i < 12; i++) { result.val[i % 3].lane[i / 3] = data[i]; }
+    return result;
+}
+
+static inline void vst3_u16(uint16_t *data, uint16x4x3_t value)
+{
+    for (int i = 0; i < 12; i++) { data[i] = value.val[i % 3].lane[i / 3]; }
+}
+
+static inline uint16x8x3_t vld3q_u16(const uint16_t *data)
+{
+    uint16x8x3_t result;
+    for (int i = 0; i < 24; i++) { result.val[i % 3].lane[i / 3] = data[i]; }
+    return result;
+}
+
+static inline void vst3q_u16(uint16_t *data, uint16x8x3_t value)
+{
+    for (int i = 0; i < 24; i++) { data[i] = value.val[i % 3].lane[i / 3]; }
+}
+
+static inline uint8x16_t vextq_u8(uint8x16_t low, uint8x16_t high, int count)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = i + count < 16 ? low.lane[i + count] : high.lane[i + count - 16]; }
+    return result;
+}
+
+static inline uint64x2_t vextq_u64(uint64x2_t low, uint64x2_t high, int count)
+{
+    uint64x2_t result;
+    for (int i = 0; i < 2; i++) { result.lane[i] = i + count < 2 ? low.lane[i + count] : high.lane[i + count - 2]; }
+    return result;
+}
+
+static inline uint8x8_t vget_low_u8(uint8x16_t value)
+{
+    uint8x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = value.lane[i]; }
+    return result;
+}
+
+static inline uint16x4_t vget_low_u16(uint16x8_t value)
+{
+    uint16x4_t result;
+    for (int i = 0; i < 4; i++) { result.lane[i] = value.lane[i]; }
+    return result;
+}
+
+static inline uint16x4_t vget_high_u16(uint16x8_t value)
+{
+    uint16x4_t result;
+    for (int i = 0; i < 4; i++) { result.lane[i] = value.lane[i + 4]; }
+    return result;
+}
+
+static inline uint8x16_t vcombine_u8(uint8x8_t low, uint8x8_t high)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 8; i++)
+    {
+        result.lane[i]     = low.lane[i];
+        result.lane[i + 8] = high.lane[i];
+    }
+    return result;
+}
+
+static inline int8x16_t vreinterpretq_s8_u8(uint8x16_t value)
+{
+    int8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = (int8_t)value.lane[i]; }
+    return result;
+}
+
+static inline uint8x16_t vreinterpretq_u8_s8(int8x16_t value)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = (uint8_t)value.lane[i]; }
+    return result;
+}
+
+static inline uint64x2_t vreinterpretq_u64_u8(uint8x16_t value)
+{
+    // Lane 0 is the low half on a little endian host, like on the Switch.
+    uint64x2_t result;
+    for (int i = 0; i < 2; i++)
+    {
+        result.lane[i] = 0;
+        for (int byte = 0; byte < 8; byte++) { result.lane[i] |= (uint64_t)value.lane[i * 8 + byte] << (byte * 8); }
+    }
+    return result;
+}
+
+// Arithmetic. Everything wraps unless the name says it saturates or widens.
+
+static inline uint8x16_t vsubq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = a.lane[i] - b.lane[i]; }
+    return result;
+}
+
+static inline uint8x16_t vhaddq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = (a.lane[i] + b.lane[i]) >> 1; }
+    return result;
+}
+
+static inline int8x16_t vnegq_s8(int8x16_t value)
+{
+    // -128 stays -128.
+    int8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = (int8_t)(uint8_t)(0 - (uint8_t)value.lane[i]); }
+    return result;
+}
+
+static inline uint8x16_t vminq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = a.lane[i] < b.lane[i] ? a.lane[i] : b.lane[i]; }
+    return result;
+}
+
+static inline uint8_t vminvq_u8(uint8x16_t value)
+{
+    uint8_t result = value.lane[0];
+    for (int i = 1; i < 16; i++) { result = value.lane[i] < result ? value.lane[i] : result; }
+    return result;
+}
+
+static inline uint8x16_t vabdq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = a.lane[i] > b.lane[i] ? a.lane[i] - b.lane[i] : b.lane[i] - a.lane[i]; }
+    return result;
+}
+
+static inline uint16x8_t vabdq_u16(uint16x8_t a, uint16x8_t b)
+{
+    uint16x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = a.lane[i] > b.lane[i] ? a.lane[i] - b.lane[i] : b.lane[i] - a.lane[i]; }
+    return result;
+}
+
+static inline uint16x8_t vaddq_u16(uint16x8_t a, uint16x8_t b)
+{
+    uint16x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = a.lane[i] + b.lane[i]; }
+    return result;
+}
+
+static inline uint16x4_t vadd_u16(uint16x4_t a, uint16x4_t b)
+{
+    uint16x4_t result;
+    for (int i = 0; i < 4; i++) { result.lane[i] = a.lane[i] + b.lane[i]; }
+    return result;
+}
+
+static inline uint64x2_t vaddq_u64(uint64x2_t a, uint64x2_t b)
+{
+    uint64x2_t result;
+    for (int i = 0; i < 2; i++) { result.lane[i] = a.lane[i] + b.lane[i]; }
+    return result;
+}
+
+static inline uint16x4_t vpadd_u16(uint16x4_t a, uint16x4_t b)
+{
+    uint16x4_t result;
+    for (int i = 0; i < 2; i++)
+    {
+        result.lane[i]     = a.lane[i * 2] + a.lane[i * 2 + 1];
+        result.lane[i + 2] = b.lane[i * 2] + b.lane[i * 2 + 1];
+    }
+    return result;
+}
+
+static inline uint16x8_t vpaddlq_u8(uint8x16_t value)
+{
+    uint16x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = value.lane[i * 2] + value.lane[i * 2 + 1]; }
+    return result;
+}
+
+static inline uint16x8_t vpadalq_u8(uint16x8_t sums, uint8x16_t value)
+{
+    uint16x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = sums.lane[i] + value.lane[i * 2] + value.lane[i * 2 + 1]; }
+    return result;
+}
+
+static inline uint32_t vaddlvq_u16(uint16x8_t value)
+{
+    uint32_t result = 0;
+    for (int i = 0; i < 8; i++) { result += value.lane[i]; }
+    return result;
+}
+
+static inline uint16x8_t vaddl_u8(uint8x8_t a, uint8x8_t b)
+{
+    uint16x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = a.lane[i] + b.lane[i]; }
+    return result;
+}
+
+static inline uint16x8_t vaddl_high_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint16x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = a.lane[i + 8] + b.lane[i + 8]; }
+    return result;
+}
+
+static inline uint64x2_t vmlal_u32(uint64x2_t sums, uint32x2_t a, uint32x2_t b)
+{
+    uint64x2_t result;
+    for (int i = 0; i < 2; i++) { result.lane[i] = sums.lane[i] + (uint64_t)a.lane[i] * b.lane[i]; }
+    return result;
+}
+
+// Shifts and narrowing.
+
+static inline uint16x8_t vshll_n_u8(uint8x8_t value, int shift)
+{
+    uint16x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = (uint16_t)(value.lane[i] << shift); }
+    return result;
+}
+
+static inline uint16x8_t vshll_high_n_u8(uint8x16_t value, int shift)
+{
+    uint16x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = (uint16_t)(value.lane[i + 8] << shift); }
+    return result;
+}
+
+static inline uint8x8_t vqmovn_u16(uint16x8_t value)
+{
+    uint8x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = value.lane[i] > 0xFF ? 0xFF : value.lane[i]; }
+    return result;
+}
+
+static inline uint8x8_t vrshrn_n_u16(uint16x8_t value, int shift)
+{
+    // The rounding add happens before narrowing, so it can't overflow.
+    uint8x8_t result;
+    for (int i = 0; i < 8; i++) { result.lane[i] = (uint8_t)(((uint32_t)value.lane[i] + (1u << (shift - 1))) >> shift); }
+    return result;
+}
+
+static inline uint32x2_t vmovn_u64(uint64x2_t value)
+{
+    uint32x2_t result;
+    for (int i = 0; i < 2; i++) { result.lane[i] = (uint32_t)value.lane[i]; }
+    return result;
+}
+
+static inline uint32x2_t vshrn_n_u64(uint64x2_t value, int shift)
+{
+    uint32x2_t result;
+    for (int i = 0; i < 2; i++) { result.lane[i] = (uint32_t)(value.lane[i] >> shift); }
+    return result;
+}
+
+// Comparisons and bitwise. Comparisons set every bit of a lane that passes.
+
+static inline uint8x16_t vceqq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = a.lane[i] == b.lane[i] ? 0xFF : 0; }
+    return result;
+}
+
+static inline uint8x16_t vcleq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = a.lane[i] <= b.lane[i] ? 0xFF : 0; }
+    return result;
+}
+
+static inline uint8x16_t vandq_u8(uint8x16_t a, uint8x16_t b)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = a.lane[i] & b.lane[i]; }
+    return result;
+}
+
+static inline uint64x2_t veorq_u64(uint64x2_t a, uint64x2_t b)
+{
+    uint64x2_t result;
+    for (int i = 0; i < 2; i++) { result.lane[i] = a.lane[i] ^ b.lane[i]; }
+    return result;
+}
+
+static inline uint8x16_t vbslq_u8(uint8x16_t mask, uint8x16_t set, uint8x16_t clear)
+{
+    uint8x16_t result;
+    for (int i = 0; i < 16; i++) { result.lane[i] = (mask.lane[i] & set.lane[i]) | (~mask.lane[i] & clear.lane[i]); }
+    return result;
+}
@@ -0,0 +1,79 @@
+#pragma once
+// Minimal stand-in for the parts of libnx the shared sources need when they're built for the host benchmark. Anything that
+// actually talks to the system lives behind the capture and FSFILE backends instead.
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define FS_MAX_PATH 0x301
+
+typedef uint32_t Result;
+#define R_SUCCEEDED(res) ((res) == 0)
+#define R_FAILED(res)    ((res) != 0)
+
+/// @brief Host filesystem. Every path is resolved relative to the root directory.
+typedef struct
+{
+    char root[FS_MAX_PATH];
+} FsFileSystem;
+
+// Ticks on the host are nanoseconds.
+uint64_t armGetSystemTick(void);
+static inline uint64_t armTicksToNs(uint64_t ticks) { return ticks; }
+static inline uint64_t armNsToTicks(uint64_t ns) { return ns; }
+
+// Sleeps of 0 or less are yields, like on the Switch.
+typedef enum
+{
+    YieldType_WithoutCoreMigration = 0,
+    YieldType_WithCoreMigration    = -1,
+    YieldType_ToAnyThread          = -2
+} YieldType;
+
+void svcSleepThread(int64_t nano);
+
+// Priorities from the main thread's 0x2C down map onto nice values 0 to 19. Raising a nice value back down needs
+// privileges, so that's best effort. Cores are host CPUs, wrapped around however many there are. The process may only use
+// core 3, like PNGShot.json, unless the benchmark lets it onto the game's cores like a GAME_CORES=1 build.
+#define CUR_THREAD_HANDLE  0xFFFF8000
+#define CUR_PROCESS_HANDLE 0xFFFF8001
+#define InfoType_CoreMask  0
+Result svcSetThreadPriority(uint32_t handle, uint32_t priority);
+Result svcGetThreadPriority(int32_t *priority, uint32_t handle);
+Result svcSetThreadCoreMask(uint32_t handle, int32_t core_id, uint32_t affinity_mask);
+Result svcGetInfo(uint64_t *out, uint32_t id0, uint32_t handle, uint64_t id1);
+uint32_t svcGetCurrentProcessorNumber(void);
+
+// Threads, mutexes and condition variables map straight onto pthreads.
+typedef void (*ThreadFunc)(void *);
+
+typedef struct
+{
+    pthread_t handle;
+    ThreadFunc entry;
+    void *arg;
+    int prio, cpuid;
+
+    /// @brief Stack libnx would have taken from the heap. 0 if it was given one.
+    size_t heapStack;
+} Thread;
+
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+
+Result threadCreate(Thread *t, ThreadFunc entry, void *arg, void *stack_mem, size_t stack_sz, int prio, int cpuid);
+Result threadStart(Thread *t);
+Result threadWaitForExit(Thread *t);
+Result threadClose(Thread *t);
+
+static inline void mutexInit(Mutex *m) { pthread_mutex_init(m, NULL); }
+static inline void mutexLock(Mutex *m) { pthread_mutex_lock(m); }
+static inline void mutexUnlock(Mutex *m) { pthread_mutex_unlock(m); }
+
+static inline void condvarInit(CondVar *c) { pthread_cond_init(c, NULL); }
+static inline Result condvarWait(CondVar *c, Mutex *m) { return pthread_cond_wait(c, m); }
+Result condvarWaitTimeout(CondVar *c, Mutex *m, uint64_t timeout);
+static inline Result condvarWakeOne(CondVar *c) { return pthread_cond_signal(c); }
+static inline Result condvarWakeAll(CondVar *c) { return pthread_cond_broadcast(c); }
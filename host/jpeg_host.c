@@ -0,0 +1,9 @@
+#include "jpeg.h"
+
+// There are no system JPEGs on the host.
+bool jpeg_delete_capture(FsFileSystem *albumDir, uint64_t timestamp)
+{
+    (void)albumDir;
+    (void)timestamp;
+    return true;
+}
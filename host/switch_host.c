@@ -0,0 +1,133 @@
+// For pthread_setaffinity_np. This has to come before switch.h pulls in pthread.h.
+#define _GNU_SOURCE
+#include "switch.h"
+#include "host.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// Host implementations of the libnx functions declared in include/switch.h.
+
+/// @brief Core the calling thread was put on. Threads start on the default core.
+static _Thread_local int currentCore = 3;
+
+/// @brief Cores the process may use. Only 3, like PNGShot.json, unless host_switch_allow_game_cores is called.
+static uint64_t coreMask = 0x8;
+
+uint64_t armGetSystemTick(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void svcSleepThread(int64_t nano)
+{
+    if (nano <= 0)
+    {
+        sched_yield();
+        return;
+    }
+
+    const struct timespec duration = {.tv_sec = nano / 1000000000LL, .tv_nsec = nano % 1000000000LL};
+    nanosleep(&duration, NULL);
+}
+
+Result svcSetThreadPriority(uint32_t handle, uint32_t priority)
+{
+    (void)handle;
+    const int nice = priority < 0x2C ? 0 : priority - 0x2C > 19 ? 19 : (int)priority - 0x2C;
+    return setpriority(PRIO_PROCESS, syscall(SYS_gettid), nice) == 0 ? 0 : 1;
+}
+
+Result svcGetThreadPriority(int32_t *priority, uint32_t handle)
+{
+    // Nice values map back onto priorities from the main thread's down, the opposite of svcSetThreadPriority.
+    (void)handle;
+    errno          = 0;
+    const int nice = getpriority(PRIO_PROCESS, syscall(SYS_gettid));
+    if (errno != 0) { return 1; }
+
+    *priority = 0x2C + (nice < 0 ? 0 : nice);
+    return 0;
+}
+
+Result svcSetThreadCoreMask(uint32_t handle, int32_t core_id, uint32_t affinity_mask)
+{
+    (void)handle;
+    (void)affinity_mask;
+    if (core_id < 0) { return 0; }
+    if (!(coreMask & (1ULL << core_id))) { return 1; }
+    currentCore = core_id;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core_id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+Result svcGetInfo(uint64_t *out, uint32_t id0, uint32_t handle, uint64_t id1)
+{
+    (void)handle;
+    (void)id1;
+    if (id0 != InfoType_CoreMask) { return 1; }
+
+    *out = coreMask;
+    return 0;
+}
+
+uint32_t svcGetCurrentProcessorNumber(void) { return currentCore; }
+
+/// @brief pthreads wants a different signature. The priority and core are set from the thread itself.
+static void *thread_trampoline(void *arg)
+{
+    Thread *thread = arg;
+    svcSetThreadPriority(CUR_THREAD_HANDLE, thread->prio);
+    svcSetThreadCoreMask(CUR_THREAD_HANDLE, thread->cpuid, 0);
+    thread->entry(thread->arg);
+    return NULL;
+}
+
+Result condvarWaitTimeout(CondVar *c, Mutex *m, uint64_t timeout)
+{
+    // pthreads wants an absolute time on the realtime clock.
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout / 1000000000ULL + (deadline.tv_nsec + timeout % 1000000000ULL) / 1000000000ULL;
+    deadline.tv_nsec = (deadline.tv_nsec + timeout % 1000000000ULL) % 1000000000ULL;
+
+    return pthread_cond_timedwait(c, m, &deadline);
+}
+
+Result threadCreate(Thread *t, ThreadFunc entry, void *arg, void *stack_mem, size_t stack_sz, int prio, int cpuid)
+{
+    // pthreads has its own stacks. Without one passed in, libnx takes it from the heap, so that's counted there until
+    // threadClose. -2, the default core, is as good as any. Cores the process isn't allowed fail like they do on the
+    // Switch.
+    if (cpuid >= 0 && !(coreMask & (1ULL << cpuid))) { return 1; }
+
+    t->entry     = entry;
+    t->arg       = arg;
+    t->prio      = prio;
+    t->cpuid     = cpuid;
+    t->heapStack = stack_mem ? 0 : stack_sz;
+    host_heap_take_stack(t->heapStack);
+    return 0;
+}
+
+Result threadStart(Thread *t) { return pthread_create(&t->handle, NULL, thread_trampoline, t); }
+
+Result threadWaitForExit(Thread *t) { return pthread_join(t->handle, NULL); }
+
+Result threadClose(Thread *t)
+{
+    host_heap_give_stack(t->heapStack);
+    t->heapStack = 0;
+    return 0;
+}
+
+void host_switch_allow_game_cores(bool allowed) { coreMask = allowed ? 0xF : 0x8; }
@@ -20,6 +20,20 @@ bool FSFILE_Exists(FsFileSystem *filesystem, const char *path);
 /// @return True on success. False on failure.
 bool FSFILE_Delete(FsFileSystem *filesystem, const char *path);
 
+/// @brief Attempts to rename (or move) the file passed.
+/// @param filesystem Filesystem the file resides on.
+/// @param oldPath Current path of the file.
+/// @param newPath Path to rename the file to.
+/// @return True on success. False on failure.
+bool FSFILE_Rename(FsFileSystem *filesystem, const char *oldPath, const char *newPath);
+
+/// @brief Gets the creation timestamp of the file passed.
+/// @param filesystem Filesystem the file resides on.
+/// @param path Path of the file.
+/// @param timestampOut Variable to write the timestamp to.
+/// @return True on success. False on failure.
+bool FSFILE_GetTimeStamp(FsFileSystem *filesystem, const char *path, uint64_t *timestampOut);
+
 /// @brief Attempts to open the path passed for reading.
 /// @param filesystem Filesystem on which the file resides.
 /// @param path Path to open.
@@ -33,6 +47,21 @@ FSFILE *FSFILE_OpenRead(FsFileSystem *filesystem, const char *path);
 /// @return FSFILE on success. NULL on failure.
 FSFILE *FSFILE_OpenWrite(FsFileSystem *filesystem, const char *path, int64_t size);
 
+/// @brief Attempts to open the path passed for writing, with writes gathered in a buffer and written in whole blocks of its
+/// size. If the file turns out bigger than the size it was created with, it's grown a quarter past what's needed at a time.
+/// @param filesystem Filesystem on which the file will be created and written to.
+/// @param path Path to open.
+/// @param size Size to create with. FSFILE_Finalize trims it to what was written.
+/// @param bufferSize Size of the buffer. If it can't be allocated, writes go straight to the file.
+/// @return FSFILE on success. NULL on failure.
+FSFILE *FSFILE_OpenWriteBuffered(FsFileSystem *filesystem, const char *path, int64_t size, size_t bufferSize);
+
+/// @brief Attempts to open the path passed for writing at the end of the file. It's created empty if it doesn't exist.
+/// @param filesystem Filesystem on which the file resides.
+/// @param path Path to open.
+/// @return FSFILE on success. NULL on failure.
+FSFILE *FSFILE_OpenAppend(FsFileSystem *filesystem, const char *path);
+
 /// @brief Reads from the file passed.
 /// @param file File to read from.
 /// @param buffer Buffer to read to.
@@ -47,11 +76,24 @@ ssize_t FSFILE_Read(FSFILE *file, void *buffer, size_t size);
 /// @return Bytes written on success. -1 on failure.
 ssize_t FSFILE_Write(FSFILE *file, const void *buffer, size_t size);
 
+/// @brief Overwrites bytes that were already written without moving the offset. Whatever is still waiting in the buffer is
+/// changed there, so this only costs a write for bytes that already went out.
+/// @param file File to write to.
+/// @param offset Offset to write at. offset + size can't be past what's been written so far.
+/// @param buffer Data to write.
+/// @param size Size of the data.
+/// @return True on success. False on failure.
+bool FSFILE_WriteAt(FSFILE *file, int64_t offset, const void *buffer, size_t size);
+
 /// @brief Returns the size of the file.
 /// @param file File to get the size of.
 /// @return Size of the file on success. -1 on failure.
 ssize_t FSFILE_GetSize(FSFILE *file);
 
+/// @brief Returns the current offset in the file. For files being written, this is how much has been written so far.
+/// @param file File to get the offset of.
+ssize_t FSFILE_Tell(FSFILE *file);
+
 /// @brief Sets the size of the file.
 /// @param file File to set the size of.
 /// @param size Size to set the file to.
@@ -0,0 +1,52 @@
+#pragma once
+#include "FSFILE.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Write buffering and growth shared by every FSFILE backend. A backend keeps an FSFILEState in its FSFILE, forwards writes
+// to the functions below and provides the two fsfile_backend functions they're built on. The Switch backend and the host
+// benchmark's both do, so the benchmark measures the same buffering the sysmodule uses.
+
+// clang-format off
+/// @brief Where a file is and what's waiting to be written to it.
+typedef struct
+{
+    /// @brief Size of the file.
+    int64_t size;
+
+    /// @brief Current offset. Buffered bytes count.
+    int64_t offset;
+
+    /// @brief Write buffer. NULL unless the file was opened with FSFILE_OpenWriteBuffered.
+    uint8_t *buffer;
+
+    /// @brief Size of the buffer and how much of it is waiting to be written.
+    size_t bufferSize, bufferUsed;
+} FSFILEState;
+// clang-format on
+
+/// @brief Writes straight to the file at the offset passed. The file is already big enough. Provided by the backend.
+/// @return True on success. False on failure.
+bool fsfile_backend_write(FSFILE *file, int64_t offset, const void *data, size_t size);
+
+/// @brief Grows the file to make room for a write. Provided by the backend.
+/// @return True on success. False on failure.
+bool fsfile_backend_grow(FSFILE *file, int64_t size);
+
+/// @brief Allocates the write buffer. If it can't be, writes go straight to the file.
+void fsfile_buffer_open(FSFILEState *state, size_t bufferSize);
+
+/// @brief Same as FSFILE_Write, once the file's been checked.
+ssize_t fsfile_buffer_write(FSFILE *file, FSFILEState *state, const void *data, size_t size);
+
+/// @brief Same as FSFILE_WriteAt, once the file's been checked.
+bool fsfile_buffer_write_at(FSFILE *file, FSFILEState *state, int64_t offset, const void *data, size_t size);
+
+/// @brief Writes whatever is in the buffer to the file.
+/// @return True on success. False on failure.
+bool fsfile_buffer_flush(FSFILE *file, FSFILEState *state);
+
+/// @brief Frees the write buffer. Flush it first.
+void fsfile_buffer_close(FSFILEState *state);
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <switch.h>
+
+// Geometry of the raw capture stream. Every row is RGBA.
+#define CAPTURE_WIDTH    1280
+#define CAPTURE_HEIGHT   720
+#define CAPTURE_ROW_SIZE (CAPTURE_WIDTH * 4)
+
+/// @brief Number of rows the duplicate check, adaptive mode and the color count sample before doing anything with the rest.
+#define CAPTURE_SAMPLE_ROWS 8
+
+/// @brief Returns the sample row passed, 0 to CAPTURE_SAMPLE_ROWS - 1. They're the middles of equal bands down the frame.
+static inline int capture_sample_row(int sample) { return (sample * 2 + 1) * CAPTURE_HEIGHT / (CAPTURE_SAMPLE_ROWS * 2); }
+
+// This is the capture source backend. On the Switch it reads from capssc. The host build replaces it with one that serves
+// synthetic or recorded frames.
+
+/// @brief Attempts to open the capture stream. Returns false on failure.
+/// @param widthOut Optional. Receives the width of the frame.
+/// @param heightOut Optional. Receives the height of the frame.
+bool capture_open_stream(uint64_t *widthOut, uint64_t *heightOut);
+
+/// @brief Opens a raw spill in place of the stream. Reads come from the spill until capture_close_stream is called.
+/// @param filesystem Filesystem the spill is on.
+/// @param path Path of the spill.
+/// @param widthOut Optional. Receives the width of the frame.
+/// @param heightOut Optional. Receives the height of the frame.
+/// @return True on success. False on failure.
+bool capture_open_spill(FsFileSystem *filesystem, const char *path, uint64_t *widthOut, uint64_t *heightOut);
+
+/// @brief Reads raw RGBA data from the stream.
+/// @param buffer Buffer to read into.
+/// @param size Number of bytes to read.
+/// @param offset Offset into the frame to read from.
+/// @return True if every byte was read. False on failure.
+bool capture_read(void *buffer, size_t size, size_t offset);
+
+/// @brief Reads a row from the stream into the buffer passed. Only valid for frames of the fixed geometry.
+/// @param buffer Row buffer to read into. Must be at least CAPTURE_ROW_SIZE bytes.
+/// @param rowIndex Current row height-wise to read.
+/// @return True on success. False on failure.
+bool capture_read_row(void *buffer, int rowIndex);
+
+/// @brief Reads consecutive rows from the stream into the buffer passed in one call. Only valid for frames of the fixed
+/// geometry.
+/// @param buffer Buffer to read into. Must be at least rowCount * CAPTURE_ROW_SIZE bytes.
+/// @param firstRow First row to read.
+/// @param rowCount Number of rows to read.
+/// @return True on success. False on failure.
+bool capture_read_rows(void *buffer, int firstRow, int rowCount);
+
+/// @brief Closes the capture stream or spill.
+void capture_close_stream(void);
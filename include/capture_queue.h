@@ -0,0 +1,37 @@
+#pragma once
+#include <stdbool.h>
+#include <switch.h>
+
+// Runs captures on a worker thread so the event loop can go right back to waiting on the capture button. Presses that come
+// in while a capture is being encoded are queued and handled in order instead of being lost.
+
+/// @brief Most presses that can be waiting at once. Each one is a small heap allocation, so a press is also dropped if
+/// that allocation fails.
+#define CAPTURE_QUEUE_MAX_DEPTH 8
+
+/// @brief Starts the worker thread.
+/// @param albumDir Album filesystem. This must stay open until capture_queue_stop returns.
+/// @return True on success. False on failure.
+bool capture_queue_start(FsFileSystem *albumDir);
+
+/// @brief Queues a capture.
+/// @return True if the capture was queued. False if it was dropped.
+bool capture_queue_push(void);
+
+/// @brief Queues a recording. It runs until capture_queue_stop_recording is called or RecordLength runs out.
+/// @return True if the recording was queued. False if it was dropped.
+bool capture_queue_record(void);
+
+/// @brief Stops the recording once the frame it's on is written. One that hasn't started yet still gets one frame.
+void capture_queue_stop_recording(void);
+
+/// @brief Queues a timelapse shot. png_timelapse decides whether it's actually taken.
+/// @return True if the shot was queued. False if it was dropped, or if one is already waiting.
+bool capture_queue_timelapse(void);
+
+/// @brief Tells the worker the capture button was touched. Recompressing saved PNGs stops right away and waits until the
+/// button's been left alone again.
+void capture_queue_notify_activity(void);
+
+/// @brief Waits for every queued capture to finish and stops the worker.
+void capture_queue_stop(void);
@@ -0,0 +1,115 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <switch.h>
+
+// Per-stage trace of captures. When TraceCaptures is set, png_capture marks the end of every stage of a capture, and the
+// FSFILE, capture and jpeg code count the bytes and IPC calls that went into it. Each stage becomes one entry in a fixed
+// ring along with how high the heap got, and the ring is appended to CAPTURE_TRACE_PATH as CSV once nothing's waiting on
+// the worker. When it isn't set, every hook returns on its first branch.
+
+/// @brief Where the trace is appended to on the filesystem passed to capture_trace_start.
+#define CAPTURE_TRACE_PATH "/config/PNGShot/trace.csv"
+
+/// @brief Number of entries the ring holds. A capture takes at most CaptureTraceStageCount of them. When it fills up
+/// before a flush, the oldest entries are dropped.
+#define CAPTURE_TRACE_ENTRIES 64
+
+/// @brief Stages of a capture, in the order they're written to the trace.
+enum CaptureTraceStages
+{
+    /// @brief Opening the stream or spill and creating the temporary file.
+    CaptureTraceOpen,
+
+    /// @brief Checking whether the capture is a duplicate.
+    CaptureTraceDuplicate,
+
+    /// @brief Sampling the capture to pick the encoder settings in adaptive mode.
+    CaptureTraceAdapt,
+
+    /// @brief Counting the colors of the capture to see if it fits in a palette or grayscale.
+    CaptureTraceColors,
+
+    /// @brief Everything from the PNG header to IEND. Row reads from the reader thread are counted here too.
+    CaptureTraceEncode,
+
+    /// @brief Ticks spent reading rows. Part of Encode. On the reader thread for the native encoders, so it overlaps.
+    CaptureTraceRead,
+
+    /// @brief Ticks spent stripping alpha and filtering. Part of Encode.
+    CaptureTraceFilter,
+
+    /// @brief Ticks spent deflating. Part of Encode. Summed across workers for the parallel encoder.
+    CaptureTraceDeflate,
+
+    /// @brief Ticks spent scaling, filtering and deflating the thumbnail. Part of Encode. Only there when one's written.
+    CaptureTraceThumbnail,
+
+    /// @brief Ticks the row loops spent giving the core up. Part of Encode. Only there when EncodeSliceRows is set.
+    CaptureTraceYield,
+
+    /// @brief The latest the latency probe woke up during Encode. Only there when LatencyProbe is on.
+    CaptureTraceLatency,
+
+    /// @brief Ticks, bytes and calls of every FSFILE_Write in the capture.
+    CaptureTraceWrite,
+
+    /// @brief FSFILE_Finalize and closing the stream.
+    CaptureTraceFinalize,
+
+    /// @brief Making sure the target directory exists and renaming the PNG into place.
+    CaptureTraceRename,
+
+    /// @brief Finding and deleting the system JPEG.
+    CaptureTraceJpeg,
+
+    /// @brief The whole capture.
+    CaptureTraceTotal,
+
+    /// @brief A timelapse shot taken in speed mode because the budget was short. Follows the shot's Total. Ticks is
+    /// the CPU time that was left in the budget.
+    CaptureTraceTimelapseReduced,
+
+    /// @brief A timelapse shot that was skipped for the budget. Carries the number of the capture before it. Ticks is the
+    /// CPU time that was left in the budget.
+    CaptureTraceTimelapseSkipped,
+
+    CaptureTraceStageCount
+};
+
+/// @brief Turns tracing on. Called once at startup, before the capture worker starts.
+/// @param filesystem Filesystem the trace is written to. Must stay open.
+/// @return True if tracing was turned on. False if the trace directory couldn't be created.
+bool capture_trace_start(FsFileSystem *filesystem);
+
+/// @brief Starts tracing a new capture.
+void capture_trace_begin(void);
+
+/// @brief Ends the stage passed. Everything since the last mark or capture_trace_begin goes into its entry.
+/// @param stage One of CaptureTraceStages.
+void capture_trace_mark(int stage);
+
+/// @brief Adds an entry for a stage whose time was measured elsewhere, like the row stages of the encoders.
+/// @param stage One of CaptureTraceStages.
+/// @param ticks Ticks the stage took.
+void capture_trace_record(int stage, uint64_t ticks);
+
+/// @brief Ends the capture and adds the Write and Total entries.
+void capture_trace_end(void);
+
+/// @brief Counts a read. This is one IPC call.
+/// @param bytes Bytes read.
+void capture_trace_count_read(size_t bytes);
+
+/// @brief Counts a write. This is one IPC call.
+/// @param bytes Bytes written.
+/// @param ticks Ticks the write took.
+void capture_trace_count_write(size_t bytes, uint64_t ticks);
+
+/// @brief Counts IPC calls that don't move any data.
+/// @param calls Number of calls.
+void capture_trace_count_ipc(int calls);
+
+/// @brief Appends every entry in the ring to the trace and empties it.
+void capture_trace_flush(void);
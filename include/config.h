@@ -9,4 +9,75 @@ void config_load(void);
 bool config_allow_jpeg(void);
 
 /// @brief Returns the compression level read from config.
-int config_compression_level(void);
\ No newline at end of file
+int config_compression_level(void);
+
+/// @brief Returns the row filter mode. This is one of PngFilterModes.
+int config_row_filter(void);
+
+/// @brief Returns the number of threads used to deflate a capture. 1 uses the serial libpng path.
+int config_encode_workers(void);
+
+/// @brief Returns the preferred encoder. This is one of PngEncoders. libpng is still used for geometry the native encoder
+/// can't handle.
+int config_encoder(void);
+
+/// @brief Returns the encode mode. This is one of PngEncodeModes.
+int config_encode_mode(void);
+
+/// @brief Returns how many milliseconds adaptive mode aims to spend deflating a capture.
+int config_encode_budget(void);
+
+/// @brief Returns whether or not captures are spilled raw and encoded later.
+bool config_raw_first(void);
+
+/// @brief Returns how raw spills are stored. This is one of RawSpillCompression.
+int config_raw_compression(void);
+
+/// @brief Returns what to do with captures identical to a recent one. This is one of FrameDuplicateModes.
+int config_duplicate_captures(void);
+
+/// @brief Returns whether or not every capture is traced to /config/PNGShot/trace.csv.
+bool config_trace_captures(void);
+
+/// @brief Returns whether or not captures with few enough colors are written as grayscale or indexed PNGs.
+bool config_reduce_colors(void);
+
+/// @brief Returns how many rows are read from the capture stream per call.
+int config_read_rows(void);
+
+/// @brief Returns how many seconds without a press it takes before saved PNGs are recompressed. 0 never does.
+int config_optimize_idle(void);
+
+/// @brief Returns how many frames per second are recorded while the capture button is held. 0 never records.
+int config_record_rate(void);
+
+/// @brief Returns the most seconds a single recording can last.
+int config_record_length(void);
+
+/// @brief Returns how many seconds apart timelapse captures are taken. 0 never takes them.
+int config_timelapse_interval(void);
+
+/// @brief Returns how many milliseconds of CPU time timelapse captures can take per minute.
+int config_timelapse_cpu_budget(void);
+
+/// @brief Returns how many kilobytes timelapse captures can write per minute.
+int config_timelapse_write_budget(void);
+
+/// @brief Returns how many times smaller than the capture its thumbnail is. 2 or 4. 0 doesn't write thumbnails.
+int config_thumbnail_scale(void);
+
+/// @brief Returns what deflates captures. Always PngDeflateZlib on the Switch. The host benchmark can pick
+/// PngDeflateLibdeflate.
+int config_deflate_backend(void);
+
+/// @brief Returns the priority the capture worker encodes at. 0x2D to 0x3F. Higher numbers are lower priorities.
+int config_encode_priority(void);
+
+/// @brief Returns the core the encoding threads run on. -1 is the process's default core.
+int config_encode_core(void);
+
+/// @brief Returns how many rows are encoded between giving up the core. 0 never gives it up.
+int config_encode_slice_rows(void);
+
+/// @brief Returns whether or not a probe thread measures how late other threads wake up while captures are encoding.
+bool config_latency_probe(void);
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+#include <stdbool.h>
+#include <switch.h>
+
+// Remembers directories that are known to exist so the ones every capture needs aren't probed over and over. Only the
+// capture worker and startup use it, never at the same time, so there's no locking.
+
+/// @brief Makes sure the directory passed exists, creating it and any parents if needed. A directory that's already in the
+/// cache costs nothing.
+/// @param filesystem Filesystem to use.
+/// @param path Path of the directory. A trailing slash is fine.
+/// @return True if the directory exists. False if it couldn't be created.
+bool directory_cache_ensure(FsFileSystem *filesystem, const char *path);
+
+/// @brief Forgets every directory. Used when something in the cache turns out to be gone.
+void directory_cache_clear(void);
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+// Per-capture bump arena for zlib and libpng. Everything they allocate for a capture comes out of one block that's taken
+// from the heap in one piece when the encode starts and given back in one piece when it ends, so their state can't leave
+// holes in the sysmodule heap and the peak is known up front. Frees inside the arena do nothing. Only the capture thread
+// allocates from it.
+
+/// @brief Heap zlib needs for a deflate stream with the parameters passed, plus room for its state struct. This is the
+/// formula from zconf.h.
+#define ENCODE_ARENA_DEFLATE_SIZE(windowBits, memLevel)                                                                        \
+    (((size_t)1 << ((windowBits) + 2)) + ((size_t)1 << ((memLevel) + 9)) + 0x2000)
+
+/// @brief Sizes of the last arena. Bytes.
+typedef struct
+{
+    /// @brief Size of the block.
+    size_t size;
+
+    /// @brief Most of it that was in use at once.
+    size_t peak;
+
+    /// @brief Allocations that didn't fit and went to the heap instead.
+    size_t overflow;
+} EncodeArenaStats;
+
+/// @brief Takes a block of the size passed from the heap. If that fails, allocations just go to the heap.
+/// @param size Size of the block.
+/// @return True if the block was allocated. False if not.
+bool encode_arena_begin(size_t size);
+
+/// @brief Allocates from the arena, or the heap if it's full or there isn't one.
+/// @param size Number of bytes to allocate.
+/// @return Pointer to the memory. NULL on failure.
+void *encode_arena_alloc(size_t size);
+
+/// @brief Frees memory from encode_arena_alloc. Does nothing for memory in the arena.
+/// @param pointer Pointer to free.
+void encode_arena_free(void *pointer);
+
+/// @brief Gives the block back to the heap. Everything allocated from the arena must be freed before this.
+/// @param statsOut Optional. Receives the sizes of the arena.
+void encode_arena_end(EncodeArenaStats *statsOut);
+
+/// @brief zalloc for z_stream.
+voidpf encode_arena_zalloc(voidpf opaque, uInt items, uInt size);
+
+/// @brief zfree for z_stream.
+void encode_arena_zfree(voidpf opaque, voidpf address);
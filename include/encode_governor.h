@@ -0,0 +1,71 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <switch.h>
+
+// Keeps encoding out of the way of whatever else runs on its core. Captures are encoded on the capture worker at
+// EncodePriority, on EncodeCore, and parallel workers get the other cores the process may use. PNGShot.json only allows
+// core 3 unless PNGShot was built with GAME_CORES=1, so by default nothing here touches the game's cores. The row loops
+// call encode_governor_row after every row, which gives the core up every EncodeSliceRows rows so threads that were kept
+// waiting get to run. With LatencyProbe on, a probe thread on the encode core sleeps a millisecond at a time at
+// EncodePriority, like a thread that can't take the core from the encoder, and measures how late it wakes up. Wakes during
+// an encode and between encodes are kept apart so they can be compared. What an encode does to the game's own threads
+// can't be measured from in here: the probe only ever sees the core it's on.
+
+// clang-format off
+/// @brief How late the probe woke up over some stretch of time.
+typedef struct
+{
+    /// @brief Times the probe woke up.
+    int wakes;
+
+    /// @brief Wakes that came more than a frame at 60 FPS late.
+    int missedFrames;
+
+    /// @brief Ticks late every wake came to, and the latest a single one was.
+    uint64_t lateTicks, maxLateTicks;
+} EncodeLatency;
+
+/// @brief How the last encode shared its core.
+typedef struct
+{
+    /// @brief Times the row loops gave the core up, and ticks they were gone for.
+    int yields;
+    uint64_t yieldTicks;
+
+    /// @brief Probe wakes while the encode ran. All 0 unless LatencyProbe is on.
+    EncodeLatency encoding;
+
+    /// @brief Probe wakes between the encode before and this one, to compare against.
+    EncodeLatency idle;
+} EncodeGovernorStats;
+// clang-format on
+
+/// @brief Starts the probe thread on the encode core. Only call this if LatencyProbe is on.
+/// @return True on success. False on failure.
+bool encode_governor_start_probe(void);
+
+/// @brief Stops the probe thread and waits for it.
+void encode_governor_stop_probe(void);
+
+/// @brief Returns the core threads that encode are created on. -2 is the process's default core, which is also what an
+/// EncodeCore the process isn't allowed on gets.
+int encode_governor_core(void);
+
+/// @brief Returns the core a parallel encode's worker is created on. Workers go round-robin over the cores the process can
+/// use other than the encoder's own, so each gets a core to itself when there are enough of them.
+/// @param worker Index of the worker.
+/// @return The core. -1 if the encoder's core is the only one, where workers would only take turns with the encoder.
+int encode_governor_worker_core(int worker);
+
+/// @brief Starts governing an encode. Only the capture worker encodes, so only it calls this.
+void encode_governor_begin(void);
+
+/// @brief Counts an encoded row, and gives up the core when a slice is done.
+void encode_governor_row(void);
+
+/// @brief Stops governing the encode and takes what the probe saw during it.
+void encode_governor_end(void);
+
+/// @brief Returns how the last encode shared its core.
+const EncodeGovernorStats *encode_governor_get_stats(void);
@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// A much faster, much simpler deflate for filtered rows. Only looks for runs, the same spot in the previous row and one
+// hashed candidate, then writes everything in a single fixed Huffman block. The output is a normal zlib stream.
+typedef struct FastDeflate FastDeflate;
+
+/// @brief Largest row fast_deflate_row accepts.
+#define FAST_DEFLATE_MAX_ROW 0x1000
+
+/// @brief Most output fast_deflate_row or fast_deflate_finish can produce for a row of the size passed.
+#define FAST_DEFLATE_BOUND(size) ((size) * 9 / 8 + 16)
+
+/// @brief Allocates a new stream. The zlib header and block header are written with the first row.
+/// @return FastDeflate on success. NULL on failure.
+FastDeflate *fast_deflate_create(void);
+
+/// @brief Compresses a row.
+/// @param deflater Stream to compress with.
+/// @param row Filtered row, filter type byte included. Can't be larger than FAST_DEFLATE_MAX_ROW.
+/// @param size Size of the row.
+/// @param out Output. Must have room for FAST_DEFLATE_BOUND(size) bytes.
+/// @return Number of bytes written to out.
+size_t fast_deflate_row(FastDeflate *deflater, const uint8_t *row, size_t size, uint8_t *out);
+
+/// @brief Ends the block and writes the Adler-32.
+/// @param deflater Stream to finish.
+/// @param out Output. Must have room for FAST_DEFLATE_BOUND(0) bytes.
+/// @return Number of bytes written to out.
+size_t fast_deflate_finish(FastDeflate *deflater, uint8_t *out);
+
+/// @brief Frees the stream.
+/// @param deflater Stream to free.
+void fast_deflate_destroy(FastDeflate *deflater);
@@ -0,0 +1,64 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fast frame hashing used to spot captures that are identical to a recent one. A handful of rows are sampled before the
+// encode starts. Only when those match a recent capture is the whole frame read and compared, so frames that differ pay for
+// a few extra row reads and nothing else.
+
+/// @brief Bytes the hash consumes at a time. Updates must be a multiple of this.
+#define FRAME_HASH_BLOCK_SIZE 64
+
+/// @brief Number of recent captures a new one is compared against.
+#define FRAME_HASH_HISTORY 4
+
+/// @brief What to do with a capture that's identical to a recent one.
+enum FrameDuplicateModes
+{
+    /// @brief Save it anyway.
+    FrameDuplicateKeep,
+
+    /// @brief Don't save it.
+    FrameDuplicateSkip
+};
+
+/// @brief Running hash. Eight 64-bit accumulators, two per NEON register.
+typedef struct
+{
+    uint64_t lanes[8];
+} FrameHash;
+
+/// @brief What a capture is remembered by.
+typedef struct
+{
+    /// @brief Hash of the sample rows.
+    uint64_t sampleHash;
+
+    /// @brief Hash of the whole frame.
+    uint64_t frameHash;
+} FrameSignature;
+
+/// @brief Starts a new hash.
+/// @param hash Hash to start.
+void frame_hash_init(FrameHash *hash);
+
+/// @brief Adds data to the hash.
+/// @param hash Hash to add to.
+/// @param data Data to add.
+/// @param size Size of the data. Must be a multiple of FRAME_HASH_BLOCK_SIZE.
+void frame_hash_update(FrameHash *hash, const uint8_t *data, size_t size);
+
+/// @brief Folds the accumulators into the final 64-bit hash.
+/// @param hash Hash to finish.
+uint64_t frame_hash_final(const FrameHash *hash);
+
+/// @brief Hashes the sample rows of the open stream and, if they match a recent capture, the whole frame. Only valid for
+/// streams of the fixed geometry. Reads are out of order, so this doesn't work on spills.
+/// @param signatureOut Receives the sample hash.
+/// @return True if the frame is identical to a recent capture. False if it isn't or a read failed.
+bool frame_hash_is_duplicate(FrameSignature *signatureOut);
+
+/// @brief Remembers a saved capture. The oldest one is forgotten once there are FRAME_HASH_HISTORY.
+/// @param signature Signature of the capture.
+void frame_hash_remember(const FrameSignature *signature);
@@ -6,7 +6,38 @@
 /// @param path Path of the directory to check.
 bool directory_exists(FsFileSystem *filesystem, const char *path);
 
+/// @brief Creates the directory passed. Its parent has to exist already.
+/// @param filesystem Filesystem to use.
+/// @param path Path of the directory to create.
+bool create_directory(FsFileSystem *filesystem, const char *path);
+
 /// @brief Creates the directory path passed recursively in the filesystem passed.
 /// @param filesystem Filesystem to use.
 /// @param path Path of the directory to create.
-bool create_directory_recursively(FsFileSystem *filesystem, const char *path);
\ No newline at end of file
+bool create_directory_recursively(FsFileSystem *filesystem, const char *path);
+
+/// @brief Finds the first file in the directory passed with the extension passed.
+/// @param filesystem Filesystem to use.
+/// @param path Path of the directory to search.
+/// @param extension Extension to look for, without the dot.
+/// @param nameOut Buffer to write the name of the file to.
+/// @param nameSize Size of nameOut.
+/// @return True if a file was found. False if not.
+bool directory_find_file(FsFileSystem *filesystem, const char *path, const char *extension, char *nameOut, size_t nameSize);
+
+/// @brief Reads the names in the directory passed, a few entries at a time. They come back in whatever order the
+/// filesystem has them in.
+/// @param filesystem Filesystem to use.
+/// @param path Path of the directory to read.
+/// @param extension Extension of the files to list, without the dot. NULL to list directories instead.
+/// @param after Only names that sort after this one are kept. Empty to keep them all.
+/// @param namesOut Receives the names, one after another and each terminated. NULL if there weren't any. Free it when
+/// done.
+/// @param countOut Receives the number of names.
+/// @return True if the directory was read. False if it couldn't be opened or there wasn't room for the names.
+bool directory_list(FsFileSystem *filesystem,
+                    const char *path,
+                    const char *extension,
+                    const char *after,
+                    char **namesOut,
+                    size_t *countOut);
@@ -7,6 +7,11 @@
 /// @return True on success. False on failure.
 bool init_open_album_directory(FsFileSystem *albumOut);
 
+/// @brief Attempts to open the SD card filesystem.
+/// @param sdmcOut Filesystem to store the handle to.
+/// @return True on success. False on failure.
+bool init_open_sd_card(FsFileSystem *sdmcOut);
+
 /// @brief Attempts to create the PNGShot directory.
 /// @param albumDir Album filesystem.
 /// @return True on success. False on failure.
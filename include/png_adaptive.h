@@ -0,0 +1,68 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Picks the zlib level, strategy and row filter for a capture before it's encoded. A few pairs of rows are read from the
+// stream and filtered every way to see which filter is worth its time, then the filtered bytes are measured for entropy
+// and how much of them repeats the byte before. That sorts the frame into one of PngContentClasses, each of which has a
+// ladder of settings from cheapest to most thorough. The most thorough step that's expected to deflate within the budget
+// is used. How long steps actually take is learned from the captures that used them.
+
+/// @brief Number of zlib strategies, Z_DEFAULT_STRATEGY through Z_FIXED.
+#define PNG_ADAPTIVE_STRATEGIES 5
+
+/// @brief What the sampled rows looked like.
+enum PngContentClasses
+{
+    /// @brief Mostly runs of the same byte once filtered. Menus, flat UI and pixel art.
+    PngContentRuns,
+
+    /// @brief Everything in between. Textured and shaded scenes, gradients.
+    PngContentDetailed,
+
+    /// @brief Close to random once filtered. Film grain, static, noisy video.
+    PngContentNoise,
+
+    PngContentClassCount
+};
+
+// clang-format off
+/// @brief Settings for one encode.
+typedef struct
+{
+    /// @brief zlib compression level.
+    int level;
+
+    /// @brief zlib strategy.
+    int strategy;
+
+    /// @brief One of PngFilterModes.
+    int rowFilter;
+
+    /// @brief One of PngContentClasses. -1 if the settings didn't come from png_adaptive_choose.
+    int contentClass;
+} PngEncodeChoice;
+
+/// @brief How often each setting was used by adaptive captures since boot.
+typedef struct
+{
+    uint32_t levels[10];
+    uint32_t strategies[PNG_ADAPTIVE_STRATEGIES];
+    uint32_t rowFilters[6];
+    uint32_t contentClasses[PngContentClassCount];
+} PngAdaptiveUsage;
+// clang-format on
+
+/// @brief Samples the capture stream and picks the settings for it. The stream must be open and of the fixed geometry.
+/// @param budgetTicks Ticks deflating is allowed to take.
+/// @param choiceOut Receives the settings. Left alone on failure.
+/// @return True on success. False if the rows couldn't be read.
+bool png_adaptive_choose(uint64_t budgetTicks, PngEncodeChoice *choiceOut);
+
+/// @brief Learns how long the settings passed took and counts them as used.
+/// @param choice Settings png_adaptive_choose picked.
+/// @param deflateTicks Ticks deflating took. For several workers, this is how long it took them together, not the sum.
+void png_adaptive_learn(const PngEncodeChoice *choice, uint64_t deflateTicks);
+
+/// @brief Returns how often each setting has been used.
+const PngAdaptiveUsage *png_adaptive_get_usage(void);
@@ -1,6 +1,160 @@
 #pragma once
+#include "png_adaptive.h"
+#include "png_palette.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <switch.h>
 
+/// @brief Encoders png_capture can use.
+enum PngEncoders
+{
+    /// @brief Writes the chunks itself. Only handles CAPTURE_WIDTH x CAPTURE_HEIGHT.
+    PngEncoderNative,
+
+    /// @brief Goes through libpng. Handles any geometry the stream reports.
+    PngEncoderLibpng
+};
+
+/// @brief How hard the native encoder works.
+enum PngEncodeModes
+{
+    /// @brief zlib at CompressionLevel.
+    PngEncodeNormal,
+
+    /// @brief fast_deflate. Much faster, somewhat larger.
+    PngEncodeSpeed,
+
+    /// @brief zlib with the level, strategy and row filter png_adaptive picks for each capture.
+    PngEncodeAdaptive
+};
+
+/// @brief What deflates a capture.
+enum PngDeflateBackends
+{
+    /// @brief zlib, streamed a row at a time. This is whatever zlib ZLIB= linked, and nothing picks or tells them apart at
+    /// runtime: a zlib-ng build is reported as this too. The benchmark prints zlibVersion() to say which it was.
+    PngDeflateZlib,
+
+    /// @brief libdeflate, on the whole filtered frame in one go. It needs every row in the heap at once, so only the host
+    /// benchmark built with LIBDEFLATE=1 uses it.
+    PngDeflateLibdeflate,
+
+    /// @brief fast_deflate. Speed mode always uses it.
+    PngDeflateFast
+};
+
+/// @brief Timing of the last capture. Ticks are from armGetSystemTick.
+typedef struct
+{
+    /// @brief Ticks from opening the stream to the PNG being moved into place.
+    uint64_t totalTicks;
+
+    /// @brief Ticks from taking the encoder's memory to the first row being requested. This is the encoder's setup, header
+    /// included.
+    uint64_t setupTicks;
+
+    /// @brief Ticks from the first row being requested to the last row being encoded.
+    uint64_t rowTicks;
+
+    /// @brief Ticks the reader thread spent reading rows from the stream.
+    uint64_t readTicks;
+
+    /// @brief Ticks spent stripping alpha and filtering rows.
+    uint64_t filterTicks;
+
+    /// @brief Ticks spent deflating. Summed across workers for the parallel encoder.
+    uint64_t deflateTicks;
+
+    /// @brief Ticks spent scaling, filtering and deflating the thumbnail. 0 unless one was written.
+    uint64_t thumbnailTicks;
+
+    /// @brief Ticks the encoder spent waiting on the reader.
+    uint64_t stallTicks;
+
+    /// @brief Rows the encoder read from the stream per call, and how many calls it took.
+    int readRows, readCalls;
+
+    /// @brief Ticks spent checking whether the capture was a duplicate before encoding it.
+    uint64_t duplicateTicks;
+
+    /// @brief Ticks spent counting the colors of the capture before encoding it.
+    uint64_t colorTicks;
+
+    /// @brief Size of the encode arena zlib and libpng allocated from. Bytes.
+    size_t arenaSize;
+
+    /// @brief Most of the arena in use at once. Bytes.
+    size_t arenaPeak;
+
+    /// @brief Bytes zlib and libpng had to take from the heap because the arena was full.
+    size_t arenaOverflow;
+
+    /// @brief Size the PNG was created with before it was written. Bytes.
+    int64_t preallocatedSize;
+
+    /// @brief Size of the PNG. Bytes. 0 unless it was saved.
+    int64_t size;
+
+    /// @brief Size of the thumbnail. Bytes. 0 unless one was saved with the PNG.
+    int64_t thumbnailSize;
+
+    /// @brief zlib settings and row filter the native encoder used. contentClass is -1 unless png_adaptive picked them.
+    /// Level is -1 if nothing was encoded.
+    PngEncodeChoice settings;
+
+    /// @brief PNG color type the capture was written as. One of PngColorTypes. -1 if nothing was encoded.
+    int colorType;
+
+    /// @brief Number of colors in the PLTE. 0 unless colorType is PngColorIndexed.
+    int paletteColors;
+
+    /// @brief Whether the capture was skipped because it was identical to a recent one.
+    bool duplicate;
+
+    /// @brief Whether the serial encoder reused the zlib stream kept from an earlier capture.
+    bool warm;
+
+    /// @brief Encoder that wrote the capture. This is one of PngEncoders.
+    int encoder;
+
+    /// @brief What deflated the capture. This is one of PngDeflateBackends. -1 if nothing was encoded.
+    int backend;
+} PngCaptureStats;
+
 /// @brief Captures the current screenshot stream and exports it to a PNG.
 /// @param albumDir Filesystem pointing to the album directory.
-void png_capture(FsFileSystem *albumDir);
+/// @param temporaryPath Path the PNG is written to before it's moved into place. Captures running back to back need
+/// different paths.
+void png_capture(FsFileSystem *albumDir, const char *temporaryPath);
+
+/// @brief Captures like png_capture, for captures nobody pressed the button for. The system didn't save a JPEG for
+/// these, so none is deleted.
+/// @param albumDir Filesystem pointing to the album directory.
+/// @param temporaryPath Path the PNG is written to before it's moved into place.
+/// @param speed Whether to encode in speed mode whatever EncodeMode is. Only the native encoder has one.
+/// @return True if the PNG was saved. False on failure or if it was skipped as a duplicate.
+bool png_capture_unattended(FsFileSystem *albumDir, const char *temporaryPath, bool speed);
+
+/// @brief Encodes a raw spill and exports it to a PNG. The spill is deleted once the PNG is in place.
+/// @param albumDir Filesystem pointing to the album directory.
+/// @param spillPath Path of the spill.
+/// @param temporaryPath Path the PNG is written to before it's moved into place.
+/// @return True if the PNG was saved. False if it wasn't, in which case the spill is left alone.
+bool png_capture_spill(FsFileSystem *albumDir, const char *spillPath, const char *temporaryPath);
+
+/// @brief Moves a finished PNG into the folder for the day of the timestamp passed and names it after the timestamp.
+/// @param albumDir Filesystem pointing to the album directory.
+/// @param temporaryPath Path the PNG was written to.
+/// @param timestamp Timestamp to file the PNG under.
+/// @param pathOut Optional. FS_MAX_PATH buffer that receives the path the PNG was moved to.
+/// @return True on success. False on failure, in which case the PNG is left where it is.
+bool png_capture_move_into_place(FsFileSystem *albumDir, const char *temporaryPath, uint64_t timestamp, char *pathOut);
+
+/// @brief Sets up the serial encoder's zlib stream ahead of the next capture, if the config has captures use it. It's kept
+/// between captures until something else needs the heap. Only call this from the capture worker, or before it starts.
+void png_capture_warm_up(void);
+
+/// @brief Returns the timing of the last capture.
+const PngCaptureStats *png_capture_get_stats(void);
@@ -0,0 +1,63 @@
+#pragma once
+#include "FSFILE.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes PNG chunks straight to an FSFILE. This is what lets the fixed geometry encoder skip libpng entirely.
+
+/// @brief Bytes in front of chunk data. Length and type.
+#define PNG_CHUNK_HEADER_SIZE 8
+
+/// @brief Bytes behind chunk data. The CRC.
+#define PNG_CHUNK_CRC_SIZE 4
+
+/// @brief Writes the PNG signature and the IHDR for a CAPTURE_WIDTH x CAPTURE_HEIGHT RGB8 image. Both are precomputed.
+/// @param file File to write to.
+/// @return True on success. False on failure.
+bool png_chunk_write_header(FSFILE *file);
+
+/// @brief Writes the PNG signature and the IHDR for a CAPTURE_WIDTH x CAPTURE_HEIGHT 8 bit image of the color type passed.
+/// The IHDR is built as it's written, so this works for gray and indexed images too.
+/// @param file File to write to.
+/// @param colorType PNG color type to put in IHDR.
+/// @return True on success. False on failure.
+bool png_chunk_write_header_color(FSFILE *file, int colorType);
+
+/// @brief Writes the PNG signature and the IHDR for an 8 bit image of any size, like a thumbnail.
+/// @param file File to write to.
+/// @param width Width of the image.
+/// @param height Height of the image.
+/// @param colorType PNG color type to put in IHDR.
+/// @return True on success. False on failure.
+bool png_chunk_write_header_image(FSFILE *file, uint32_t width, uint32_t height, int colorType);
+
+/// @brief Writes IEND.
+/// @param file File to write to.
+/// @return True on success. False on failure.
+bool png_chunk_write_end(FSFILE *file);
+
+/// @brief Writes a chunk whose data already has room for the header in front and the CRC behind it. The header and CRC are
+/// filled in place so the whole chunk goes out in one write.
+/// @param file File to write to.
+/// @param type Four character chunk type.
+/// @param data Chunk data. PNG_CHUNK_HEADER_SIZE bytes before it and PNG_CHUNK_CRC_SIZE bytes after it must be writable.
+/// @param size Size of the chunk data.
+/// @return True on success. False on failure.
+bool png_chunk_write_framed(FSFILE *file, const char *type, uint8_t *data, size_t size);
+
+/// @brief Writes a chunk from data that has no room around it.
+/// @param file File to write to.
+/// @param type Four character chunk type.
+/// @param data Chunk data. Can be NULL if size is 0.
+/// @param size Size of the chunk data.
+/// @return True on success. False on failure.
+bool png_chunk_write(FSFILE *file, const char *type, const void *data, size_t size);
+
+/// @brief Updates a running CRC-32 with the data passed. Same semantics as zlib's crc32. Uses the ARMv8 CRC instructions
+/// when they're available.
+/// @param crc Running CRC. 0 to start.
+/// @param data Data to add.
+/// @param size Size of the data.
+uint32_t png_chunk_crc(uint32_t crc, const uint8_t *data, size_t size);
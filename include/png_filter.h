@@ -0,0 +1,61 @@
+#pragma once
+#include "capture.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/// @brief Size of a filtered RGB row. The first byte is the filter type.
+#define PNG_FILTER_ROW_SIZE (CAPTURE_WIDTH * 3 + 1)
+
+/// @brief Row filter selection. The fixed modes match the PNG filter type bytes.
+enum PngFilterModes
+{
+    PngFilterNone,
+    PngFilterSub,
+    PngFilterUp,
+    PngFilterAverage,
+    PngFilterPaeth,
+    PngFilterAdaptive
+};
+
+/// @brief Filters the RGB row passed. Adaptive tries every filter and keeps the one with the lowest sum of absolute
+/// differences, which is the same heuristic libpng uses by default.
+/// @param row Unfiltered RGB row.
+/// @param previous Unfiltered RGB row above it. NULL for the first row.
+/// @param out Buffer of PNG_FILTER_ROW_SIZE bytes to write the filter type and filtered row to.
+/// @param mode Filter mode to use.
+void png_filter_row(const uint8_t *row, const uint8_t *previous, uint8_t *out, int mode);
+
+/// @brief Strips the alpha from the RGBA row passed and filters it in the same pass.
+/// @param rgba RGBA row straight from the capture stream.
+/// @param rgbOut Buffer of CAPTURE_WIDTH * 3 bytes that receives the unfiltered RGB row. This is what gets passed as
+/// previous for the next row.
+/// @param previous Unfiltered RGB row above it. NULL for the first row.
+/// @param out Buffer of PNG_FILTER_ROW_SIZE bytes to write the filter type and filtered row to.
+/// @param mode Filter mode to use.
+void png_filter_rgba_row(const uint8_t *rgba, uint8_t *rgbOut, const uint8_t *previous, uint8_t *out, int mode);
+
+/// @brief Filters a row of CAPTURE_WIDTH one byte pixels, gray or palette indices. Adaptive works the same as for RGB rows.
+/// @param row Unfiltered row.
+/// @param previous Unfiltered row above it. NULL for the first row.
+/// @param out Buffer of CAPTURE_WIDTH + 1 bytes to write the filter type and filtered row to.
+/// @param mode Filter mode to use.
+void png_filter_gray_row(const uint8_t *row, const uint8_t *previous, uint8_t *out, int mode);
+
+/// @brief Filters an RGB row narrower than the capture, like a part of one. This is a plain loop, so png_filter_row is the
+/// one to use for whole rows.
+/// @param row Unfiltered RGB row.
+/// @param previous Unfiltered RGB row above it. NULL for the first row.
+/// @param out Buffer of width * 3 + 1 bytes to write the filter type and filtered row to.
+/// @param width Width of the row in pixels. At most CAPTURE_WIDTH.
+/// @param mode Filter mode to use.
+void png_filter_rgb_span(const uint8_t *row, const uint8_t *previous, uint8_t *out, int width, int mode);
+
+/// @brief Undoes the filter on a row read back from a PNG.
+/// @param filtered Filter type byte followed by the filtered row.
+/// @param previous Unfiltered row above it. NULL for the first row.
+/// @param out Buffer of size bytes to write the unfiltered row to.
+/// @param size Size of the unfiltered row. At most CAPTURE_WIDTH * 3.
+/// @param bytesPerPixel Bytes per pixel of the row.
+/// @return True on success. False if the filter type isn't one of the five PNG has.
+bool png_unfilter_row(const uint8_t *filtered, const uint8_t *previous, uint8_t *out, int size, int bytesPerPixel);
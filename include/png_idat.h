@@ -0,0 +1,97 @@
+#pragma once
+#include "FSFILE.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Streams rows that are already filtered through zlib (or fast_deflate) and writes the output as IDAT chunks, or as the fdAT
+// chunks of an animated PNG frame.
+typedef struct IdatWriter IdatWriter;
+
+/// @brief Size of the output buffer of a writer from idat_writer_open. This is the same as libpng's default zbuf, so chunks
+/// come out the same size.
+#define IDAT_BUFFER_SIZE 0x2000
+
+/// @brief Returns how much of the encode arena a writer needs.
+/// @param speed Whether or not the writer will be in speed mode.
+size_t idat_writer_arena_size(bool speed);
+
+/// @brief Starts a new zlib stream. The PNG header must already be written.
+/// @param file File the chunks are written to.
+/// @param level zlib compression level. Ignored in speed mode.
+/// @param strategy zlib strategy. Ignored in speed mode.
+/// @param speed Whether or not to use fast_deflate instead of zlib.
+/// @return IdatWriter on success. NULL on failure. zlib's state comes out of the encode arena if there is one.
+IdatWriter *idat_writer_open(FSFILE *file, int level, int strategy, bool speed);
+
+/// @brief Starts a new zlib stream for a frame of an animated PNG. Chunks are numbered from *sequence and it's moved past
+/// each one, so the frame control chunks in between can take the next number.
+/// @param file File the chunks are written to.
+/// @param level zlib compression level. Ignored in speed mode.
+/// @param strategy zlib strategy. Ignored in speed mode.
+/// @param speed Whether or not to use fast_deflate instead of zlib.
+/// @param sequence Sequence number of the first chunk. NULL writes IDAT, which is what the first frame uses.
+/// @return IdatWriter on success. NULL on failure.
+IdatWriter *idat_writer_open_frame(FSFILE *file, int level, int strategy, bool speed, uint32_t *sequence);
+
+/// @brief Starts a new zlib stream with the window, memory and output buffer passed instead of libpng's. This is for writers
+/// that share the heap with something else. ENCODE_ARENA_DEFLATE_SIZE gives the arena it needs.
+/// @param file File the chunks are written to.
+/// @param level zlib compression level.
+/// @param strategy zlib strategy.
+/// @param windowBits zlib window bits. 9 to 15.
+/// @param memLevel zlib memory level. 1 to 9.
+/// @param bufferSize Size of the output buffer. This is the most data a chunk holds.
+/// @return IdatWriter on success. NULL on failure.
+IdatWriter *idat_writer_open_sized(FSFILE *file, int level, int strategy, int windowBits, int memLevel, size_t bufferSize);
+
+/// @brief Sets up a zlib stream with idat_writer_open's window and memory and keeps it between captures, so opening a writer
+/// is a deflateReset instead of taking and setting up the whole state again. It holds ENCODE_ARENA_DEFLATE_SIZE(15, 8) and
+/// the writer's buffer until idat_writer_warm_release. Only the capture worker uses it.
+/// @return True if the stream is warm. False if there wasn't room for it.
+bool idat_writer_warm_up(void);
+
+/// @brief Frees the warm stream so its heap can be used for something else. Does nothing if it isn't warm or is in use.
+void idat_writer_warm_release(void);
+
+/// @brief Returns how much of the heap the warm stream holds. 0 if it isn't warm.
+size_t idat_writer_warm_size(void);
+
+/// @brief Like idat_writer_open without speed mode, but hands out the warm stream reset for a new image. Closing or
+/// aborting it gives it back instead of freeing it.
+/// @param file File the chunks are written to.
+/// @param level zlib compression level. This can differ from the last image's.
+/// @param strategy zlib strategy. This can differ from the last image's.
+/// @return IdatWriter on success. NULL if the stream isn't warm or is already in use.
+IdatWriter *idat_writer_open_warm(FSFILE *file, int level, int strategy);
+
+/// @brief Starts a writer that gathers every row and deflates them in one go with libdeflate when it's closed. The rows,
+/// the output and libdeflate's compressor are all taken from the heap up front, so this is how to find out whether there's
+/// room for them. That's never the case in the sysmodule, so only the host benchmark is built with libdeflate.
+/// @param file File the chunks are written to.
+/// @param level Compression level. libdeflate's levels are roughly zlib's.
+/// @param size Size of every filtered row together. Writing more than this fails.
+/// @return IdatWriter on success. NULL if there isn't room, or if PNGShot was built without libdeflate.
+IdatWriter *idat_writer_open_oneshot(FSFILE *file, int level, size_t size);
+
+/// @brief Compresses the filtered row passed.
+/// @param writer Writer to write to.
+/// @param row Filtered row, filter type byte included.
+/// @param size Size of the row.
+/// @return True on success. False on failure.
+bool idat_writer_write_row(IdatWriter *writer, const uint8_t *row, size_t size);
+
+/// @brief Finishes the zlib stream, writes the last IDAT and IEND and frees the writer.
+/// @param writer Writer to close.
+/// @return True on success. False on failure.
+bool idat_writer_close(IdatWriter *writer);
+
+/// @brief Finishes the zlib stream, writes the last chunk and frees the writer. Nothing comes after it, so more frames can.
+/// @param writer Writer to finish.
+/// @return True on success. False on failure.
+bool idat_writer_finish(IdatWriter *writer);
+
+/// @brief Frees the writer without finishing the image. Used on failure. The warm stream is only given back.
+/// @param writer Writer to free.
+void idat_writer_abort(IdatWriter *writer);
@@ -0,0 +1,80 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <switch.h>
+
+// Recompresses PNGs that were already saved while nothing else is going on. Captures are written at whatever level keeps
+// them quick, so most have room to shrink. Each file is read back and run through every row filter with zlib's default
+// strategy at level 9, then the best filter with the other strategies that can help, and the smallest result replaces the
+// file if it's smaller. Only PNGs of the fixed geometry with nothing but IHDR, PLTE, IDAT and IEND are touched, which is
+// everything PNGShot writes itself. Anything else is left alone.
+//
+// Files are gone through in name order, which is capture order, and a marker of the last one done is kept in
+// PNG_OPTIMIZE_DIRECTORY so nothing is done twice. There's no way to replace a file in one step, so the new file is moved
+// next to the marker before the old one is deleted. If that's interrupted, png_optimize_start finishes it.
+
+/// @brief Directory the progress marker and the file being written are kept in.
+#define PNG_OPTIMIZE_DIRECTORY "/PNGs/Optimize"
+
+/// @brief What png_optimize_next did.
+enum PngOptimizeResults
+{
+    /// @brief Every file up to now has been done.
+    PngOptimizeDone,
+
+    /// @brief The file was replaced by a smaller one.
+    PngOptimizeReplaced,
+
+    /// @brief Nothing came out smaller, so the file was kept.
+    PngOptimizeKept,
+
+    /// @brief The file isn't one that can be optimized.
+    PngOptimizeSkipped,
+
+    /// @brief png_optimize_set_cancelled was called. The file is tried again next time.
+    PngOptimizeCancelled,
+
+    /// @brief Something went wrong reading or writing. The file is counted as done anyway so it isn't retried forever.
+    PngOptimizeFailed
+};
+
+// clang-format off
+/// @brief What happened to the last file.
+typedef struct
+{
+    /// @brief Path of the file.
+    char path[FS_MAX_PATH];
+
+    /// @brief Size of the file before and after. The same if it was kept.
+    int64_t oldSize, newSize;
+
+    /// @brief Row filter and zlib strategy that came out smallest. -1 if nothing beat the file.
+    int rowFilter, strategy;
+
+    /// @brief Number of times the image was read back and deflated, trials and the final write together.
+    int passes;
+
+    /// @brief Ticks the whole file took.
+    uint64_t ticks;
+} PngOptimizeStats;
+// clang-format on
+
+/// @brief Loads the progress marker and finishes a replace that was interrupted. A new marker starts a week back.
+/// @param albumDir Album filesystem.
+/// @return True on success. False if the marker couldn't be read or created.
+bool png_optimize_start(FsFileSystem *albumDir);
+
+/// @brief Optimizes the next file after the marker and moves the marker past it. This can take seconds, so it should run at
+/// a low priority and be cancelled when something more important comes along.
+/// @param albumDir Album filesystem.
+/// @param statsOut Optional. Receives what happened to the file.
+/// @return One of PngOptimizeResults.
+int png_optimize_next(FsFileSystem *albumDir, PngOptimizeStats *statsOut);
+
+/// @brief Makes png_optimize_next give up on the file it's on as soon as it can, or lets it run again.
+/// @param cancelled Whether or not to give up.
+void png_optimize_set_cancelled(bool cancelled);
+
+/// @brief Frees the listing of the day png_optimize_next is going through. It's kept between files so the day is only read
+/// once, and should be let go of before anything else needs the heap.
+void png_optimize_release(void);
@@ -0,0 +1,78 @@
+#pragma once
+#include "FSFILE.h"
+#include "capture.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Color analysis for captures that don't need RGB. Every pixel of the frame is read once up front. If they're all gray,
+// the PNG is written as 8 bit grayscale. If there are 256 colors or fewer, it's written as 8 bit indexed with a PLTE.
+// Either way there's one byte per pixel to filter and deflate instead of three. Eight rows spread over the frame are
+// checked first, so most frames that don't fit are given up on after only a few reads. Frames that fit are read a second
+// time to be written, since a whole frame of indices wouldn't fit in the heap. If the stream changes in between, an RGB
+// capture would tear there too, so colors the analysis didn't see get the closest one it did instead of the frame being
+// read a third time. Gray frames take red, the same as they always do.
+
+/// @brief Most colors a palette can have.
+#define PNG_PALETTE_MAX_COLORS 256
+
+/// @brief Size of a filtered row of one byte pixels. The first byte is the filter type.
+#define PNG_PALETTE_ROW_SIZE (CAPTURE_WIDTH + 1)
+
+/// @brief PNG color types the analysis can end with. The values are the ones written to IHDR.
+enum PngColorTypes
+{
+    PngColorGray    = 0,
+    PngColorRGB     = 2,
+    PngColorIndexed = 3
+};
+
+/// @brief Number of slots in the color hash. Twice the most colors so probes stay short.
+#define PNG_PALETTE_SLOTS (PNG_PALETTE_MAX_COLORS * 2)
+
+// clang-format off
+typedef struct
+{
+    /// @brief One of PngColorTypes.
+    int colorType;
+
+    /// @brief Number of colors in the palette.
+    int colorCount;
+
+    /// @brief Palette as PLTE wants it. RGB, one entry per index.
+    uint8_t colors[PNG_PALETTE_MAX_COLORS * 3];
+
+    /// @brief Color hash. Each occupied slot holds the RGB with the top byte set, so 0 is empty.
+    uint32_t slots[PNG_PALETTE_SLOTS];
+
+    /// @brief Palette index of the color in the same slot.
+    uint8_t indices[PNG_PALETTE_SLOTS];
+} PngPalette;
+// clang-format on
+
+/// @brief Reads the whole frame from the capture stream and decides how it can be written. The stream must be open, of the
+/// fixed geometry, and readable out of order.
+/// @param palette Palette to fill.
+/// @return True if the frame was read. colorType says what it can be written as. False on a read failure.
+bool png_palette_analyze(PngPalette *palette);
+
+/// @brief Writes the PNG signature, IHDR for the color type of the palette and PLTE if it's indexed.
+/// @param file File to write to.
+/// @param palette Analyzed palette. Must be gray or indexed.
+/// @return True on success. False on failure.
+bool png_palette_write_header(FSFILE *file, const PngPalette *palette);
+
+/// @brief Converts the RGBA row passed to gray or palette indices and filters it.
+/// @param palette Analyzed palette. Must be gray or indexed.
+/// @param rgba RGBA row straight from the capture stream.
+/// @param rowOut Buffer of CAPTURE_WIDTH bytes that receives the unfiltered row. This is what gets passed as previous for
+/// the next row.
+/// @param previous Unfiltered row above it. NULL for the first row.
+/// @param out Buffer of PNG_PALETTE_ROW_SIZE bytes to write the filter type and filtered row to.
+/// @param mode One of PngFilterModes. Indexed rows are never filtered, filters don't help palette indices.
+void png_palette_filter_rgba_row(const PngPalette *palette,
+                                 const uint8_t *rgba,
+                                 uint8_t *rowOut,
+                                 const uint8_t *previous,
+                                 uint8_t *out,
+                                 int mode);
@@ -0,0 +1,62 @@
+#pragma once
+#include "FSFILE.h"
+#include "frame_hash.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Strip-parallel encoder. Rows are read and filtered on the calling thread, split into strips and every strip is deflated
+// on its own worker pigz-style: raw deflate ended with a sync flush, primed with the tail of the strip before it. The
+// strips are stitched back together in order into one zlib stream with a combined Adler-32 so the result is an ordinary
+// PNG.
+
+/// @brief Most workers the encoder will run.
+#define PNG_PARALLEL_MAX_WORKERS 4
+
+/// @brief Timing for a parallel encode. Ticks are from armGetSystemTick.
+typedef struct
+{
+    /// @brief Ticks the calling thread spent reading rows.
+    uint64_t readTicks;
+
+    /// @brief Ticks the calling thread spent stripping alpha and filtering.
+    uint64_t filterTicks;
+
+    /// @brief Ticks the workers spent deflating, summed.
+    uint64_t deflateTicks;
+
+    /// @brief Ticks the calling thread spent waiting on workers.
+    uint64_t stallTicks;
+
+    /// @brief Number of reads it took. One IPC round trip each.
+    int readCalls;
+} PngParallelStats;
+
+/// @brief Returns how many workers actually run for the worker count passed.
+/// @param workerCount Number of workers. Clamped the same way png_parallel_write_image clamps it.
+int png_parallel_worker_count(int workerCount);
+
+/// @brief Returns how much of the encode arena the workers' zlib streams need.
+/// @param workerCount Number of workers. Clamped the same way png_parallel_write_image clamps it.
+size_t png_parallel_arena_size(int workerCount);
+
+/// @brief Reads every row from the capture stream and writes the image data as IDAT chunks followed by IEND. The header
+/// must already be written.
+/// @param file File the chunks are written to.
+/// @param workerCount Number of workers. Clamped to 2 - PNG_PARALLEL_MAX_WORKERS, and down to as many as the heap budget
+/// has room for.
+/// @param level zlib compression level.
+/// @param strategy zlib strategy.
+/// @param rowFilter Row filter mode. One of PngFilterModes.
+/// @param readRows Rows to read from the stream per call.
+/// @param hash Optional. Every row is added to this as it's read.
+/// @param statsOut Optional. Receives the timing of the encode.
+/// @return True on success. False on failure.
+bool png_parallel_write_image(FSFILE *file,
+                              int workerCount,
+                              int level,
+                              int strategy,
+                              int rowFilter,
+                              int readRows,
+                              FrameHash *hash,
+                              PngParallelStats *statsOut);
@@ -0,0 +1,54 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <switch.h>
+
+// Records an animated PNG for as long as the capture button is held. Frames are taken from the capture stream at RecordRate
+// and only the part of each one that changed since the last is written, as an APNG frame over the one before it. A whole
+// frame is far larger than INNER_HEAP_SIZE, so the last one can't be kept around to compare against. Every row and every
+// 16 pixel wide column of it is hashed instead. The rows and columns whose hashes changed give the box that's written, and
+// only those rows are read again to write it. Players that don't know APNG just show the first frame.
+
+/// @brief Width of the columns frames are compared in. One FRAME_HASH_BLOCK_SIZE of RGBA.
+#define PNG_RECORD_COLUMN_WIDTH 16
+
+// clang-format off
+/// @brief How the last recording went. Ticks are from armGetSystemTick.
+typedef struct
+{
+    /// @brief Frames taken from the stream, and how many of them were written. Frames that didn't change aren't.
+    int frames, written;
+
+    /// @brief Frames that were taken later than RecordRate asked for because the one before took too long.
+    int late;
+
+    /// @brief Pixels written across every frame, the whole first frame included.
+    uint64_t pixels;
+
+    /// @brief Ticks spent reading and hashing frames to find what changed.
+    uint64_t hashTicks;
+
+    /// @brief Ticks spent reading, filtering and deflating the parts that changed.
+    uint64_t encodeTicks;
+
+    /// @brief Ticks from the first frame to the PNG being moved into place.
+    uint64_t totalTicks;
+
+    /// @brief Size of the PNG. Bytes.
+    int64_t size;
+} PngRecordStats;
+// clang-format on
+
+/// @brief Records until png_record_set_stopped is called or RecordLength runs out and moves the PNG into place. There's
+/// always at least one frame.
+/// @param albumDir Filesystem pointing to the album directory.
+/// @param temporaryPath Path the PNG is written to before it's moved into place.
+/// @return True if the PNG was saved. False on failure.
+bool png_record(FsFileSystem *albumDir, const char *temporaryPath);
+
+/// @brief Makes png_record stop after the frame it's on, or lets the next recording run.
+/// @param stopped Whether or not to stop.
+void png_record_set_stopped(bool stopped);
+
+/// @brief Returns how the last recording went.
+const PngRecordStats *png_record_get_stats(void);
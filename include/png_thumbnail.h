@@ -0,0 +1,48 @@
+#pragma once
+#include "FSFILE.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <switch.h>
+
+// Writes a scaled down copy of a capture as a second, small PNG while the capture itself is encoded. It's fed the same RGBA
+// rows the capture is encoded from, so the stream is still only read once. Every scale x scale block of pixels is averaged
+// into one. Only the sums for the row of blocks in progress are kept, and each finished row is filtered and deflated
+// straight into the thumbnail's own file by a zlib stream with a small window.
+
+/// @brief zlib window bits of the thumbnail's stream. A half scale row is 1921 bytes, so this still reaches the row above.
+#define PNG_THUMBNAIL_WINDOW_BITS 12
+
+/// @brief zlib memory level of the thumbnail's stream.
+#define PNG_THUMBNAIL_MEM_LEVEL 4
+
+typedef struct PngThumbnail PngThumbnail;
+
+/// @brief Returns how much of the encode arena a thumbnail needs. Its row buffers come from the heap.
+size_t png_thumbnail_arena_size(void);
+
+/// @brief Creates the thumbnail's file and writes its header. zlib's state comes out of the encode arena if there is one.
+/// @param filesystem Filesystem to create the file on.
+/// @param path Path of the file.
+/// @param scale 2 or 4. The thumbnail is CAPTURE_WIDTH / scale x CAPTURE_HEIGHT / scale.
+/// @param level zlib compression level.
+/// @param rowFilter One of PngFilterModes.
+/// @return PngThumbnail on success. NULL on failure, in which case the file may still need deleting.
+PngThumbnail *png_thumbnail_open(FsFileSystem *filesystem, const char *path, int scale, int level, int rowFilter);
+
+/// @brief Adds the next row of the capture. A row of the thumbnail is written every scale rows.
+/// @param thumbnail Thumbnail to add to.
+/// @param rgba CAPTURE_WIDTH RGBA pixels.
+/// @return True on success. False on failure.
+bool png_thumbnail_add_row(PngThumbnail *thumbnail, const uint8_t *rgba);
+
+/// @brief Finishes the thumbnail, closes the file and frees the thumbnail. Every row of the capture must have been added.
+/// @param thumbnail Thumbnail to close.
+/// @param sizeOut Optional. Receives the size of the file.
+/// @return True if the thumbnail was written. The file is left where it is either way.
+bool png_thumbnail_close(PngThumbnail *thumbnail, int64_t *sizeOut);
+
+/// @brief Closes the file and frees the thumbnail without finishing it. Used on failure.
+/// @param thumbnail Thumbnail to abort. Can be NULL.
+void png_thumbnail_abort(PngThumbnail *thumbnail);
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <switch.h>
+
+// Takes a capture every TimelapseInterval seconds without the button being pressed. Timelapses run for whole sessions, so
+// each shot is held to a budget of CPU time and bytes written per minute. Both are buckets that fill back up over a
+// minute and each shot is paid for out of them. When the shot isn't expected to fit, it's taken in speed mode instead, and
+// when that won't fit either, it's skipped unless the buckets are full. What a shot is expected to cost is a running
+// average of the last few at the same effort. A shot that costs more than was left overdraws the bucket, and the shots
+// after it pay that back.
+
+/// @brief What png_timelapse_capture did.
+enum PngTimelapseResults
+{
+    /// @brief The shot was taken at the configured effort.
+    PngTimelapseFull,
+
+    /// @brief The budget was short, so the shot was taken in speed mode.
+    PngTimelapseReduced,
+
+    /// @brief Not even speed mode fit in the budget, so the shot wasn't taken.
+    PngTimelapseSkipped
+};
+
+// clang-format off
+/// @brief How timelapse captures have gone since boot.
+typedef struct
+{
+    /// @brief Shots that came due, and what was done about them. The last three add up to the first.
+    int due, full, reduced, skipped;
+
+    /// @brief Shots that were saved. Shots identical to a recent capture aren't when DuplicateCaptures is Skip.
+    int saved;
+
+    /// @brief CPU ticks and bytes every shot taken came to.
+    uint64_t cpuTicks;
+    int64_t bytes;
+
+    /// @brief What was left of each budget after the last shot. Negative when it's overdrawn.
+    int64_t cpuLeft, bytesLeft;
+} PngTimelapseStats;
+// clang-format on
+
+/// @brief Takes a timelapse shot, or doesn't, depending on what's left of the budget.
+/// @param albumDir Filesystem pointing to the album directory.
+/// @param temporaryPath Path the PNG is written to before it's moved into place.
+/// @return One of PngTimelapseResults.
+int png_timelapse_capture(FsFileSystem *albumDir, const char *temporaryPath);
+
+/// @brief Returns how timelapse captures have gone since boot.
+const PngTimelapseStats *png_timelapse_get_stats(void);
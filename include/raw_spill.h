@@ -0,0 +1,62 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <switch.h>
+
+// Raw-first captures. The stream is drained into a spill file as fast as the filesystem allows and closed, then the spill
+// is encoded later. Spills live on the album filesystem so they survive a reboot.
+
+/// @brief Directory pending spills are kept in.
+#define RAW_SPILL_DIRECTORY "/PNGs/Pending"
+
+/// @brief How spill files are stored.
+enum RawSpillCompression
+{
+    /// @brief Rows exactly as they came out of the stream.
+    RawSpillNone,
+
+    /// @brief Every row is LZ4 compressed on its own.
+    RawSpillLZ4
+};
+
+/// @brief Drains the capture stream into a new spill file. The stream is closed as soon as the last row is read.
+/// @param albumDir Album filesystem.
+/// @param compression One of RawSpillCompression.
+/// @return True on success. False on failure.
+bool raw_spill_capture(FsFileSystem *albumDir, int compression);
+
+/// @brief Finds a finished spill that still needs encoding.
+/// @param albumDir Album filesystem.
+/// @param pathOut Buffer to write the full path of the spill to.
+/// @param pathSize Size of pathOut.
+/// @return True if one was found. False if there's nothing pending.
+bool raw_spill_find_pending(FsFileSystem *albumDir, char *pathOut, size_t pathSize);
+
+/// @brief Deletes spills that were never finished. Those are from captures interrupted by a crash or power loss and can't
+/// be recovered.
+/// @param albumDir Album filesystem.
+void raw_spill_discard_partial(FsFileSystem *albumDir);
+
+/// @brief Opens a spill for reading.
+/// @param albumDir Album filesystem.
+/// @param path Path of the spill.
+/// @param widthOut Set to the width of the capture.
+/// @param heightOut Set to the height of the capture.
+/// @return True on success. False on failure.
+bool raw_spill_open(FsFileSystem *albumDir, const char *path, uint64_t *widthOut, uint64_t *heightOut);
+
+/// @brief Reads from the open spill like capture_read reads from the stream. Reads must be whole rows, in order.
+/// @param buffer Buffer to read to.
+/// @param size Number of bytes to read.
+/// @param offset Offset of the data in the frame.
+/// @return True on success. False on failure or while reads are cancelled.
+bool raw_spill_read(void *buffer, size_t size, size_t offset);
+
+/// @brief Closes the open spill.
+void raw_spill_close(void);
+
+/// @brief Makes every raw_spill_read fail, or lets them work again. This is how a new capture takes priority over encoding
+/// a spill.
+/// @param cancelled Whether or not reads should fail.
+void raw_spill_set_cancelled(bool cancelled);
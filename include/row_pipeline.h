@@ -0,0 +1,51 @@
+#pragma once
+#include "frame_hash.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Reads rows from the capture stream on a second thread into a small ring buffer so the IPC round-trips overlap with
+// encoding instead of running back to back with it. Rows are read in blocks straight into the ring, so one round trip
+// brings in several rows and the encoder works on them where they landed.
+typedef struct RowPipeline RowPipeline;
+
+/// @brief Number of rows the ring holds. Every slot is CAPTURE_ROW_SIZE bytes.
+#define ROW_PIPELINE_SLOTS 8
+
+/// @brief Most rows read in one call. Half the ring, so the encoder always has one block to work on while the next is read.
+#define ROW_PIPELINE_MAX_BLOCK (ROW_PIPELINE_SLOTS / 2)
+
+/// @brief Timing for a pipelined capture. Ticks are from armGetSystemTick.
+typedef struct
+{
+    /// @brief Ticks the reader thread spent in capture_read_row.
+    uint64_t readTicks;
+
+    /// @brief Ticks the encoder spent waiting for the reader.
+    uint64_t stallTicks;
+
+    /// @brief Number of reads it took. One IPC round trip each.
+    int readCalls;
+} RowPipelineStats;
+
+/// @brief Allocates the ring and starts the reader thread. The capture stream must already be open, and only one pipeline
+/// can run at a time.
+/// @param hash Optional. Every row is added to this on the reader thread as it's read.
+/// @param blockRows Rows to read per call. Must divide ROW_PIPELINE_SLOTS and be at most ROW_PIPELINE_MAX_BLOCK.
+/// @return RowPipeline on success. NULL on failure.
+RowPipeline *row_pipeline_start(FrameHash *hash, int blockRows);
+
+/// @brief Waits for the row passed to be read and returns it. Rows must be acquired in order.
+/// @param pipeline Pipeline to acquire from.
+/// @param rowIndex Row to acquire.
+/// @return Pointer to the row. It can be modified in place. NULL if the read failed.
+uint8_t *row_pipeline_acquire(RowPipeline *pipeline, int rowIndex);
+
+/// @brief Hands the last acquired row's slot back to the reader.
+/// @param pipeline Pipeline to release to.
+void row_pipeline_release(RowPipeline *pipeline);
+
+/// @brief Stops the reader, waits for it and frees the pipeline.
+/// @param pipeline Pipeline to finish.
+/// @param statsOut Optional. Receives the timing of the pipeline.
+void row_pipeline_finish(RowPipeline *pipeline, RowPipelineStats *statsOut);
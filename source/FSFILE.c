@@ -1,5 +1,8 @@
 #include "FSFILE.h"
 
+#include "FSFILE_buffer.h"
+#include "capture_trace.h"
+
 #include <malloc.h>
 
 /// @brief This is just so we have structure.
@@ -19,11 +22,8 @@ struct FSFILE
     /// @brief The mode in which the file is opened.
     uint8_t mode;
 
-    /// @brief Size of the file.
-    int64_t size;
-
-    /// @brief Current offset.
-    int64_t offset;
+    /// @brief Size, offset and write buffer.
+    FSFILEState state;
 };
 // clang-format on
 
@@ -32,10 +32,12 @@ bool FSFILE_Exists(FsFileSystem *filesystem, const char *path)
     // Just try to open the file for reading. If it fails, return false.
     FsFile handle;
     const bool openError = R_FAILED(fsFsOpenFile(filesystem, path, FsOpenMode_Read, &handle));
+    capture_trace_count_ipc(1);
     if (openError) { return false; }
 
     // Close the handle and return true because it exists.
     fsFileClose(&handle);
+    capture_trace_count_ipc(1);
     return true;
 }
 
@@ -45,26 +47,46 @@ bool FSFILE_Delete(FsFileSystem *filesystem, const char *path)
     const bool exists = FSFILE_Exists(filesystem, path);
     if (!exists) { return false; }
 
+    capture_trace_count_ipc(1);
     return R_SUCCEEDED(fsFsDeleteFile(filesystem, path));
 }
 
+bool FSFILE_Rename(FsFileSystem *filesystem, const char *oldPath, const char *newPath)
+{
+    capture_trace_count_ipc(1);
+    return R_SUCCEEDED(fsFsRenameFile(filesystem, oldPath, newPath));
+}
+
+bool FSFILE_GetTimeStamp(FsFileSystem *filesystem, const char *path, uint64_t *timestampOut)
+{
+    FsTimeStampRaw timestamp;
+    const bool stampError = R_FAILED(fsFsGetFileTimeStampRaw(filesystem, path, &timestamp));
+    capture_trace_count_ipc(1);
+    if (stampError) { return false; }
+
+    *timestampOut = timestamp.created;
+    return true;
+}
+
 FSFILE *FSFILE_OpenRead(FsFileSystem *filesystem, const char *path)
 {
     // Allocate.
-    FSFILE *file = malloc(sizeof(FSFILE));
+    FSFILE *file = calloc(1, sizeof(FSFILE));
     if (!file) { goto abort; }
 
     // Attempt opening before continuing at all.
     const bool opened = R_SUCCEEDED(fsFsOpenFile(filesystem, path, FsOpenMode_Read, &file->handle));
+    capture_trace_count_ipc(1);
     if (!opened) { goto abort; }
 
     // Get the size.
-    const bool getSize = R_SUCCEEDED(fsFileGetSize(&file->handle, &file->size));
+    const bool getSize = R_SUCCEEDED(fsFileGetSize(&file->handle, &file->state.size));
+    capture_trace_count_ipc(1);
     if (!getSize) { goto abort; }
 
     // Set offset and mode.
-    file->offset = 0;
-    file->mode   = Reading;
+    file->state.offset = 0;
+    file->mode         = Reading;
 
     // Success ending achieved.
     return file;
@@ -89,20 +111,22 @@ FSFILE *FSFILE_OpenWrite(FsFileSystem *filesystem, const char *path, int64_t siz
 
     // Try to create it.
     const bool created = R_SUCCEEDED(fsFsCreateFile(filesystem, path, size, 0));
+    capture_trace_count_ipc(1);
     if (!created) { goto abort; }
 
     // Allocate.
-    FSFILE *file = malloc(sizeof(FSFILE));
+    FSFILE *file = calloc(1, sizeof(FSFILE));
     if (!file) { goto abort; }
 
     // Open.
     const bool opened = R_SUCCEEDED(fsFsOpenFile(filesystem, path, FsOpenMode_Write, &file->handle));
+    capture_trace_count_ipc(1);
     if (!opened) { goto abort; }
 
     // Offset, size, and mode.
-    file->offset = 0;
-    file->size   = size;
-    file->mode   = Writing;
+    file->state.offset = 0;
+    file->state.size   = size;
+    file->mode         = Writing;
 
     return file;
 
@@ -112,17 +136,57 @@ abort:
     return NULL;
 }
 
+FSFILE *FSFILE_OpenWriteBuffered(FsFileSystem *filesystem, const char *path, int64_t size, size_t bufferSize)
+{
+    FSFILE *file = FSFILE_OpenWrite(filesystem, path, size);
+    if (!file) { return NULL; }
+
+    fsfile_buffer_open(&file->state, bufferSize);
+    return file;
+}
+
+FSFILE *FSFILE_OpenAppend(FsFileSystem *filesystem, const char *path)
+{
+    // Create it empty if it isn't there yet.
+    const bool exists  = FSFILE_Exists(filesystem, path);
+    const bool created = exists || R_SUCCEEDED(fsFsCreateFile(filesystem, path, 0, 0));
+    if (!exists) { capture_trace_count_ipc(1); }
+    if (!created) { return NULL; }
+
+    // Allocate.
+    FSFILE *file = calloc(1, sizeof(FSFILE));
+    if (!file) { return NULL; }
+
+    // Open and get the size so writing starts at the end.
+    const bool opened  = R_SUCCEEDED(fsFsOpenFile(filesystem, path, FsOpenMode_Write | FsOpenMode_Append, &file->handle));
+    const bool getSize = opened && R_SUCCEEDED(fsFileGetSize(&file->handle, &file->state.size));
+    capture_trace_count_ipc(opened ? 2 : 1);
+    if (!getSize)
+    {
+        if (opened) { fsFileClose(&file->handle); }
+        free(file);
+        return NULL;
+    }
+
+    file->state.offset = file->state.size;
+    file->mode         = Writing;
+
+    return file;
+}
+
 ssize_t FSFILE_Read(FSFILE *file, void *buffer, size_t size)
 {
     if (!file || !buffer || file->mode != Reading) { return -1; }
 
     // Read.
-    uint64_t bytesRead = 0;
-    const bool read    = R_SUCCEEDED(fsFileRead(&file->handle, file->offset, buffer, size, FsReadOption_None, &bytesRead));
+    uint64_t bytesRead   = 0;
+    const int64_t offset = file->state.offset;
+    const bool read      = R_SUCCEEDED(fsFileRead(&file->handle, offset, buffer, size, FsReadOption_None, &bytesRead));
+    capture_trace_count_read(bytesRead);
     if (!read) { return -1; }
 
     // Update offset.
-    file->offset += bytesRead;
+    file->state.offset += bytesRead;
 
     return (ssize_t)bytesRead;
 }
@@ -132,31 +196,31 @@ ssize_t FSFILE_Write(FSFILE *file, const void *buffer, size_t size)
     // Do not continue if we're not passed valid data.
     if (!file || !buffer || file->mode != Writing) { return -1; }
 
-    // Whether or not the file needs to be resized.
-    const int64_t endSize  = file->offset + size;
-    const bool needsResize = endSize > file->size;
-    const bool resized     = needsResize && R_SUCCEEDED(fsFileSetSize(&file->handle, endSize));
-    if (needsResize && !resized) { return -1; }
-
-    // Attempt to write the data.
-    const bool dataWritten = R_SUCCEEDED(fsFileWrite(&file->handle, file->offset, buffer, size, FsWriteOption_None));
-    if (!dataWritten) { return -1; }
+    return fsfile_buffer_write(file, &file->state, buffer, size);
+}
 
-    // Update the offset and size if needed.
-    file->offset += size;
-    file->size = file->offset > file->size ? file->offset : file->size;
+bool FSFILE_WriteAt(FSFILE *file, int64_t offset, const void *buffer, size_t size)
+{
+    if (!file || !buffer || file->mode != Writing) { return false; }
 
-    return size;
+    return fsfile_buffer_write_at(file, &file->state, offset, buffer, size);
 }
 
-ssize_t FSFILE_GetSize(FSFILE *file) { return file->size; }
+ssize_t FSFILE_GetSize(FSFILE *file) { return file->state.size; }
 
-bool FSFILE_SetSize(FSFILE *file, int64_t size) { return R_SUCCEEDED(fsFileSetSize(&file->handle, size)); }
+ssize_t FSFILE_Tell(FSFILE *file) { return file->state.offset; }
+
+bool FSFILE_SetSize(FSFILE *file, int64_t size)
+{
+    capture_trace_count_ipc(1);
+    return R_SUCCEEDED(fsFileSetSize(&file->handle, size));
+}
 
 bool FSFILE_Flush(FSFILE *file)
 {
-    if (!file) { return false; }
+    if (!file || !fsfile_buffer_flush(file, &file->state)) { return false; }
 
+    capture_trace_count_ipc(1);
     return R_SUCCEEDED(fsFileFlush(&file->handle));
 }
 
@@ -165,10 +229,15 @@ void FSFILE_Close(FSFILE *file)
     // Check
     if (!file) { return; }
 
+    // Whatever's still buffered goes out first.
+    fsfile_buffer_flush(file, &file->state);
+
     // Close the handle.
     fsFileClose(&file->handle);
+    capture_trace_count_ipc(1);
 
     // Free the data
+    fsfile_buffer_close(&file->state);
     free(file);
 }
 
@@ -179,8 +248,15 @@ void FSFILE_Finalize(FSFILE *file)
 
     // Set the size according to what the file internally thinks it is. Note: I don't like this. Might need to revise. Serves
     // its purpose though.
-    FSFILE_SetSize(file, file->offset);
+    FSFILE_SetSize(file, file->state.offset);
 
     // Close.
     FSFILE_Close(file);
-}
\ No newline at end of file
+}
+
+bool fsfile_backend_write(FSFILE *file, int64_t offset, const void *data, size_t size)
+{
+    return R_SUCCEEDED(fsFileWrite(&file->handle, offset, data, size, FsWriteOption_None));
+}
+
+bool fsfile_backend_grow(FSFILE *file, int64_t size) { return R_SUCCEEDED(fsFileSetSize(&file->handle, size)); }
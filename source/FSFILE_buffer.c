@@ -0,0 +1,115 @@
+#include "FSFILE_buffer.h"
+
+#include "capture_trace.h"
+
+#include <malloc.h>
+#include <string.h>
+
+// Defined at bottom.
+
+/// @brief Writes straight to the file at the offset passed, growing it first if needed.
+/// @return True on success. False on failure.
+static bool fsfile_write_at(FSFILE *file, FSFILEState *state, int64_t offset, const void *data, size_t size);
+
+void fsfile_buffer_open(FSFILEState *state, size_t bufferSize)
+{
+    // Without the buffer it's just a normal file. Slower, but it still works.
+    state->buffer     = malloc(bufferSize);
+    state->bufferSize = state->buffer ? bufferSize : 0;
+    state->bufferUsed = 0;
+}
+
+ssize_t fsfile_buffer_write(FSFILE *file, FSFILEState *state, const void *data, size_t size)
+{
+    if (!state->buffer)
+    {
+        if (!fsfile_write_at(file, state, state->offset, data, size)) { return -1; }
+
+        state->offset += size;
+        return size;
+    }
+
+    // Buffered writes only reach the file in whole blocks, so every write lands on a multiple of the buffer size.
+    const uint8_t *input = data;
+    size_t remaining     = size;
+    while (remaining > 0)
+    {
+        // Whole blocks don't need to be copied if nothing is waiting in front of them.
+        if (state->bufferUsed == 0 && remaining >= state->bufferSize)
+        {
+            const size_t blocks = remaining - remaining % state->bufferSize;
+            if (!fsfile_write_at(file, state, state->offset, input, blocks)) { return -1; }
+
+            state->offset += blocks;
+            input += blocks;
+            remaining -= blocks;
+            continue;
+        }
+
+        const size_t space = state->bufferSize - state->bufferUsed;
+        const size_t copy  = remaining < space ? remaining : space;
+        memcpy(state->buffer + state->bufferUsed, input, copy);
+        state->bufferUsed += copy;
+        state->offset += copy;
+        input += copy;
+        remaining -= copy;
+
+        if (state->bufferUsed == state->bufferSize && !fsfile_buffer_flush(file, state)) { return -1; }
+    }
+
+    return size;
+}
+
+bool fsfile_buffer_write_at(FSFILE *file, FSFILEState *state, int64_t offset, const void *data, size_t size)
+{
+    if (offset < 0 || offset + (int64_t)size > state->offset) { return false; }
+
+    // The part that's still buffered is patched in the buffer. Only what's in front of it has to be written.
+    const int64_t bufferStart = state->offset - state->bufferUsed;
+    if (offset + (int64_t)size > bufferStart)
+    {
+        const size_t skip = offset < bufferStart ? bufferStart - offset : 0;
+        memcpy(state->buffer + (offset + skip - bufferStart), (const uint8_t *)data + skip, size - skip);
+        size = skip;
+    }
+
+    return size == 0 || fsfile_write_at(file, state, offset, data, size);
+}
+
+bool fsfile_buffer_flush(FSFILE *file, FSFILEState *state)
+{
+    if (state->bufferUsed == 0) { return true; }
+
+    const bool written = fsfile_write_at(file, state, state->offset - state->bufferUsed, state->buffer, state->bufferUsed);
+    state->bufferUsed  = 0;
+    return written;
+}
+
+void fsfile_buffer_close(FSFILEState *state)
+{
+    free(state->buffer);
+    state->buffer     = NULL;
+    state->bufferSize = 0;
+    state->bufferUsed = 0;
+}
+
+static bool fsfile_write_at(FSFILE *file, FSFILEState *state, int64_t offset, const void *data, size_t size)
+{
+    // Buffered files grow a quarter past what's needed, so a file created too small costs a few resizes instead of one
+    // per block. FSFILE_Finalize trims it back down.
+    const int64_t endSize = offset + size;
+    if (endSize > state->size)
+    {
+        const int64_t newSize = state->buffer ? endSize + endSize / 4 : endSize;
+        const bool resized    = fsfile_backend_grow(file, newSize);
+        capture_trace_count_ipc(1);
+        if (!resized) { return false; }
+
+        state->size = newSize;
+    }
+
+    const uint64_t writeBegin = armGetSystemTick();
+    const bool dataWritten    = fsfile_backend_write(file, offset, data, size);
+    capture_trace_count_write(dataWritten ? size : 0, armGetSystemTick() - writeBegin);
+    return dataWritten;
+}
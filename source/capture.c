@@ -0,0 +1,65 @@
+#include "capture.h"
+
+#include "capture_trace.h"
+#include "raw_spill.h"
+
+#include <switch.h>
+
+/// @brief Whether or not reads are coming from a spill instead of capssc.
+static bool spillOpen = false;
+
+bool capture_open_stream(uint64_t *widthOut, uint64_t *heightOut)
+{
+    // The timeout for screen capture
+    static const int64_t SCREENSHOT_CAPTURE_TIMEOUT = 1e+8;
+
+    uint64_t size;
+    uint64_t width;
+    uint64_t height;
+    const bool opened = R_SUCCEEDED(
+        capsscOpenRawScreenShotReadStream(&size, &width, &height, ViLayerStack_Screenshot, SCREENSHOT_CAPTURE_TIMEOUT));
+    capture_trace_count_ipc(1);
+    if (!opened) { return false; }
+
+    if (widthOut) { *widthOut = width; }
+    if (heightOut) { *heightOut = height; }
+
+    return true;
+}
+
+bool capture_open_spill(FsFileSystem *filesystem, const char *path, uint64_t *widthOut, uint64_t *heightOut)
+{
+    spillOpen = raw_spill_open(filesystem, path, widthOut, heightOut);
+    return spillOpen;
+}
+
+bool capture_read(void *buffer, size_t size, size_t offset)
+{
+    if (spillOpen) { return raw_spill_read(buffer, size, offset); }
+
+    uint64_t bytesRead;
+    const bool read = R_SUCCEEDED(capsscReadRawScreenShotReadStream(&bytesRead, buffer, size, offset));
+    capture_trace_count_read(read ? bytesRead : 0);
+    return read && bytesRead == size;
+}
+
+bool capture_read_row(void *buffer, int rowIndex) { return capture_read_rows(buffer, rowIndex, 1); }
+
+bool capture_read_rows(void *buffer, int firstRow, int rowCount)
+{
+    // Rows are back to back in the stream, so a block of them is one read at the first one's offset.
+    return capture_read(buffer, (size_t)rowCount * CAPTURE_ROW_SIZE, (size_t)firstRow * CAPTURE_ROW_SIZE);
+}
+
+void capture_close_stream(void)
+{
+    if (spillOpen)
+    {
+        raw_spill_close();
+        spillOpen = false;
+        return;
+    }
+
+    capsscCloseRawScreenShotReadStream();
+    capture_trace_count_ipc(1);
+}
@@ -0,0 +1,401 @@
+#include "capture_queue.h"
+
+#include "FSFILE.h"
+#include "capture_trace.h"
+#include "config.h"
+#include "encode_governor.h"
+#include "png_capture.h"
+#include "png_optimize.h"
+#include "png_record.h"
+#include "png_timelapse.h"
+#include "raw_spill.h"
+
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+
+// The capssc stream only holds one frame and a raw frame is far larger than INNER_HEAP_SIZE, so a queued press is captured
+// when the worker gets to it rather than at the moment of the press. That's still better than it vanishing. In raw-first
+// mode the worker only drains the stream to a spill, which keeps that wait short, and encodes spills whenever it has
+// nothing else to do. Once the button has been left alone for IdleOptimize seconds, it recompresses saved PNGs one at a
+// time until there are none left or the button's touched again. Holding the button queues a recording, which takes frames
+// until it's let go. Timelapse shots are queued by the event loop's timer and only one waits at a time.
+
+/// @brief Stack size of the worker. This is the same as the main thread's in PNGShot.json, which png_capture used to run on.
+#define WORKER_STACK_SIZE 0x4000
+
+/// @brief Priority the worker drops to while encoding spills. Nothing is waiting on those.
+static const int SPILL_PRIORITY = 0x3B;
+
+/// @brief Priority the worker drops to while taking timelapse shots. Nobody's waiting on those either.
+static const int TIMELAPSE_PRIORITY = 0x3B;
+
+/// @brief Priority the worker drops to while recompressing saved PNGs. The lowest there is.
+static const int OPTIMIZE_PRIORITY = 0x3F;
+
+/// @brief Temporary file spills are encoded to.
+static const char *SPILL_TEMPORARY_PATH = "/PNGs/temp_spill.png";
+
+/// @brief Kinds of queued captures.
+enum CaptureRequestKinds
+{
+    /// @brief A press.
+    CaptureRequestPress,
+
+    /// @brief A hold. This records until it's let go.
+    CaptureRequestRecord,
+
+    /// @brief A timelapse shot.
+    CaptureRequestTimelapse
+};
+
+/// @brief A queued capture.
+typedef struct CaptureRequest
+{
+    /// @brief Temporary file this capture is written to. Every queued capture gets its own.
+    char temporaryPath[32];
+
+    /// @brief One of CaptureRequestKinds.
+    int kind;
+
+    /// @brief Next request in line.
+    struct CaptureRequest *next;
+} CaptureRequest;
+
+// clang-format off
+typedef struct
+{
+    /// @brief Worker thread.
+    Thread worker;
+
+    /// @brief Album filesystem captures are written to.
+    FsFileSystem *albumDir;
+
+    /// @brief Guards everything below.
+    Mutex lock;
+
+    /// @brief Signalled when a capture is queued or the worker should stop.
+    CondVar requestQueued;
+
+    /// @brief Oldest and newest queued captures.
+    CaptureRequest *head, *tail;
+
+    /// @brief Number of queued captures.
+    int depth;
+
+    /// @brief Set while a timelapse shot is waiting for the worker.
+    bool timelapseQueued;
+
+    /// @brief Number used to name the next temporary file.
+    unsigned int sequence;
+
+    /// @brief Set when there might be spills waiting to be encoded.
+    bool spillsPending;
+
+    /// @brief Set while the worker is encoding a spill.
+    bool encodingSpill;
+
+    /// @brief Set when the worker should exit once the queue is empty and every spill is encoded.
+    bool stopping;
+
+    /// @brief Set if png_optimize_start succeeded, and when there might be saved PNGs it hasn't been through yet.
+    bool optimizeEnabled, optimizePending;
+
+    /// @brief Set while the worker is recompressing a saved PNG.
+    bool optimizing;
+
+    /// @brief Tick of the last button event.
+    uint64_t lastActivity;
+} CaptureQueue;
+// clang-format on
+
+/// @brief The queue. There's only ever one capture button.
+static CaptureQueue captureQueue = {0};
+
+/// @brief Stack of the worker. It's static so it doesn't take from the heap captures need.
+static uint8_t workerStack[WORKER_STACK_SIZE] __attribute__((aligned(0x1000)));
+
+// Defined at bottom.
+
+/// @brief Worker thread function.
+/// @param arg Unused.
+static void capture_queue_worker(void *arg);
+
+/// @brief Queues a capture.
+/// @param kind One of CaptureRequestKinds.
+static bool capture_queue_enqueue(int kind);
+
+/// @brief Handles a request. Presses either capture straight to PNG or spill, depending on the config. Recordings and
+/// timelapse shots always go straight to PNG.
+static void capture_queue_capture(CaptureRequest *request);
+
+/// @brief Encodes one pending spill, if there are any.
+static void capture_queue_encode_spill(void);
+
+/// @brief Recompresses the next saved PNG, if there are any.
+static void capture_queue_optimize(void);
+
+/// @brief Drops the worker to the priority passed, unless EncodePriority is already lower. 0 puts it back to EncodePriority.
+static void capture_queue_set_priority(int priority);
+
+/// @brief Returns how many more nanoseconds the button has to be left alone before saved PNGs are recompressed. 0 if it's
+/// been long enough. The lock must be held.
+static uint64_t capture_queue_idle_remaining(void);
+
+bool capture_queue_start(FsFileSystem *albumDir)
+{
+    captureQueue.albumDir = albumDir;
+    mutexInit(&captureQueue.lock);
+    condvarInit(&captureQueue.requestQueued);
+
+    // Spills left over from before a reboot get encoded first thing. Half written ones are useless.
+    raw_spill_discard_partial(albumDir);
+    captureQueue.spillsPending = true;
+
+    // PNGs saved before a reboot still count, so there's something to look at right away.
+    captureQueue.optimizeEnabled = config_optimize_idle() > 0 && png_optimize_start(albumDir);
+    captureQueue.optimizePending = captureQueue.optimizeEnabled;
+    captureQueue.lastActivity    = armGetSystemTick();
+
+    // So the first capture doesn't have to set up zlib.
+    png_capture_warm_up();
+
+    // EncodePriority is never above one below the main thread, so the event loop always gets the core when a press comes in.
+    const bool created = R_SUCCEEDED(threadCreate(&captureQueue.worker,
+                                                  capture_queue_worker,
+                                                  NULL,
+                                                  workerStack,
+                                                  WORKER_STACK_SIZE,
+                                                  config_encode_priority(),
+                                                  encode_governor_core()));
+    if (!created) { return false; }
+
+    const bool started = R_SUCCEEDED(threadStart(&captureQueue.worker));
+    if (!started)
+    {
+        threadClose(&captureQueue.worker);
+        return false;
+    }
+
+    return true;
+}
+
+bool capture_queue_push(void) { return capture_queue_enqueue(CaptureRequestPress); }
+
+bool capture_queue_record(void)
+{
+    // A recording that has to wait its turn still gets its first frame, even if the button's let go by then.
+    png_record_set_stopped(false);
+    return capture_queue_enqueue(CaptureRequestRecord);
+}
+
+void capture_queue_stop_recording(void) { png_record_set_stopped(true); }
+
+bool capture_queue_timelapse(void)
+{
+    // One that's still waiting would see the same frame as a second one. It stands in for both.
+    mutexLock(&captureQueue.lock);
+    const bool queued            = captureQueue.timelapseQueued;
+    captureQueue.timelapseQueued = true;
+    mutexUnlock(&captureQueue.lock);
+    if (queued) { return false; }
+
+    const bool pushed = capture_queue_enqueue(CaptureRequestTimelapse);
+    if (!pushed)
+    {
+        mutexLock(&captureQueue.lock);
+        captureQueue.timelapseQueued = false;
+        mutexUnlock(&captureQueue.lock);
+    }
+    return pushed;
+}
+
+void capture_queue_notify_activity(void)
+{
+    // The button being touched at all means someone's there. A press is likely to follow.
+    mutexLock(&captureQueue.lock);
+    captureQueue.lastActivity = armGetSystemTick();
+    if (captureQueue.optimizing) { png_optimize_set_cancelled(true); }
+    mutexUnlock(&captureQueue.lock);
+}
+
+void capture_queue_stop(void)
+{
+    mutexLock(&captureQueue.lock);
+    captureQueue.stopping = true;
+    condvarWakeOne(&captureQueue.requestQueued);
+    mutexUnlock(&captureQueue.lock);
+
+    threadWaitForExit(&captureQueue.worker);
+    threadClose(&captureQueue.worker);
+
+    captureQueue.stopping = false;
+}
+
+static void capture_queue_worker(void *arg)
+{
+    while (true)
+    {
+        // Wait for something to do. The queue and spills are drained before stopping. Saved PNGs are only recompressed
+        // once the button's been left alone long enough, so that's a wait with a timeout.
+        mutexLock(&captureQueue.lock);
+        bool optimize = false;
+        while (!captureQueue.head && !captureQueue.spillsPending && !captureQueue.stopping)
+        {
+            const uint64_t remaining = captureQueue.optimizePending ? capture_queue_idle_remaining() : UINT64_MAX;
+            optimize                 = remaining == 0;
+            if (optimize) { break; }
+
+            if (remaining == UINT64_MAX) { condvarWait(&captureQueue.requestQueued, &captureQueue.lock); }
+            else { condvarWaitTimeout(&captureQueue.requestQueued, &captureQueue.lock, remaining); }
+        }
+
+        CaptureRequest *request = captureQueue.head;
+        if (request)
+        {
+            captureQueue.head = request->next;
+            if (!captureQueue.head) { captureQueue.tail = NULL; }
+            if (request->kind == CaptureRequestTimelapse) { captureQueue.timelapseQueued = false; }
+        }
+        const bool encodeSpill     = !request && captureQueue.spillsPending;
+        captureQueue.encodingSpill = encodeSpill;
+        if (encodeSpill) { raw_spill_set_cancelled(false); }
+
+        // Stopping doesn't wait for saved PNGs. Whatever's left is picked up after the next boot.
+        optimize                = !request && !encodeSpill && !captureQueue.stopping && optimize;
+        captureQueue.optimizing = optimize;
+        if (optimize) { png_optimize_set_cancelled(false); }
+        mutexUnlock(&captureQueue.lock);
+
+        // The optimizer's listing is only kept while it runs file after file.
+        if (!optimize) { png_optimize_release(); }
+
+        if (request) { capture_queue_capture(request); }
+        else if (encodeSpill) { capture_queue_encode_spill(); }
+        else if (optimize) { capture_queue_optimize(); }
+        else { return; }
+
+        // The trace is only written out when nothing's queued so it never holds up a capture. The warm stream is set back
+        // up for the next one if something freed it, unless the optimizer's about to free it again.
+        mutexLock(&captureQueue.lock);
+        const bool idle         = !captureQueue.head;
+        const bool optimizeNext = optimize && captureQueue.optimizePending;
+        const bool spillNext    = captureQueue.spillsPending;
+        mutexUnlock(&captureQueue.lock);
+        if (idle) { capture_trace_flush(); }
+        if (idle && !optimizeNext && !spillNext) { png_capture_warm_up(); }
+    }
+}
+
+static bool capture_queue_enqueue(int kind)
+{
+    mutexLock(&captureQueue.lock);
+    const bool full = captureQueue.depth >= CAPTURE_QUEUE_MAX_DEPTH;
+    mutexUnlock(&captureQueue.lock);
+    if (full) { return false; }
+
+    CaptureRequest *request = malloc(sizeof(CaptureRequest));
+    if (!request) { return false; }
+    request->kind = kind;
+    request->next = NULL;
+
+    mutexLock(&captureQueue.lock);
+    snprintf(request->temporaryPath, sizeof(request->temporaryPath), "/PNGs/temp_%u.png", captureQueue.sequence++);
+    if (captureQueue.tail) { captureQueue.tail->next = request; }
+    else { captureQueue.head = request; }
+    captureQueue.tail = request;
+    ++captureQueue.depth;
+    condvarWakeOne(&captureQueue.requestQueued);
+
+    // A new capture beats encoding an old one. The spill stays pending and gets picked back up later. Timelapse shots
+    // aren't in a hurry, so they wait for the one file to be done rather than throw away the work on it.
+    const bool preempt = kind != CaptureRequestTimelapse;
+    if (preempt && captureQueue.encodingSpill) { raw_spill_set_cancelled(true); }
+    if (preempt && captureQueue.optimizing) { png_optimize_set_cancelled(true); }
+    mutexUnlock(&captureQueue.lock);
+
+    return true;
+}
+
+static void capture_queue_capture(CaptureRequest *request)
+{
+    // If spilling fails for whatever reason, try the normal way instead of losing the capture.
+    const bool press   = request->kind == CaptureRequestPress;
+    const bool spilled = press && config_raw_first() && raw_spill_capture(captureQueue.albumDir, config_raw_compression());
+    if (request->kind == CaptureRequestRecord) { png_record(captureQueue.albumDir, request->temporaryPath); }
+    else if (request->kind == CaptureRequestTimelapse)
+    {
+        capture_queue_set_priority(TIMELAPSE_PRIORITY);
+        png_timelapse_capture(captureQueue.albumDir, request->temporaryPath);
+        capture_queue_set_priority(0);
+    }
+    else if (!spilled) { png_capture(captureQueue.albumDir, request->temporaryPath); }
+    free(request);
+
+    // The slot only frees up once the capture is done, so depth counts the one being encoded too.
+    mutexLock(&captureQueue.lock);
+    --captureQueue.depth;
+    captureQueue.spillsPending   = captureQueue.spillsPending || spilled;
+    captureQueue.optimizePending = captureQueue.optimizeEnabled;
+    mutexUnlock(&captureQueue.lock);
+}
+
+static void capture_queue_encode_spill(void)
+{
+    char spillPath[FS_MAX_PATH];
+    const bool found = raw_spill_find_pending(captureQueue.albumDir, spillPath, sizeof(spillPath));
+
+    bool saved = false;
+    if (found)
+    {
+        capture_queue_set_priority(SPILL_PRIORITY);
+        saved = png_capture_spill(captureQueue.albumDir, spillPath, SPILL_TEMPORARY_PATH);
+        capture_queue_set_priority(0);
+    }
+
+    mutexLock(&captureQueue.lock);
+    const bool cancelled       = captureQueue.head != NULL;
+    captureQueue.encodingSpill = false;
+    captureQueue.spillsPending = found;
+    mutexUnlock(&captureQueue.lock);
+
+    // A spill that fails without being cancelled would just fail again. It's renamed so it's kept, but not retried.
+    if (found && !saved && !cancelled)
+    {
+        char failedPath[FS_MAX_PATH];
+        snprintf(failedPath, sizeof(failedPath), "%.*s.bad", (int)(strrchr(spillPath, '.') - spillPath), spillPath);
+        const bool renamed = FSFILE_Rename(captureQueue.albumDir, spillPath, failedPath);
+
+        // Don't spin on it if it can't even be renamed. It'll be tried again after the next spill.
+        mutexLock(&captureQueue.lock);
+        captureQueue.spillsPending = captureQueue.spillsPending && renamed;
+        mutexUnlock(&captureQueue.lock);
+    }
+}
+
+static void capture_queue_optimize(void)
+{
+    capture_queue_set_priority(OPTIMIZE_PRIORITY);
+    const int result = png_optimize_next(captureQueue.albumDir, NULL);
+    capture_queue_set_priority(0);
+
+    // Done means there's nothing left until the next capture. A failure would most likely just happen again, so that waits
+    // for the next capture too.
+    mutexLock(&captureQueue.lock);
+    captureQueue.optimizing      = false;
+    captureQueue.optimizePending = result != PngOptimizeDone && result != PngOptimizeFailed;
+    mutexUnlock(&captureQueue.lock);
+}
+
+static void capture_queue_set_priority(int priority)
+{
+    const int encodePriority = config_encode_priority();
+    svcSetThreadPriority(CUR_THREAD_HANDLE, priority > encodePriority ? priority : encodePriority);
+}
+
+static uint64_t capture_queue_idle_remaining(void)
+{
+    const uint64_t idleNano    = (uint64_t)config_optimize_idle() * 1000000000ULL;
+    const uint64_t elapsedNano = armTicksToNs(armGetSystemTick() - captureQueue.lastActivity);
+    return elapsedNano >= idleNano ? 0 : idleNano - elapsedNano;
+}
@@ -0,0 +1,297 @@
+#include "capture_trace.h"
+
+#include "FSFILE.h"
+#include "fsdir.h"
+
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+/// @brief Directory CAPTURE_TRACE_PATH is in. The trailing slash is how create_directory_recursively knows it's a directory.
+static const char *TRACE_DIRECTORY = "/config/PNGShot/";
+
+/// @brief Size of the buffer lines are gathered in before they're written. Every write is an IPC call.
+#define TRACE_WRITE_BUFFER_SIZE 0x400
+
+/// @brief One stage of one capture.
+typedef struct
+{
+    /// @brief Number of the capture since boot.
+    uint32_t capture;
+
+    /// @brief One of CaptureTraceStages.
+    uint32_t stage;
+
+    /// @brief Ticks the stage took.
+    uint64_t ticks;
+
+    /// @brief Bytes read and written during the stage.
+    uint64_t bytesRead, bytesWritten;
+
+    /// @brief IPC calls made during the stage.
+    uint32_t ipcCalls;
+
+    /// @brief Most of the heap seen in use during the stage. Bytes.
+    uint32_t heapHighWater;
+} CaptureTraceEntry;
+
+/// @brief Counters the hooks add to. The reader thread counts its row reads while the capture thread is writing, so
+/// these are atomic.
+typedef struct
+{
+    atomic_uint_fast64_t bytesRead, bytesWritten, writeTicks;
+    atomic_uint_fast32_t ipcCalls, writeCalls;
+    atomic_size_t heapHighWater;
+} TraceCounters;
+
+// clang-format off
+typedef struct
+{
+    /// @brief Whether tracing is on. Only set at startup, before anything else runs.
+    bool enabled;
+
+    /// @brief Filesystem the trace is written to.
+    FsFileSystem *filesystem;
+
+    /// @brief The ring.
+    CaptureTraceEntry entries[CAPTURE_TRACE_ENTRIES];
+
+    /// @brief Oldest entry and number of entries in the ring.
+    int head, count;
+
+    /// @brief Number of the current capture.
+    uint32_t capture;
+
+    /// @brief Ticks the capture and the current stage began at.
+    uint64_t captureBegin, stageBegin;
+
+    /// @brief Counted since the last mark.
+    TraceCounters stage;
+
+    /// @brief Counted since capture_trace_begin. Only the capture thread touches these.
+    uint64_t totalRead, totalWritten, totalIpc;
+    size_t totalHeap;
+} CaptureTrace;
+// clang-format on
+
+/// @brief The trace. Only the capture worker begins, marks and flushes it.
+static CaptureTrace trace = {0};
+
+/// @brief Stage names in the same order as CaptureTraceStages.
+static const char *STAGE_NAMES[] = {"open",
+                                    "duplicate",
+                                    "adapt",
+                                    "colors",
+                                    "encode",
+                                    "read",
+                                    "filter",
+                                    "deflate",
+                                    "thumbnail",
+                                    "yield",
+                                    "latency",
+                                    "write",
+                                    "finalize",
+                                    "rename",
+                                    "jpeg",
+                                    "total",
+                                    "timelapse_reduced",
+                                    "timelapse_skipped"};
+
+// Defined at bottom.
+
+/// @brief Adds an entry to the ring, dropping the oldest if it's full.
+static void trace_push(int stage, uint64_t ticks, uint64_t bytesRead, uint64_t bytesWritten, uint64_t ipcCalls, size_t heap);
+
+/// @brief Samples the heap and raises the stage's high-water mark if needed.
+static inline void trace_sample_heap(void);
+
+/// @brief Returns the number of bytes allocated from the heap right now.
+static inline size_t heap_in_use(void);
+
+bool capture_trace_start(FsFileSystem *filesystem)
+{
+    const bool directory = directory_exists(filesystem, TRACE_DIRECTORY) ||
+                           create_directory_recursively(filesystem, TRACE_DIRECTORY);
+    if (!directory) { return false; }
+
+    trace.filesystem = filesystem;
+    trace.enabled    = true;
+    return true;
+}
+
+void capture_trace_begin(void)
+{
+    if (!trace.enabled) { return; }
+
+    // Whatever the last flush counted doesn't belong to this capture.
+    atomic_store(&trace.stage.bytesRead, 0);
+    atomic_store(&trace.stage.bytesWritten, 0);
+    atomic_store(&trace.stage.writeTicks, 0);
+    atomic_store(&trace.stage.ipcCalls, 0);
+    atomic_store(&trace.stage.writeCalls, 0);
+    atomic_store(&trace.stage.heapHighWater, 0);
+    trace.totalRead = trace.totalWritten = trace.totalIpc = trace.totalHeap = 0;
+
+    ++trace.capture;
+    trace.captureBegin = trace.stageBegin = armGetSystemTick();
+    trace_sample_heap();
+}
+
+void capture_trace_mark(int stage)
+{
+    if (!trace.enabled) { return; }
+
+    const uint64_t now = armGetSystemTick();
+    trace_sample_heap();
+
+    const uint64_t bytesRead    = atomic_exchange(&trace.stage.bytesRead, 0);
+    const uint64_t bytesWritten = atomic_exchange(&trace.stage.bytesWritten, 0);
+    const uint64_t ipcCalls     = atomic_exchange(&trace.stage.ipcCalls, 0);
+    const size_t heap           = atomic_exchange(&trace.stage.heapHighWater, 0);
+    trace_push(stage, now - trace.stageBegin, bytesRead, bytesWritten, ipcCalls, heap);
+
+    trace.totalRead += bytesRead;
+    trace.totalWritten += bytesWritten;
+    trace.totalIpc += ipcCalls;
+    trace.totalHeap  = heap > trace.totalHeap ? heap : trace.totalHeap;
+    trace.stageBegin = now;
+}
+
+void capture_trace_record(int stage, uint64_t ticks)
+{
+    if (!trace.enabled) { return; }
+
+    trace_push(stage, ticks, 0, 0, 0, 0);
+}
+
+void capture_trace_end(void)
+{
+    if (!trace.enabled) { return; }
+
+    // Anything after the last mark still counts toward the total.
+    const uint64_t now = armGetSystemTick();
+    trace_sample_heap();
+    trace.totalRead += atomic_exchange(&trace.stage.bytesRead, 0);
+    trace.totalWritten += atomic_exchange(&trace.stage.bytesWritten, 0);
+    trace.totalIpc += atomic_exchange(&trace.stage.ipcCalls, 0);
+    const size_t heap = atomic_exchange(&trace.stage.heapHighWater, 0);
+    trace.totalHeap   = heap > trace.totalHeap ? heap : trace.totalHeap;
+
+    const uint64_t writeCalls = atomic_exchange(&trace.stage.writeCalls, 0);
+    const uint64_t writeTicks = atomic_exchange(&trace.stage.writeTicks, 0);
+    trace_push(CaptureTraceWrite, writeTicks, 0, trace.totalWritten, writeCalls, 0);
+    trace_push(CaptureTraceTotal,
+               now - trace.captureBegin,
+               trace.totalRead,
+               trace.totalWritten,
+               trace.totalIpc,
+               trace.totalHeap);
+}
+
+void capture_trace_count_read(size_t bytes)
+{
+    if (!trace.enabled) { return; }
+
+    atomic_fetch_add(&trace.stage.bytesRead, bytes);
+    atomic_fetch_add(&trace.stage.ipcCalls, 1);
+}
+
+void capture_trace_count_write(size_t bytes, uint64_t ticks)
+{
+    if (!trace.enabled) { return; }
+
+    atomic_fetch_add(&trace.stage.bytesWritten, bytes);
+    atomic_fetch_add(&trace.stage.writeTicks, ticks);
+    atomic_fetch_add(&trace.stage.writeCalls, 1);
+    atomic_fetch_add(&trace.stage.ipcCalls, 1);
+
+    // Writes happen all through the encode, while the arena and row buffers are all allocated.
+    trace_sample_heap();
+}
+
+void capture_trace_count_ipc(int calls)
+{
+    if (!trace.enabled) { return; }
+
+    atomic_fetch_add(&trace.stage.ipcCalls, calls);
+}
+
+void capture_trace_flush(void)
+{
+    if (!trace.enabled || trace.count == 0) { return; }
+
+    FSFILE *traceFile = FSFILE_OpenAppend(trace.filesystem, CAPTURE_TRACE_PATH);
+    if (!traceFile) { return; }
+
+    char buffer[TRACE_WRITE_BUFFER_SIZE];
+    size_t length = 0;
+    if (FSFILE_GetSize(traceFile) == 0)
+    {
+        length = snprintf(buffer, sizeof(buffer), "capture,stage,us,bytes_read,bytes_written,ipc_calls,heap_high_water\n");
+    }
+
+    for (int i = 0; i < trace.count; i++)
+    {
+        const CaptureTraceEntry *entry = &trace.entries[(trace.head + i) % CAPTURE_TRACE_ENTRIES];
+
+        // Lines are well under 128 bytes. The buffer is written out whenever another one might not fit.
+        if (length + 128 > sizeof(buffer))
+        {
+            FSFILE_Write(traceFile, buffer, length);
+            length = 0;
+        }
+
+        length += snprintf(buffer + length,
+                           sizeof(buffer) - length,
+                           "%u,%s,%llu,%llu,%llu,%u,%u\n",
+                           entry->capture,
+                           STAGE_NAMES[entry->stage],
+                           (unsigned long long)(armTicksToNs(entry->ticks) / 1000),
+                           (unsigned long long)entry->bytesRead,
+                           (unsigned long long)entry->bytesWritten,
+                           entry->ipcCalls,
+                           entry->heapHighWater);
+    }
+
+    if (length > 0) { FSFILE_Write(traceFile, buffer, length); }
+    FSFILE_Close(traceFile);
+
+    trace.head = trace.count = 0;
+}
+
+static void trace_push(int stage, uint64_t ticks, uint64_t bytesRead, uint64_t bytesWritten, uint64_t ipcCalls, size_t heap)
+{
+    // Full means the oldest one goes.
+    if (trace.count == CAPTURE_TRACE_ENTRIES)
+    {
+        trace.head = (trace.head + 1) % CAPTURE_TRACE_ENTRIES;
+        --trace.count;
+    }
+
+    CaptureTraceEntry *entry = &trace.entries[(trace.head + trace.count++) % CAPTURE_TRACE_ENTRIES];
+    *entry                   = (CaptureTraceEntry){.capture       = trace.capture,
+                                                   .stage         = stage,
+                                                   .ticks         = ticks,
+                                                   .bytesRead     = bytesRead,
+                                                   .bytesWritten  = bytesWritten,
+                                                   .ipcCalls      = ipcCalls,
+                                                   .heapHighWater = heap};
+}
+
+static inline void trace_sample_heap(void)
+{
+    const size_t current = heap_in_use();
+    size_t highWater     = atomic_load(&trace.stage.heapHighWater);
+    while (current > highWater && !atomic_compare_exchange_weak(&trace.stage.heapHighWater, &highWater, current)) {}
+}
+
+static inline size_t heap_in_use(void)
+{
+    // glibc deprecated mallinfo for mallinfo2. newlib only has mallinfo. Large blocks glibc maps on its own are in hblkhd.
+#if defined(__SWITCH__)
+    const struct mallinfo info = mallinfo();
+#else
+    const struct mallinfo2 info = mallinfo2();
+#endif
+    return info.uordblks + info.hblkhd;
+}
@@ -1,6 +1,12 @@
 #include "config.h"
 
 #include "FSFILE.h"
+#include "capture.h"
+#include "frame_hash.h"
+#include "png_capture.h"
+#include "png_filter.h"
+#include "raw_spill.h"
+#include "row_pipeline.h"
 
 #include <json-c/json.h>
 #include <malloc.h>
@@ -14,12 +20,115 @@ static bool allowJpegs = false;
 /// @brief The compression level. 4 by default.
 static int compressionLevel = 4;
 
+/// @brief Row filter mode. Adaptive by default.
+static int rowFilter = PngFilterAdaptive;
+
+/// @brief Number of deflate workers. 1 (serial) by default.
+static int encodeWorkers = 1;
+
+/// @brief Preferred encoder. Native by default.
+static int encoder = PngEncoderNative;
+
+/// @brief Encode mode. Normal by default.
+static int encodeMode = PngEncodeNormal;
+
+/// @brief Milliseconds adaptive mode aims to deflate in. 500 by default.
+static int encodeBudget = 500;
+
+/// @brief Whether or not to spill captures raw and encode them later. False by default.
+static bool rawFirst = false;
+
+/// @brief How raw spills are stored. Uncompressed by default.
+static int rawCompression = RawSpillNone;
+
+/// @brief What to do with captures identical to a recent one. Kept by default.
+static int duplicateCaptures = FrameDuplicateKeep;
+
+/// @brief Whether or not to write a trace of every capture. False by default.
+static bool traceCaptures = false;
+
+/// @brief Whether or not to write low color captures as grayscale or indexed. False by default.
+static bool reduceColors = false;
+
+/// @brief Rows read from the capture stream per call. 4 by default.
+static int readRows = 4;
+
+/// @brief Seconds without a press before saved PNGs are recompressed. 0 (off) by default.
+static int idleOptimize = 0;
+
+/// @brief Frames per second recorded while the button is held. 0 (off) by default.
+static int recordRate = 0;
+
+/// @brief Longest a recording can last in seconds. 10 by default.
+static int recordLength = 10;
+
+/// @brief Seconds between timelapse captures. 0 (off) by default.
+static int timelapseInterval = 0;
+
+/// @brief Milliseconds of CPU time timelapse captures can take per minute. 3000 by default.
+static int timelapseCpuBudget = 3000;
+
+/// @brief Kilobytes timelapse captures can write per minute. 8192 by default.
+static int timelapseWriteBudget = 8192;
+
+/// @brief How many times smaller thumbnails are than captures. 0 (off) by default.
+static int thumbnailScale = 0;
+
+/// @brief Priority the capture worker encodes at. 0x2D, one below the main thread, by default.
+static int encodePriority = 0x2D;
+
+/// @brief Core the encoding threads run on. -1 (the process's default core) by default.
+static int encodeCore = -1;
+
+/// @brief Rows encoded between yields. 0 (never yield) by default.
+static int encodeSliceRows = 0;
+
+/// @brief Whether or not to measure how late other threads wake up while encoding. False by default.
+static bool latencyProbe = false;
+
 void config_load(void)
 {
     // Config path.
     static const char *CONFIG_PATH           = "/config/PNGShot/config.json";
     static const char *KEY_ALLOW_JPEG        = "AllowJPEGs";
     static const char *KEY_COMPRESSION_LEVEL = "CompressionLevel";
+    static const char *KEY_ENCODE_WORKERS    = "EncodeWorkers";
+    static const char *KEY_ROW_FILTER        = "RowFilter";
+    static const char *KEY_ENCODER           = "Encoder";
+    static const char *KEY_ENCODE_MODE       = "EncodeMode";
+    static const char *KEY_RAW_FIRST         = "RawFirst";
+    static const char *KEY_RAW_COMPRESSION   = "RawCompression";
+    static const char *KEY_DUPLICATES        = "DuplicateCaptures";
+    static const char *KEY_TRACE             = "TraceCaptures";
+    static const char *KEY_ENCODE_BUDGET     = "EncodeBudget";
+    static const char *KEY_REDUCE_COLORS     = "ReduceColors";
+    static const char *KEY_READ_ROWS         = "ReadRows";
+    static const char *KEY_IDLE_OPTIMIZE     = "IdleOptimize";
+    static const char *KEY_RECORD_RATE       = "RecordRate";
+    static const char *KEY_RECORD_LENGTH     = "RecordLength";
+    static const char *KEY_LAPSE_INTERVAL    = "TimelapseInterval";
+    static const char *KEY_LAPSE_CPU         = "TimelapseCPUBudget";
+    static const char *KEY_LAPSE_WRITES      = "TimelapseWriteBudget";
+    static const char *KEY_THUMBNAIL_SCALE   = "ThumbnailScale";
+    static const char *KEY_ENCODE_PRIORITY   = "EncodePriority";
+    static const char *KEY_ENCODE_CORE       = "EncodeCore";
+    static const char *KEY_SLICE_ROWS        = "EncodeSliceRows";
+    static const char *KEY_LATENCY_PROBE     = "LatencyProbe";
+
+    // Row filter names in the same order as PngFilterModes.
+    static const char *ROW_FILTER_NAMES[] = {"None", "Sub", "Up", "Average", "Paeth", "Adaptive"};
+
+    // Encoder names in the same order as PngEncoders.
+    static const char *ENCODER_NAMES[] = {"Native", "LibPNG"};
+
+    // Encode mode names in the same order as PngEncodeModes.
+    static const char *ENCODE_MODE_NAMES[] = {"Normal", "Speed", "Adaptive"};
+
+    // Raw compression names in the same order as RawSpillCompression.
+    static const char *RAW_COMPRESSION_NAMES[] = {"None", "LZ4"};
+
+    // Duplicate handling names in the same order as FrameDuplicateModes.
+    static const char *DUPLICATE_NAMES[] = {"Keep", "Skip"};
 
     // Open the sdmc.
     FsFileSystem sdmc     = {0};
@@ -56,15 +165,83 @@ void config_load(void)
         const json_object *value = json_object_iter_peek_value(&current);
 
         // Key eval.
-        const bool keyJpegs       = strcmp(key, KEY_ALLOW_JPEG) == 0;
-        const bool keyCompression = !keyJpegs && strcmp(key, KEY_COMPRESSION_LEVEL) == 0;
-
-        if (keyJpegs) { allowJpegs = json_object_get_boolean(value); }
-        else if (keyCompression) { compressionLevel = json_object_get_uint64(value); }
+        if (strcmp(key, KEY_ALLOW_JPEG) == 0) { allowJpegs = json_object_get_boolean(value); }
+        else if (strcmp(key, KEY_COMPRESSION_LEVEL) == 0) { compressionLevel = json_object_get_uint64(value); }
+        else if (strcmp(key, KEY_ENCODE_WORKERS) == 0) { encodeWorkers = json_object_get_uint64(value); }
+        else if (strcmp(key, KEY_ROW_FILTER) == 0)
+        {
+            // Unknown names leave the default alone.
+            const char *filterName = json_object_get_string((json_object *)value);
+            for (int i = 0; filterName && i <= PngFilterAdaptive; i++)
+            {
+                if (strcmp(filterName, ROW_FILTER_NAMES[i]) == 0) { rowFilter = i; }
+            }
+        }
+        else if (strcmp(key, KEY_ENCODER) == 0)
+        {
+            const char *encoderName = json_object_get_string((json_object *)value);
+            for (int i = 0; encoderName && i <= PngEncoderLibpng; i++)
+            {
+                if (strcmp(encoderName, ENCODER_NAMES[i]) == 0) { encoder = i; }
+            }
+        }
+        else if (strcmp(key, KEY_ENCODE_MODE) == 0)
+        {
+            const char *modeName = json_object_get_string((json_object *)value);
+            for (int i = 0; modeName && i <= PngEncodeAdaptive; i++)
+            {
+                if (strcmp(modeName, ENCODE_MODE_NAMES[i]) == 0) { encodeMode = i; }
+            }
+        }
+        else if (strcmp(key, KEY_RAW_FIRST) == 0) { rawFirst = json_object_get_boolean(value); }
+        else if (strcmp(key, KEY_RAW_COMPRESSION) == 0)
+        {
+            const char *compressionName = json_object_get_string((json_object *)value);
+            for (int i = 0; compressionName && i <= RawSpillLZ4; i++)
+            {
+                if (strcmp(compressionName, RAW_COMPRESSION_NAMES[i]) == 0) { rawCompression = i; }
+            }
+        }
+        else if (strcmp(key, KEY_DUPLICATES) == 0)
+        {
+            const char *duplicateName = json_object_get_string((json_object *)value);
+            for (int i = 0; duplicateName && i <= FrameDuplicateSkip; i++)
+            {
+                if (strcmp(duplicateName, DUPLICATE_NAMES[i]) == 0) { duplicateCaptures = i; }
+            }
+        }
+        else if (strcmp(key, KEY_TRACE) == 0) { traceCaptures = json_object_get_boolean(value); }
+        else if (strcmp(key, KEY_ENCODE_BUDGET) == 0) { encodeBudget = json_object_get_int(value); }
+        else if (strcmp(key, KEY_REDUCE_COLORS) == 0) { reduceColors = json_object_get_boolean(value); }
+        else if (strcmp(key, KEY_READ_ROWS) == 0) { readRows = json_object_get_int(value); }
+        else if (strcmp(key, KEY_IDLE_OPTIMIZE) == 0) { idleOptimize = json_object_get_int(value); }
+        else if (strcmp(key, KEY_RECORD_RATE) == 0) { recordRate = json_object_get_int(value); }
+        else if (strcmp(key, KEY_RECORD_LENGTH) == 0) { recordLength = json_object_get_int(value); }
+        else if (strcmp(key, KEY_LAPSE_INTERVAL) == 0) { timelapseInterval = json_object_get_int(value); }
+        else if (strcmp(key, KEY_LAPSE_CPU) == 0) { timelapseCpuBudget = json_object_get_int(value); }
+        else if (strcmp(key, KEY_LAPSE_WRITES) == 0) { timelapseWriteBudget = json_object_get_int(value); }
+        else if (strcmp(key, KEY_THUMBNAIL_SCALE) == 0) { thumbnailScale = json_object_get_int(value); }
+        else if (strcmp(key, KEY_ENCODE_PRIORITY) == 0) { encodePriority = json_object_get_int(value); }
+        else if (strcmp(key, KEY_ENCODE_CORE) == 0) { encodeCore = json_object_get_int(value); }
+        else if (strcmp(key, KEY_SLICE_ROWS) == 0) { encodeSliceRows = json_object_get_int(value); }
+        else if (strcmp(key, KEY_LATENCY_PROBE) == 0) { latencyProbe = json_object_get_boolean(value); }
     }
 
     // Take care of funny business.
     if (compressionLevel > 9) { compressionLevel = 4; }
+    if (encodeWorkers < 1 || encodeWorkers > 4) { encodeWorkers = 1; }
+    if (encodeBudget < 1 || encodeBudget > 60000) { encodeBudget = 500; }
+    if (readRows < 1 || readRows > ROW_PIPELINE_MAX_BLOCK || ROW_PIPELINE_SLOTS % readRows != 0) { readRows = 4; }
+    if (idleOptimize < 0 || idleOptimize > 3600) { idleOptimize = 0; }
+    if (recordRate < 0 || recordRate > 30) { recordRate = 0; }
+    if (recordLength < 1 || recordLength > 60) { recordLength = 10; }
+    if (timelapseInterval < 0 || timelapseInterval > 3600) { timelapseInterval = 0; }
+    if (timelapseCpuBudget < 1 || timelapseCpuBudget > 60000) { timelapseCpuBudget = 3000; }
+    if (timelapseWriteBudget < 1 || timelapseWriteBudget > 1048576) { timelapseWriteBudget = 8192; }
+    if (thumbnailScale != 0 && thumbnailScale != 2 && thumbnailScale != 4) { thumbnailScale = 0; }
+    if (encodePriority < 0x2D || encodePriority > 0x3F) { encodePriority = 0x2D; }
+    if (encodeCore < -1 || encodeCore > 3) { encodeCore = -1; }
+    if (encodeSliceRows < 0 || encodeSliceRows > CAPTURE_HEIGHT) { encodeSliceRows = 0; }
 
 cleanup:
     if (config) { FSFILE_Close(config); }
@@ -75,4 +252,51 @@ cleanup:
 
 bool config_allow_jpeg(void) { return allowJpegs; }
 
-int config_compression_level(void) { return compressionLevel; }
\ No newline at end of file
+int config_compression_level(void) { return compressionLevel; }
+
+int config_row_filter(void) { return rowFilter; }
+
+int config_encode_workers(void) { return encodeWorkers; }
+
+int config_encoder(void) { return encoder; }
+
+int config_encode_mode(void) { return encodeMode; }
+
+int config_encode_budget(void) { return encodeBudget; }
+
+bool config_raw_first(void) { return rawFirst; }
+
+int config_raw_compression(void) { return rawCompression; }
+
+int config_duplicate_captures(void) { return duplicateCaptures; }
+
+bool config_trace_captures(void) { return traceCaptures; }
+
+bool config_reduce_colors(void) { return reduceColors; }
+
+int config_read_rows(void) { return readRows; }
+
+int config_optimize_idle(void) { return idleOptimize; }
+
+int config_record_rate(void) { return recordRate; }
+
+int config_record_length(void) { return recordLength; }
+
+int config_timelapse_interval(void) { return timelapseInterval; }
+
+int config_timelapse_cpu_budget(void) { return timelapseCpuBudget; }
+
+int config_timelapse_write_budget(void) { return timelapseWriteBudget; }
+
+int config_thumbnail_scale(void) { return thumbnailScale; }
+
+// libdeflate needs every row in the heap at once, which never fits here. Only the host benchmark can pick it.
+int config_deflate_backend(void) { return PngDeflateZlib; }
+
+int config_encode_priority(void) { return encodePriority; }
+
+int config_encode_core(void) { return encodeCore; }
+
+int config_encode_slice_rows(void) { return encodeSliceRows; }
+
+bool config_latency_probe(void) { return latencyProbe; }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "directory_cache.h"
+
+#include "fsdir.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/// @brief Number of directories remembered. The root, the pending spill directory, today and a few days around it.
+#define CACHE_ENTRIES 8
+
+/// @brief Longest path remembered. /PNGs/YYYY/MM/DD is 16. Anything longer just isn't cached.
+#define CACHE_PATH_LENGTH 48
+
+// clang-format off
+typedef struct
+{
+    /// @brief Known directories without trailing slashes. Empty entries are unused.
+    char paths[CACHE_ENTRIES][CACHE_PATH_LENGTH];
+
+    /// @brief Entry the next directory replaces.
+    int next;
+} DirectoryCache;
+// clang-format on
+
+/// @brief The cache.
+static DirectoryCache cache = {0};
+
+// Defined at bottom.
+
+/// @brief Returns whether the directory passed is in the cache.
+/// @param path Path without a trailing slash.
+/// @param length Length of the path.
+static inline bool cache_contains(const char *path, size_t length);
+
+/// @brief Adds the directory passed to the cache, replacing the oldest entry.
+/// @param path Path without a trailing slash.
+/// @param length Length of the path.
+static inline void cache_add(const char *path, size_t length);
+
+bool directory_cache_ensure(FsFileSystem *filesystem, const char *path)
+{
+    // Same directory with or without the slash.
+    size_t length = strlen(path);
+    while (length > 1 && path[length - 1] == '/') { --length; }
+    if (length >= FS_MAX_PATH) { return false; }
+    if (cache_contains(path, length)) { return true; }
+
+    // Walk down from the root. Parents are usually cached already, so a new day only checks and creates the last one.
+    char subPath[FS_MAX_PATH];
+    for (size_t end = 1; end <= length; end++)
+    {
+        if (end < length && path[end] != '/') { continue; }
+        if (cache_contains(path, end)) { continue; }
+
+        snprintf(subPath, FS_MAX_PATH, "%.*s", (int)end, path);
+        const bool exists = directory_exists(filesystem, subPath) || create_directory(filesystem, subPath);
+        if (!exists) { return false; }
+
+        cache_add(path, end);
+    }
+
+    return true;
+}
+
+void directory_cache_clear(void) { memset(&cache, 0, sizeof(DirectoryCache)); }
+
+static inline bool cache_contains(const char *path, size_t length)
+{
+    if (length >= CACHE_PATH_LENGTH) { return false; }
+
+    for (int i = 0; i < CACHE_ENTRIES; i++)
+    {
+        if (strncmp(cache.paths[i], path, length) == 0 && cache.paths[i][length] == '\0') { return true; }
+    }
+
+    return false;
+}
+
+static inline void cache_add(const char *path, size_t length)
+{
+    if (length >= CACHE_PATH_LENGTH) { return; }
+
+    snprintf(cache.paths[cache.next], CACHE_PATH_LENGTH, "%.*s", (int)length, path);
+    cache.next = (cache.next + 1) % CACHE_ENTRIES;
+}
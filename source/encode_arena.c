@@ -0,0 +1,78 @@
+#include "encode_arena.h"
+
+#include <malloc.h>
+
+/// @brief Every allocation is rounded up to this so it's aligned the same as malloc's.
+#define ARENA_ALIGNMENT 16
+
+// clang-format off
+typedef struct
+{
+    /// @brief The block. NULL when there isn't an arena.
+    uint8_t *memory;
+
+    /// @brief Size of the block.
+    size_t size;
+
+    /// @brief Bytes handed out so far. Nothing is ever given back until the end, so this is also the peak.
+    size_t used;
+
+    /// @brief Bytes that went to the heap instead.
+    size_t overflow;
+} EncodeArena;
+// clang-format on
+
+/// @brief The arena. There's only ever one capture encoding at a time.
+static EncodeArena arena = {0};
+
+bool encode_arena_begin(size_t size)
+{
+    // Don't lose track of an arena that was never ended.
+    encode_arena_end(NULL);
+
+    arena.memory = memalign(ARENA_ALIGNMENT, size);
+    arena.size   = arena.memory ? size : 0;
+    return arena.memory != NULL;
+}
+
+void *encode_arena_alloc(size_t size)
+{
+    const size_t alignedSize = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (arena.memory && alignedSize <= arena.size - arena.used)
+    {
+        void *pointer = arena.memory + arena.used;
+        arena.used += alignedSize;
+        return pointer;
+    }
+
+    // Running out isn't an error, it just means the arena was sized too small for this capture.
+    void *pointer = malloc(size);
+    if (pointer) { arena.overflow += size; }
+    return pointer;
+}
+
+void encode_arena_free(void *pointer)
+{
+    const bool inArena = arena.memory && (uint8_t *)pointer >= arena.memory && (uint8_t *)pointer < arena.memory + arena.size;
+    if (!inArena) { free(pointer); }
+}
+
+void encode_arena_end(EncodeArenaStats *statsOut)
+{
+    if (statsOut) { *statsOut = (EncodeArenaStats){.size = arena.size, .peak = arena.used, .overflow = arena.overflow}; }
+
+    free(arena.memory);
+    arena = (EncodeArena){0};
+}
+
+voidpf encode_arena_zalloc(voidpf opaque, uInt items, uInt size)
+{
+    (void)opaque;
+    return encode_arena_alloc((size_t)items * size);
+}
+
+void encode_arena_zfree(voidpf opaque, voidpf address)
+{
+    (void)opaque;
+    encode_arena_free(address);
+}
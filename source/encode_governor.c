@@ -0,0 +1,193 @@
+#include "encode_governor.h"
+
+#include "config.h"
+
+/// @brief How long the probe sleeps for. Nanoseconds.
+static const uint64_t PROBE_PERIOD_NS = 1000000;
+
+/// @brief A frame at 60 FPS. Nanoseconds.
+static const uint64_t FRAME_NS = 16666667;
+
+/// @brief Stack size of the probe. libnx takes the TLS and reent out of it too. It only sleeps and adds.
+#define PROBE_STACK_SIZE 0x2000
+
+// clang-format off
+typedef struct
+{
+    /// @brief Probe thread, and whether it's running.
+    Thread thread;
+    bool running;
+
+    /// @brief Guards everything below.
+    Mutex lock;
+
+    /// @brief Set while the capture worker is encoding.
+    bool active;
+
+    /// @brief Set when the probe should exit.
+    bool stopping;
+
+    /// @brief What the probe has seen since the last encode began or ended.
+    EncodeLatency encoding, idle;
+} LatencyProbe;
+// clang-format on
+
+/// @brief The probe. Only ever one.
+static LatencyProbe probe = {0};
+
+/// @brief Stack of the probe. It's static so measuring doesn't take from the heap the encoders need.
+static uint8_t probeStack[PROBE_STACK_SIZE] __attribute__((aligned(0x1000)));
+
+/// @brief Rows per slice of the encode in progress, and rows encoded since the last yield.
+static int sliceRows = 0, sliceUsed = 0;
+
+/// @brief How the last encode shared its core.
+static EncodeGovernorStats governorStats = {0};
+
+// Defined at bottom.
+
+/// @brief Probe thread function.
+/// @param arg Unused.
+static void governor_probe(void *arg);
+
+/// @brief Returns whether PNGShot.json lets the process run threads on the core passed.
+static bool governor_core_allowed(int core);
+
+/// @brief Adds a wake that came late by the ticks passed.
+static inline void governor_add_wake(EncodeLatency *latency, uint64_t lateTicks);
+
+bool encode_governor_start_probe(void)
+{
+    mutexInit(&probe.lock);
+    probe.stopping = false;
+
+    // The probe stands in for anything else on the encode core at the encoder's priority. Anything at a higher one would
+    // get the core from the encoder right away and never see it.
+    const bool created = R_SUCCEEDED(threadCreate(&probe.thread,
+                                                  governor_probe,
+                                                  NULL,
+                                                  probeStack,
+                                                  PROBE_STACK_SIZE,
+                                                  config_encode_priority(),
+                                                  encode_governor_core()));
+    if (!created) { return false; }
+
+    if (R_FAILED(threadStart(&probe.thread)))
+    {
+        threadClose(&probe.thread);
+        return false;
+    }
+
+    probe.running = true;
+    return true;
+}
+
+void encode_governor_stop_probe(void)
+{
+    if (!probe.running) { return; }
+
+    mutexLock(&probe.lock);
+    probe.stopping = true;
+    mutexUnlock(&probe.lock);
+
+    threadWaitForExit(&probe.thread);
+    threadClose(&probe.thread);
+    probe.running = false;
+}
+
+int encode_governor_core(void)
+{
+    // Cores PNGShot.json doesn't allow are left for the default one. Only a GAME_CORES=1 build has the game's cores.
+    const int core = config_encode_core();
+    return core >= 0 && governor_core_allowed(core) ? core : -2;
+}
+
+int encode_governor_worker_core(int worker)
+{
+    uint64_t coreMask = 0;
+    if (R_FAILED(svcGetInfo(&coreMask, InfoType_CoreMask, CUR_PROCESS_HANDLE, 0))) { return -1; }
+
+    // Without EncodeCore, the encoder is on the default core, same as whoever's asking.
+    const int encodeCore  = encode_governor_core();
+    const int encoderCore = encodeCore < 0 ? (int)svcGetCurrentProcessorNumber() : encodeCore;
+    coreMask &= ~(1ULL << encoderCore);
+
+    const int coreCount = __builtin_popcountll(coreMask);
+    if (coreCount == 0) { return -1; }
+
+    int skip = worker % coreCount;
+    for (int core = 0; coreMask; core++, coreMask >>= 1)
+    {
+        if ((coreMask & 1) && skip-- == 0) { return core; }
+    }
+    return -1;
+}
+
+void encode_governor_begin(void)
+{
+    sliceRows     = config_encode_slice_rows();
+    sliceUsed     = 0;
+    governorStats = (EncodeGovernorStats){0};
+
+    // Whatever the probe saw since the last encode is what this one gets compared to. Without it, it's all zeros.
+    mutexLock(&probe.lock);
+    governorStats.idle = probe.idle;
+    probe.idle         = (EncodeLatency){0};
+    probe.active       = true;
+    mutexUnlock(&probe.lock);
+}
+
+void encode_governor_row(void)
+{
+    if (sliceRows == 0 || ++sliceUsed < sliceRows) { return; }
+    sliceUsed = 0;
+
+    // Anything on the core that's ready gets it, even at a lower priority. If nothing is, this comes right back.
+    const uint64_t yieldBegin = armGetSystemTick();
+    svcSleepThread(YieldType_ToAnyThread);
+    governorStats.yieldTicks += armGetSystemTick() - yieldBegin;
+    ++governorStats.yields;
+}
+
+void encode_governor_end(void)
+{
+    mutexLock(&probe.lock);
+    governorStats.encoding = probe.encoding;
+    probe.encoding         = (EncodeLatency){0};
+    probe.active           = false;
+    mutexUnlock(&probe.lock);
+}
+
+const EncodeGovernorStats *encode_governor_get_stats(void) { return &governorStats; }
+
+static void governor_probe(void *arg)
+{
+    const uint64_t periodTicks = armNsToTicks(PROBE_PERIOD_NS);
+    while (true)
+    {
+        const uint64_t sleepBegin = armGetSystemTick();
+        svcSleepThread(PROBE_PERIOD_NS);
+        const uint64_t sleptTicks = armGetSystemTick() - sleepBegin;
+        const uint64_t lateTicks  = sleptTicks > periodTicks ? sleptTicks - periodTicks : 0;
+
+        mutexLock(&probe.lock);
+        governor_add_wake(probe.active ? &probe.encoding : &probe.idle, lateTicks);
+        const bool stopping = probe.stopping;
+        mutexUnlock(&probe.lock);
+        if (stopping) { return; }
+    }
+}
+
+static inline void governor_add_wake(EncodeLatency *latency, uint64_t lateTicks)
+{
+    ++latency->wakes;
+    latency->lateTicks += lateTicks;
+    if (lateTicks > latency->maxLateTicks) { latency->maxLateTicks = lateTicks; }
+    if (armTicksToNs(lateTicks) > FRAME_NS) { ++latency->missedFrames; }
+}
+
+static bool governor_core_allowed(int core)
+{
+    uint64_t coreMask = 0;
+    return R_SUCCEEDED(svcGetInfo(&coreMask, InfoType_CoreMask, CUR_PROCESS_HANDLE, 0)) && (coreMask & (1ULL << core));
+}
@@ -0,0 +1,289 @@
+#include "fast_deflate.h"
+
+#include <malloc.h>
+#include <stdbool.h>
+#include <string.h>
+#include <zlib.h>
+
+/// @brief Number of hash table entries. Must be a power of two.
+#define HASH_SIZE 0x1000
+
+/// @brief Shortest match worth coding. Three bytes with the fixed codes is 12 to 22 bits instead of 24 to 27.
+#define MIN_MATCH 3
+
+/// @brief Longest match deflate can code.
+#define MAX_MATCH 258
+
+/// @brief End of block symbol.
+#define END_OF_BLOCK 256
+
+// clang-format off
+struct FastDeflate
+{
+    /// @brief Bits waiting to be written. Deflate packs from the least significant bit up.
+    uint64_t bitBuffer;
+
+    /// @brief Number of bits in bitBuffer.
+    uint32_t bitCount;
+
+    /// @brief Running Adler-32 of the uncompressed data.
+    uint32_t adler;
+
+    /// @brief Stream position of window[0].
+    uint32_t windowBase;
+
+    /// @brief Size of the previous row at the front of window.
+    size_t previousSize;
+
+    /// @brief Last stream position each hash was seen at.
+    uint32_t hashTable[HASH_SIZE];
+
+    /// @brief Previous row followed by the current row. Matches can't reach any further back than this.
+    uint8_t window[FAST_DEFLATE_MAX_ROW * 2];
+};
+// clang-format on
+
+/// @brief Bit reversed fixed Huffman code and length for every literal/length symbol.
+static uint16_t literalCodes[288];
+static uint8_t literalLengths[288];
+
+/// @brief Whether or not the tables above are filled.
+static bool tablesReady = false;
+
+// Defined at bottom.
+
+/// @brief Fills the fixed code tables.
+static void build_tables(void);
+
+/// @brief Reverses the bit order of a code so it can be packed least significant bit first.
+static inline uint32_t reverse_bits(uint32_t code, int length);
+
+/// @brief Returns how many bytes at current match the ones at reference, up to maxLength.
+static inline size_t match_length(const uint8_t *current, const uint8_t *reference, size_t maxLength);
+
+/// @brief Adds bits to the buffer, writing out full words. count can't be more than 32.
+static inline void put_bits(FastDeflate *deflater, uint32_t bits, uint32_t count, uint8_t **out);
+
+/// @brief Writes a literal.
+static inline void put_literal(FastDeflate *deflater, uint8_t literal, uint8_t **out);
+
+/// @brief Writes a length and distance pair.
+static inline void put_match(FastDeflate *deflater, size_t length, size_t distance, uint8_t **out);
+
+FastDeflate *fast_deflate_create(void)
+{
+    if (!tablesReady) { build_tables(); }
+
+    FastDeflate *deflater = calloc(1, sizeof(FastDeflate));
+    if (!deflater) { return NULL; }
+
+    // zlib header for a 32K window with the fastest level flag, then the final fixed Huffman block header. That's 19
+    // bits, so nothing gets written until the first row.
+    deflater->bitBuffer = 0x0178 | (0x03 << 16);
+    deflater->bitCount  = 19;
+    deflater->adler     = adler32(0, NULL, 0);
+
+    return deflater;
+}
+
+size_t fast_deflate_row(FastDeflate *deflater, const uint8_t *row, size_t size, uint8_t *out)
+{
+    uint8_t *outBegin = out;
+    uint8_t *window   = deflater->window;
+
+    deflater->adler = adler32(deflater->adler, row, size);
+
+    // The new row goes right behind the previous one so matches can run back into it.
+    const size_t begin = deflater->previousSize;
+    const size_t end   = begin + size;
+    memcpy(window + begin, row, size);
+
+    size_t i = begin;
+    while (i < end)
+    {
+        const size_t remaining = end - i;
+        const size_t maxLength = remaining < MAX_MATCH ? remaining : MAX_MATCH;
+        size_t bestLength      = 0;
+        size_t bestDistance    = 0;
+
+        if (remaining >= MIN_MATCH)
+        {
+            // Runs. Filtered rows are mostly these.
+            if (i >= 1)
+            {
+                bestLength   = match_length(window + i, window + i - 1, maxLength);
+                bestDistance = 1;
+            }
+
+            // The same spot in the previous row.
+            if (i >= size && bestLength < maxLength)
+            {
+                const size_t length = match_length(window + i, window + i - size, maxLength);
+                if (length > bestLength)
+                {
+                    bestLength   = length;
+                    bestDistance = size;
+                }
+            }
+
+            // Whatever was last seen with the same four bytes.
+            if (remaining >= 4 && bestLength < maxLength)
+            {
+                uint32_t value;
+                memcpy(&value, window + i, sizeof(uint32_t));
+
+                const uint32_t hash      = (value * 2654435761u) >> 20;
+                const uint32_t position  = deflater->windowBase + i;
+                const uint32_t candidate = deflater->hashTable[hash];
+                deflater->hashTable[hash] = position;
+
+                if (candidate >= deflater->windowBase && candidate < position)
+                {
+                    const size_t distance = position - candidate;
+                    const size_t length   = match_length(window + i, window + i - distance, maxLength);
+                    if (length > bestLength)
+                    {
+                        bestLength   = length;
+                        bestDistance = distance;
+                    }
+                }
+            }
+        }
+
+        if (bestLength >= MIN_MATCH)
+        {
+            put_match(deflater, bestLength, bestDistance, &out);
+            i += bestLength;
+        }
+        else { put_literal(deflater, window[i++], &out); }
+    }
+
+    // The current row becomes the previous row.
+    memmove(window, window + begin, size);
+    deflater->windowBase += begin;
+    deflater->previousSize = size;
+
+    return out - outBegin;
+}
+
+size_t fast_deflate_finish(FastDeflate *deflater, uint8_t *out)
+{
+    uint8_t *outBegin = out;
+
+    put_bits(deflater, literalCodes[END_OF_BLOCK], literalLengths[END_OF_BLOCK], &out);
+
+    // Whatever's left, padded out to a byte.
+    while (deflater->bitCount > 0)
+    {
+        *out++ = deflater->bitBuffer & 0xFF;
+        deflater->bitBuffer >>= 8;
+        deflater->bitCount = deflater->bitCount > 8 ? deflater->bitCount - 8 : 0;
+    }
+
+    // Adler-32 is big endian.
+    *out++ = deflater->adler >> 24;
+    *out++ = deflater->adler >> 16;
+    *out++ = deflater->adler >> 8;
+    *out++ = deflater->adler;
+
+    return out - outBegin;
+}
+
+void fast_deflate_destroy(FastDeflate *deflater) { free(deflater); }
+
+static void build_tables(void)
+{
+    // RFC 1951 3.2.6.
+    for (int i = 0; i < 288; i++)
+    {
+        int code, length;
+        if (i < 144) { code = 0x30 + i, length = 8; }
+        else if (i < 256) { code = 0x190 + i - 144, length = 9; }
+        else if (i < 280) { code = i - 256, length = 7; }
+        else { code = 0xC0 + i - 280, length = 8; }
+
+        literalCodes[i]   = reverse_bits(code, length);
+        literalLengths[i] = length;
+    }
+
+    tablesReady = true;
+}
+
+static inline uint32_t reverse_bits(uint32_t code, int length)
+{
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; i++, code >>= 1) { reversed = (reversed << 1) | (code & 1); }
+    return reversed;
+}
+
+static inline size_t match_length(const uint8_t *current, const uint8_t *reference, size_t maxLength)
+{
+    size_t length = 0;
+    for (; length + sizeof(uint64_t) <= maxLength; length += sizeof(uint64_t))
+    {
+        uint64_t a, b;
+        memcpy(&a, current + length, sizeof(uint64_t));
+        memcpy(&b, reference + length, sizeof(uint64_t));
+
+        // Little endian, so the lowest set bit is the first byte that differs.
+        if (a != b) { return length + (__builtin_ctzll(a ^ b) >> 3); }
+    }
+
+    while (length < maxLength && current[length] == reference[length]) { length++; }
+    return length;
+}
+
+static inline void put_bits(FastDeflate *deflater, uint32_t bits, uint32_t count, uint8_t **out)
+{
+    deflater->bitBuffer |= (uint64_t)bits << deflater->bitCount;
+    deflater->bitCount += count;
+    if (deflater->bitCount < 32) { return; }
+
+    // Little endian, so this writes the low bytes first.
+    const uint32_t word = deflater->bitBuffer;
+    memcpy(*out, &word, sizeof(uint32_t));
+    *out += sizeof(uint32_t);
+    deflater->bitBuffer >>= 32;
+    deflater->bitCount -= 32;
+}
+
+static inline void put_literal(FastDeflate *deflater, uint8_t literal, uint8_t **out)
+{
+    put_bits(deflater, literalCodes[literal], literalLengths[literal], out);
+}
+
+static inline void put_match(FastDeflate *deflater, size_t length, size_t distance, uint8_t **out)
+{
+    // Length symbol and extra bits. 258 has a symbol of its own.
+    const uint32_t lengthValue = length - 3;
+    uint32_t symbol, extraBits, extraValue;
+    if (length == MAX_MATCH) { symbol = 285, extraBits = 0, extraValue = 0; }
+    else if (lengthValue < 8) { symbol = 257 + lengthValue, extraBits = 0, extraValue = 0; }
+    else
+    {
+        const uint32_t log = 31 - __builtin_clz(lengthValue);
+        extraBits          = log - 2;
+        symbol             = 257 + 4 * (log - 1) + ((lengthValue >> extraBits) & 3);
+        extraValue         = lengthValue & ((1u << extraBits) - 1);
+    }
+
+    const uint32_t lengthBits  = literalCodes[symbol] | (extraValue << literalLengths[symbol]);
+    const uint32_t lengthCount = literalLengths[symbol] + extraBits;
+
+    // Distance codes are all five bits.
+    const uint32_t distanceValue = distance - 1;
+    uint32_t distanceCode, distanceExtraBits;
+    if (distanceValue < 4) { distanceCode = distanceValue, distanceExtraBits = 0; }
+    else
+    {
+        const uint32_t log = 31 - __builtin_clz(distanceValue);
+        distanceExtraBits  = log - 1;
+        distanceCode       = 2 * log + ((distanceValue >> distanceExtraBits) & 1);
+    }
+    const uint32_t distanceExtra = distanceValue & ((1u << distanceExtraBits) - 1);
+    const uint32_t distanceBits  = reverse_bits(distanceCode, 5) | (distanceExtra << 5);
+
+    // Each of these is 18 bits at most, so they're written separately to stay under 32.
+    put_bits(deflater, lengthBits, lengthCount, out);
+    put_bits(deflater, distanceBits, 5 + distanceExtraBits, out);
+}
@@ -0,0 +1,164 @@
+#include "frame_hash.h"
+
+#include "capture.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+// The hash is the XXH3 accumulate step without the scrambling: every 8 bytes are added to the neighbouring lane and the
+// product of their two halves, after mixing with a key, is added to their own lane. It isn't meant to stand up to anyone
+// trying to collide it, only to tell apart frames that came out of the same game a few seconds apart.
+
+/// @brief Keys the data is mixed with. Any odd looking constants work.
+static const uint64_t HASH_KEYS[8] = {0xBE4BA423396CFEB8,
+                                      0x1CAD21F72C81017C,
+                                      0xDB979083E96DD4DE,
+                                      0x1F67B3B7A4A44072,
+                                      0x78E5C0CC4EE679CB,
+                                      0x2172FFCC7DD05A82,
+                                      0x8E2443F7744608B8,
+                                      0x4C263A81E69035E0};
+
+/// @brief Recent captures, oldest first once it wraps.
+static FrameSignature history[FRAME_HASH_HISTORY] = {0};
+
+/// @brief Number of valid entries in history.
+static int historyCount = 0;
+
+/// @brief Where the next capture is remembered.
+static int historyNext = 0;
+
+// Defined at bottom.
+
+/// @brief Returns whether a recent capture matches the signature passed.
+/// @param signature Signature to look for.
+/// @param wholeFrame Whether to compare the frame hash too, or only the samples.
+static inline bool history_contains(const FrameSignature *signature, bool wholeFrame);
+
+/// @brief Reads and hashes the whole frame.
+static bool hash_whole_frame(uint8_t *rowBuffer, uint64_t *hashOut);
+
+void frame_hash_init(FrameHash *hash)
+{
+    // Starting from the keys means a run of zero rows doesn't hash to zero.
+    memcpy(hash->lanes, HASH_KEYS, sizeof(hash->lanes));
+}
+
+#if defined(__ARM_NEON)
+void frame_hash_update(FrameHash *hash, const uint8_t *data, size_t size)
+{
+    uint64x2_t lanes[4], keys[4];
+    for (int i = 0; i < 4; i++)
+    {
+        lanes[i] = vld1q_u64(hash->lanes + i * 2);
+        keys[i]  = vld1q_u64(HASH_KEYS + i * 2);
+    }
+
+    for (const uint8_t *end = data + size; data < end; data += FRAME_HASH_BLOCK_SIZE)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            // vextq swaps the two halves, which is what puts each word in its neighbour's lane.
+            const uint64x2_t words = vreinterpretq_u64_u8(vld1q_u8(data + i * 16));
+            const uint64x2_t keyed = veorq_u64(words, keys[i]);
+            lanes[i]               = vaddq_u64(lanes[i], vextq_u64(words, words, 1));
+            lanes[i]               = vmlal_u32(lanes[i], vmovn_u64(keyed), vshrn_n_u64(keyed, 32));
+        }
+    }
+
+    for (int i = 0; i < 4; i++) { vst1q_u64(hash->lanes + i * 2, lanes[i]); }
+}
+#else
+void frame_hash_update(FrameHash *hash, const uint8_t *data, size_t size)
+{
+    for (const uint8_t *end = data + size; data < end; data += FRAME_HASH_BLOCK_SIZE)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            uint64_t word;
+            memcpy(&word, data + i * 8, sizeof(uint64_t));
+
+            const uint64_t keyed = word ^ HASH_KEYS[i];
+            hash->lanes[i ^ 1] += word;
+            hash->lanes[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+        }
+    }
+}
+#endif
+
+uint64_t frame_hash_final(const FrameHash *hash)
+{
+    // Every lane goes through a multiply and shift so a difference in any of them reaches every bit of the result.
+    uint64_t result = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        result = (result ^ hash->lanes[i]) * 0x9E3779B97F4A7C15;
+        result ^= result >> 29;
+    }
+
+    return result;
+}
+
+bool frame_hash_is_duplicate(FrameSignature *signatureOut)
+{
+    uint8_t *rowBuffer = malloc(CAPTURE_ROW_SIZE);
+    if (!rowBuffer) { return false; }
+
+    // Rows spread evenly down the frame. A menu cursor or a clock moving almost always touches one of them.
+    FrameHash sampleHash;
+    frame_hash_init(&sampleHash);
+    for (int i = 0; i < CAPTURE_SAMPLE_ROWS; i++)
+    {
+        if (!capture_read_row(rowBuffer, capture_sample_row(i)))
+        {
+            free(rowBuffer);
+            return false;
+        }
+
+        frame_hash_update(&sampleHash, rowBuffer, CAPTURE_ROW_SIZE);
+    }
+    signatureOut->sampleHash = frame_hash_final(&sampleHash);
+
+    // Only when the samples match is it worth reading the rest.
+    const bool duplicate = history_contains(signatureOut, false) &&
+                           hash_whole_frame(rowBuffer, &signatureOut->frameHash) && history_contains(signatureOut, true);
+
+    free(rowBuffer);
+    return duplicate;
+}
+
+void frame_hash_remember(const FrameSignature *signature)
+{
+    history[historyNext] = *signature;
+    historyNext          = (historyNext + 1) % FRAME_HASH_HISTORY;
+    if (historyCount < FRAME_HASH_HISTORY) { ++historyCount; }
+}
+
+static inline bool history_contains(const FrameSignature *signature, bool wholeFrame)
+{
+    for (int i = 0; i < historyCount; i++)
+    {
+        const bool samplesMatch = history[i].sampleHash == signature->sampleHash;
+        if (samplesMatch && (!wholeFrame || history[i].frameHash == signature->frameHash)) { return true; }
+    }
+
+    return false;
+}
+
+static bool hash_whole_frame(uint8_t *rowBuffer, uint64_t *hashOut)
+{
+    FrameHash hash;
+    frame_hash_init(&hash);
+    for (int i = 0; i < CAPTURE_HEIGHT; i++)
+    {
+        if (!capture_read_row(rowBuffer, i)) { return false; }
+        frame_hash_update(&hash, rowBuffer, CAPTURE_ROW_SIZE);
+    }
+
+    *hashOut = frame_hash_final(&hash);
+    return true;
+}
@@ -1,9 +1,23 @@
 #include "fsdir.h"
 
 #include "FSFILE.h"
+#include "capture_trace.h"
 
+#include <malloc.h>
+#include <stdio.h>
 #include <string.h>
 
+/// @brief Number of entries read from a directory at a time.
+#define READ_BATCH 8
+
+/// @brief Size the buffer directory_list collects names in starts at. It doubles from there.
+#define NAMES_START_SIZE 0x400
+
+// Defined at bottom.
+
+/// @brief Adds a name to the end of the buffer passed, growing it if it has to.
+static bool append_name(char **names, size_t *size, size_t *capacity, const char *name);
+
 bool directory_exists(FsFileSystem *filesystem, const char *path)
 {
     // Directory flags.
@@ -11,12 +25,20 @@ bool directory_exists(FsFileSystem *filesystem, const char *path)
 
     FsDir testDir;
     const bool openFailed = R_FAILED(fsFsOpenDirectory(filesystem, path, DIR_OPEN_FLAGS, &testDir));
+    capture_trace_count_ipc(1);
     if (openFailed) { return false; }
 
     fsDirClose(&testDir);
+    capture_trace_count_ipc(1);
     return true;
 }
 
+bool create_directory(FsFileSystem *filesystem, const char *path)
+{
+    capture_trace_count_ipc(1);
+    return R_SUCCEEDED(fsFsCreateDirectory(filesystem, path));
+}
+
 bool create_directory_recursively(FsFileSystem *filesystem, const char *path)
 {
     // Check this first to ensure we weren't passed an empty path or only /
@@ -30,8 +52,8 @@ bool create_directory_recursively(FsFileSystem *filesystem, const char *path)
     const char *pathOffset = path;
     while ((pathOffset = strchr(pathOffset + 1, '/')))
     {
-        // subPath.
-        strncpy(subPath, path, pathOffset - path);
+        // subPath. strncpy wouldn't terminate it.
+        snprintf(subPath, FS_MAX_PATH, "%.*s", (int)(pathOffset - path), path);
 
         // Try to create it.
         const bool exists      = directory_exists(filesystem, subPath);
@@ -40,4 +62,109 @@ bool create_directory_recursively(FsFileSystem *filesystem, const char *path)
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+bool directory_find_file(FsFileSystem *filesystem, const char *path, const char *extension, char *nameOut, size_t nameSize)
+{
+    FsDirectoryEntry *entries = malloc(sizeof(FsDirectoryEntry) * READ_BATCH);
+    if (!entries) { return false; }
+
+    FsDir searchDir;
+    const bool openFailed = R_FAILED(fsFsOpenDirectory(filesystem, path, FsDirOpenMode_ReadFiles, &searchDir));
+    capture_trace_count_ipc(1);
+    if (openFailed)
+    {
+        free(entries);
+        return false;
+    }
+
+    bool found = false;
+    int64_t readCount;
+    while (!found && R_SUCCEEDED(fsDirRead(&searchDir, &readCount, READ_BATCH, entries)) && readCount > 0)
+    {
+        capture_trace_count_ipc(1);
+        for (int64_t i = 0; !found && i < readCount; i++)
+        {
+            const char *entryExtension = strrchr(entries[i].name, '.');
+            found                      = entryExtension && strcmp(entryExtension + 1, extension) == 0;
+            if (found) { snprintf(nameOut, nameSize, "%s", entries[i].name); }
+        }
+    }
+
+    fsDirClose(&searchDir);
+    capture_trace_count_ipc(1);
+    free(entries);
+    return found;
+}
+
+bool directory_list(FsFileSystem *filesystem,
+                    const char *path,
+                    const char *extension,
+                    const char *after,
+                    char **namesOut,
+                    size_t *countOut)
+{
+    FsDirectoryEntry *entries = malloc(sizeof(FsDirectoryEntry) * READ_BATCH);
+    if (!entries) { return false; }
+
+    FsDir listDir;
+    const int openMode    = extension ? FsDirOpenMode_ReadFiles : FsDirOpenMode_ReadDirs;
+    const bool openFailed = R_FAILED(fsFsOpenDirectory(filesystem, path, openMode, &listDir));
+    capture_trace_count_ipc(1);
+    if (openFailed)
+    {
+        free(entries);
+        return false;
+    }
+
+    char *names     = NULL;
+    size_t size     = 0;
+    size_t capacity = 0;
+    size_t count    = 0;
+    bool appended   = true;
+    int64_t readCount;
+    while (appended && R_SUCCEEDED(fsDirRead(&listDir, &readCount, READ_BATCH, entries)) && readCount > 0)
+    {
+        capture_trace_count_ipc(1);
+        for (int64_t i = 0; appended && i < readCount; i++)
+        {
+            const char *entryExtension = strrchr(entries[i].name, '.');
+            const bool matches         = !extension || (entryExtension && strcmp(entryExtension + 1, extension) == 0);
+            if (!matches || strcmp(entries[i].name, after) <= 0) { continue; }
+
+            appended = append_name(&names, &size, &capacity, entries[i].name);
+            ++count;
+        }
+    }
+
+    fsDirClose(&listDir);
+    capture_trace_count_ipc(1);
+    free(entries);
+
+    if (!appended)
+    {
+        free(names);
+        return false;
+    }
+
+    *namesOut = names;
+    *countOut = count;
+    return true;
+}
+
+static bool append_name(char **names, size_t *size, size_t *capacity, const char *name)
+{
+    const size_t length = strlen(name) + 1;
+    if (*size + length > *capacity)
+    {
+        const size_t newCapacity = *capacity ? *capacity * 2 : NAMES_START_SIZE;
+        char *newNames           = realloc(*names, newCapacity);
+        if (!newNames) { return false; }
+        *names    = newNames;
+        *capacity = newCapacity;
+    }
+
+    memcpy(*names + *size, name, length);
+    *size += length;
+    return true;
+}
@@ -1,5 +1,7 @@
 #include "init.h"
 
+#include "directory_cache.h"
+
 bool init_open_album_directory(FsFileSystem *albumOut)
 {
     bool opened = R_SUCCEEDED(fsOpenImageDirectoryFileSystem(albumOut, FsImageDirectoryId_Sd));
@@ -8,25 +10,13 @@ bool init_open_album_directory(FsFileSystem *albumOut)
     return opened;
 }
 
+bool init_open_sd_card(FsFileSystem *sdmcOut) { return R_SUCCEEDED(fsOpenSdCardFileSystem(sdmcOut)); }
+
 bool init_create_pngshot_directory(FsFileSystem *albumDir)
 {
     // Path.
-    static const char *PNGSHOT_DIR       = "/PNGs";
-    static const uint32_t DIR_OPEN_FLAGS = FsDirOpenMode_ReadDirs | FsDirOpenMode_ReadFiles;
-
-    // Check if it already exists.
-    FsDir handle;
-    const bool opened = R_SUCCEEDED(fsFsOpenDirectory(albumDir, PNGSHOT_DIR, DIR_OPEN_FLAGS, &handle));
-    // It exists already. Just return true.
-    if (opened)
-    {
-        fsDirClose(&handle);
-        return true;
-    }
-
-    // If we're here, we need to create it.
-    const bool createError = R_FAILED(fsFsCreateDirectory(albumDir, PNGSHOT_DIR));
-    if (createError) { return false; }
+    static const char *PNGSHOT_DIR = "/PNGs";
 
-    return true;
+    // This checks for it and creates it if it's missing. Either way it's remembered so captures don't check again.
+    return directory_cache_ensure(albumDir, PNGSHOT_DIR);
 }
\ No newline at end of file
@@ -1,75 +1,254 @@
 #include "jpeg.h"
 
 #include "FSFILE.h"
+#include "capture_trace.h"
 
+#include <malloc.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
+// Album JPEGs are named YYYYMMDDHHMMSSCC-<32 hex digits>.jpg. The first part is the local time of the press plus a counter
+// for presses in the same second, the hex is a hash of the title that was running. Once a title's hash has been seen, the
+// JPEG for the next capture can be named outright and deleted without listing the directory at all. Presses in the same
+// second as the last one get the counter after its. Only the first
+// capture of a title, or one that took unusually long to get to, falls back to reading the directory, and that reads the
+// names in batches instead of asking for every file's timestamp.
+
+/// @brief Length of the time and counter at the beginning of an album name.
+#define ALBUM_STAMP_LENGTH 16
+
+/// @brief Length of the title hash.
+#define ALBUM_HASH_LENGTH 32
+
+/// @brief Length of a whole album JPEG name.
+#define ALBUM_NAME_LENGTH (ALBUM_STAMP_LENGTH + 1 + ALBUM_HASH_LENGTH + 4)
+
+/// @brief Number of title hashes remembered.
+#define KNOWN_HASHES 4
+
+/// @brief Seconds between the press and the PNG's timestamp that are tried by name before giving up and listing.
+#define PROBE_SECONDS 3
+
+/// @brief Directory entries read per fsDirRead. Every entry is 0x310 bytes.
+#define READ_BATCH 8
+
+// clang-format off
+typedef struct
+{
+    /// @brief Title hashes seen recently, most recent first.
+    char hashes[KNOWN_HASHES][ALBUM_HASH_LENGTH + 1];
+
+    /// @brief Number of valid hashes.
+    int hashCount;
+
+    /// @brief Seconds between the press and the PNG's timestamp last time. Queued captures take longer.
+    int lastDelay;
+
+    /// @brief Time of the press whose JPEG was deleted last, and its counter.
+    uint64_t lastPress;
+    int lastCounter;
+} JpegIndex;
+// clang-format on
+
+/// @brief What's been learned from past captures.
+static JpegIndex jpegIndex = {0};
+
 // Defined at bottom.
 
-/// @brief Returns the absolute time difference between the two timestamps passed.
-/// @param stampA First stamp to compare.
-/// @param stampB Second stamp to compare.
-static inline uint64_t absolute_time_difference(uint64_t stampA, uint64_t stampB);
+/// @brief Tries to delete the JPEG by name with every known title hash, closest to the capture time first.
+/// @param albumDir Album filesystem.
+/// @param timestamp Time of the capture.
+/// @param localTime Local time of the capture.
+/// @return True if the JPEG was found and deleted.
+static bool delete_by_name(FsFileSystem *albumDir, uint64_t timestamp, const struct tm *localTime);
+
+/// @brief Lists the day's directory and deletes the JPEG closest to the capture time. The index learns its title hash.
+/// @param albumDir Album filesystem.
+/// @param timestamp Time of the capture.
+/// @param localTime Local time of the capture.
+/// @return False if the directory couldn't be opened.
+static bool delete_by_listing(FsFileSystem *albumDir, uint64_t timestamp, const struct tm *localTime);
+
+/// @brief Parses the time out of an album name and returns it as seconds into the day. -1 if it isn't an album JPEG.
+static int album_name_seconds(const char *name);
+
+/// @brief Puts the title hash of the album name passed at the front of the index, and remembers its press.
+/// @param name Album JPEG name.
+/// @param timestamp Time of the capture.
+/// @param delay Seconds between the press and the capture.
+static void remember_jpeg(const char *name, uint64_t timestamp, int delay);
+
+/// @brief Returns the number of seconds into the day of the time passed.
+static inline int seconds_of_day(const struct tm *time);
 
 bool jpeg_delete_capture(FsFileSystem *albumDir, uint64_t timestamp)
 {
     // Get the current local time of the system.
     struct tm localTime = *localtime((const time_t *)&timestamp);
 
-    // This is what we're using in the end.
-    uint64_t lowestDelta         = UINT64_MAX;
-    char targetJpeg[FS_MAX_PATH] = {0};
+    if (delete_by_name(albumDir, timestamp, &localTime)) { return true; }
+
+    return delete_by_listing(albumDir, timestamp, &localTime);
+}
+
+static bool delete_by_name(FsFileSystem *albumDir, uint64_t timestamp, const struct tm *localTime)
+{
+    if (jpegIndex.hashCount == 0) { return false; }
+
+    // Closest to the capture time first, the same as the listing picks, so the first hit is the right one. Queued captures
+    // can take longer than PROBE_SECONDS, so last time's delay goes last when it's past them. Each miss is a single failed
+    // delete.
+    int delays[PROBE_SECONDS * 2 + 2] = {0};
+    int delayCount                    = 1;
+    for (int delay = 1; delay <= PROBE_SECONDS; delay++)
+    {
+        delays[delayCount++] = delay;
+        delays[delayCount++] = -delay;
+    }
+    if (jpegIndex.lastDelay > PROBE_SECONDS) { delays[delayCount++] = jpegIndex.lastDelay; }
+
+    const int captureSeconds = seconds_of_day(localTime);
+    for (int i = 0; i < delayCount; i++)
+    {
+        // The JPEG is in the same day's directory as the capture. Anything across midnight is left to the listing.
+        const int pressSeconds = captureSeconds - delays[i];
+        if (pressSeconds < 0 || pressSeconds >= 24 * 3600) { continue; }
+
+        // The last press's JPEG is gone already, so another in the same second is the one after it.
+        const int counter = timestamp - delays[i] == jpegIndex.lastPress ? jpegIndex.lastCounter + 1 : 0;
+        if (counter > 99) { continue; }
+
+        // Every title seen recently, most recent first.
+        for (int hash = 0; hash < jpegIndex.hashCount; hash++)
+        {
+            char jpegPath[FS_MAX_PATH] = {0};
+            snprintf(jpegPath,
+                     FS_MAX_PATH,
+                     "/%04d/%02d/%02d/%04d%02d%02d%02d%02d%02d%02d-%s.jpg",
+                     localTime->tm_year + 1900,
+                     localTime->tm_mon + 1,
+                     localTime->tm_mday,
+                     localTime->tm_year + 1900,
+                     localTime->tm_mon + 1,
+                     localTime->tm_mday,
+                     pressSeconds / 3600,
+                     pressSeconds / 60 % 60,
+                     pressSeconds % 60,
+                     counter,
+                     jpegIndex.hashes[hash]);
+
+            capture_trace_count_ipc(1);
+            if (R_FAILED(fsFsDeleteFile(albumDir, jpegPath))) { continue; }
+
+            remember_jpeg(strrchr(jpegPath, '/') + 1, timestamp, delays[i]);
+            return true;
+        }
+    }
+
+    return false;
+}
 
+static bool delete_by_listing(FsFileSystem *albumDir, uint64_t timestamp, const struct tm *localTime)
+{
     // Construct the path.
     char targetPath[FS_MAX_PATH] = {0};
-    snprintf(targetPath, FS_MAX_PATH, "/%04d/%02d/%02d", localTime.tm_year + 1900, localTime.tm_mon + 1, localTime.tm_mday);
+    snprintf(targetPath,
+             FS_MAX_PATH,
+             "/%04d/%02d/%02d",
+             localTime->tm_year + 1900,
+             localTime->tm_mon + 1,
+             localTime->tm_mday);
+
+    FsDirectoryEntry *entries = malloc(sizeof(FsDirectoryEntry) * READ_BATCH);
+    if (!entries) { return false; }
 
     // Try to open the target directory.
     FsDir targetDir;
     const bool openError = R_FAILED(fsFsOpenDirectory(albumDir, targetPath, FsDirOpenMode_ReadFiles, &targetDir));
-    if (openError) { return false; }
-
-    // Loop through the directory.
-    int64_t readCount;
-    FsDirectoryEntry entry;
-    while (R_SUCCEEDED(fsDirRead(&targetDir, &readCount, 1, &entry)) && readCount > 0)
+    capture_trace_count_ipc(1);
+    if (openError)
     {
-        // Get where the extension begins. If the extension isn't jpg, don't bother.
-        const char *extension = strchr(entry.name, '.');
-        if (!extension) { continue; }
+        free(entries);
+        return false;
+    }
 
-        // Ensure the extension is jpg before wasting time on it.
-        ++extension;
-        if (strcmp(extension, "jpg") != 0) { continue; }
+    // The names carry the time, so nothing past the listing itself is needed to find the closest one.
+    const int captureSeconds = seconds_of_day(localTime);
+    int lowestDelta          = -1;
+    int bestDelay            = 0;
+    char targetJpeg[ALBUM_NAME_LENGTH + 1] = {0};
 
-        // Construct our final target.
-        char stampPath[FS_MAX_PATH] = {0};
-        snprintf(stampPath, FS_MAX_PATH, "%s/%s", targetPath, entry.name);
+    int64_t readCount;
+    while (R_SUCCEEDED(fsDirRead(&targetDir, &readCount, READ_BATCH, entries)) && readCount > 0)
+    {
+        capture_trace_count_ipc(1);
+        for (int64_t i = 0; i < readCount; i++)
+        {
+            const int nameSeconds = album_name_seconds(entries[i].name);
+            if (nameSeconds < 0) { continue; }
 
-        // Read the timestamp.
-        FsTimeStampRaw rawStamp;
-        const bool stampError = R_FAILED(fsFsGetFileTimeStampRaw(albumDir, stampPath, &rawStamp));
-        if (stampError) { continue; }
+            const int delay = captureSeconds - nameSeconds;
+            const int delta = delay < 0 ? -delay : delay;
+            if (lowestDelta >= 0 && delta >= lowestDelta) { continue; }
 
-        const uint64_t delta = absolute_time_difference(timestamp, rawStamp.created);
-        if (delta < lowestDelta)
-        {
             lowestDelta = delta;
-            // To do: Look into a different solution for this. Difficult, but not impossible.
-            strncpy(targetJpeg, stampPath, FS_MAX_PATH);
+            bestDelay   = delay;
+            memcpy(targetJpeg, entries[i].name, ALBUM_NAME_LENGTH);
         }
     }
 
-    // Close the handle.
+    // The read that came back empty and the close.
     fsDirClose(&targetDir);
-    if (lowestDelta != UINT64_MAX) { FSFILE_Delete(albumDir, targetJpeg); }
+    capture_trace_count_ipc(2);
+    free(entries);
+    if (lowestDelta < 0) { return true; }
+
+    char jpegPath[FS_MAX_PATH] = {0};
+    snprintf(jpegPath, FS_MAX_PATH, "%s/%s", targetPath, targetJpeg);
+    if (FSFILE_Delete(albumDir, jpegPath)) { remember_jpeg(targetJpeg, timestamp, bestDelay); }
 
     return true;
 }
 
-static inline uint64_t absolute_time_difference(uint64_t stampA, uint64_t stampB)
+static int album_name_seconds(const char *name)
 {
-    return stampA > stampB ? stampA - stampB : stampB - stampA;
-}
\ No newline at end of file
+    if (strlen(name) != ALBUM_NAME_LENGTH || name[ALBUM_STAMP_LENGTH] != '-') { return -1; }
+    if (strcmp(name + ALBUM_NAME_LENGTH - 4, ".jpg") != 0) { return -1; }
+
+    for (int i = 0; i < ALBUM_STAMP_LENGTH; i++)
+    {
+        if (name[i] < '0' || name[i] > '9') { return -1; }
+    }
+
+    // HHMMSS follows YYYYMMDD.
+    const int hours   = (name[8] - '0') * 10 + (name[9] - '0');
+    const int minutes = (name[10] - '0') * 10 + (name[11] - '0');
+    const int seconds = (name[12] - '0') * 10 + (name[13] - '0');
+    return hours * 3600 + minutes * 60 + seconds;
+}
+
+static void remember_jpeg(const char *name, uint64_t timestamp, int delay)
+{
+    jpegIndex.lastDelay   = delay > 0 ? delay : 0;
+    jpegIndex.lastPress   = timestamp - delay;
+    jpegIndex.lastCounter = (name[14] - '0') * 10 + (name[15] - '0');
+
+    // The hash can be one of the index's own, which the move below would overwrite.
+    char newHash[ALBUM_HASH_LENGTH];
+    memcpy(newHash, name + ALBUM_STAMP_LENGTH + 1, ALBUM_HASH_LENGTH);
+
+    // Already known ones move to the front, new ones push the oldest out.
+    int position = jpegIndex.hashCount < KNOWN_HASHES ? jpegIndex.hashCount : KNOWN_HASHES - 1;
+    for (int i = 0; i < jpegIndex.hashCount; i++)
+    {
+        if (strncmp(jpegIndex.hashes[i], newHash, ALBUM_HASH_LENGTH) == 0) { position = i; }
+    }
+    if (position == jpegIndex.hashCount) { ++jpegIndex.hashCount; }
+
+    memmove(jpegIndex.hashes[1], jpegIndex.hashes[0], (ALBUM_HASH_LENGTH + 1) * position);
+    memcpy(jpegIndex.hashes[0], newHash, ALBUM_HASH_LENGTH);
+    jpegIndex.hashes[0][ALBUM_HASH_LENGTH] = '\0';
+}
+
+static inline int seconds_of_day(const struct tm *time) { return time->tm_hour * 3600 + time->tm_min * 60 + time->tm_sec; }
@@ -1,7 +1,9 @@
 #include "FSFILE.h"
+#include "capture_queue.h"
+#include "capture_trace.h"
 #include "config.h"
+#include "encode_governor.h"
 #include "init.h"
-#include "png_capture.h"
 
 #include <stdbool.h>
 #include <stdio.h>
@@ -71,6 +73,13 @@ void __appExit(void)
     hidsysExit();
 }
 
+// Nanoseconds until the tick passed. 0 if it's already gone by.
+static inline uint64_t nano_until(uint64_t tick)
+{
+    const uint64_t now = armGetSystemTick();
+    return tick > now ? armTicksToNs(tick - now) : 0;
+}
+
 int main(void)
 {
     // Thresholds for capturing.
@@ -90,16 +99,74 @@ int main(void)
     if (!init_open_album_directory(&albumDir)) { return -1; }
     else if (!init_create_pngshot_directory(&albumDir)) { return -2; }
 
-    bool captureHeld    = false; // Tracks whether the button was held.
-    uint64_t beginTicks = 0;     // The beginning tick number when the button was first pressed.
+    // The trace goes next to the config. Captures work the same if it can't be opened.
+    FsFileSystem sdmc;
+    if (config_trace_captures() && init_open_sd_card(&sdmc)) { capture_trace_start(&sdmc); }
+
+    // Only measures. Captures are the same without it.
+    if (config_latency_probe()) { encode_governor_start_probe(); }
+
+    if (!capture_queue_start(&albumDir)) { return -3; }
+
+    const bool holdToRecord = config_record_rate() > 0; // Whether holding the button records.
+    bool captureHeld        = false;                    // Tracks whether the button was held.
+    bool recording          = false;                    // Tracks whether the button is being held to record.
+    bool pastGhost          = false;                    // Set once the ghost press at startup has come and gone.
+    uint64_t beginTicks     = 0;                        // The beginning tick number when the button was first pressed.
+
+    // Timelapse shots are timed off the same wait. 0 means there aren't any.
+    const uint64_t timelapseTicks = armNsToTicks((uint64_t)config_timelapse_interval() * 1000000000ULL);
+    uint64_t nextTimelapse        = armGetSystemTick() + timelapseTicks;
     while (true)
     {
-        // Wait for the capture button to be pressed.
-        const bool capturePressed = R_SUCCEEDED(eventWait(&captureButton, UINT64_MAX));
+        // Wait for the capture button to be pressed. While it's down, only wait as long as a press can be when holding it
+        // records. The ghost press never gets a release, so it can't be waited on like this. Recordings have the worker
+        // to themselves, so the timelapse waits for them to end.
+        const bool waitForHold      = holdToRecord && captureHeld && pastGhost;
+        const bool waitForTimelapse = timelapseTicks > 0 && !recording;
+        const uint64_t holdTimeout  = waitForHold ? nano_until(beginTicks + armNsToTicks(UPPER_THRESHOLD)) : UINT64_MAX;
+        const uint64_t lapseTimeout = waitForTimelapse ? nano_until(nextTimelapse) : UINT64_MAX;
+        const uint64_t timeout      = holdTimeout < lapseTimeout ? holdTimeout : lapseTimeout;
+        const bool capturePressed   = R_SUCCEEDED(eventWait(&captureButton, timeout));
+
+        if (!capturePressed && timeout != UINT64_MAX)
+        {
+            // Shots that came due during a recording are dropped rather than all taken at once.
+            const uint64_t expiredTicks = armGetSystemTick();
+            if (waitForTimelapse && expiredTicks >= nextTimelapse)
+            {
+                capture_queue_timelapse();
+                nextTimelapse += timelapseTicks;
+                if (nextTimelapse <= expiredTicks) { nextTimelapse = expiredTicks + timelapseTicks; }
+            }
+
+            // Still down when a press would've been over. That's a hold. The release that ends it is swallowed even if
+            // the recording was dropped, so it isn't taken for the start of another hold.
+            if (waitForHold && armTicksToNs(expiredTicks - beginTicks) >= UPPER_THRESHOLD)
+            {
+                capture_queue_record();
+                recording   = true;
+                captureHeld = false;
+            }
+            continue;
+        }
+
         const bool captureCleared = R_SUCCEEDED(eventClear(&captureButton));
         // I guess technically it's possible for the timeout to expire.
         if (!capturePressed && !captureCleared) { continue; }
 
+        // Any press or release counts, not just the ones that end up as captures.
+        capture_queue_notify_activity();
+        pastGhost = pastGhost || captureHeld;
+
+        // Letting go ends the recording and nothing else.
+        if (recording)
+        {
+            capture_queue_stop_recording();
+            recording = false;
+            continue;
+        }
+
         // Calculate this stuff.
         const uint64_t systemTicks = armGetSystemTick();
         const uint64_t elapsedNano = armTicksToNs(systemTicks - beginTicks);
@@ -115,7 +182,8 @@ int main(void)
         }
         else if (validPress)
         {
-            png_capture(&albumDir);
+            // This only queues it. The capture itself happens on the worker so the next press isn't missed.
+            capture_queue_push();
             captureHeld = false;
         }
         else
@@ -0,0 +1,236 @@
+#include "png_adaptive.h"
+
+#include "capture.h"
+#include "png_filter.h"
+
+#include <malloc.h>
+#include <zlib.h>
+
+/// @brief Size of an unfiltered RGB row.
+#define RGB_ROW_SIZE (CAPTURE_WIDTH * 3)
+
+/// @brief Filtered samples with at least this much entropy are treated as noise. Bits per byte, in 1/256ths.
+#define NOISE_ENTROPY (7 * 256)
+
+/// @brief Filtered samples where at least this percentage of bytes repeat the one before are treated as runs.
+#define RUNS_PERCENT 85
+
+// clang-format off
+/// @brief One step of a ladder.
+typedef struct
+{
+    uint8_t level, strategy;
+
+    /// @brief How long deflating takes relative to the first step of the ladder, in tenths.
+    uint16_t cost;
+} LadderStep;
+// clang-format on
+
+// Ladders, cheapest first. The costs are from deflating the host bench's corpus. Z_RLE only ever looks one byte back,
+// which is nearly free and beats levels 1 - 3 on frames that are mostly runs. On noise nothing beats it, every level
+// comes out the same size. Z_FILTERED came out the same size or a little larger than the default on every frame, so it
+// isn't on any of them.
+static const LadderStep RUNS_LADDER[] = {{1, Z_RLE, 10},
+                                         {4, Z_DEFAULT_STRATEGY, 24},
+                                         {5, Z_DEFAULT_STRATEGY, 28},
+                                         {6, Z_DEFAULT_STRATEGY, 40},
+                                         {7, Z_DEFAULT_STRATEGY, 58},
+                                         {8, Z_DEFAULT_STRATEGY, 86},
+                                         {9, Z_DEFAULT_STRATEGY, 143}};
+
+static const LadderStep DETAILED_LADDER[] = {{1, Z_DEFAULT_STRATEGY, 10},
+                                             {2, Z_DEFAULT_STRATEGY, 11},
+                                             {4, Z_DEFAULT_STRATEGY, 16},
+                                             {5, Z_DEFAULT_STRATEGY, 26},
+                                             {6, Z_DEFAULT_STRATEGY, 50},
+                                             {7, Z_DEFAULT_STRATEGY, 82},
+                                             {8, Z_DEFAULT_STRATEGY, 200},
+                                             {9, Z_DEFAULT_STRATEGY, 258}};
+
+static const LadderStep NOISE_LADDER[] = {{1, Z_RLE, 10}};
+
+// clang-format off
+/// @brief Ladders in the same order as PngContentClasses.
+static const struct
+{
+    const LadderStep *steps;
+    int count;
+} LADDERS[PngContentClassCount] = {{RUNS_LADDER,     sizeof(RUNS_LADDER) / sizeof(RUNS_LADDER[0])},
+                                   {DETAILED_LADDER, sizeof(DETAILED_LADDER) / sizeof(DETAILED_LADDER[0])},
+                                   {NOISE_LADDER,    sizeof(NOISE_LADDER) / sizeof(NOISE_LADDER[0])}};
+// clang-format on
+
+/// @brief Ticks per 10 units of cost for each class, learned from past captures. 0 until a class has been encoded once.
+static uint64_t ticksPerCost[PngContentClassCount] = {0};
+
+/// @brief How often each setting was used.
+static PngAdaptiveUsage usage = {0};
+
+// Defined at bottom.
+
+/// @brief Returns the step of the ladder for the class passed that's expected to fit in the budget.
+static const LadderStep *choose_step(int contentClass, uint64_t budgetTicks);
+
+/// @brief Returns the row filter to use going by what each one cost on the samples.
+static int choose_filter(const uint64_t filterCosts[PngFilterAdaptive + 1]);
+
+/// @brief Returns the sum of the absolute value of the filtered row as signed bytes. The filter type byte is skipped.
+static inline uint64_t filtered_cost(const uint8_t *filtered);
+
+/// @brief Returns log2 of the value passed, in 1/256ths. Close enough to tell noise from anything else.
+static inline uint32_t log2_fixed(uint32_t value);
+
+bool png_adaptive_choose(uint64_t budgetTicks, PngEncodeChoice *choiceOut)
+{
+    // One RGBA row from the stream, the two RGB rows it's filtered from and somewhere for the output of each filter.
+    uint8_t *buffers = malloc(CAPTURE_ROW_SIZE + RGB_ROW_SIZE * 2 + PNG_FILTER_ROW_SIZE * 2);
+    if (!buffers) { return false; }
+
+    uint8_t *rgbaRow     = buffers;
+    uint8_t *previousRow = rgbaRow + CAPTURE_ROW_SIZE;
+    uint8_t *currentRow  = previousRow + RGB_ROW_SIZE;
+    uint8_t *adaptiveRow = currentRow + RGB_ROW_SIZE;
+    uint8_t *filteredRow = adaptiveRow + PNG_FILTER_ROW_SIZE;
+
+    uint64_t filterCosts[PngFilterAdaptive + 1] = {0};
+    uint32_t histogram[256]                     = {0};
+    uint32_t repeats                            = 0;
+    for (int i = 0; i < CAPTURE_SAMPLE_ROWS; i++)
+    {
+        // Up, Average and Paeth need the row above, so rows are read in pairs.
+        const int rowIndex = capture_sample_row(i);
+        if (!capture_read_row(rgbaRow, rowIndex - 1))
+        {
+            free(buffers);
+            return false;
+        }
+        png_filter_rgba_row(rgbaRow, previousRow, NULL, filteredRow, PngFilterNone);
+
+        if (!capture_read_row(rgbaRow, rowIndex))
+        {
+            free(buffers);
+            return false;
+        }
+        png_filter_rgba_row(rgbaRow, currentRow, previousRow, adaptiveRow, PngFilterAdaptive);
+        filterCosts[PngFilterAdaptive] += filtered_cost(adaptiveRow);
+
+        for (int filter = PngFilterNone; filter < PngFilterAdaptive; filter++)
+        {
+            png_filter_row(currentRow, previousRow, filteredRow, filter);
+            filterCosts[filter] += filtered_cost(filteredRow);
+        }
+
+        // What deflate will see is close to the adaptive output, whichever filter ends up used.
+        for (int j = 1; j < PNG_FILTER_ROW_SIZE; j++)
+        {
+            ++histogram[adaptiveRow[j]];
+            repeats += j > 1 && adaptiveRow[j] == adaptiveRow[j - 1];
+        }
+    }
+    free(buffers);
+
+    // Entropy is log2(n) - sum(count * log2(count)) / n.
+    const uint32_t sampleSize = CAPTURE_SAMPLE_ROWS * (PNG_FILTER_ROW_SIZE - 1);
+    uint64_t weightedLog2     = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (histogram[i]) { weightedLog2 += (uint64_t)histogram[i] * log2_fixed(histogram[i]); }
+    }
+    const uint32_t entropy = log2_fixed(sampleSize) - weightedLog2 / sampleSize;
+
+    int contentClass = PngContentDetailed;
+    if (entropy >= NOISE_ENTROPY) { contentClass = PngContentNoise; }
+    else if (repeats * 100 >= sampleSize * RUNS_PERCENT) { contentClass = PngContentRuns; }
+
+    const LadderStep *step = choose_step(contentClass, budgetTicks);
+    *choiceOut             = (PngEncodeChoice){.level        = step->level,
+                                               .strategy     = step->strategy,
+                                               .rowFilter    = choose_filter(filterCosts),
+                                               .contentClass = contentClass};
+    return true;
+}
+
+void png_adaptive_learn(const PngEncodeChoice *choice, uint64_t deflateTicks)
+{
+    if (choice->contentClass < 0) { return; }
+
+    // Find the cost of the step that was used. Going over the budget is worse than coming in under it, so a capture slower
+    // than expected is believed right away, and a faster one is folded in the same way PNG sizes are.
+    const int contentClass = choice->contentClass;
+    for (int i = 0; i < LADDERS[contentClass].count; i++)
+    {
+        const LadderStep *step = &LADDERS[contentClass].steps[i];
+        if (step->level != choice->level || step->strategy != choice->strategy) { continue; }
+
+        const uint64_t measured    = deflateTicks * 10 / step->cost;
+        const uint64_t average     = ticksPerCost[contentClass];
+        ticksPerCost[contentClass] = measured > average ? measured : (average * 3 + measured) / 4;
+        break;
+    }
+
+    ++usage.levels[choice->level];
+    ++usage.strategies[choice->strategy];
+    ++usage.rowFilters[choice->rowFilter];
+    ++usage.contentClasses[contentClass];
+}
+
+const PngAdaptiveUsage *png_adaptive_get_usage(void) { return &usage; }
+
+static const LadderStep *choose_step(int contentClass, uint64_t budgetTicks)
+{
+    // Nothing to go by yet. The cheapest step is the one least likely to blow the budget, and it teaches the speed.
+    const LadderStep *steps = LADDERS[contentClass].steps;
+    if (ticksPerCost[contentClass] == 0) { return &steps[0]; }
+
+    int chosen = 0;
+    for (int i = 1; i < LADDERS[contentClass].count; i++)
+    {
+        if (ticksPerCost[contentClass] * steps[i].cost / 10 <= budgetTicks) { chosen = i; }
+    }
+
+    return &steps[chosen];
+}
+
+static int choose_filter(const uint64_t filterCosts[PngFilterAdaptive + 1])
+{
+    int best = PngFilterNone;
+    for (int filter = PngFilterSub; filter < PngFilterAdaptive; filter++)
+    {
+        if (filterCosts[filter] < filterCosts[best]) { best = filter; }
+    }
+
+    // Filters are in order of how much work they are. The first one within 2% of the best is as good as it.
+    int fixed = best;
+    for (int filter = PngFilterNone; filter < best; filter++)
+    {
+        if (filterCosts[filter] <= filterCosts[best] + filterCosts[best] / 50)
+        {
+            fixed = filter;
+            break;
+        }
+    }
+
+    // Trying every filter on every row is only worth it when it beats the single best one by more than 5%.
+    const uint64_t adaptiveCost = filterCosts[PngFilterAdaptive];
+    return filterCosts[fixed] <= adaptiveCost + adaptiveCost / 20 ? fixed : PngFilterAdaptive;
+}
+
+static inline uint64_t filtered_cost(const uint8_t *filtered)
+{
+    uint64_t cost = 0;
+    for (int i = 1; i < PNG_FILTER_ROW_SIZE; i++)
+    {
+        const int8_t value = filtered[i];
+        cost += value < 0 ? -value : value;
+    }
+
+    return cost;
+}
+
+static inline uint32_t log2_fixed(uint32_t value)
+{
+    // The whole part is the top bit. The fraction is the next 8 bits below it, which is linear between powers of two.
+    const int whole         = 31 - __builtin_clz(value);
+    const uint32_t fraction = whole >= 8 ? (value >> (whole - 8)) & 0xFF : (value << (8 - whole)) & 0xFF;
+    return whole * 256 + fraction;
+}
@@ -1,9 +1,22 @@
 #include "FSFILE.h"
+#include "capture.h"
+#include "capture_trace.h"
 #include "config.h"
-#include "fsdir.h"
+#include "directory_cache.h"
+#include "encode_arena.h"
+#include "encode_governor.h"
+#include "frame_hash.h"
 #include "jpeg.h"
+#include "png_adaptive.h"
+#include "png_capture.h"
+#include "png_chunk.h"
+#include "png_filter.h"
+#include "png_idat.h"
+#include "png_palette.h"
+#include "png_parallel.h"
+#include "png_thumbnail.h"
+#include "row_pipeline.h"
 
-#include <arm_neon.h>
 #include <ctype.h> // Include for tolower
 #include <malloc.h>
 #include <png.h>
@@ -13,28 +26,102 @@
 #include <string.h>
 #include <switch.h>
 #include <time.h>
+#include <zlib.h>
 
 // These are used in a couple of different places.
-static const int SCREENSHOT_WIDTH  = 1280;
-static const int SCREENSHOT_HEIGHT = 720;
+static const int SCREENSHOT_WIDTH  = CAPTURE_WIDTH;
+static const int SCREENSHOT_HEIGHT = CAPTURE_HEIGHT;
 
-// This is a temporary name used to write the PNG. It's moved and renamed afterwards.
-static const char *TEMPORARY_NAME = "/PNGs/temp.png";
+// Size of an unfiltered RGB row.
+static const size_t RGB_ROW_SIZE = CAPTURE_WIDTH * 3;
+
+/// @brief Writes are gathered and written to the SD in blocks this size. libpng and the chunk writers hand over a few KB at
+/// a time, and every one of those would be an IPC call otherwise. The serial encoder, its row ring and this all have to fit
+/// in INNER_HEAP_SIZE together, which is what keeps it from being bigger.
+static const size_t PNG_WRITE_BLOCK_SIZE = 0x4000;
+
+/// @brief zlib memory level of the capture's stream when a thumbnail is written alongside it. One under the default halves
+/// the hash tables, which is what makes room in the heap for the thumbnail's stream.
+static const int THUMBNAIL_CAPTURE_MEM_LEVEL = 7;
+
+/// @brief Timing of the last capture.
+static PngCaptureStats captureStats = {0};
+
+/// @brief Running average of the size of recent PNGs. 0 until the first one is saved.
+static int64_t pngSizeAverage = 0;
 
 // Defined at bottom.
 
+/// @brief Encodes whatever capture_open_stream or capture_open_spill opened and moves the PNG into place. The stream or
+/// spill is closed before this returns.
+/// @param filesystem Album filesystem.
+/// @param temporaryPath Path the PNG is written to first.
+/// @param width Width of the capture.
+/// @param height Height of the capture.
+/// @param timestamp Optional. Timestamp to name the PNG after. The PNG's own creation time is used if this is NULL.
+/// @param encodeMode One of PngEncodeModes. Only the native encoder goes by it.
+/// @param pressed Whether the button was pressed for this capture. Only those have a system JPEG to delete.
+/// @return True if the PNG was saved. False on failure or if it was skipped as a duplicate.
+static bool png_capture_save(FsFileSystem *filesystem,
+                             const char *temporaryPath,
+                             uint64_t width,
+                             uint64_t height,
+                             const uint64_t *timestamp,
+                             int encodeMode,
+                             bool pressed);
+
+/// @brief Captures the current screenshot stream. This is png_capture and png_capture_unattended.
+/// @return True if the PNG was saved.
+static bool png_capture_live(FsFileSystem *filesystem, const char *temporaryPath, int encodeMode, bool pressed);
+
+/// @brief Writes the capture with the native encoder, serially. Rows are read on the second thread, filtered here and
+/// deflated straight into IDAT chunks.
+/// @param file File to write to.
+/// @param settings zlib settings and row filter to use.
+/// @param palette Optional. Analyzed palette to write the capture as gray or indexed with. NULL writes RGB.
+/// @param hash Optional. Every row is added to this as it's read.
+/// @param speed Whether to deflate with fast_deflate instead of zlib.
+/// @param thumbnail Optional. Every row is added to this before it's filtered. It's dropped if adding to it fails.
+/// @param writer Optional. Writer to deflate with instead of opening one. It's closed or freed before this returns.
+/// @return True on success. False on failure.
+static bool png_encode_native(FSFILE *file,
+                              const PngEncodeChoice *settings,
+                              const PngPalette *palette,
+                              FrameHash *hash,
+                              bool speed,
+                              PngThumbnail *thumbnail,
+                              IdatWriter *writer);
+
+/// @brief Writes the capture with the native encoder, deflating strips on several threads.
+/// @param file File to write to.
+/// @param settings zlib settings and row filter to use.
+/// @param hash Optional. Every row is added to this as it's read.
+/// @return True on success. False on failure.
+static bool png_encode_parallel(FSFILE *file, const PngEncodeChoice *settings, FrameHash *hash);
+
+/// @brief Writes the capture through libpng. This is the fallback for any geometry the native encoder doesn't handle.
+/// @param file File to write to.
+/// @param width Width of the capture.
+/// @param height Height of the capture.
+/// @return True on success. False on failure.
+static bool png_encode_libpng(FSFILE *file, uint32_t width, uint32_t height);
+
+/// @brief Returns how much of the encode arena libpng needs for a capture of the width passed.
+static inline size_t png_libpng_arena_size(uint32_t width);
+
+/// @brief Returns the size to create the next PNG with, going by the size of recent ones.
+static inline int64_t png_predicted_size(void);
+
+/// @brief Clears captureStats. Settings, color type and backend are -1 until something's encoded.
+static inline void png_capture_reset_stats(void);
+
 // These are needed to make libpng work with the raw FS commands.
 static void png_write_function(png_structp writingStruct, png_bytep pngData, png_size_t length);
 static void png_flush_function(png_structp writingStruct);
 
-/// @brief Attempts to open the capssc capture stream. Returns false on failure.
-static inline bool capssc_open_stream();
-
-/// @brief Reads a row from the stream into the buffer passed.
-/// @param buffer Row buffer to read into.
-/// @param rowIndex Current row height-wise to read.
-/// @return True on success. False on failure.
-static inline bool capssc_read_row(void *buffer, int rowIndex);
+// These put libpng's allocations, and the zlib stream it creates, in the encode arena.
+static png_voidp png_malloc_function(png_structp writingStruct, png_alloc_size_t size);
+static void png_free_function(png_structp writingStruct, png_voidp pointer);
 
 /// @brief Initializes the structs for PNG writing. Returns false on failure.
 /// @param writeStruct Pointer to writing struct pointer.
@@ -49,74 +136,573 @@ static inline void png_cleanup(png_structpp writeStruct, png_infopp infoStruct);
 /// @brief Inits the I/O functions for writing the png and writes info to the png.
 /// @param writeStruct PNG write struct we're using.
 /// @param file FSFILE we're writing to.
-static inline void png_init_io_write_info(png_structp writeStruct, png_infop infoStruct, FSFILE *file);
-
-/// @brief Shifts all of the bytes over in the row passed and "deletes" the alpha value from the screenshot since it's not
-/// needed.
-static inline void rgba_strip_alpha(restrict png_bytep row);
-
-/// @brief Creates the end target directory for the screenshot to go to.
+/// @param width Width of the capture.
+/// @param height Height of the capture.
+static inline void png_init_io_write_info(png_structp writeStruct,
+                                          png_infop infoStruct,
+                                          FSFILE *file,
+                                          uint32_t width,
+                                          uint32_t height);
+
+/// @brief Creates the end target directory for the screenshot to go to, unless it's already known to exist.
 /// @param timestamp Timestamp to use to generate the path.
 static inline bool create_target_directory(FsFileSystem *filesystem, uint64_t timestamp);
 
 /// @brief Renames (or moves) the screenshot to its final destination.
 /// @param filesystem Filesystem the screenshot was created on.
+/// @param temporaryPath Path the screenshot was written to.
 /// @param timestamp Timestamp to use to name the screenshot.
-static inline void move_rename_screenshot(FsFileSystem *filesystem, uint64_t timestamp);
+/// @param pathOut Optional. Receives the path the screenshot was moved to.
+/// @return True on success. False on failure.
+static inline bool move_rename_screenshot(FsFileSystem *filesystem,
+                                          const char *temporaryPath,
+                                          uint64_t timestamp,
+                                          char *pathOut);
+
+/// @brief Writes the path of the thumbnail that goes with the PNG path passed. That's the same path with _thumb before .png.
+/// @param pngPath Path of the PNG.
+/// @param pathOut FS_MAX_PATH buffer to write the path to.
+static inline void thumbnail_path(const char *pngPath, char *pathOut);
 
 // Same as above, but safer and less memory hungry for a Switch sysmodule
-void png_capture(FsFileSystem *filesystem)
+void png_capture(FsFileSystem *filesystem, const char *temporaryPath)
 {
-    // File size for a full, uncompressed capture.
-    static const int64_t FILE_SIZE = 0x2A4470;
+    png_capture_live(filesystem, temporaryPath, config_encode_mode(), true);
+}
 
-    png_structp writeStruct = NULL;
-    png_infop infoStruct    = NULL;
-    FSFILE *pngFile         = NULL;
-    uint8_t rowBuffer[SCREENSHOT_WIDTH * sizeof(uint32_t)];
+bool png_capture_unattended(FsFileSystem *filesystem, const char *temporaryPath, bool speed)
+{
+    return png_capture_live(filesystem, temporaryPath, speed ? PngEncodeSpeed : config_encode_mode(), false);
+}
+
+bool png_capture_spill(FsFileSystem *filesystem, const char *spillPath, const char *temporaryPath)
+{
+    const uint64_t captureBegin = armGetSystemTick();
+    png_capture_reset_stats();
+    capture_trace_begin();
+
+    // The spill was created when the button was pressed, so that's what the PNG is named after.
+    uint64_t timestamp, width, height;
+    const bool opened = FSFILE_GetTimeStamp(filesystem, spillPath, &timestamp) &&
+                        capture_open_spill(filesystem, spillPath, &width, &height);
+
+    const bool saved =
+        opened && png_capture_save(filesystem, temporaryPath, width, height, &timestamp, config_encode_mode(), true);
+    if (saved) { FSFILE_Delete(filesystem, spillPath); }
+
+    captureStats.totalTicks = armGetSystemTick() - captureBegin;
+    capture_trace_end();
+    return saved;
+}
+
+void png_capture_warm_up(void)
+{
+    // Only the serial encoder with zlib uses the warm stream. Everything else needs the heap it would hold.
+    const bool serial = config_encode_workers() <= 1 || encode_governor_worker_core(0) < 0;
+    const bool used   = config_encoder() == PngEncoderNative && serial &&
+                        config_encode_mode() != PngEncodeSpeed && config_thumbnail_scale() == 0;
+    if (used) { idat_writer_warm_up(); }
+}
+
+const PngCaptureStats *png_capture_get_stats(void) { return &captureStats; }
+
+bool png_capture_move_into_place(FsFileSystem *filesystem, const char *temporaryPath, uint64_t timestamp, char *pathOut)
+{
+    // Ensure the final directory exists, then move the screenshot.
+    if (create_target_directory(filesystem, timestamp) &&
+        move_rename_screenshot(filesystem, temporaryPath, timestamp, pathOut))
+    {
+        return true;
+    }
+
+    // The directory could have been deleted since it was cached. Check for real once before giving up.
+    directory_cache_clear();
+    return create_target_directory(filesystem, timestamp) &&
+           move_rename_screenshot(filesystem, temporaryPath, timestamp, pathOut);
+}
+
+static bool png_capture_live(FsFileSystem *filesystem, const char *temporaryPath, int encodeMode, bool pressed)
+{
+    const uint64_t captureBegin = armGetSystemTick();
+    png_capture_reset_stats();
+    capture_trace_begin();
+
+    // Open the stream and get the geometry of what's in it.
+    uint64_t width, height;
+    if (!capture_open_stream(&width, &height))
+    {
+        capture_trace_end();
+        return false;
+    }
+
+    // Live captures are named after when the PNG was created.
+    const bool saved        = png_capture_save(filesystem, temporaryPath, width, height, NULL, encodeMode, pressed);
+    captureStats.totalTicks = armGetSystemTick() - captureBegin;
+    capture_trace_end();
+    return saved;
+}
+
+static bool png_capture_save(FsFileSystem *filesystem,
+                             const char *temporaryPath,
+                             uint64_t width,
+                             uint64_t height,
+                             const uint64_t *timestamp,
+                             int encodeMode,
+                             bool pressed)
+{
+    // Nothing from the last capture carries over, whichever way this one ends.
+    png_capture_reset_stats();
+
+    // Attempt to open temporary output file. It's created at about the size recent PNGs came out to rather than the size of
+    // an uncompressed one, so the SD doesn't have to find room for one that big every time.
+    captureStats.preallocatedSize = png_predicted_size();
+    FSFILE *pngFile = FSFILE_OpenWriteBuffered(filesystem, temporaryPath, captureStats.preallocatedSize, PNG_WRITE_BLOCK_SIZE);
+    if (!pngFile)
+    {
+        capture_close_stream();
+        return false;
+    }
+    capture_trace_mark(CaptureTraceOpen);
+
+    // The native encoder's header is precomputed, so it only works for the one geometry. Everything else goes to libpng.
+    const bool fixedGeometry = width == SCREENSHOT_WIDTH && height == SCREENSHOT_HEIGHT;
+    const bool useNative     = fixedGeometry && config_encoder() == PngEncoderNative;
+    captureStats.encoder     = useNative ? PngEncoderNative : PngEncoderLibpng;
+
+    // Speed mode is cheap enough that it isn't worth splitting up. Without a core to spare, neither is anything else.
+    const bool useParallel = useNative && config_encode_workers() > 1 && encodeMode != PngEncodeSpeed &&
+                             encode_governor_worker_core(0) >= 0;
+
+    // Spills can only be read in order, so only live captures are checked. The native encoders hash the rest as they go.
+    const bool checkDuplicates = !timestamp && useNative && config_duplicate_captures() == FrameDuplicateSkip;
+    FrameSignature signature   = {0};
+    FrameHash frameHash;
+    frame_hash_init(&frameHash);
+    if (checkDuplicates)
+    {
+        const uint64_t checkBegin   = armGetSystemTick();
+        captureStats.duplicate      = frame_hash_is_duplicate(&signature);
+        captureStats.duplicateTicks = armGetSystemTick() - checkBegin;
+        capture_trace_mark(CaptureTraceDuplicate);
+    }
+
+    if (captureStats.duplicate)
+    {
+        // Nothing gets written, so nothing's charged to timelapse budgets for it. The system still saved a JPEG for the
+        // press, though. The empty file's time finds it.
+        captureStats.size = 0;
+        FSFILE_Close(pngFile);
+        capture_close_stream();
+
+        uint64_t pressTime;
+        const bool deleteJpeg =
+            pressed && !config_allow_jpeg() && FSFILE_GetTimeStamp(filesystem, temporaryPath, &pressTime);
+        if (deleteJpeg) { jpeg_delete_capture(filesystem, pressTime); }
+
+        FSFILE_Delete(filesystem, temporaryPath);
+        capture_trace_mark(CaptureTraceJpeg);
+        return false;
+    }
+
+    // Adaptive mode samples the capture to pick the settings. Spills can only be read in order, and they're encoded when
+    // nothing's waiting on them anyway, so they stick to the config.
+    captureStats.settings = (PngEncodeChoice){.level        = config_compression_level(),
+                                              .strategy     = Z_DEFAULT_STRATEGY,
+                                              .rowFilter    = config_row_filter(),
+                                              .contentClass = -1};
+    const bool adaptive   = useNative && !timestamp && encodeMode == PngEncodeAdaptive;
+    if (adaptive)
+    {
+        const uint64_t budgetTicks = armNsToTicks((uint64_t)config_encode_budget() * 1000000);
+        png_adaptive_choose(budgetTicks, &captureStats.settings);
+        capture_trace_mark(CaptureTraceAdapt);
+    }
+
+    // Frames with few colors are counted up front and written with one byte per pixel. Only the serial encoder does this,
+    // and only for live captures, since it needs the whole frame read before the first row is written.
+    PngPalette *palette    = NULL;
+    captureStats.colorType = PngColorRGB;
+    if (useNative && !useParallel && !timestamp && config_reduce_colors())
+    {
+        const uint64_t colorBegin = armGetSystemTick();
+        palette                   = malloc(sizeof(PngPalette));
+        if (palette && (!png_palette_analyze(palette) || palette->colorType == PngColorRGB))
+        {
+            free(palette);
+            palette = NULL;
+        }
+
+        if (palette)
+        {
+            captureStats.colorType     = palette->colorType;
+            captureStats.paletteColors = palette->colorType == PngColorIndexed ? palette->colorCount : 0;
+        }
+        captureStats.colorTicks = armGetSystemTick() - colorBegin;
+        capture_trace_mark(CaptureTraceColors);
+    }
+
+    // Thumbnails are scaled from the rows the serial encoder reads, so only it writes them.
+    const int thumbnailScale                 = useNative && !useParallel ? config_thumbnail_scale() : 0;
+    char temporaryThumbnailPath[FS_MAX_PATH] = {0};
+    if (thumbnailScale) { thumbnail_path(temporaryPath, temporaryThumbnailPath); }
+
+    // The serial encoder with zlib keeps its stream between captures, and sets it up here if it's been freed since. Every
+    // other path needs the heap it holds.
+    const uint64_t setupBegin = armGetSystemTick();
+    const bool speed          = encodeMode == PngEncodeSpeed;
+    const bool useWarm        = useNative && !useParallel && !speed && thumbnailScale == 0;
+
+    // libdeflate deflates the whole filtered frame in one go, so it needs every row in the heap at once. That never fits the
+    // sysmodule's heap, so only the host benchmark picks it. When it doesn't fit, the capture streams through zlib like
+    // always. Adaptive mode's settings are picked for zlib's speed.
+    IdatWriter *oneShotWriter = NULL;
+    if (useWarm && !adaptive && config_deflate_backend() == PngDeflateLibdeflate)
+    {
+        const size_t filteredSize = palette ? PNG_PALETTE_ROW_SIZE : PNG_FILTER_ROW_SIZE;
+        oneShotWriter = idat_writer_open_oneshot(pngFile, captureStats.settings.level, filteredSize * SCREENSHOT_HEIGHT);
+    }
+    captureStats.backend = oneShotWriter ? PngDeflateLibdeflate : useNative && speed ? PngDeflateFast : PngDeflateZlib;
+
+    if (!useWarm) { idat_writer_warm_release(); }
+    captureStats.warm = useWarm && !oneShotWriter && idat_writer_warm_size() > 0;
+    const bool warmed = useWarm && !oneShotWriter && idat_writer_warm_up();
+
+    // zlib and libpng get one block for the whole encode. It's taken before anything else so it's never squeezed between
+    // smaller allocations. The thumbnail's stream shares it, with the capture's cut down to make room.
+    size_t arenaSize = png_libpng_arena_size(width);
+    if (useParallel) { arenaSize = png_parallel_arena_size(config_encode_workers()); }
+    else if (thumbnailScale)
+    {
+        const size_t captureArenaSize = speed ? 0 : ENCODE_ARENA_DEFLATE_SIZE(15, THUMBNAIL_CAPTURE_MEM_LEVEL);
+        arenaSize                     = captureArenaSize + png_thumbnail_arena_size();
+    }
+    else if (useNative) { arenaSize = warmed || oneShotWriter ? 0 : idat_writer_arena_size(speed); }
+    if (arenaSize > 0) { encode_arena_begin(arenaSize); }
+    captureStats.setupTicks = armGetSystemTick() - setupBegin;
+
+    // Speed mode compresses the thumbnail the way it does the capture. A thumbnail that can't be opened isn't worth
+    // failing the capture over.
+    PngThumbnail *thumbnail = NULL;
+    if (thumbnailScale)
+    {
+        const int thumbnailLevel  = speed ? 1 : captureStats.settings.level;
+        const int thumbnailFilter = speed ? PngFilterSub : captureStats.settings.rowFilter;
+        thumbnail =
+            png_thumbnail_open(filesystem, temporaryThumbnailPath, thumbnailScale, thumbnailLevel, thumbnailFilter);
+    }
+
+    // libpng reads a row at a time.
+    captureStats.readRows = useNative ? config_read_rows() : 1;
+
+    // The row loops yield every EncodeSliceRows rows from here on.
+    FrameHash *rowHash = checkDuplicates ? &frameHash : NULL;
+    bool encoded       = false;
+    encode_governor_begin();
+    if (useParallel) { encoded = png_encode_parallel(pngFile, &captureStats.settings, rowHash); }
+    else if (useNative)
+    {
+        encoded =
+            png_encode_native(pngFile, &captureStats.settings, palette, rowHash, speed, thumbnail, oneShotWriter);
+    }
+    else { encoded = png_encode_libpng(pngFile, width, height); }
+    encode_governor_end();
+
+    // The thumbnail's stream is in the arena, so it's finished before the arena goes. Only a whole one is worth keeping.
+    int64_t thumbnailSize = 0;
+    bool thumbnailWritten = false;
+    if (thumbnail && encoded)
+    {
+        const uint64_t closeBegin = armGetSystemTick();
+        thumbnailWritten          = png_thumbnail_close(thumbnail, &thumbnailSize);
+        captureStats.thumbnailTicks += armGetSystemTick() - closeBegin;
+    }
+    else { png_thumbnail_abort(thumbnail); }
+
+    EncodeArenaStats arenaStats;
+    encode_arena_end(&arenaStats);
+    captureStats.arenaSize     = arenaStats.size;
+    captureStats.arenaPeak     = arenaStats.peak;
+    captureStats.arenaOverflow = arenaStats.overflow;
+    capture_trace_mark(CaptureTraceEncode);
+    capture_trace_record(CaptureTraceRead, captureStats.readTicks);
+    capture_trace_record(CaptureTraceFilter, captureStats.filterTicks);
+    capture_trace_record(CaptureTraceDeflate, captureStats.deflateTicks);
+    if (thumbnailScale) { capture_trace_record(CaptureTraceThumbnail, captureStats.thumbnailTicks); }
+    const EncodeGovernorStats *governorStats = encode_governor_get_stats();
+    if (config_encode_slice_rows() > 0) { capture_trace_record(CaptureTraceYield, governorStats->yieldTicks); }
+    if (config_latency_probe()) { capture_trace_record(CaptureTraceLatency, governorStats->encoding.maxLateTicks); }
+    free(palette);
+
+    // The workers deflate at the same time, so what counts against the budget is their share. A reduced capture is a third
+    // of the bytes, so it's scaled back up to what RGB would have taken. Otherwise it would teach a speed RGB can't match.
+    if (encoded && adaptive)
+    {
+        uint64_t deflateTicks = captureStats.deflateTicks / (useParallel ? png_parallel_worker_count(config_encode_workers()) : 1);
+        if (captureStats.colorType != PngColorRGB) { deflateTicks *= 3; }
+        png_adaptive_learn(&captureStats.settings, deflateTicks);
+    }
+
+    // Only finished PNGs say anything about the size of the next one.
+    const int64_t pngSize = FSFILE_Tell(pngFile);
+    if (encoded) { pngSizeAverage = pngSizeAverage ? (pngSizeAverage * 3 + pngSize) / 4 : pngSize; }
+
+    FSFILE_Finalize(pngFile);
+    capture_close_stream();
+    capture_trace_mark(CaptureTraceFinalize);
+
+    // Spills pass the time of the press. Live captures go by the PNG's own creation time.
+    uint64_t captureTime = timestamp ? *timestamp : 0;
+    const bool timed     = encoded && (timestamp || FSFILE_GetTimeStamp(filesystem, temporaryPath, &captureTime));
+
+    char finalPath[FS_MAX_PATH] = {0};
+    const bool moved            = timed && png_capture_move_into_place(filesystem, temporaryPath, captureTime, finalPath);
+
+    // The thumbnail goes next to wherever the PNG ended up. It's only extra, so the capture stands without it.
+    bool thumbnailMoved = false;
+    if (moved && thumbnailWritten)
+    {
+        char finalThumbnailPath[FS_MAX_PATH] = {0};
+        thumbnail_path(finalPath, finalThumbnailPath);
+        thumbnailMoved = FSFILE_Rename(filesystem, temporaryThumbnailPath, finalThumbnailPath);
+    }
+    if (thumbnailScale && !thumbnailMoved) { FSFILE_Delete(filesystem, temporaryThumbnailPath); }
+    capture_trace_mark(CaptureTraceRename);
 
-    // Open stream and init libPNG structs.
-    if (!capssc_open_stream()) { return; }
-    else if (!png_init_structs(&writeStruct, &infoStruct)) { return; }
+    // Don't leave a broken PNG in the album.
+    if (!moved)
+    {
+        FSFILE_Delete(filesystem, temporaryPath);
+        return false;
+    }
+
+    captureStats.size          = pngSize;
+    captureStats.thumbnailSize = thumbnailMoved ? thumbnailSize : 0;
+
+    // Delete the jpeg if needed.
+    if (pressed && !config_allow_jpeg())
+    {
+        jpeg_delete_capture(filesystem, captureTime);
+        capture_trace_mark(CaptureTraceJpeg);
+    }
+
+    // Only saved captures count as something to be a duplicate of.
+    if (checkDuplicates)
+    {
+        signature.frameHash = frame_hash_final(&frameHash);
+        frame_hash_remember(&signature);
+    }
+
+    return true;
+}
+
+static bool png_encode_native(FSFILE *file,
+                              const PngEncodeChoice *settings,
+                              const PngPalette *palette,
+                              FrameHash *hash,
+                              bool speed,
+                              PngThumbnail *thumbnail,
+                              IdatWriter *writer)
+{
+    const uint64_t setupBegin = armGetSystemTick();
+    RowPipeline *pipeline     = NULL;
+    IdatWriter *idatWriter    = writer;
+    uint8_t *rowBuffers       = NULL;
+    bool encoded              = false;
+
+    const bool headerWritten = palette ? png_palette_write_header(file, palette) : png_chunk_write_header(file);
+    if (!headerWritten) { goto cleanup; }
+
+    // The unfiltered RGB of the current and previous rows are needed for filtering. The filtered row follows them. Gray
+    // and indexed rows are smaller and use the same buffers.
+    // With a thumbnail, zlib gets the smaller memory level png_capture_save sized the arena for.
+    rowBuffers = malloc(RGB_ROW_SIZE * 2 + PNG_FILTER_ROW_SIZE);
+    if (!idatWriter && thumbnail && !speed)
+    {
+        idatWriter = idat_writer_open_sized(file,
+                                            settings->level,
+                                            settings->strategy,
+                                            15,
+                                            THUMBNAIL_CAPTURE_MEM_LEVEL,
+                                            IDAT_BUFFER_SIZE);
+    }
+    else if (!idatWriter)
+    {
+        // The warm stream if there is one. Otherwise a new one comes out of the arena. The arena wasn't sized for one when
+        // there's a warm stream, so if it can't be used it's freed to make room.
+        idatWriter = speed ? NULL : idat_writer_open_warm(file, settings->level, settings->strategy);
+        if (!idatWriter)
+        {
+            idat_writer_warm_release();
+            idatWriter = idat_writer_open(file, settings->level, settings->strategy, speed);
+        }
+    }
+    if (!rowBuffers || !idatWriter) { goto cleanup; }
 
-    // Attempt to open temporary output file.
-    pngFile = FSFILE_OpenWrite(filesystem, TEMPORARY_NAME, FILE_SIZE);
-    if (!pngFile) { goto cleanup; }
+    uint8_t *currentRow  = rowBuffers;
+    uint8_t *previousRow = rowBuffers + RGB_ROW_SIZE;
+    uint8_t *filteredRow = rowBuffers + RGB_ROW_SIZE * 2;
 
-    // Initialize libpng to use our write functions and write the initial info.
-    png_init_io_write_info(writeStruct, infoStruct, pngFile);
+    // Start reading rows on the second thread.
+    pipeline = row_pipeline_start(hash, config_read_rows());
+    if (!pipeline) { goto cleanup; }
 
     // Loop through the rows of the capture.
+    // Speed mode skips the filter search too. Sub is the cheapest filter and suits its run matching best.
+    const int rowFilter       = speed ? PngFilterSub : settings->rowFilter;
+    const size_t filteredSize = palette ? PNG_PALETTE_ROW_SIZE : PNG_FILTER_ROW_SIZE;
+    const uint64_t rowBegin   = armGetSystemTick();
+    captureStats.setupTicks += rowBegin - setupBegin;
     for (size_t i = 0; i < SCREENSHOT_HEIGHT; i++)
     {
-        // Read the next row.
-        const bool rowRead = capssc_read_row(rowBuffer, i);
-        if (!rowRead) { goto cleanup; }
+        // Wait for the reader to get to this row.
+        const uint8_t *row = row_pipeline_acquire(pipeline, i);
+        if (!row) { goto cleanup; }
+
+        // The thumbnail is scaled from the RGBA row while it's still in the slot. Closing it finds it short if this fails.
+        if (thumbnail)
+        {
+            const uint64_t thumbnailBegin = armGetSystemTick();
+            if (!png_thumbnail_add_row(thumbnail, row)) { thumbnail = NULL; }
+            captureStats.thumbnailTicks += armGetSystemTick() - thumbnailBegin;
+        }
+
+        // Strip the alpha and filter in one go, then give the slot back.
+        const uint64_t filterBegin = armGetSystemTick();
+        const uint8_t *previous    = i > 0 ? previousRow : NULL;
+        if (palette) { png_palette_filter_rgba_row(palette, row, currentRow, previous, filteredRow, rowFilter); }
+        else { png_filter_rgba_row(row, currentRow, previous, filteredRow, rowFilter); }
+        row_pipeline_release(pipeline);
+
+        const uint64_t deflateBegin = armGetSystemTick();
+        const bool rowWritten       = idat_writer_write_row(idatWriter, filteredRow, filteredSize);
+        if (!rowWritten) { goto cleanup; }
+        captureStats.filterTicks += deflateBegin - filterBegin;
+        captureStats.deflateTicks += armGetSystemTick() - deflateBegin;
+        encode_governor_row();
+
+        uint8_t *swap = previousRow;
+        previousRow   = currentRow;
+        currentRow    = swap;
+    }
 
-        // Shift everything and delete the alpha values.
-        rgba_strip_alpha(rowBuffer);
+    // This finishes the stream and writes IEND.
+    const uint64_t closeBegin = armGetSystemTick();
+    encoded                   = idat_writer_close(idatWriter);
+    idatWriter                = NULL;
+    captureStats.deflateTicks += armGetSystemTick() - closeBegin;
+    captureStats.rowTicks = armGetSystemTick() - rowBegin;
 
-        // Write the RGBA row with libpng stripping the alpha channel
-        png_write_row(writeStruct, rowBuffer);
+cleanup:
+    // Stop the reader before anything else. It needs the stream open until it exits.
+    if (pipeline)
+    {
+        RowPipelineStats pipelineStats;
+        row_pipeline_finish(pipeline, &pipelineStats);
+        captureStats.readTicks  = pipelineStats.readTicks;
+        captureStats.stallTicks = pipelineStats.stallTicks;
+        captureStats.readCalls  = pipelineStats.readCalls;
     }
+    idat_writer_abort(idatWriter);
+    free(rowBuffers);
+    return encoded;
+}
+
+static bool png_encode_parallel(FSFILE *file, const PngEncodeChoice *settings, FrameHash *hash)
+{
+    if (!png_chunk_write_header(file)) { return false; }
+
+    // The parallel encoder reads the rows itself and writes everything up to IEND.
+    const uint64_t rowBegin = armGetSystemTick();
+    PngParallelStats parallelStats;
+    const bool encoded = png_parallel_write_image(file,
+                                                  config_encode_workers(),
+                                                  settings->level,
+                                                  settings->strategy,
+                                                  settings->rowFilter,
+                                                  config_read_rows(),
+                                                  hash,
+                                                  &parallelStats);
+    if (!encoded) { return false; }
+
+    captureStats.rowTicks     = armGetSystemTick() - rowBegin;
+    captureStats.readTicks    = parallelStats.readTicks;
+    captureStats.filterTicks  = parallelStats.filterTicks;
+    captureStats.deflateTicks = parallelStats.deflateTicks;
+    captureStats.stallTicks   = parallelStats.stallTicks;
+    captureStats.readCalls    = parallelStats.readCalls;
+    return true;
+}
+
+static bool png_encode_libpng(FSFILE *file, uint32_t width, uint32_t height)
+{
+    png_structp writeStruct = NULL;
+    png_infop infoStruct    = NULL;
+    const size_t rowSize    = (size_t)width * 4;
+
+    // This is allocated before setjmp so longjmp can't lose it.
+    uint8_t *rowBuffer = malloc(rowSize);
+    if (!rowBuffer || !png_init_structs(&writeStruct, &infoStruct))
+    {
+        free(rowBuffer);
+        return false;
+    }
+
+    // libpng jumps back here on errors.
+    if (setjmp(png_jmpbuf(writeStruct)))
+    {
+        png_cleanup(&writeStruct, &infoStruct);
+        free(rowBuffer);
+        return false;
+    }
+
+    png_set_compression_level(writeStruct, config_compression_level());
+    png_init_io_write_info(writeStruct, infoStruct, file, width, height);
+
+    // The stream is RGBA. libpng drops the alpha byte as it writes.
+    png_set_filler(writeStruct, 0, PNG_FILLER_AFTER);
+
+    bool encoded            = true;
+    const uint64_t rowBegin = armGetSystemTick();
+    for (uint32_t i = 0; encoded && i < height; i++)
+    {
+        const uint64_t readBegin = armGetSystemTick();
+        encoded                  = capture_read(rowBuffer, rowSize, (size_t)i * rowSize);
+        captureStats.readTicks += armGetSystemTick() - readBegin;
+        ++captureStats.readCalls;
+        if (encoded) { png_write_row(writeStruct, rowBuffer); }
+        encode_governor_row();
+    }
+
+    if (encoded) { png_write_end(writeStruct, infoStruct); }
+    captureStats.rowTicks = armGetSystemTick() - rowBegin;
 
-cleanup:
-    // This will finalize writing and destroy the structs.
     png_cleanup(&writeStruct, &infoStruct);
-    FSFILE_Finalize(pngFile);
-    capsscCloseRawScreenShotReadStream();
+    free(rowBuffer);
+    return encoded;
+}
 
-    FsTimeStampRaw timestamp;
-    if (R_FAILED(fsFsGetFileTimeStampRaw(filesystem, TEMPORARY_NAME, &timestamp))) { return; }
+static inline size_t png_libpng_arena_size(uint32_t width)
+{
+    // Same stream as deflateInit. On top of it libpng keeps its structs, one compressed buffer and a handful of rows: the
+    // current and previous rows plus scratch rows for picking a filter, all at the 32 bit depth the filler asks for.
+    static const size_t LIBPNG_OVERHEAD = 0x4000;
+    return ENCODE_ARENA_DEFLATE_SIZE(15, 8) + LIBPNG_OVERHEAD + ((size_t)width * 4 + 16) * 5;
+}
 
-    // Ensure the final directory exists.
-    if (!create_target_directory(filesystem, timestamp.created)) { return; }
+static inline void png_capture_reset_stats(void)
+{
+    captureStats = (PngCaptureStats){.settings = {.level = -1, .contentClass = -1}, .colorType = -1, .backend = -1};
+}
 
-    // Move the screenshot.
-    move_rename_screenshot(filesystem, timestamp.created);
+static inline int64_t png_predicted_size(void)
+{
+    // Nothing to go by for the first capture. This is on the big side of what games come out to.
+    static const int64_t FIRST_PREDICTION = 0x100000;
+    if (pngSizeAverage == 0) { return FIRST_PREDICTION; }
 
-    // Delete the jpeg if needed.
-    if (!config_allow_jpeg()) { jpeg_delete_capture(filesystem, timestamp.created); }
+    // A quarter over the average, in whole blocks. Anything over is trimmed when the file is finalized.
+    const int64_t predicted = pngSizeAverage + pngSizeAverage / 4;
+    return (predicted + PNG_WRITE_BLOCK_SIZE - 1) / PNG_WRITE_BLOCK_SIZE * PNG_WRITE_BLOCK_SIZE;
 }
 
 static void png_write_function(png_structp writingStruct, png_bytep pngData, png_size_t length)
@@ -131,33 +717,27 @@ static void png_flush_function(png_structp writingStruct)
     FSFILE_Flush(fsfile);
 }
 
-static inline bool capssc_open_stream()
+static png_voidp png_malloc_function(png_structp writingStruct, png_alloc_size_t size)
 {
-    // The timeout for screen capture
-    static const int64_t SCREENSHOT_CAPTURE_TIMEOUT = 1e+8;
-
-    uint64_t size;
-    uint64_t width;
-    uint64_t height;
-    const bool opened = R_SUCCEEDED(
-        capsscOpenRawScreenShotReadStream(&size, &width, &height, ViLayerStack_Screenshot, SCREENSHOT_CAPTURE_TIMEOUT));
-    return opened;
+    (void)writingStruct;
+    return encode_arena_alloc(size);
 }
 
-static inline bool capssc_read_row(void *buffer, int rowOffset)
+static void png_free_function(png_structp writingStruct, png_voidp pointer)
 {
-    // This is always the same.
-    static const size_t ROW_SIZE = SCREENSHOT_WIDTH * 4; // Each row is RGBA.
-
-    // Read the row at the offset.
-    uint64_t bytesRead;
-    const bool rowRead = R_SUCCEEDED(capsscReadRawScreenShotReadStream(&bytesRead, buffer, ROW_SIZE, rowOffset * ROW_SIZE));
-    return rowRead && bytesRead == ROW_SIZE;
+    (void)writingStruct;
+    encode_arena_free(pointer);
 }
 
 static inline bool png_init_structs(png_structpp writeStruct, png_infopp infoStruct)
 {
-    *writeStruct = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    *writeStruct = png_create_write_struct_2(PNG_LIBPNG_VER_STRING,
+                                             NULL,
+                                             NULL,
+                                             NULL,
+                                             NULL,
+                                             png_malloc_function,
+                                             png_free_function);
     if (!*writeStruct) { return false; }
 
     *infoStruct = png_create_info_struct(*writeStruct);
@@ -167,9 +747,6 @@ static inline bool png_init_structs(png_structpp writeStruct, png_infopp infoStr
         return false;
     }
 
-    const int level = config_compression_level();
-    png_set_compression_level(*writeStruct, level);
-
     return true;
 }
 
@@ -177,12 +754,15 @@ static inline void png_cleanup(png_structpp writeStruct, png_infopp infoStruct)
 {
     if (!*writeStruct && !*infoStruct) { return; }
 
-    png_write_end(*writeStruct, *infoStruct);
     png_free_data(*writeStruct, *infoStruct, PNG_FREE_ALL, -1);
     png_destroy_write_struct(writeStruct, infoStruct);
 }
 
-static inline void png_init_io_write_info(png_structp writeStruct, png_infop infoStruct, FSFILE *file)
+static inline void png_init_io_write_info(png_structp writeStruct,
+                                          png_infop infoStruct,
+                                          FSFILE *file,
+                                          uint32_t width,
+                                          uint32_t height)
 {
     // Just in case this stuff changes.
     static const int SCREENSHOT_BIT_DEPTH = 8;
@@ -193,8 +773,8 @@ static inline void png_init_io_write_info(png_structp writeStruct, png_infop inf
     // Set IHDR
     png_set_IHDR(writeStruct,
                  infoStruct,
-                 SCREENSHOT_WIDTH,
-                 SCREENSHOT_HEIGHT,
+                 width,
+                 height,
                  SCREENSHOT_BIT_DEPTH,
                  PNG_COLOR_TYPE_RGB,
                  PNG_INTERLACE_NONE,
@@ -205,26 +785,6 @@ static inline void png_init_io_write_info(png_structp writeStruct, png_infop inf
     png_write_info(writeStruct, infoStruct);
 }
 
-static inline void rgba_strip_alpha(restrict png_bytep row)
-{
-    int i = 0;
-    int j = 0;
-
-    for (; i <= (SCREENSHOT_WIDTH - 16) * 4; i += 64, j += 48)
-    {
-        uint8x16x4_t rgba = vld4q_u8(row + i);
-        uint8x16x3_t rgb  = {{rgba.val[0], rgba.val[1], rgba.val[2]}};
-        vst3q_u8(row + j, rgb);
-    }
-
-    for (; i < SCREENSHOT_WIDTH * 4; i += 4, j += 3)
-    {
-        row[j]     = row[i];
-        row[j + 1] = row[i + 1];
-        row[j + 2] = row[i + 2];
-    }
-}
-
 static inline bool create_target_directory(FsFileSystem *filesystem, uint64_t timestamp)
 {
     // This just makes stuff easier to read and work with.
@@ -239,34 +799,54 @@ static inline bool create_target_directory(FsFileSystem *filesystem, uint64_t ti
              localTime.tm_mon + 1,
              localTime.tm_mday);
 
-    // Check if it exists first. If it does, don't continue.
-    const bool exists = directory_exists(filesystem, pathBuffer);
-    if (exists) { return true; }
-
-    // Try to create it.
-    return create_directory_recursively(filesystem, pathBuffer);
+    // Same day as the last capture is a cache hit and doesn't touch the filesystem at all.
+    return directory_cache_ensure(filesystem, pathBuffer);
 }
 
-static inline void move_rename_screenshot(FsFileSystem *filesystem, uint64_t timestamp)
+static inline bool move_rename_screenshot(FsFileSystem *filesystem,
+                                          const char *temporaryPath,
+                                          uint64_t timestamp,
+                                          char *pathOut)
 {
+    // Queued captures can easily land in the same second, so the ones after the first get a number on the end.
+    static const int MAX_DUPLICATES = 16;
+
     // Convert this to something easier to work with.
     struct tm localTime = *localtime((const time_t *)&timestamp);
 
     // Construct the final path.
     char finalPath[FS_MAX_PATH] = {0};
-    snprintf(finalPath,
-             FS_MAX_PATH,
-             "/PNGs/%04d/%02d/%02d/%04d%02d%02d_%02d%02d%02d.png",
-             localTime.tm_year + 1900,
-             localTime.tm_mon + 1,
-             localTime.tm_mday,
-             localTime.tm_year + 1900,
-             localTime.tm_mon + 1,
-             localTime.tm_mday,
-             localTime.tm_hour,
-             localTime.tm_min,
-             localTime.tm_sec);
+    const int baseLength = snprintf(finalPath,
+                                    FS_MAX_PATH,
+                                    "/PNGs/%04d/%02d/%02d/%04d%02d%02d_%02d%02d%02d",
+                                    localTime.tm_year + 1900,
+                                    localTime.tm_mon + 1,
+                                    localTime.tm_mday,
+                                    localTime.tm_year + 1900,
+                                    localTime.tm_mon + 1,
+                                    localTime.tm_mday,
+                                    localTime.tm_hour,
+                                    localTime.tm_min,
+                                    localTime.tm_sec);
+
+    // Move/rename. Renaming fails if the target exists, which is how duplicates are found.
+    for (int i = 0; i < MAX_DUPLICATES; i++)
+    {
+        if (i == 0) { snprintf(finalPath + baseLength, FS_MAX_PATH - baseLength, ".png"); }
+        else { snprintf(finalPath + baseLength, FS_MAX_PATH - baseLength, "_%d.png", i); }
+
+        if (!FSFILE_Rename(filesystem, temporaryPath, finalPath)) { continue; }
 
-    // Move/rename. There's no real point in error checking this.
-    fsFsRenameFile(filesystem, TEMPORARY_NAME, finalPath);
+        if (pathOut) { memcpy(pathOut, finalPath, FS_MAX_PATH); }
+        return true;
+    }
+
+    return false;
+}
+
+static inline void thumbnail_path(const char *pngPath, char *pathOut)
+{
+    const size_t length  = strlen(pngPath);
+    const int baseLength = length > 4 && strcmp(pngPath + length - 4, ".png") == 0 ? (int)length - 4 : (int)length;
+    snprintf(pathOut, FS_MAX_PATH, "%.*s_thumb.png", baseLength, pngPath);
 }
@@ -0,0 +1,116 @@
+#include "png_chunk.h"
+
+#include "capture.h"
+
+#include <string.h>
+
+#if defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+#else
+    #include <zlib.h>
+#endif
+
+// The header below is only right for this exact geometry.
+_Static_assert(CAPTURE_WIDTH == 1280 && CAPTURE_HEIGHT == 720, "PNG_HEADER needs to be regenerated for the new geometry.");
+
+// clang-format off
+/// @brief Signature followed by the IHDR chunk: 1280x720, 8 bit RGB, no interlacing.
+static const uint8_t PNG_HEADER[] = {0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A,
+                                     0x00, 0x00, 0x00, 0x0D, 'I', 'H', 'D', 'R',
+                                     0x00, 0x00, 0x05, 0x00, 0x00, 0x00, 0x02, 0xD0,
+                                     0x08, 0x02, 0x00, 0x00, 0x00,
+                                     0x40, 0x1F, 0x4A, 0x01};
+
+/// @brief IEND never changes.
+static const uint8_t PNG_END[] = {0x00, 0x00, 0x00, 0x00, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82};
+// clang-format on
+
+// Defined at bottom.
+
+/// @brief Writes the 32-bit value passed big endian.
+static inline void write_big_endian(uint8_t *out, uint32_t value);
+
+bool png_chunk_write_header(FSFILE *file)
+{
+    return FSFILE_Write(file, PNG_HEADER, sizeof(PNG_HEADER)) == sizeof(PNG_HEADER);
+}
+
+bool png_chunk_write_header_color(FSFILE *file, int colorType)
+{
+    return png_chunk_write_header_image(file, CAPTURE_WIDTH, CAPTURE_HEIGHT, colorType);
+}
+
+bool png_chunk_write_header_image(FSFILE *file, uint32_t width, uint32_t height, int colorType)
+{
+    // The signature is the first 8 bytes of the precomputed header. The IHDR is built here.
+    static const size_t SIGNATURE_SIZE = 8;
+
+    uint8_t ihdr[13] = {0};
+    write_big_endian(ihdr, width);
+    write_big_endian(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = colorType;
+
+    return FSFILE_Write(file, PNG_HEADER, SIGNATURE_SIZE) == (ssize_t)SIGNATURE_SIZE &&
+           png_chunk_write(file, "IHDR", ihdr, sizeof(ihdr));
+}
+
+bool png_chunk_write_end(FSFILE *file) { return FSFILE_Write(file, PNG_END, sizeof(PNG_END)) == sizeof(PNG_END); }
+
+bool png_chunk_write_framed(FSFILE *file, const char *type, uint8_t *data, size_t size)
+{
+    uint8_t *chunk = data - PNG_CHUNK_HEADER_SIZE;
+    write_big_endian(chunk, size);
+    memcpy(chunk + 4, type, 4);
+
+    // The CRC covers the type and the data.
+    write_big_endian(data + size, png_chunk_crc(0, chunk + 4, size + 4));
+
+    const size_t chunkSize = PNG_CHUNK_HEADER_SIZE + size + PNG_CHUNK_CRC_SIZE;
+    return FSFILE_Write(file, chunk, chunkSize) == (ssize_t)chunkSize;
+}
+
+bool png_chunk_write(FSFILE *file, const char *type, const void *data, size_t size)
+{
+    uint8_t header[PNG_CHUNK_HEADER_SIZE];
+    write_big_endian(header, size);
+    memcpy(header + 4, type, 4);
+
+    uint8_t crc[PNG_CHUNK_CRC_SIZE];
+    uint32_t runningCrc = png_chunk_crc(0, header + 4, 4);
+    if (size > 0) { runningCrc = png_chunk_crc(runningCrc, data, size); }
+    write_big_endian(crc, runningCrc);
+
+    const bool headerWritten = FSFILE_Write(file, header, PNG_CHUNK_HEADER_SIZE) == PNG_CHUNK_HEADER_SIZE;
+    const bool dataWritten   = size == 0 || FSFILE_Write(file, data, size) == (ssize_t)size;
+    const bool crcWritten    = FSFILE_Write(file, crc, PNG_CHUNK_CRC_SIZE) == PNG_CHUNK_CRC_SIZE;
+    return headerWritten && dataWritten && crcWritten;
+}
+
+uint32_t png_chunk_crc(uint32_t crc, const uint8_t *data, size_t size)
+{
+#if defined(__ARM_FEATURE_CRC32)
+    // The CRC instructions use the same polynomial as PNG. Eight bytes at a time, then whatever's left.
+    crc = ~crc;
+    for (; size >= 8; data += 8, size -= 8)
+    {
+        uint64_t block;
+        memcpy(&block, data, sizeof(uint64_t));
+        crc = __crc32d(crc, block);
+    }
+
+    for (; size > 0; data++, size--) { crc = __crc32b(crc, *data); }
+
+    return ~crc;
+#else
+    return crc32(crc, data, size);
+#endif
+}
+
+static inline void write_big_endian(uint8_t *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
@@ -0,0 +1,457 @@
+#include "png_filter.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+/// @brief Number of bytes in an unfiltered RGB row.
+static const int ROW_BYTES = CAPTURE_WIDTH * 3;
+
+/// @brief Row of zeroes used as the row above the first one.
+static const uint8_t ZERO_ROW[CAPTURE_WIDTH * 3] = {0};
+
+// Defined at bottom.
+
+#if defined(__ARM_NEON)
+/// @brief Scores every filter for 16 pixels and adds it to the running sums.
+static inline void neon_score_pixels(uint8x16x3_t current,
+                                     uint8x16x3_t up,
+                                     uint8x16_t lastCurrent[3],
+                                     uint8x16_t lastUp[3],
+                                     uint16x8_t sums[PngFilterAdaptive]);
+
+/// @brief Returns the filter with the lowest sum.
+static inline int neon_best_filter(const uint16x8_t sums[PngFilterAdaptive]);
+
+/// @brief Writes the RGB row filtered with the filter passed to out.
+static inline void neon_filter_row(int filter, const uint8_t *row, const uint8_t *previous, uint8_t *out);
+
+/// @brief Applies every filter to 16 pixels of one channel.
+static inline void neon_filter_lanes(uint8x16_t current,
+                                     uint8x16_t left,
+                                     uint8x16_t up,
+                                     uint8x16_t upLeft,
+                                     uint8x16_t filtered[PngFilterAdaptive]);
+
+/// @brief Paeth predictor for 16 lanes.
+static inline uint8x16_t neon_paeth_predictor(uint8x16_t left, uint8x16_t up, uint8x16_t upLeft);
+#else
+/// @brief Bytes per pixel of an RGB8 row.
+static const int BYTES_PER_PIXEL = 3;
+
+/// @brief Applies the filter passed to the row and returns the sum of the absolute value of the output as signed bytes.
+static inline uint32_t filter_row(int filter, const uint8_t *row, const uint8_t *previous, uint8_t *out);
+#endif
+
+/// @brief Applies the filter passed to a row of size bytes and returns the sum of the absolute value of the output as signed
+/// bytes. This is what gray rows and rows narrower than the capture use.
+static uint32_t filter_span(int filter, const uint8_t *row, const uint8_t *previous, uint8_t *out, int size, int bytesPerPixel);
+
+/// @brief Picks and writes the filter for a row of any size with filter_span. Adaptive tries every filter in place.
+static void filter_span_row(const uint8_t *row, const uint8_t *previous, uint8_t *out, int size, int bytesPerPixel, int mode);
+
+/// @brief Paeth predictor from the PNG spec.
+static inline uint8_t paeth_predictor(int left, int up, int upLeft);
+
+#if defined(__ARM_NEON)
+void png_filter_row(const uint8_t *row, const uint8_t *previous, uint8_t *out, int mode)
+{
+    if (!previous) { previous = ZERO_ROW; }
+
+    // One pass to pick, one pass to write. The row is in cache for the second one.
+    int filter = mode;
+    if (mode == PngFilterAdaptive)
+    {
+        uint8x16_t lastCurrent[3] = {vdupq_n_u8(0), vdupq_n_u8(0), vdupq_n_u8(0)};
+        uint8x16_t lastUp[3]      = {vdupq_n_u8(0), vdupq_n_u8(0), vdupq_n_u8(0)};
+        uint16x8_t sums[PngFilterAdaptive];
+        for (int i = 0; i < PngFilterAdaptive; i++) { sums[i] = vdupq_n_u16(0); }
+
+        for (int x = 0; x < CAPTURE_WIDTH; x += 16)
+        {
+            neon_score_pixels(vld3q_u8(row + x * 3), vld3q_u8(previous + x * 3), lastCurrent, lastUp, sums);
+        }
+        filter = neon_best_filter(sums);
+    }
+
+    out[0] = filter;
+    neon_filter_row(filter, row, previous, out + 1);
+}
+
+void png_filter_rgba_row(const uint8_t *rgba, uint8_t *rgbOut, const uint8_t *previous, uint8_t *out, int mode)
+{
+    if (!previous) { previous = ZERO_ROW; }
+
+    // Left neighbours carried over from the last 16 pixels.
+    uint8x16_t lastCurrent[3] = {vdupq_n_u8(0), vdupq_n_u8(0), vdupq_n_u8(0)};
+    uint8x16_t lastUp[3]      = {vdupq_n_u8(0), vdupq_n_u8(0), vdupq_n_u8(0)};
+    uint16x8_t sums[PngFilterAdaptive];
+    for (int i = 0; i < PngFilterAdaptive; i++) { sums[i] = vdupq_n_u16(0); }
+
+    // Strip the alpha and score every filter in the same pass over the RGBA row. Scoring is skipped for a fixed filter.
+    const bool scoring = mode == PngFilterAdaptive;
+    for (int x = 0; x < CAPTURE_WIDTH; x += 16)
+    {
+        const uint8x16x4_t pixels = vld4q_u8(rgba + x * 4);
+        const uint8x16x3_t rgb    = {{pixels.val[0], pixels.val[1], pixels.val[2]}};
+        vst3q_u8(rgbOut + x * 3, rgb);
+
+        if (scoring) { neon_score_pixels(rgb, vld3q_u8(previous + x * 3), lastCurrent, lastUp, sums); }
+    }
+
+    // The RGB row is still in cache for the second pass.
+    const int filter = scoring ? neon_best_filter(sums) : mode;
+    out[0]           = filter;
+    neon_filter_row(filter, rgbOut, previous, out + 1);
+}
+
+static inline void neon_score_pixels(uint8x16x3_t current,
+                                     uint8x16x3_t up,
+                                     uint8x16_t lastCurrent[3],
+                                     uint8x16_t lastUp[3],
+                                     uint16x8_t sums[PngFilterAdaptive])
+{
+    // Every lane of the sums gets at most 256 per channel per call, which is 61440 for a whole row. That fits.
+    for (int channel = 0; channel < 3; channel++)
+    {
+        const uint8x16_t left   = vextq_u8(lastCurrent[channel], current.val[channel], 15);
+        const uint8x16_t upLeft = vextq_u8(lastUp[channel], up.val[channel], 15);
+
+        uint8x16_t filtered[PngFilterAdaptive];
+        neon_filter_lanes(current.val[channel], left, up.val[channel], upLeft, filtered);
+        for (int filter = 0; filter < PngFilterAdaptive; filter++)
+        {
+            // |x| of the byte as signed is min(x, -x) unsigned. -128 comes out as 128 like it should.
+            const uint8x16_t negated  = vreinterpretq_u8_s8(vnegq_s8(vreinterpretq_s8_u8(filtered[filter])));
+            const uint8x16_t absolute = vminq_u8(filtered[filter], negated);
+            sums[filter]              = vpadalq_u8(sums[filter], absolute);
+        }
+
+        lastCurrent[channel] = current.val[channel];
+        lastUp[channel]      = up.val[channel];
+    }
+}
+
+static inline int neon_best_filter(const uint16x8_t sums[PngFilterAdaptive])
+{
+    int bestFilter   = PngFilterNone;
+    uint32_t bestSum = vaddlvq_u16(sums[PngFilterNone]);
+    for (int i = PngFilterSub; i < PngFilterAdaptive; i++)
+    {
+        const uint32_t sum = vaddlvq_u16(sums[i]);
+        if (sum >= bestSum) { continue; }
+
+        bestSum    = sum;
+        bestFilter = i;
+    }
+
+    return bestFilter;
+}
+
+static inline void neon_filter_row(int filter, const uint8_t *row, const uint8_t *previous, uint8_t *out)
+{
+    if (filter == PngFilterNone)
+    {
+        memcpy(out, row, ROW_BYTES);
+        return;
+    }
+
+    uint8x16_t lastCurrent[3] = {vdupq_n_u8(0), vdupq_n_u8(0), vdupq_n_u8(0)};
+    uint8x16_t lastUp[3]      = {vdupq_n_u8(0), vdupq_n_u8(0), vdupq_n_u8(0)};
+    for (int x = 0; x < CAPTURE_WIDTH; x += 16)
+    {
+        const uint8x16x3_t current = vld3q_u8(row + x * 3);
+        const uint8x16x3_t up      = vld3q_u8(previous + x * 3);
+
+        uint8x16x3_t result;
+        for (int channel = 0; channel < 3; channel++)
+        {
+            const uint8x16_t left   = vextq_u8(lastCurrent[channel], current.val[channel], 15);
+            const uint8x16_t upLeft = vextq_u8(lastUp[channel], up.val[channel], 15);
+
+            switch (filter)
+            {
+                case PngFilterSub: result.val[channel] = vsubq_u8(current.val[channel], left); break;
+                case PngFilterUp:  result.val[channel] = vsubq_u8(current.val[channel], up.val[channel]); break;
+                case PngFilterAverage:
+                {
+                    result.val[channel] = vsubq_u8(current.val[channel], vhaddq_u8(left, up.val[channel]));
+                }
+                break;
+                default:
+                {
+                    const uint8x16_t predicted = neon_paeth_predictor(left, up.val[channel], upLeft);
+                    result.val[channel]        = vsubq_u8(current.val[channel], predicted);
+                }
+                break;
+            }
+
+            lastCurrent[channel] = current.val[channel];
+            lastUp[channel]      = up.val[channel];
+        }
+
+        vst3q_u8(out + x * 3, result);
+    }
+}
+
+static inline void neon_filter_lanes(uint8x16_t current,
+                                     uint8x16_t left,
+                                     uint8x16_t up,
+                                     uint8x16_t upLeft,
+                                     uint8x16_t filtered[PngFilterAdaptive])
+{
+    // vhaddq is (a + b) >> 1 without overflowing, which is exactly what Average wants.
+    filtered[PngFilterNone]    = current;
+    filtered[PngFilterSub]     = vsubq_u8(current, left);
+    filtered[PngFilterUp]      = vsubq_u8(current, up);
+    filtered[PngFilterAverage] = vsubq_u8(current, vhaddq_u8(left, up));
+    filtered[PngFilterPaeth]   = vsubq_u8(current, neon_paeth_predictor(left, up, upLeft));
+}
+
+static inline uint8x16_t neon_paeth_predictor(uint8x16_t left, uint8x16_t up, uint8x16_t upLeft)
+{
+    // Distances to left and up always fit in 8 bits. The distance to upLeft can be up to 510, but saturating it to 255 doesn't
+    // change the outcome of either comparison since the other two can't be more than 255.
+    const uint16x8_t sumLow         = vaddl_u8(vget_low_u8(left), vget_low_u8(up));
+    const uint16x8_t sumHigh        = vaddl_high_u8(left, up);
+    const uint16x8_t upLeftLow      = vabdq_u16(sumLow, vshll_n_u8(vget_low_u8(upLeft), 1));
+    const uint16x8_t upLeftHigh     = vabdq_u16(sumHigh, vshll_high_n_u8(upLeft, 1));
+    const uint8x16_t distanceLeft   = vabdq_u8(up, upLeft);
+    const uint8x16_t distanceUp     = vabdq_u8(left, upLeft);
+    const uint8x16_t distanceUpLeft = vcombine_u8(vqmovn_u16(upLeftLow), vqmovn_u16(upLeftHigh));
+
+    const uint8x16_t useLeft = vandq_u8(vcleq_u8(distanceLeft, distanceUp), vcleq_u8(distanceLeft, distanceUpLeft));
+    const uint8x16_t useUp   = vcleq_u8(distanceUp, distanceUpLeft);
+    return vbslq_u8(useLeft, left, vbslq_u8(useUp, up, upLeft));
+}
+#else
+void png_filter_row(const uint8_t *row, const uint8_t *previous, uint8_t *out, int mode)
+{
+    if (!previous) { previous = ZERO_ROW; }
+
+    if (mode != PngFilterAdaptive)
+    {
+        out[0] = mode;
+        filter_row(mode, row, previous, out + 1);
+        return;
+    }
+
+    // Every filter is written to the scratch row and copied out if it beats the best so far.
+    uint8_t scratch[CAPTURE_WIDTH * 3];
+
+    int bestFilter   = PngFilterNone;
+    uint32_t bestSum = filter_row(PngFilterNone, row, previous, out + 1);
+    for (int filter = PngFilterSub; filter < PngFilterAdaptive; filter++)
+    {
+        const uint32_t sum = filter_row(filter, row, previous, scratch);
+        if (sum >= bestSum) { continue; }
+
+        bestFilter = filter;
+        bestSum    = sum;
+        memcpy(out + 1, scratch, ROW_BYTES);
+    }
+
+    out[0] = bestFilter;
+}
+
+void png_filter_rgba_row(const uint8_t *rgba, uint8_t *rgbOut, const uint8_t *previous, uint8_t *out, int mode)
+{
+    for (int i = 0, j = 0; i < CAPTURE_ROW_SIZE; i += 4, j += 3)
+    {
+        rgbOut[j]     = rgba[i];
+        rgbOut[j + 1] = rgba[i + 1];
+        rgbOut[j + 2] = rgba[i + 2];
+    }
+
+    png_filter_row(rgbOut, previous, out, mode);
+}
+
+static inline uint32_t filter_row(int filter, const uint8_t *row, const uint8_t *previous, uint8_t *out)
+{
+    // The first pixel has nothing to its left.
+    switch (filter)
+    {
+        case PngFilterSub:
+        {
+            memcpy(out, row, BYTES_PER_PIXEL);
+            for (int i = BYTES_PER_PIXEL; i < ROW_BYTES; i++) { out[i] = row[i] - row[i - BYTES_PER_PIXEL]; }
+        }
+        break;
+
+        case PngFilterUp:
+        {
+            for (int i = 0; i < ROW_BYTES; i++) { out[i] = row[i] - previous[i]; }
+        }
+        break;
+
+        case PngFilterAverage:
+        {
+            for (int i = 0; i < BYTES_PER_PIXEL; i++) { out[i] = row[i] - (previous[i] >> 1); }
+            for (int i = BYTES_PER_PIXEL; i < ROW_BYTES; i++)
+            {
+                out[i] = row[i] - ((row[i - BYTES_PER_PIXEL] + previous[i]) >> 1);
+            }
+        }
+        break;
+
+        case PngFilterPaeth:
+        {
+            for (int i = 0; i < BYTES_PER_PIXEL; i++) { out[i] = row[i] - previous[i]; }
+            for (int i = BYTES_PER_PIXEL; i < ROW_BYTES; i++)
+            {
+                out[i] = row[i] - paeth_predictor(row[i - BYTES_PER_PIXEL], previous[i], previous[i - BYTES_PER_PIXEL]);
+            }
+        }
+        break;
+
+        default: memcpy(out, row, ROW_BYTES); break;
+    }
+
+    uint32_t sum = 0;
+    for (int i = 0; i < ROW_BYTES; i++) { sum += abs((int8_t)out[i]); }
+
+    return sum;
+}
+#endif
+
+void png_filter_gray_row(const uint8_t *row, const uint8_t *previous, uint8_t *out, int mode)
+{
+    filter_span_row(row, previous, out, CAPTURE_WIDTH, 1, mode);
+}
+
+void png_filter_rgb_span(const uint8_t *row, const uint8_t *previous, uint8_t *out, int width, int mode)
+{
+    filter_span_row(row, previous, out, width * 3, 3, mode);
+}
+
+bool png_unfilter_row(const uint8_t *filtered, const uint8_t *previous, uint8_t *out, int size, int bytesPerPixel)
+{
+    if (!previous) { previous = ZERO_ROW; }
+
+    // Each byte depends on the one to its left once it's been unfiltered, so this doesn't vectorize like filtering does.
+    const uint8_t *in = filtered + 1;
+    switch (filtered[0])
+    {
+        case PngFilterNone:
+            memcpy(out, in, size);
+            break;
+
+        case PngFilterSub:
+        {
+            memcpy(out, in, bytesPerPixel);
+            for (int i = bytesPerPixel; i < size; i++) { out[i] = in[i] + out[i - bytesPerPixel]; }
+        }
+        break;
+
+        case PngFilterUp:
+        {
+            for (int i = 0; i < size; i++) { out[i] = in[i] + previous[i]; }
+        }
+        break;
+
+        case PngFilterAverage:
+        {
+            for (int i = 0; i < bytesPerPixel; i++) { out[i] = in[i] + (previous[i] >> 1); }
+            for (int i = bytesPerPixel; i < size; i++) { out[i] = in[i] + ((out[i - bytesPerPixel] + previous[i]) >> 1); }
+        }
+        break;
+
+        case PngFilterPaeth:
+        {
+            for (int i = 0; i < bytesPerPixel; i++) { out[i] = in[i] + previous[i]; }
+            for (int i = bytesPerPixel; i < size; i++)
+            {
+                out[i] = in[i] + paeth_predictor(out[i - bytesPerPixel], previous[i], previous[i - bytesPerPixel]);
+            }
+        }
+        break;
+
+        default: return false;
+    }
+
+    return true;
+}
+
+static uint32_t filter_span(int filter, const uint8_t *row, const uint8_t *previous, uint8_t *out, int size, int bytesPerPixel)
+{
+    uint32_t cost = 0;
+    for (int x = 0; x < size; x++)
+    {
+        // The first pixel has nothing to its left.
+        const int left   = x >= bytesPerPixel ? row[x - bytesPerPixel] : 0;
+        const int up     = previous[x];
+        const int upLeft = x >= bytesPerPixel ? previous[x - bytesPerPixel] : 0;
+
+        uint8_t predicted = 0;
+        switch (filter)
+        {
+            case PngFilterSub:
+                predicted = left;
+                break;
+
+            case PngFilterUp:
+                predicted = up;
+                break;
+
+            case PngFilterAverage:
+                predicted = (left + up) / 2;
+                break;
+
+            case PngFilterPaeth:
+                predicted = paeth_predictor(left, up, upLeft);
+                break;
+        }
+
+        out[x]             = row[x] - predicted;
+        const int8_t value = out[x];
+        cost += value < 0 ? -value : value;
+    }
+
+    return cost;
+}
+
+static void filter_span_row(const uint8_t *row, const uint8_t *previous, uint8_t *out, int size, int bytesPerPixel, int mode)
+{
+    if (!previous) { previous = ZERO_ROW; }
+
+    int filter = mode;
+    if (mode == PngFilterAdaptive)
+    {
+        // Same heuristic as whole RGB rows, with every filter tried in place.
+        uint32_t bestCost = UINT32_MAX;
+        for (int i = PngFilterNone; i < PngFilterAdaptive; i++)
+        {
+            const uint32_t cost = filter_span(i, row, previous, out + 1, size, bytesPerPixel);
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                filter   = i;
+            }
+        }
+
+        // Paeth was the last one written.
+        if (filter == PngFilterPaeth)
+        {
+            out[0] = filter;
+            return;
+        }
+    }
+
+    out[0] = filter;
+    filter_span(filter, row, previous, out + 1, size, bytesPerPixel);
+}
+
+static inline uint8_t paeth_predictor(int left, int up, int upLeft)
+{
+    // Same as the spec, written without branches so it vectorizes.
+    const int distanceLeft   = abs(up - upLeft);
+    const int distanceUp     = abs(left - upLeft);
+    const int distanceUpLeft = abs(left + up - 2 * upLeft);
+
+    const int upOrUpLeft = distanceUp <= distanceUpLeft ? up : upLeft;
+    return distanceLeft <= distanceUp && distanceLeft <= distanceUpLeft ? left : upOrUpLeft;
+}
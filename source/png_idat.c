@@ -0,0 +1,412 @@
+#include "png_idat.h"
+
+#include "encode_arena.h"
+#include "fast_deflate.h"
+#include "png_chunk.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined(PNGSHOT_LIBDEFLATE)
+    #include <libdeflate.h>
+#endif
+
+/// @brief Bytes in front of the data of an fdAT. The sequence number.
+#define FDAT_SEQUENCE_SIZE 4
+
+// clang-format off
+struct IdatWriter
+{
+    /// @brief File the chunks are written to.
+    FSFILE *file;
+
+    /// @brief zlib stream. Unused in speed mode.
+    z_stream stream;
+
+    /// @brief Fast deflate stream. NULL unless this is speed mode.
+    FastDeflate *fast;
+
+    /// @brief Bytes of buffer fast has filled so far.
+    size_t fastUsed;
+
+    /// @brief libdeflate compressor. NULL unless this is a one-shot writer.
+    struct libdeflate_compressor *oneShot;
+
+    /// @brief Every row of a one-shot writer, followed by room for its output.
+    uint8_t *oneShotBuffer;
+
+    /// @brief Room for rows in oneShotBuffer, how much of it's been filled, and room for output after it.
+    size_t oneShotSize, oneShotUsed, oneShotBound;
+
+    /// @brief Sequence number of the next fdAT. NULL for IDAT.
+    uint32_t *sequence;
+
+    /// @brief Points to where compressed data goes in chunk. That's behind the sequence number for fdAT.
+    uint8_t *buffer;
+
+    /// @brief Size of the part of chunk buffer points to.
+    size_t bufferSize;
+
+    /// @brief Compressed data waiting to become a chunk, with room for the header, sequence number and CRC around it so the
+    /// whole chunk goes out in one write.
+    uint8_t chunk[];
+};
+
+/// @brief The stream idat_writer_warm_up keeps between captures.
+typedef struct
+{
+    /// @brief The writer. NULL when it isn't warm.
+    IdatWriter *writer;
+
+    /// @brief Block zlib's state was allocated from, and how much of it was handed out.
+    uint8_t *memory;
+    size_t used;
+
+    /// @brief Level and strategy the stream is set to.
+    int level, strategy;
+
+    /// @brief Set while the writer is handed out.
+    bool inUse;
+} WarmWriter;
+// clang-format on
+
+/// @brief Size of the warm stream's block. The same as a writer from idat_writer_open takes from the arena.
+static const size_t WARM_MEMORY_SIZE = ENCODE_ARENA_DEFLATE_SIZE(15, 8);
+
+/// @brief The warm stream. Only the capture worker uses it.
+static WarmWriter warm = {0};
+
+// Defined at bottom.
+
+/// @brief Runs deflate with the flush passed and writes every full buffer as a chunk.
+static bool idat_writer_deflate(IdatWriter *writer, int flush);
+
+/// @brief Writes the buffer as a chunk if there isn't room for size more bytes of fast deflate output.
+static bool idat_writer_fast_reserve(IdatWriter *writer, size_t size);
+
+/// @brief Writes size bytes of the buffer as an IDAT or fdAT.
+static bool idat_writer_write_chunk(IdatWriter *writer, size_t size);
+
+/// @brief Deflates every row a one-shot writer gathered and writes them as one IDAT.
+static bool idat_writer_oneshot_finish(IdatWriter *writer);
+
+/// @brief Allocates a writer with room for a buffer of the size passed.
+static IdatWriter *idat_writer_create(FSFILE *file, uint32_t *sequence, size_t bufferSize);
+
+/// @brief zalloc for the warm stream. Everything comes out of its block, once, when it's set up.
+static voidpf idat_writer_warm_zalloc(voidpf opaque, uInt items, uInt size);
+
+/// @brief zfree for the warm stream. The block is freed in one piece.
+static void idat_writer_warm_zfree(voidpf opaque, voidpf address);
+
+size_t idat_writer_arena_size(bool speed)
+{
+    // fast_deflate doesn't go through the arena. zlib gets a 15 bit window and memLevel 8.
+    return speed ? 0 : ENCODE_ARENA_DEFLATE_SIZE(15, 8);
+}
+
+IdatWriter *idat_writer_open(FSFILE *file, int level, int strategy, bool speed)
+{
+    return idat_writer_open_frame(file, level, strategy, speed, NULL);
+}
+
+IdatWriter *idat_writer_open_frame(FSFILE *file, int level, int strategy, bool speed, uint32_t *sequence)
+{
+    IdatWriter *writer = idat_writer_create(file, sequence, IDAT_BUFFER_SIZE);
+    if (!writer) { return NULL; }
+
+    // Same window and memory libpng would use, unless this is speed mode.
+    writer->fast           = speed ? fast_deflate_create() : NULL;
+    const bool initialized = speed ? writer->fast != NULL
+                                   : deflateInit2(&writer->stream, level, Z_DEFLATED, 15, 8, strategy) == Z_OK;
+    if (!initialized)
+    {
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+IdatWriter *idat_writer_open_sized(FSFILE *file, int level, int strategy, int windowBits, int memLevel, size_t bufferSize)
+{
+    IdatWriter *writer = idat_writer_create(file, NULL, bufferSize);
+    if (!writer) { return NULL; }
+
+    if (deflateInit2(&writer->stream, level, Z_DEFLATED, windowBits, memLevel, strategy) != Z_OK)
+    {
+        free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+bool idat_writer_warm_up(void)
+{
+    if (warm.writer) { return true; }
+
+    // The level and strategy are set for every image, so what it starts with doesn't matter.
+    warm.memory = memalign(16, WARM_MEMORY_SIZE);
+    warm.writer = warm.memory ? idat_writer_create(NULL, NULL, IDAT_BUFFER_SIZE) : NULL;
+    if (!warm.writer) { goto abort; }
+    warm.writer->stream.zalloc = idat_writer_warm_zalloc;
+    warm.writer->stream.zfree  = idat_writer_warm_zfree;
+
+    if (deflateInit2(&warm.writer->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        goto abort;
+    }
+    warm.level    = Z_DEFAULT_COMPRESSION;
+    warm.strategy = Z_DEFAULT_STRATEGY;
+
+    return true;
+
+abort:
+    free(warm.writer);
+    free(warm.memory);
+    warm = (WarmWriter){0};
+    return false;
+}
+
+void idat_writer_warm_release(void)
+{
+    if (!warm.writer || warm.inUse) { return; }
+
+    deflateEnd(&warm.writer->stream);
+    free(warm.writer);
+    free(warm.memory);
+    warm = (WarmWriter){0};
+}
+
+size_t idat_writer_warm_size(void)
+{
+    return warm.writer ? WARM_MEMORY_SIZE + sizeof(IdatWriter) + warm.writer->bufferSize : 0;
+}
+
+IdatWriter *idat_writer_open_warm(FSFILE *file, int level, int strategy)
+{
+    if (!warm.writer || warm.inUse) { return NULL; }
+
+    // deflateReset keeps the window and tables and only clears what a new stream needs. Right after it, deflateParams has
+    // nothing to flush, but the output is set up first anyway in case it tries. Most captures use the same settings as the
+    // last one, so it's skipped then.
+    IdatWriter *writer = warm.writer;
+    if (deflateReset(&writer->stream) != Z_OK) { return NULL; }
+
+    writer->stream.next_out  = writer->buffer;
+    writer->stream.avail_out = writer->bufferSize;
+    const bool changed       = level != warm.level || strategy != warm.strategy;
+    if (changed && deflateParams(&writer->stream, level, strategy) != Z_OK) { return NULL; }
+    warm.level    = level;
+    warm.strategy = strategy;
+
+    writer->file = file;
+    warm.inUse   = true;
+    return writer;
+}
+
+IdatWriter *idat_writer_open_oneshot(FSFILE *file, int level, size_t size)
+{
+#if defined(PNGSHOT_LIBDEFLATE)
+    // Nothing's written until the end, so the chunk buffer isn't needed.
+    IdatWriter *writer = idat_writer_create(file, NULL, 0);
+    if (!writer) { return NULL; }
+
+    writer->oneShot = libdeflate_alloc_compressor(level);
+    if (!writer->oneShot) { goto abort; }
+
+    // The rows and the output are one block.
+    writer->oneShotSize   = size;
+    writer->oneShotBound  = libdeflate_zlib_compress_bound(writer->oneShot, size);
+    writer->oneShotBuffer = malloc(size + writer->oneShotBound);
+    if (!writer->oneShotBuffer) { goto abort; }
+
+    return writer;
+
+abort:
+    idat_writer_abort(writer);
+    return NULL;
+#else
+    (void)file;
+    (void)level;
+    (void)size;
+    return NULL;
+#endif
+}
+
+bool idat_writer_write_row(IdatWriter *writer, const uint8_t *row, size_t size)
+{
+    if (writer->oneShot)
+    {
+        if (size > writer->oneShotSize - writer->oneShotUsed) { return false; }
+
+        memcpy(writer->oneShotBuffer + writer->oneShotUsed, row, size);
+        writer->oneShotUsed += size;
+        return true;
+    }
+
+    if (writer->fast)
+    {
+        if (size > FAST_DEFLATE_MAX_ROW || !idat_writer_fast_reserve(writer, FAST_DEFLATE_BOUND(size))) { return false; }
+
+        writer->fastUsed += fast_deflate_row(writer->fast, row, size, writer->buffer + writer->fastUsed);
+        return true;
+    }
+
+    writer->stream.next_in  = (Bytef *)row;
+    writer->stream.avail_in = size;
+    return idat_writer_deflate(writer, Z_NO_FLUSH);
+}
+
+bool idat_writer_close(IdatWriter *writer)
+{
+    FSFILE *file = writer->file;
+    return idat_writer_finish(writer) && png_chunk_write_end(file);
+}
+
+bool idat_writer_finish(IdatWriter *writer)
+{
+    // Whatever's left that didn't fill a whole buffer.
+    bool finished    = false;
+    size_t remaining = 0;
+    if (writer->oneShot) { finished = idat_writer_oneshot_finish(writer); }
+    else if (writer->fast)
+    {
+        finished = idat_writer_fast_reserve(writer, FAST_DEFLATE_BOUND(0));
+        if (finished) { writer->fastUsed += fast_deflate_finish(writer->fast, writer->buffer + writer->fastUsed); }
+        remaining = writer->fastUsed;
+    }
+    else
+    {
+        finished  = idat_writer_deflate(writer, Z_FINISH);
+        remaining = writer->bufferSize - writer->stream.avail_out;
+    }
+
+    const bool lastWritten = finished && (remaining == 0 || idat_writer_write_chunk(writer, remaining));
+
+    idat_writer_abort(writer);
+    return lastWritten;
+}
+
+void idat_writer_abort(IdatWriter *writer)
+{
+    if (!writer) { return; }
+
+    // The warm stream is reset when it's next opened.
+    if (writer == warm.writer)
+    {
+        writer->file = NULL;
+        warm.inUse   = false;
+        return;
+    }
+
+#if defined(PNGSHOT_LIBDEFLATE)
+    if (writer->oneShot) { libdeflate_free_compressor(writer->oneShot); }
+#endif
+    if (writer->fast) { fast_deflate_destroy(writer->fast); }
+    else if (!writer->oneShot) { deflateEnd(&writer->stream); }
+    free(writer->oneShotBuffer);
+    free(writer);
+}
+
+static bool idat_writer_deflate(IdatWriter *writer, int flush)
+{
+    const int expected = flush == Z_FINISH ? Z_STREAM_END : Z_OK;
+    while (true)
+    {
+        const int result = deflate(&writer->stream, flush);
+        if (result != Z_OK && result != expected && result != Z_BUF_ERROR) { return false; }
+
+        // Full buffer becomes a chunk.
+        if (writer->stream.avail_out == 0)
+        {
+            if (!idat_writer_write_chunk(writer, writer->bufferSize)) { return false; }
+
+            writer->stream.next_out  = writer->buffer;
+            writer->stream.avail_out = writer->bufferSize;
+            continue;
+        }
+
+        // Done once all of the input is consumed, or the stream is finished.
+        if (result == expected && (flush == Z_FINISH || writer->stream.avail_in == 0)) { return true; }
+        if (result == Z_BUF_ERROR) { return flush != Z_FINISH; }
+    }
+}
+
+static bool idat_writer_fast_reserve(IdatWriter *writer, size_t size)
+{
+    if (writer->bufferSize - writer->fastUsed >= size) { return true; }
+
+    const bool chunkWritten = idat_writer_write_chunk(writer, writer->fastUsed);
+    writer->fastUsed        = 0;
+    return chunkWritten;
+}
+
+static bool idat_writer_write_chunk(IdatWriter *writer, size_t size)
+{
+    if (!writer->sequence) { return png_chunk_write_framed(writer->file, "IDAT", writer->buffer, size); }
+
+    // fdAT is the same as IDAT with the sequence number in front of the data.
+    uint8_t *data           = writer->buffer - FDAT_SEQUENCE_SIZE;
+    const uint32_t sequence = (*writer->sequence)++;
+    data[0]                 = sequence >> 24;
+    data[1]                 = sequence >> 16;
+    data[2]                 = sequence >> 8;
+    data[3]                 = sequence;
+    return png_chunk_write_framed(writer->file, "fdAT", data, size + FDAT_SEQUENCE_SIZE);
+}
+
+static bool idat_writer_oneshot_finish(IdatWriter *writer)
+{
+#if defined(PNGSHOT_LIBDEFLATE)
+    // libdeflate writes the zlib header and Adler-32 too, so this is the whole stream.
+    uint8_t *output         = writer->oneShotBuffer + writer->oneShotSize;
+    const size_t outputSize = libdeflate_zlib_compress(writer->oneShot,
+                                                       writer->oneShotBuffer,
+                                                       writer->oneShotUsed,
+                                                       output,
+                                                       writer->oneShotBound);
+    return outputSize > 0 && png_chunk_write(writer->file, "IDAT", output, outputSize);
+#else
+    (void)writer;
+    return false;
+#endif
+}
+
+static IdatWriter *idat_writer_create(FSFILE *file, uint32_t *sequence, size_t bufferSize)
+{
+    const size_t chunkSize = PNG_CHUNK_HEADER_SIZE + FDAT_SEQUENCE_SIZE + bufferSize + PNG_CHUNK_CRC_SIZE;
+    IdatWriter *writer     = calloc(1, sizeof(IdatWriter) + chunkSize);
+    if (!writer) { return NULL; }
+
+    writer->file             = file;
+    writer->sequence         = sequence;
+    writer->buffer           = writer->chunk + PNG_CHUNK_HEADER_SIZE + (sequence ? FDAT_SEQUENCE_SIZE : 0);
+    writer->bufferSize       = bufferSize;
+    writer->stream.zalloc    = encode_arena_zalloc;
+    writer->stream.zfree     = encode_arena_zfree;
+    writer->stream.next_out  = writer->buffer;
+    writer->stream.avail_out = bufferSize;
+    return writer;
+}
+
+static voidpf idat_writer_warm_zalloc(voidpf opaque, uInt items, uInt size)
+{
+    (void)opaque;
+
+    // zlib allocates its state once in deflateInit2. Anything that doesn't fit fails the setup.
+    const size_t alignedSize = ((size_t)items * size + 15) & ~(size_t)15;
+    if (alignedSize > WARM_MEMORY_SIZE - warm.used) { return Z_NULL; }
+
+    voidpf pointer = warm.memory + warm.used;
+    warm.used += alignedSize;
+    return pointer;
+}
+
+static void idat_writer_warm_zfree(voidpf opaque, voidpf address)
+{
+    (void)opaque;
+    (void)address;
+}
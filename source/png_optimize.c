@@ -0,0 +1,851 @@
+#include "png_optimize.h"
+
+#include "FSFILE.h"
+#include "capture.h"
+#include "directory_cache.h"
+#include "encode_arena.h"
+#include "fsdir.h"
+#include "png_chunk.h"
+#include "png_filter.h"
+#include "png_idat.h"
+#include "png_palette.h"
+
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+/// @brief Directory the dated directories are in. The marker is relative to it.
+#define ALBUM_ROOT "/PNGs/"
+
+/// @brief Depth of the day directories below ALBUM_ROOT. YYYY/MM/DD.
+#define DAY_DEPTH 3
+
+/// @brief Longest directory or file name looked at. Captures are named YYYYMMDD_HHMMSS_N.png.
+#define NAME_SIZE 0x40
+
+/// @brief Size of the buffer compressed data is read into. Same as the IDATs captures are written in.
+#define INPUT_BUFFER_SIZE 0x2000
+
+/// @brief Size of the buffer trials deflate into. What comes out is only counted.
+#define TRIAL_BUFFER_SIZE 0x1000
+
+/// @brief Largest unfiltered row. RGB.
+#define MAX_ROW_SIZE (CAPTURE_WIDTH * 3)
+
+/// @brief Heap inflate needs for a 15 bit window, plus room for its state.
+#define INFLATE_ARENA_SIZE (((size_t)1 << 15) + 0x2000)
+
+/// @brief Marker of the last file done.
+static const char *PROGRESS_PATH = PNG_OPTIMIZE_DIRECTORY "/progress";
+
+/// @brief New marker. It's written in full before it replaces the old one.
+static const char *PROGRESS_NEW_PATH = PNG_OPTIMIZE_DIRECTORY "/progress.new";
+
+/// @brief Optimized file while it's being written.
+static const char *TEMPORARY_PATH = PNG_OPTIMIZE_DIRECTORY "/temp.png";
+
+/// @brief Optimized file once it's been checked and the marker is on the file it replaces.
+static const char *REPLACE_PATH = PNG_OPTIMIZE_DIRECTORY "/replace.png";
+
+/// @brief How far back a new marker starts. A week, in seconds.
+static const uint64_t FIRST_RUN_SECONDS = 7 * 24 * 60 * 60;
+
+/// @brief zlib level every pass uses. Time doesn't matter here.
+static const int OPTIMIZE_LEVEL = 9;
+
+/// @brief PNG signature.
+static const uint8_t PNG_SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+/// @brief Strategies tried with the filter that came out best with the default one. Huffman only and fixed never win on
+/// images.
+static const int STRATEGIES[] = {Z_FILTERED, Z_RLE};
+
+/// @brief How a pass ended.
+enum PassResults
+{
+    PassFinished,
+    PassOverLimit,
+    PassCancelled,
+    PassFailed
+};
+
+// clang-format off
+/// @brief PNG being read back.
+typedef struct
+{
+    /// @brief File being read.
+    FSFILE *file;
+
+    /// @brief Inflate stream for the IDATs.
+    z_stream stream;
+
+    /// @brief Whether inflateInit succeeded and whether the stream has ended.
+    bool inflating, ended;
+
+    /// @brief Color type from IHDR and what it means for rows.
+    int colorType, bytesPerPixel, rowSize;
+
+    /// @brief PLTE if the image is indexed.
+    uint8_t palette[PNG_PALETTE_MAX_COLORS * 3];
+
+    /// @brief Size of palette.
+    uint32_t paletteSize;
+
+    /// @brief Bytes of the current IDAT that haven't been read yet.
+    uint32_t chunkRemaining;
+
+    /// @brief CRC of the current chunk so far.
+    uint32_t crc;
+
+    /// @brief Compressed data waiting to be inflated.
+    uint8_t input[INPUT_BUFFER_SIZE];
+} PngSource;
+
+/// @brief Names read from a directory, sorted.
+typedef struct
+{
+    /// @brief The names, one after another.
+    char *names;
+
+    /// @brief Where each name starts in names, in order.
+    const char **sorted;
+
+    /// @brief Number of names.
+    size_t count;
+} NameList;
+// clang-format on
+
+/// @brief Path of the last file done, relative to ALBUM_ROOT and sized to still fit in a path after it. Directories on it are
+/// searched from the names on it, so a marker with an empty file name is before every file in its directory.
+static char marker[FS_MAX_PATH - sizeof(ALBUM_ROOT) + 1] = {0};
+
+/// @brief Set by png_optimize_set_cancelled.
+static atomic_bool optimizeCancelled = false;
+
+/// @brief Day directory being gone through and its PNGs past the marker when it was read. Empty path if nothing's listed.
+static char dayPath[FS_MAX_PATH] = {0};
+static NameList dayList          = {0};
+
+// Defined at bottom.
+
+/// @brief Runs the trials on the file passed and replaces it if one of them is smaller.
+/// @return One of PngOptimizeResults.
+static int optimize_file(FsFileSystem *albumDir, const char *path, PngOptimizeStats *stats);
+
+/// @brief Runs a trial pass with the settings passed. If it comes in under bestSize, they become the best settings.
+/// @return One of PassResults.
+static int run_trial(FsFileSystem *albumDir,
+                     const char *path,
+                     int rowFilter,
+                     int strategy,
+                     int64_t *bestSize,
+                     PngOptimizeStats *stats);
+
+/// @brief Reads the image back, refilters every row with the filter passed and deflates it with the strategy passed.
+/// @param output File to write the new PNG to. NULL for a trial, which only counts the compressed bytes.
+/// @param limit Trials give up once they're past this many compressed bytes.
+/// @param sizeOut Receives the number of compressed bytes a trial came out to.
+/// @return One of PassResults.
+static int run_pass(FsFileSystem *albumDir,
+                    const char *path,
+                    int rowFilter,
+                    int strategy,
+                    FSFILE *output,
+                    int64_t limit,
+                    int64_t *sizeOut);
+
+/// @brief Deflates the data passed into the buffer passed, which is thrown away every time it fills.
+static bool trial_deflate(z_stream *stream, uint8_t *buffer, const uint8_t *data, size_t size, int flush);
+
+/// @brief Reads the whole PNG passed to make sure it's intact. This is done to the new file before the old one goes.
+static bool check_file(FsFileSystem *albumDir, const char *path);
+
+/// @brief Swaps the optimized file in for the one passed.
+/// @return One of PngOptimizeResults.
+static int replace_file(FsFileSystem *albumDir, const char *path);
+
+/// @brief Moves a leftover replace.png to the file the marker is on, or deletes it if that file is still there.
+/// @return True if there's no replace.png left.
+static bool finish_replace(FsFileSystem *albumDir);
+
+/// @brief Opens the PNG passed and reads up to the first IDAT. Fails on anything that isn't a plain capture.
+static bool source_open(FsFileSystem *albumDir, const char *path, PngSource *source);
+
+/// @brief Inflates the next row, filter type byte included.
+static bool source_read_row(PngSource *source, uint8_t *row, size_t size);
+
+/// @brief Makes sure the zlib stream ends right after the last row and is followed by IEND.
+static bool source_finish(PngSource *source);
+
+/// @brief Frees the stream and closes the file.
+static void source_close(PngSource *source);
+
+/// @brief Fills the input buffer from the current IDAT, moving on to the next one when it runs out.
+static bool source_refill(PngSource *source);
+
+/// @brief Reads the length and type of the next chunk and starts its CRC.
+static bool source_next_chunk(PngSource *source, uint32_t *lengthOut, char typeOut[4]);
+
+/// @brief Reads chunk data and adds it to the CRC.
+static bool source_read_data(PngSource *source, void *buffer, size_t size);
+
+/// @brief Reads the CRC at the end of the chunk and compares it to the one worked out.
+static bool source_check_crc(PngSource *source);
+
+/// @brief Searches the directory in path for the first PNG past what's left of the marker.
+/// @param path Full path of the directory, ending in a slash. Receives the full path of the file.
+/// @param depth Depth of the directory below ALBUM_ROOT.
+/// @param after What's left of the marker below this directory. NULL to take the first PNG there is.
+static bool find_after(FsFileSystem *albumDir, char *path, int depth, const char *after);
+
+/// @brief Reads the names in a directory that sort after the one passed, and sorts them.
+/// @param extension Extension of the files to list. NULL for directories.
+static bool list_names(FsFileSystem *albumDir, const char *path, const char *extension, const char *after, NameList *listOut);
+
+/// @brief Returns the first name in the list that sorts after the one passed, skipping any too long for NAME_SIZE. NULL if
+/// there isn't one.
+static const char *list_next(const NameList *list, const char *after);
+
+/// @brief Frees the list passed.
+static void list_free(NameList *list);
+
+/// @brief qsort comparison for names.
+static int compare_names(const void *a, const void *b);
+
+/// @brief Reads the marker from the SD.
+static bool load_marker(FsFileSystem *albumDir);
+
+/// @brief Creates a marker at the start of the day a week ago.
+static bool start_marker(FsFileSystem *albumDir);
+
+/// @brief Writes the marker passed to the SD and makes it the current one.
+static bool save_marker(FsFileSystem *albumDir, const char *relativePath);
+
+/// @brief Returns whether the name passed is only digits.
+static inline bool all_digits(const char *name);
+
+/// @brief Reads a big endian 32 bit integer.
+static inline uint32_t read_be32(const uint8_t *data);
+
+bool png_optimize_start(FsFileSystem *albumDir)
+{
+    if (!directory_cache_ensure(albumDir, PNG_OPTIMIZE_DIRECTORY)) { return false; }
+    if (!load_marker(albumDir) && !start_marker(albumDir)) { return false; }
+
+    // A half written file is useless. A finished one is sorted out before anything else happens.
+    if (FSFILE_Exists(albumDir, TEMPORARY_PATH)) { FSFILE_Delete(albumDir, TEMPORARY_PATH); }
+    finish_replace(albumDir);
+
+    return true;
+}
+
+int png_optimize_next(FsFileSystem *albumDir, PngOptimizeStats *statsOut)
+{
+    // The marker can't move on while a replace.png that belongs to it is still around.
+    if (!finish_replace(albumDir)) { return PngOptimizeFailed; }
+
+    PngOptimizeStats stats = {.rowFilter = -1, .strategy = -1};
+    snprintf(stats.path, sizeof(stats.path), ALBUM_ROOT);
+    if (!find_after(albumDir, stats.path, 0, marker))
+    {
+        png_optimize_release();
+        return PngOptimizeDone;
+    }
+
+    // Every pass takes as much of the heap as a capture, which doesn't leave room for the warm stream.
+    idat_writer_warm_release();
+
+    const uint64_t begin = armGetSystemTick();
+    int result           = optimize_file(albumDir, stats.path, &stats);
+    stats.ticks          = armGetSystemTick() - begin;
+
+    // Replacing moves the marker on before the old file goes. A cancelled file is done again next time.
+    const bool done = result != PngOptimizeCancelled && result != PngOptimizeReplaced;
+    if (done && !save_marker(albumDir, stats.path + strlen(ALBUM_ROOT))) { result = PngOptimizeFailed; }
+
+    if (statsOut) { *statsOut = stats; }
+    return result;
+}
+
+void png_optimize_set_cancelled(bool cancelled) { atomic_store(&optimizeCancelled, cancelled); }
+
+void png_optimize_release(void)
+{
+    list_free(&dayList);
+    dayPath[0] = '\0';
+}
+
+static int optimize_file(FsFileSystem *albumDir, const char *path, PngOptimizeStats *stats)
+{
+    FSFILE *file = FSFILE_OpenRead(albumDir, path);
+    if (!file) { return PngOptimizeFailed; }
+    stats->oldSize = FSFILE_GetSize(file);
+    stats->newSize = stats->oldSize;
+    FSFILE_Close(file);
+
+    // Every filter with the default strategy first. Each trial only has to beat the best so far, so most give up well
+    // before the end. Trials only fail if the file can't be read back.
+    int64_t bestSize = stats->oldSize;
+    for (int filter = PngFilterNone; filter <= PngFilterAdaptive; filter++)
+    {
+        const int result = run_trial(albumDir, path, filter, Z_DEFAULT_STRATEGY, &bestSize, stats);
+        if (result == PassCancelled) { return PngOptimizeCancelled; }
+        if (result == PassFailed) { return PngOptimizeSkipped; }
+    }
+
+    // The other strategies only ever shave a little off, so if the default couldn't beat the file they won't either.
+    if (stats->rowFilter < 0) { return PngOptimizeKept; }
+
+    const int bestFilter = stats->rowFilter;
+    for (size_t i = 0; i < sizeof(STRATEGIES) / sizeof(STRATEGIES[0]); i++)
+    {
+        const int result = run_trial(albumDir, path, bestFilter, STRATEGIES[i], &bestSize, stats);
+        if (result == PassCancelled) { return PngOptimizeCancelled; }
+        if (result == PassFailed) { return PngOptimizeSkipped; }
+    }
+
+    // It should come out smaller than the old one, so that's what it's created at. Chunks are already written whole, and
+    // a write buffer would only add to the peak.
+    FSFILE *output = FSFILE_OpenWrite(albumDir, TEMPORARY_PATH, stats->oldSize);
+    if (!output) { return PngOptimizeFailed; }
+
+    const int result   = run_pass(albumDir, path, stats->rowFilter, stats->strategy, output, 0, NULL);
+    const int64_t size = FSFILE_Tell(output);
+    const bool flushed = result == PassFinished && FSFILE_Flush(output);
+    FSFILE_Finalize(output);
+    ++stats->passes;
+
+    // Chunk headers aren't in the trial sizes, so the winner can still come out a few bytes over.
+    const bool smaller = flushed && size < stats->oldSize;
+    if (!smaller || !check_file(albumDir, TEMPORARY_PATH))
+    {
+        FSFILE_Delete(albumDir, TEMPORARY_PATH);
+        if (result == PassCancelled) { return PngOptimizeCancelled; }
+        return flushed && !smaller ? PngOptimizeKept : PngOptimizeFailed;
+    }
+
+    stats->newSize = size;
+    return replace_file(albumDir, path);
+}
+
+static int run_trial(FsFileSystem *albumDir,
+                     const char *path,
+                     int rowFilter,
+                     int strategy,
+                     int64_t *bestSize,
+                     PngOptimizeStats *stats)
+{
+    int64_t size     = 0;
+    const int result = run_pass(albumDir, path, rowFilter, strategy, NULL, *bestSize, &size);
+    ++stats->passes;
+    if (result != PassFinished) { return result; }
+
+    *bestSize        = size;
+    stats->rowFilter = rowFilter;
+    stats->strategy  = strategy;
+    return result;
+}
+
+static int run_pass(FsFileSystem *albumDir,
+                    const char *path,
+                    int rowFilter,
+                    int strategy,
+                    FSFILE *output,
+                    int64_t limit,
+                    int64_t *sizeOut)
+{
+    // Inflate and deflate both live in the arena. Nothing else runs while this does, so this is the same peak as a capture.
+    encode_arena_begin(ENCODE_ARENA_DEFLATE_SIZE(15, 8) + INFLATE_ARENA_SIZE);
+
+    // The source, the row it inflates to, the unfiltered rows above and below, the refiltered row and the trial output.
+    PngSource *source = malloc(sizeof(PngSource) + (MAX_ROW_SIZE + 1) * 2 + MAX_ROW_SIZE * 2 + TRIAL_BUFFER_SIZE);
+    if (!source)
+    {
+        encode_arena_end(NULL);
+        return PassFailed;
+    }
+    memset(source, 0, sizeof(PngSource));
+
+    uint8_t *inputRow    = (uint8_t *)(source + 1);
+    uint8_t *outputRow   = inputRow + MAX_ROW_SIZE + 1;
+    uint8_t *previousRow = outputRow + MAX_ROW_SIZE + 1;
+    uint8_t *currentRow  = previousRow + MAX_ROW_SIZE;
+    uint8_t *trialBuffer = currentRow + MAX_ROW_SIZE;
+
+    int result         = PassFailed;
+    IdatWriter *writer = NULL;
+    z_stream trial     = {.zalloc = encode_arena_zalloc, .zfree = encode_arena_zfree};
+    bool trialOpen     = false;
+    if (!source_open(albumDir, path, source)) { goto cleanup; }
+
+    if (output)
+    {
+        const bool headerWritten = png_chunk_write_header_color(output, source->colorType) &&
+                                   (source->colorType != PngColorIndexed ||
+                                    png_chunk_write(output, "PLTE", source->palette, source->paletteSize));
+        writer = headerWritten ? idat_writer_open(output, OPTIMIZE_LEVEL, strategy, false) : NULL;
+        if (!writer) { goto cleanup; }
+    }
+    else
+    {
+        trialOpen = deflateInit2(&trial, OPTIMIZE_LEVEL, Z_DEFLATED, 15, 8, strategy) == Z_OK;
+        if (!trialOpen) { goto cleanup; }
+    }
+
+    const int rowSize = source->rowSize;
+    for (int y = 0; y < CAPTURE_HEIGHT; y++)
+    {
+        // A capture is waiting. Everything so far is thrown away.
+        if (atomic_load(&optimizeCancelled))
+        {
+            result = PassCancelled;
+            goto cleanup;
+        }
+
+        const uint8_t *above = y > 0 ? previousRow : NULL;
+        const bool read      = source_read_row(source, inputRow, rowSize + 1) &&
+                               png_unfilter_row(inputRow, above, currentRow, rowSize, source->bytesPerPixel);
+        if (!read) { goto cleanup; }
+
+        // Gray and indexed rows are one byte per pixel, so they filter the same way.
+        if (source->colorType == PngColorRGB) { png_filter_row(currentRow, above, outputRow, rowFilter); }
+        else { png_filter_gray_row(currentRow, above, outputRow, rowFilter); }
+
+        if (writer && !idat_writer_write_row(writer, outputRow, rowSize + 1)) { goto cleanup; }
+        if (!writer && !trial_deflate(&trial, trialBuffer, outputRow, rowSize + 1, Z_NO_FLUSH)) { goto cleanup; }
+        if (!writer && (int64_t)trial.total_out > limit)
+        {
+            result = PassOverLimit;
+            goto cleanup;
+        }
+
+        uint8_t *swap = previousRow;
+        previousRow   = currentRow;
+        currentRow    = swap;
+    }
+
+    // Anything after the last row means the file wasn't what it looked like.
+    if (!source_finish(source)) { goto cleanup; }
+
+    if (writer)
+    {
+        const bool closed = idat_writer_close(writer);
+        writer            = NULL;
+        result            = closed ? PassFinished : PassFailed;
+    }
+    else if (trial_deflate(&trial, trialBuffer, NULL, 0, Z_FINISH))
+    {
+        *sizeOut = trial.total_out;
+        result   = *sizeOut > limit ? PassOverLimit : PassFinished;
+    }
+
+cleanup:
+    if (writer) { idat_writer_abort(writer); }
+    if (trialOpen) { deflateEnd(&trial); }
+    source_close(source);
+    free(source);
+    encode_arena_end(NULL);
+
+    return result;
+}
+
+static bool trial_deflate(z_stream *stream, uint8_t *buffer, const uint8_t *data, size_t size, int flush)
+{
+    stream->next_in  = (Bytef *)data;
+    stream->avail_in = size;
+    while (true)
+    {
+        stream->next_out  = buffer;
+        stream->avail_out = TRIAL_BUFFER_SIZE;
+
+        const int status = deflate(stream, flush);
+        if (status == Z_STREAM_ERROR) { return false; }
+
+        // Room left over means deflate took everything it was given.
+        if (flush == Z_FINISH ? status == Z_STREAM_END : stream->avail_out > 0) { return true; }
+    }
+}
+
+static bool check_file(FsFileSystem *albumDir, const char *path)
+{
+    encode_arena_begin(INFLATE_ARENA_SIZE);
+
+    PngSource *source = malloc(sizeof(PngSource) + MAX_ROW_SIZE + 1);
+    if (!source)
+    {
+        encode_arena_end(NULL);
+        return false;
+    }
+    memset(source, 0, sizeof(PngSource));
+
+    // Every CRC and the zlib checksum are checked on the way through.
+    uint8_t *row = (uint8_t *)(source + 1);
+    bool intact  = source_open(albumDir, path, source);
+    for (int y = 0; intact && y < CAPTURE_HEIGHT; y++) { intact = source_read_row(source, row, source->rowSize + 1); }
+    intact = intact && source_finish(source);
+
+    source_close(source);
+    free(source);
+    encode_arena_end(NULL);
+
+    return intact;
+}
+
+static int replace_file(FsFileSystem *albumDir, const char *path)
+{
+    // The marker goes on the file first, so an interrupted replace knows where replace.png belongs.
+    const bool ready = save_marker(albumDir, path + strlen(ALBUM_ROOT)) &&
+                       FSFILE_Rename(albumDir, TEMPORARY_PATH, REPLACE_PATH);
+    if (!ready)
+    {
+        FSFILE_Delete(albumDir, TEMPORARY_PATH);
+        return PngOptimizeFailed;
+    }
+
+    if (!FSFILE_Delete(albumDir, path))
+    {
+        FSFILE_Delete(albumDir, REPLACE_PATH);
+        return PngOptimizeFailed;
+    }
+
+    // If this fails, replace.png is the only copy left. finish_replace keeps trying.
+    return FSFILE_Rename(albumDir, REPLACE_PATH, path) ? PngOptimizeReplaced : PngOptimizeFailed;
+}
+
+static bool finish_replace(FsFileSystem *albumDir)
+{
+    if (!FSFILE_Exists(albumDir, REPLACE_PATH)) { return true; }
+
+    char path[FS_MAX_PATH];
+    snprintf(path, sizeof(path), ALBUM_ROOT "%s", marker);
+
+    // The old file only goes once replace.png is finished, so if it's still there nothing's lost.
+    if (FSFILE_Exists(albumDir, path)) { return FSFILE_Delete(albumDir, REPLACE_PATH); }
+
+    return FSFILE_Rename(albumDir, REPLACE_PATH, path);
+}
+
+static bool source_open(FsFileSystem *albumDir, const char *path, PngSource *source)
+{
+    source->file = FSFILE_OpenRead(albumDir, path);
+    if (!source->file) { return false; }
+
+    uint8_t signature[sizeof(PNG_SIGNATURE)], header[13];
+    uint32_t length;
+    char type[4];
+    const bool headerRead = FSFILE_Read(source->file, signature, sizeof(signature)) == sizeof(signature) &&
+                            memcmp(signature, PNG_SIGNATURE, sizeof(signature)) == 0 &&
+                            source_next_chunk(source, &length, type) && memcmp(type, "IHDR", 4) == 0 &&
+                            length == sizeof(header) && source_read_data(source, header, sizeof(header)) &&
+                            source_check_crc(source);
+    if (!headerRead) { return false; }
+
+    // Only the fixed geometry at 8 bits without interlacing, in a color type captures are written as.
+    source->colorType    = header[9];
+    const bool supported = read_be32(header) == CAPTURE_WIDTH && read_be32(header + 4) == CAPTURE_HEIGHT &&
+                           header[8] == 8 && header[10] == 0 && header[11] == 0 && header[12] == 0 &&
+                           (source->colorType == PngColorGray || source->colorType == PngColorRGB ||
+                            source->colorType == PngColorIndexed);
+    if (!supported) { return false; }
+
+    source->bytesPerPixel = source->colorType == PngColorRGB ? 3 : 1;
+    source->rowSize       = CAPTURE_WIDTH * source->bytesPerPixel;
+
+    // PLTE is the only thing allowed before the image. Anything else would be lost by the new file.
+    while (source_next_chunk(source, &length, type) && memcmp(type, "IDAT", 4) != 0)
+    {
+        const bool palette = memcmp(type, "PLTE", 4) == 0 && source->colorType == PngColorIndexed &&
+                             source->paletteSize == 0 && length > 0 && length <= sizeof(source->palette) &&
+                             length % 3 == 0;
+        if (!palette || !source_read_data(source, source->palette, length) || !source_check_crc(source)) { return false; }
+
+        source->paletteSize = length;
+    }
+
+    const bool imageFound = memcmp(type, "IDAT", 4) == 0 &&
+                            (source->colorType != PngColorIndexed || source->paletteSize > 0);
+    if (!imageFound) { return false; }
+
+    source->chunkRemaining = length;
+    source->stream.zalloc  = encode_arena_zalloc;
+    source->stream.zfree   = encode_arena_zfree;
+    source->inflating      = inflateInit(&source->stream) == Z_OK;
+
+    return source->inflating;
+}
+
+static bool source_read_row(PngSource *source, uint8_t *row, size_t size)
+{
+    source->stream.next_out  = row;
+    source->stream.avail_out = size;
+    while (source->stream.avail_out > 0)
+    {
+        if (source->ended || (source->stream.avail_in == 0 && !source_refill(source))) { return false; }
+
+        const int status = inflate(&source->stream, Z_NO_FLUSH);
+        if (status != Z_OK && status != Z_STREAM_END) { return false; }
+        source->ended = status == Z_STREAM_END;
+    }
+
+    return true;
+}
+
+static bool source_finish(PngSource *source)
+{
+    // The stream can end with the last row or just after it, once the checksum's been read. Nothing else can come out.
+    uint8_t extra;
+    while (!source->ended)
+    {
+        if (source->stream.avail_in == 0 && !source_refill(source)) { return false; }
+
+        source->stream.next_out  = &extra;
+        source->stream.avail_out = 1;
+        const int status         = inflate(&source->stream, Z_NO_FLUSH);
+        if ((status != Z_OK && status != Z_STREAM_END) || source->stream.avail_out == 0) { return false; }
+        source->ended = status == Z_STREAM_END;
+    }
+
+    uint32_t length;
+    char type[4];
+    return source->stream.avail_in == 0 && source->chunkRemaining == 0 && source_check_crc(source) &&
+           source_next_chunk(source, &length, type) && memcmp(type, "IEND", 4) == 0 && length == 0 &&
+           source_check_crc(source);
+}
+
+static void source_close(PngSource *source)
+{
+    if (source->inflating) { inflateEnd(&source->stream); }
+    if (source->file) { FSFILE_Close(source->file); }
+}
+
+static bool source_refill(PngSource *source)
+{
+    // IDATs can be any size, empty ones included.
+    while (source->chunkRemaining == 0)
+    {
+        uint32_t length;
+        char type[4];
+        const bool nextIdat = source_check_crc(source) && source_next_chunk(source, &length, type) &&
+                              memcmp(type, "IDAT", 4) == 0;
+        if (!nextIdat) { return false; }
+
+        source->chunkRemaining = length;
+    }
+
+    const uint32_t size = source->chunkRemaining < INPUT_BUFFER_SIZE ? source->chunkRemaining : INPUT_BUFFER_SIZE;
+    if (!source_read_data(source, source->input, size)) { return false; }
+
+    source->chunkRemaining -= size;
+    source->stream.next_in  = source->input;
+    source->stream.avail_in = size;
+    return true;
+}
+
+static bool source_next_chunk(PngSource *source, uint32_t *lengthOut, char typeOut[4])
+{
+    uint8_t header[PNG_CHUNK_HEADER_SIZE];
+    if (FSFILE_Read(source->file, header, sizeof(header)) != sizeof(header)) { return false; }
+
+    *lengthOut  = read_be32(header);
+    source->crc = png_chunk_crc(0, header + 4, 4);
+    memcpy(typeOut, header + 4, 4);
+
+    // PNG lengths only go up to 2^31 - 1.
+    return *lengthOut <= 0x7FFFFFFF;
+}
+
+static bool source_read_data(PngSource *source, void *buffer, size_t size)
+{
+    if (FSFILE_Read(source->file, buffer, size) != (ssize_t)size) { return false; }
+
+    source->crc = png_chunk_crc(source->crc, buffer, size);
+    return true;
+}
+
+static bool source_check_crc(PngSource *source)
+{
+    uint8_t crc[PNG_CHUNK_CRC_SIZE];
+    return FSFILE_Read(source->file, crc, sizeof(crc)) == sizeof(crc) && read_be32(crc) == source->crc;
+}
+
+static bool find_after(FsFileSystem *albumDir, char *path, int depth, const char *after)
+{
+    const size_t length = strlen(path);
+
+    // The part of the marker for this level, and what's left of it below.
+    char name[NAME_SIZE] = "";
+    const char *rest     = NULL;
+    if (after)
+    {
+        const char *slash = depth < DAY_DEPTH ? strchr(after, '/') : NULL;
+        const int nameLength = slash ? (int)(slash - after) : (int)strlen(after);
+        snprintf(name, sizeof(name), "%.*s", nameLength, after);
+        rest = slash ? slash + 1 : "";
+    }
+
+    // Files have to come after the marker. The day is read once and searched from then on. New captures sort after
+    // everything already in it, so it's only read again once the listing runs out.
+    if (depth == DAY_DEPTH)
+    {
+        const char *next = strcmp(path, dayPath) == 0 ? list_next(&dayList, name) : NULL;
+        if (!next)
+        {
+            png_optimize_release();
+            if (!list_names(albumDir, path, "png", name, &dayList)) { return false; }
+            snprintf(dayPath, sizeof(dayPath), "%s", path);
+            next = list_next(&dayList, name);
+        }
+
+        if (next) { snprintf(path + length, FS_MAX_PATH - length, "%s", next); }
+        return next != NULL;
+    }
+
+    // Directories on the marker's path are searched first for what's after it.
+    if (after && name[0])
+    {
+        snprintf(path + length, FS_MAX_PATH - length, "%s/", name);
+        if (find_after(albumDir, path, depth + 1, rest)) { return true; }
+        path[length] = '\0';
+    }
+
+    // Years are the only directories at the top that are all digits. Pending spills and this module's files aren't.
+    NameList list;
+    if (!list_names(albumDir, path, NULL, name, &list)) { return false; }
+
+    bool found       = false;
+    const char *next = name;
+    while (!found && (next = list_next(&list, next)))
+    {
+        if (depth == 0 && !all_digits(next)) { continue; }
+
+        snprintf(path + length, FS_MAX_PATH - length, "%s/", next);
+        found = find_after(albumDir, path, depth + 1, NULL);
+        if (!found) { path[length] = '\0'; }
+    }
+
+    list_free(&list);
+    return found;
+}
+
+static bool list_names(FsFileSystem *albumDir, const char *path, const char *extension, const char *after, NameList *listOut)
+{
+    *listOut = (NameList){0};
+    if (!directory_list(albumDir, path, extension, after, &listOut->names, &listOut->count)) { return false; }
+    if (listOut->count == 0) { return true; }
+
+    listOut->sorted = malloc(sizeof(const char *) * listOut->count);
+    if (!listOut->sorted)
+    {
+        list_free(listOut);
+        return false;
+    }
+
+    const char *name = listOut->names;
+    for (size_t i = 0; i < listOut->count; i++, name += strlen(name) + 1) { listOut->sorted[i] = name; }
+    qsort(listOut->sorted, listOut->count, sizeof(const char *), compare_names);
+    return true;
+}
+
+static const char *list_next(const NameList *list, const char *after)
+{
+    size_t low  = 0;
+    size_t high = list->count;
+    while (low < high)
+    {
+        const size_t middle = low + (high - low) / 2;
+        if (strcmp(list->sorted[middle], after) <= 0) { low = middle + 1; }
+        else { high = middle; }
+    }
+
+    while (low < list->count && strlen(list->sorted[low]) >= NAME_SIZE) { ++low; }
+    return low < list->count ? list->sorted[low] : NULL;
+}
+
+static void list_free(NameList *list)
+{
+    free(list->sorted);
+    free(list->names);
+    *list = (NameList){0};
+}
+
+static int compare_names(const void *a, const void *b) { return strcmp(*(const char *const *)a, *(const char *const *)b); }
+
+static bool load_marker(FsFileSystem *albumDir)
+{
+    // Saving was interrupted after the old marker was deleted. The new one is already complete.
+    if (!FSFILE_Exists(albumDir, PROGRESS_PATH) && FSFILE_Exists(albumDir, PROGRESS_NEW_PATH))
+    {
+        FSFILE_Rename(albumDir, PROGRESS_NEW_PATH, PROGRESS_PATH);
+    }
+
+    FSFILE *file = FSFILE_OpenRead(albumDir, PROGRESS_PATH);
+    if (!file) { return false; }
+
+    const ssize_t size = FSFILE_GetSize(file);
+    const bool read    = size > 0 && size < (ssize_t)sizeof(marker) && FSFILE_Read(file, marker, size) == size;
+    FSFILE_Close(file);
+
+    marker[read ? size : 0] = '\0';
+    return read;
+}
+
+static bool start_marker(FsFileSystem *albumDir)
+{
+    // There's no clock without another service, but a file that was just created has the time on it.
+    FSFILE *file = FSFILE_OpenWrite(albumDir, PROGRESS_NEW_PATH, 0);
+    if (!file) { return false; }
+    FSFILE_Close(file);
+
+    uint64_t timestamp;
+    if (!FSFILE_GetTimeStamp(albumDir, PROGRESS_NEW_PATH, &timestamp)) { return false; }
+
+    // The day's directory with no file name, so everything in it comes after.
+    const time_t start        = (time_t)(timestamp - FIRST_RUN_SECONDS);
+    const struct tm localTime = *localtime(&start);
+
+    char dayMarker[NAME_SIZE];
+    snprintf(dayMarker,
+             sizeof(dayMarker),
+             "%04d/%02d/%02d/",
+             localTime.tm_year + 1900,
+             localTime.tm_mon + 1,
+             localTime.tm_mday);
+    return save_marker(albumDir, dayMarker);
+}
+
+static bool save_marker(FsFileSystem *albumDir, const char *relativePath)
+{
+    // Written in full before the old one goes, so there's always one complete marker on the SD.
+    const size_t length = strlen(relativePath);
+    FSFILE *file        = FSFILE_OpenWrite(albumDir, PROGRESS_NEW_PATH, length);
+    if (!file) { return false; }
+
+    const bool written = FSFILE_Write(file, relativePath, length) == (ssize_t)length && FSFILE_Flush(file);
+    FSFILE_Close(file);
+
+    const bool saved = written &&
+                       (!FSFILE_Exists(albumDir, PROGRESS_PATH) || FSFILE_Delete(albumDir, PROGRESS_PATH)) &&
+                       FSFILE_Rename(albumDir, PROGRESS_NEW_PATH, PROGRESS_PATH);
+    if (saved) { snprintf(marker, sizeof(marker), "%s", relativePath); }
+
+    return saved;
+}
+
+static inline bool all_digits(const char *name)
+{
+    for (; *name; name++)
+    {
+        if (*name < '0' || *name > '9') { return false; }
+    }
+
+    return true;
+}
+
+static inline uint32_t read_be32(const uint8_t *data)
+{
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
@@ -0,0 +1,247 @@
+#include "png_palette.h"
+
+#include "png_chunk.h"
+#include "png_filter.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+/// @brief Set on every key in the color hash so black isn't mistaken for an empty slot.
+#define COLOR_KEY_BIT 0x01000000
+
+// clang-format off
+/// @brief What's been seen of the frame so far.
+typedef struct
+{
+    /// @brief Whether every pixel so far has been gray.
+    bool gray;
+
+    /// @brief Key of the last pixel added. Runs of the same color are only looked up once.
+    uint32_t lastKey;
+} ColorScan;
+// clang-format on
+
+// Defined at bottom.
+
+/// @brief Adds every pixel of the RGBA row passed to the palette.
+/// @return False once there are more colors than fit.
+static bool scan_row(PngPalette *palette, const uint8_t *rgba, ColorScan *scan);
+
+/// @brief Adds the pixels passed to the palette one at a time.
+/// @return False once there are more colors than fit.
+static bool scan_pixels(PngPalette *palette, const uint8_t *rgba, int count, ColorScan *scan);
+
+/// @brief Adds the color passed to the palette if it isn't in it yet.
+/// @return False if it isn't and the palette is full.
+static inline bool palette_insert(PngPalette *palette, uint32_t key);
+
+/// @brief Finds the palette index of the color passed.
+/// @return False if the color isn't in the palette.
+static inline bool palette_lookup(const PngPalette *palette, uint32_t key, uint8_t *indexOut);
+
+/// @brief Returns the palette index of the color closest to the one passed.
+static uint8_t palette_nearest(const PngPalette *palette, uint32_t key);
+
+/// @brief Returns the slot to start probing at for the color passed.
+static inline uint32_t palette_hash(uint32_t key);
+
+/// @brief Returns the key of the RGBA pixel passed.
+static inline uint32_t pixel_key(const uint8_t *rgba);
+
+bool png_palette_analyze(PngPalette *palette)
+{
+    uint8_t *rgbaRow = malloc(CAPTURE_ROW_SIZE);
+    if (!rgbaRow) { return false; }
+
+    memset(palette, 0, sizeof(PngPalette));
+    ColorScan scan = {.gray = true, .lastKey = 0};
+
+    // A frame with too many colors nearly always shows it somewhere in the samples. Those rows are read again below, but
+    // they're already in the palette, so it only costs the read.
+    bool fits = true;
+    for (int i = 0; fits && i < CAPTURE_SAMPLE_ROWS; i++)
+    {
+        if (!capture_read_row(rgbaRow, capture_sample_row(i)))
+        {
+            free(rgbaRow);
+            return false;
+        }
+        fits = scan_row(palette, rgbaRow, &scan);
+    }
+
+    for (int i = 0; fits && i < CAPTURE_HEIGHT; i++)
+    {
+        if (!capture_read_row(rgbaRow, i))
+        {
+            free(rgbaRow);
+            return false;
+        }
+        fits = scan_row(palette, rgbaRow, &scan);
+    }
+    free(rgbaRow);
+
+    // Gray can't have more than 256 colors, so it always fits. It's preferred since it needs no PLTE and filters still work.
+    if (!fits) { palette->colorType = PngColorRGB; }
+    else if (scan.gray) { palette->colorType = PngColorGray; }
+    else { palette->colorType = PngColorIndexed; }
+
+    return true;
+}
+
+bool png_palette_write_header(FSFILE *file, const PngPalette *palette)
+{
+    if (!png_chunk_write_header_color(file, palette->colorType)) { return false; }
+
+    return palette->colorType != PngColorIndexed ||
+           png_chunk_write(file, "PLTE", palette->colors, (size_t)palette->colorCount * 3);
+}
+
+void png_palette_filter_rgba_row(const PngPalette *palette,
+                                 const uint8_t *rgba,
+                                 uint8_t *rowOut,
+                                 const uint8_t *previous,
+                                 uint8_t *out,
+                                 int mode)
+{
+    if (palette->colorType == PngColorIndexed)
+    {
+        // Rows of a frame with this few colors are mostly runs. The last color found is tried before the hash.
+        uint32_t lastKey  = 0;
+        uint8_t lastIndex = 0;
+        for (int x = 0; x < CAPTURE_WIDTH; x++)
+        {
+            const uint32_t key = pixel_key(rgba + x * 4);
+            if (key != lastKey)
+            {
+                if (!palette_lookup(palette, key, &lastIndex)) { lastIndex = palette_nearest(palette, key); }
+                lastKey = key;
+            }
+            rowOut[x] = lastIndex;
+        }
+
+        // Neighbouring indices don't mean neighbouring colors, so filtering them only hurts.
+        out[0] = PngFilterNone;
+        memcpy(out + 1, rowOut, CAPTURE_WIDTH);
+        return;
+    }
+
+    // Gray pixels have the same value in every channel. Red is as good as any.
+#if defined(__ARM_NEON)
+    for (int x = 0; x < CAPTURE_WIDTH; x += 16) { vst1q_u8(rowOut + x, vld4q_u8(rgba + x * 4).val[0]); }
+#else
+    for (int x = 0; x < CAPTURE_WIDTH; x++) { rowOut[x] = rgba[x * 4]; }
+#endif
+
+    png_filter_gray_row(rowOut, previous, out, mode);
+}
+
+static bool scan_row(PngPalette *palette, const uint8_t *rgba, ColorScan *scan)
+{
+#if defined(__ARM_NEON)
+    // Runs of one color are by far the most common thing in frames that fit, so 16 pixels at a time are checked against
+    // the last color and skipped if they all match. Nothing has been added before the first pixel, so that's never skipped.
+    for (int x = 0; x < CAPTURE_WIDTH; x += 16)
+    {
+        const uint8x16x4_t pixels  = vld4q_u8(rgba + x * 4);
+        const uint8x16_t sameRed   = vceqq_u8(pixels.val[0], vdupq_n_u8(scan->lastKey));
+        const uint8x16_t sameGreen = vceqq_u8(pixels.val[1], vdupq_n_u8(scan->lastKey >> 8));
+        const uint8x16_t sameBlue  = vceqq_u8(pixels.val[2], vdupq_n_u8(scan->lastKey >> 16));
+        const uint8x16_t same      = vandq_u8(vandq_u8(sameRed, sameGreen), sameBlue);
+        if (scan->lastKey && vminvq_u8(same) == 0xFF) { continue; }
+
+        if (!scan_pixels(palette, rgba + x * 4, 16, scan)) { return false; }
+    }
+
+    return true;
+#else
+    return scan_pixels(palette, rgba, CAPTURE_WIDTH, scan);
+#endif
+}
+
+static bool scan_pixels(PngPalette *palette, const uint8_t *rgba, int count, ColorScan *scan)
+{
+    for (int x = 0; x < count; x++, rgba += 4)
+    {
+        const uint32_t key = pixel_key(rgba);
+        if (key == scan->lastKey) { continue; }
+
+        scan->lastKey = key;
+        scan->gray    = scan->gray && rgba[0] == rgba[1] && rgba[1] == rgba[2];
+        if (!palette_insert(palette, key)) { return false; }
+    }
+
+    return true;
+}
+
+static inline bool palette_insert(PngPalette *palette, uint32_t key)
+{
+    // Linear probing. The hash is never more than half full, so this is short.
+    uint32_t slot = palette_hash(key);
+    while (palette->slots[slot] != 0)
+    {
+        if (palette->slots[slot] == key) { return true; }
+        slot = (slot + 1) % PNG_PALETTE_SLOTS;
+    }
+
+    if (palette->colorCount == PNG_PALETTE_MAX_COLORS) { return false; }
+
+    const int index                = palette->colorCount++;
+    palette->slots[slot]           = key;
+    palette->indices[slot]         = index;
+    palette->colors[index * 3]     = key;
+    palette->colors[index * 3 + 1] = key >> 8;
+    palette->colors[index * 3 + 2] = key >> 16;
+    return true;
+}
+
+static inline bool palette_lookup(const PngPalette *palette, uint32_t key, uint8_t *indexOut)
+{
+    // An empty slot ends the probe like it does for palette_insert. No slot is probed twice either way.
+    uint32_t slot = palette_hash(key);
+    for (int i = 0; i < PNG_PALETTE_SLOTS && palette->slots[slot] != 0; i++)
+    {
+        if (palette->slots[slot] == key)
+        {
+            *indexOut = palette->indices[slot];
+            return true;
+        }
+        slot = (slot + 1) % PNG_PALETTE_SLOTS;
+    }
+
+    return false;
+}
+
+static uint8_t palette_nearest(const PngPalette *palette, uint32_t key)
+{
+    int nearest         = 0;
+    int nearestDistance = -1;
+    for (int i = 0; i < palette->colorCount; i++)
+    {
+        const int red      = (int)(key & 0xFF) - palette->colors[i * 3];
+        const int green    = (int)(key >> 8 & 0xFF) - palette->colors[i * 3 + 1];
+        const int blue     = (int)(key >> 16 & 0xFF) - palette->colors[i * 3 + 2];
+        const int distance = red * red + green * green + blue * blue;
+        if (nearestDistance >= 0 && distance >= nearestDistance) { continue; }
+
+        nearest         = i;
+        nearestDistance = distance;
+    }
+
+    return nearest;
+}
+
+static inline uint32_t palette_hash(uint32_t key)
+{
+    // Fibonacci hashing. The top bits are the best mixed, and 9 of them index all 512 slots.
+    _Static_assert(PNG_PALETTE_SLOTS == 1 << 9, "palette_hash needs to keep log2(PNG_PALETTE_SLOTS) bits.");
+    return (key * 0x9E3779B1u) >> 23;
+}
+
+static inline uint32_t pixel_key(const uint8_t *rgba)
+{
+    return (uint32_t)rgba[0] | (uint32_t)rgba[1] << 8 | (uint32_t)rgba[2] << 16 | COLOR_KEY_BIT;
+}
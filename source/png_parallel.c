@@ -0,0 +1,504 @@
+#include "png_parallel.h"
+
+#include "capture.h"
+#include "config.h"
+#include "encode_arena.h"
+#include "encode_governor.h"
+#include "png_chunk.h"
+#include "png_filter.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <switch.h>
+#include <zlib.h>
+
+// Everything here comes out of the sysmodule heap. The serial path hands zlib its default 256KB of state. This splits a
+// budget of about the same size between the workers and picks the biggest window and memLevel that leave each share room
+// for a strip of at least MIN_STRIP_ROWS, with the rest going to longer strips. A worker holds its whole strip while it
+// deflates it, so strips can't get long. When not even MIN_WINDOW_BITS fits, there are fewer workers than asked for. With
+// this budget that's 2: more threads would mean short strips and small windows, which cost more in size than they win in
+// time. Strips are still shorter than the serial encoder's whole frame and the window is smaller than its 32KB, so
+// parallel captures come out a little bigger.
+
+/// @brief Heap shared between all of the workers.
+static const size_t WORKER_HEAP_BUDGET = 0x48000;
+
+/// @brief Fewest rows in a strip. Every strip costs a reset, a dictionary and a sync flush.
+static const int MIN_STRIP_ROWS = 16;
+
+/// @brief Smallest window. It has to reach back a whole filtered row, or Up and Paeth rows can't match the row above.
+static const int MIN_WINDOW_BITS = 12;
+
+/// @brief Deflate data a worker holds at once. A strip that comes to more waits for the rest of it to be written.
+static const size_t OUTPUT_SIZE = 0x4000;
+
+/// @brief Stack size of a worker. deflate doesn't need much.
+static const size_t WORKER_STACK_SIZE = 0x4000;
+
+/// @brief Room for the zlib header in front and the Adler-32 behind the deflate data.
+static const size_t ZLIB_HEADER_SIZE  = 2;
+static const size_t ZLIB_TRAILER_SIZE = 4;
+
+/// @brief Everything around the deflate data in the output buffer. The chunk header and CRC are filled in place.
+static const size_t OUTPUT_FRONT = PNG_CHUNK_HEADER_SIZE + ZLIB_HEADER_SIZE;
+static const size_t OUTPUT_BACK  = ZLIB_TRAILER_SIZE + PNG_CHUNK_CRC_SIZE;
+
+// clang-format off
+/// @brief One worker and the strip it's currently responsible for.
+typedef struct
+{
+    /// @brief Worker thread.
+    Thread thread;
+
+    /// @brief Raw deflate stream. Reset for every strip.
+    z_stream stream;
+
+    /// @brief Signalled by the encoder when a strip is ready, and by the worker when it's done with it.
+    CondVar signal;
+
+    /// @brief Whether a strip is waiting to be or is being deflated.
+    bool busy;
+
+    /// @brief Set when the output filled up before the strip was done. The worker waits until it's been written.
+    bool outputFull;
+
+    /// @brief Set when the worker should exit.
+    bool exiting;
+
+    /// @brief Whether the last strip deflated without error.
+    bool succeeded;
+
+    /// @brief Whether this is the final strip of the image.
+    bool finalStrip;
+
+    /// @brief Bytes of dictionary at the beginning of input.
+    size_t dictionarySize;
+
+    /// @brief Bytes of filtered rows following the dictionary.
+    size_t inputSize;
+
+    /// @brief Dictionary followed by the strip's filtered rows.
+    uint8_t *input;
+
+    /// @brief Size of the output buffer.
+    size_t outputCapacity;
+
+    /// @brief Bytes of deflate data in the output.
+    size_t outputSize;
+
+    /// @brief Deflate data. Has room for the chunk header and zlib header in front and the trailer and CRC behind.
+    uint8_t *output;
+
+    /// @brief Adler-32 of the strip's filtered rows.
+    uLong adler;
+
+    /// @brief Ticks spent deflating.
+    uint64_t deflateTicks;
+} StripWorker;
+
+/// @brief Strip length and deflate settings for a worker count.
+typedef struct
+{
+    int stripRows, windowBits, memLevel;
+} StripParams;
+
+/// @brief State shared between the encoder and the workers.
+typedef struct
+{
+    /// @brief Guards the busy, outputFull and exiting flags of every worker.
+    Mutex lock;
+
+    /// @brief Workers.
+    StripWorker workers[PNG_PARALLEL_MAX_WORKERS];
+
+    /// @brief Number of workers started.
+    int workerCount;
+} StripEncoder;
+// clang-format on
+
+/// @brief Passed to the worker threads.
+typedef struct
+{
+    StripEncoder *encoder;
+    StripWorker *worker;
+} WorkerArgs;
+
+// Defined at bottom.
+
+/// @brief Worker thread function.
+static void strip_worker_main(void *arg);
+
+/// @brief Picks the strip length, window and memLevel for the worker count passed.
+/// @return True on success. False if not even the smallest of them fit the worker's share of the budget.
+static bool choose_strip_params(int workerCount, StripParams *paramsOut);
+
+/// @brief Waits for the worker passed to finish its current strip, writing its output as IDAT chunks as it fills up.
+/// @param adler Adler-32 of every strip before this one. Receives it with this one combined in.
+/// @return True if the strip was deflated and written. False on failure.
+static bool finish_strip(FSFILE *file, StripEncoder *encoder, StripWorker *worker, bool firstStrip, uLong *adler);
+
+/// @brief Writes the output of the worker passed as an IDAT chunk.
+/// @param zlibHeader Whether the output starts the zlib stream.
+/// @param adler Written behind the output if it ends the zlib stream.
+static inline bool write_output(FSFILE *file, StripWorker *worker, bool zlibHeader, bool zlibTrailer, uLong adler);
+
+/// @brief Stops the workers and frees everything.
+static void strip_encoder_destroy(StripEncoder *encoder);
+
+/// @brief Clamps the worker count passed to what the encoder supports and the budget has room for.
+static inline int clamp_worker_count(int workerCount, StripParams *paramsOut);
+
+int png_parallel_worker_count(int workerCount)
+{
+    StripParams params;
+    return clamp_worker_count(workerCount, &params);
+}
+
+size_t png_parallel_arena_size(int workerCount)
+{
+    StripParams params;
+    workerCount = clamp_worker_count(workerCount, &params);
+    return ENCODE_ARENA_DEFLATE_SIZE(params.windowBits, params.memLevel) * workerCount;
+}
+
+bool png_parallel_write_image(FSFILE *file,
+                              int workerCount,
+                              int level,
+                              int strategy,
+                              int rowFilter,
+                              int readRows,
+                              FrameHash *hash,
+                              PngParallelStats *statsOut)
+{
+    StripParams params;
+    workerCount = clamp_worker_count(workerCount, &params);
+    if (readRows < 1) { readRows = 1; }
+
+    const size_t stripSize     = (size_t)params.stripRows * PNG_FILTER_ROW_SIZE;
+    const size_t maxDictionary = (size_t)1 << params.windowBits;
+
+    // Thread arguments need to outlive the threads.
+    WorkerArgs args[PNG_PARALLEL_MAX_WORKERS];
+    StripEncoder *encoder = calloc(1, sizeof(StripEncoder));
+    uint8_t *rgbaRows     = malloc((size_t)readRows * CAPTURE_ROW_SIZE);
+    uint8_t *rows         = malloc(CAPTURE_WIDTH * 3 * 2);
+    bool success          = false;
+    if (!encoder || !rgbaRows || !rows) { goto cleanup; }
+
+    mutexInit(&encoder->lock);
+    for (int i = 0; i < workerCount; i++)
+    {
+        StripWorker *worker = &encoder->workers[i];
+        condvarInit(&worker->signal);
+
+        // zlib header and trailer get written around whichever strip ends up first and last.
+        worker->outputCapacity = OUTPUT_FRONT + OUTPUT_SIZE + OUTPUT_BACK;
+        worker->input          = malloc(maxDictionary + stripSize);
+        worker->output         = malloc(worker->outputCapacity);
+        if (!worker->input || !worker->output) { goto cleanup; }
+
+        worker->stream.zalloc = encode_arena_zalloc;
+        worker->stream.zfree  = encode_arena_zfree;
+        const bool deflateReady =
+            deflateInit2(&worker->stream, level, Z_DEFLATED, -params.windowBits, params.memLevel, strategy) == Z_OK;
+        if (!deflateReady) { goto cleanup; }
+
+        // The workers deflate for the capture worker, so they're held to its priority. They each get a core other than its
+        // own, or they'd only take turns with it.
+        args[i]            = (WorkerArgs){encoder, worker};
+        const bool created = R_SUCCEEDED(threadCreate(&worker->thread,
+                                                      strip_worker_main,
+                                                      &args[i],
+                                                      NULL,
+                                                      WORKER_STACK_SIZE,
+                                                      config_encode_priority(),
+                                                      encode_governor_worker_core(i)));
+        if (!created)
+        {
+            deflateEnd(&worker->stream);
+            goto cleanup;
+        }
+
+        if (R_FAILED(threadStart(&worker->thread)))
+        {
+            threadClose(&worker->thread);
+            deflateEnd(&worker->stream);
+            goto cleanup;
+        }
+
+        ++encoder->workerCount;
+    }
+
+    // Unfiltered RGB rows. The current one and the one above it.
+    uint8_t *currentRow  = rows;
+    uint8_t *previousRow = rows + CAPTURE_WIDTH * 3;
+
+    // The adler starts at 1 and every strip gets combined into it in order.
+    uLong adler              = adler32(0, NULL, 0);
+    const int stripCount     = (CAPTURE_HEIGHT + params.stripRows - 1) / params.stripRows;
+    StripWorker *lastStarted = NULL;
+    PngParallelStats stats   = {0};
+    for (int strip = 0; strip < stripCount; strip++)
+    {
+        StripWorker *worker = &encoder->workers[strip % encoder->workerCount];
+
+        // The worker's previous strip has to be written before it can take a new one. Going round-robin keeps them in order.
+        if (strip >= encoder->workerCount)
+        {
+            const uint64_t waitBegin = armGetSystemTick();
+            const bool stripWritten  = finish_strip(file, encoder, worker, strip == encoder->workerCount, &adler);
+            stats.stallTicks += armGetSystemTick() - waitBegin;
+            if (!stripWritten) { goto cleanup; }
+        }
+
+        // Prime with the tail of the strip before this one.
+        worker->dictionarySize = 0;
+        if (lastStarted)
+        {
+            const size_t available = lastStarted->inputSize;
+            worker->dictionarySize = available < maxDictionary ? available : maxDictionary;
+            memcpy(worker->input,
+                   lastStarted->input + lastStarted->dictionarySize + available - worker->dictionarySize,
+                   worker->dictionarySize);
+        }
+
+        // Read and filter the strip's rows.
+        const int firstRow = strip * params.stripRows;
+        const int lastRow  = firstRow + params.stripRows < CAPTURE_HEIGHT ? firstRow + params.stripRows : CAPTURE_HEIGHT;
+        uint8_t *input     = worker->input + worker->dictionarySize;
+        for (int row = firstRow; row < lastRow; row++, input += PNG_FILTER_ROW_SIZE)
+        {
+            // Rows come in blocks. Whichever row starts one reads the whole block, which can run into the next strip.
+            const int blockRow = row % readRows;
+            if (blockRow == 0)
+            {
+                const int rowCount       = CAPTURE_HEIGHT - row < readRows ? CAPTURE_HEIGHT - row : readRows;
+                const uint64_t readBegin = armGetSystemTick();
+                const bool rowsRead      = capture_read_rows(rgbaRows, row, rowCount);
+                if (rowsRead && hash) { frame_hash_update(hash, rgbaRows, (size_t)rowCount * CAPTURE_ROW_SIZE); }
+                stats.readTicks += armGetSystemTick() - readBegin;
+                ++stats.readCalls;
+                if (!rowsRead) { goto cleanup; }
+            }
+            const uint8_t *rgbaRow = rgbaRows + blockRow * CAPTURE_ROW_SIZE;
+
+            const uint64_t filterBegin = armGetSystemTick();
+            png_filter_rgba_row(rgbaRow, currentRow, row > 0 ? previousRow : NULL, input, rowFilter);
+            stats.filterTicks += armGetSystemTick() - filterBegin;
+            encode_governor_row();
+
+            uint8_t *swap = previousRow;
+            previousRow   = currentRow;
+            currentRow    = swap;
+        }
+
+        // Hand it off.
+        mutexLock(&encoder->lock);
+        worker->inputSize  = (lastRow - firstRow) * PNG_FILTER_ROW_SIZE;
+        worker->finalStrip = strip == stripCount - 1;
+        worker->busy       = true;
+        condvarWakeAll(&worker->signal);
+        mutexUnlock(&encoder->lock);
+
+        lastStarted = worker;
+    }
+
+    // Drain whatever's left in order.
+    const int firstUnwritten = stripCount > encoder->workerCount ? stripCount - encoder->workerCount : 0;
+    for (int strip = firstUnwritten; strip < stripCount; strip++)
+    {
+        StripWorker *worker = &encoder->workers[strip % encoder->workerCount];
+
+        const uint64_t waitBegin = armGetSystemTick();
+        const bool stripWritten  = finish_strip(file, encoder, worker, strip == 0, &adler);
+        stats.stallTicks += armGetSystemTick() - waitBegin;
+        if (!stripWritten) { goto cleanup; }
+    }
+
+    success = png_chunk_write_end(file);
+
+    for (int i = 0; i < encoder->workerCount; i++) { stats.deflateTicks += encoder->workers[i].deflateTicks; }
+    if (statsOut) { *statsOut = stats; }
+
+cleanup:
+    strip_encoder_destroy(encoder);
+    free(rgbaRows);
+    free(rows);
+
+    return success;
+}
+
+static void strip_worker_main(void *arg)
+{
+    StripEncoder *encoder = ((WorkerArgs *)arg)->encoder;
+    StripWorker *worker   = ((WorkerArgs *)arg)->worker;
+
+    while (true)
+    {
+        mutexLock(&encoder->lock);
+        while (!worker->busy && !worker->exiting) { condvarWait(&worker->signal, &encoder->lock); }
+        const bool exiting = worker->exiting;
+        mutexUnlock(&encoder->lock);
+        if (exiting) { return; }
+
+        uint64_t deflateBegin = armGetSystemTick();
+
+        // Fresh stream primed with the tail of the strip before.
+        z_stream *stream = &worker->stream;
+        deflateReset(stream);
+        if (worker->dictionarySize > 0) { deflateSetDictionary(stream, worker->input, worker->dictionarySize); }
+
+        stream->next_in  = worker->input + worker->dictionarySize;
+        stream->avail_in = worker->inputSize;
+        worker->adler    = adler32(adler32(0, NULL, 0), worker->input + worker->dictionarySize, worker->inputSize);
+
+        // Sync flush ends the strip on a byte boundary so the next one can be appended to it. It's only complete once
+        // deflate stops with output space left over.
+        const int flush = worker->finalStrip ? Z_FINISH : Z_SYNC_FLUSH;
+        bool deflated   = false;
+        while (true)
+        {
+            stream->next_out    = worker->output + OUTPUT_FRONT;
+            stream->avail_out   = OUTPUT_SIZE;
+            const int result    = deflate(stream, flush);
+            worker->outputSize  = stream->next_out - (worker->output + OUTPUT_FRONT);
+            const bool finished = worker->finalStrip ? result == Z_STREAM_END : stream->avail_out > 0;
+            if (result != Z_OK && result != Z_STREAM_END) { break; }
+            if (finished)
+            {
+                deflated = stream->avail_in == 0;
+                break;
+            }
+
+            // Full. The encoder writes it once every strip before this one has been.
+            worker->deflateTicks += armGetSystemTick() - deflateBegin;
+            mutexLock(&encoder->lock);
+            worker->outputFull = true;
+            condvarWakeAll(&worker->signal);
+            while (worker->outputFull && !worker->exiting) { condvarWait(&worker->signal, &encoder->lock); }
+            const bool exiting = worker->exiting;
+            mutexUnlock(&encoder->lock);
+            if (exiting) { break; }
+            deflateBegin = armGetSystemTick();
+        }
+        worker->deflateTicks += armGetSystemTick() - deflateBegin;
+
+        mutexLock(&encoder->lock);
+        worker->succeeded = deflated;
+        worker->busy      = false;
+        condvarWakeAll(&worker->signal);
+        mutexUnlock(&encoder->lock);
+    }
+}
+
+static bool choose_strip_params(int workerCount, StripParams *paramsOut)
+{
+    // Everything a worker needs that isn't zlib's state, the dictionary or its strip.
+    static const size_t WORKER_OVERHEAD = OUTPUT_FRONT + OUTPUT_SIZE + OUTPUT_BACK + WORKER_STACK_SIZE;
+
+    const size_t share = WORKER_HEAP_BUDGET / workerCount;
+
+    // Try the biggest window first. The dictionary copy needs a window's worth on top of zlib's state.
+    for (int windowBits = 15; windowBits >= MIN_WINDOW_BITS; windowBits--)
+    {
+        const int memLevel = windowBits - 7;
+        const size_t needs = WORKER_OVERHEAD + ENCODE_ARENA_DEFLATE_SIZE(windowBits, memLevel) + ((size_t)1 << windowBits);
+        const int rows     = needs < share ? (share - needs) / PNG_FILTER_ROW_SIZE : 0;
+        if (rows < MIN_STRIP_ROWS) { continue; }
+
+        *paramsOut = (StripParams){rows, windowBits, memLevel};
+        return true;
+    }
+
+    return false;
+}
+
+static bool finish_strip(FSFILE *file, StripEncoder *encoder, StripWorker *worker, bool firstStrip, uLong *adler)
+{
+    // Whatever the worker has so far goes out as its own chunk, so it can carry on with an empty output.
+    bool zlibHeader = firstStrip;
+    while (true)
+    {
+        mutexLock(&encoder->lock);
+        while (worker->busy && !worker->outputFull) { condvarWait(&worker->signal, &encoder->lock); }
+        const bool full = worker->outputFull;
+        mutexUnlock(&encoder->lock);
+        if (!full) { break; }
+
+        if (!write_output(file, worker, zlibHeader, false, 0)) { return false; }
+        zlibHeader = false;
+
+        mutexLock(&encoder->lock);
+        worker->outputFull = false;
+        condvarWakeAll(&worker->signal);
+        mutexUnlock(&encoder->lock);
+    }
+    if (!worker->succeeded) { return false; }
+
+    *adler = adler32_combine(*adler, worker->adler, worker->inputSize);
+    return write_output(file, worker, zlibHeader, worker->finalStrip, *adler);
+}
+
+static inline bool write_output(FSFILE *file, StripWorker *worker, bool zlibHeader, bool zlibTrailer, uLong adler)
+{
+    // windowBits 15, default compression. Decoders don't care what level was actually used.
+    static const uint8_t ZLIB_HEADER[] = {0x78, 0x9C};
+
+    uint8_t *begin = worker->output + OUTPUT_FRONT;
+    uint8_t *end   = begin + worker->outputSize;
+
+    if (zlibHeader)
+    {
+        begin -= ZLIB_HEADER_SIZE;
+        memcpy(begin, ZLIB_HEADER, ZLIB_HEADER_SIZE);
+    }
+
+    if (zlibTrailer)
+    {
+        end[0] = adler >> 24;
+        end[1] = adler >> 16;
+        end[2] = adler >> 8;
+        end[3] = adler;
+        end += ZLIB_TRAILER_SIZE;
+    }
+
+    return png_chunk_write_framed(file, "IDAT", begin, end - begin);
+}
+
+static void strip_encoder_destroy(StripEncoder *encoder)
+{
+    if (!encoder) { return; }
+
+    mutexLock(&encoder->lock);
+    for (int i = 0; i < encoder->workerCount; i++)
+    {
+        encoder->workers[i].exiting = true;
+        condvarWakeAll(&encoder->workers[i].signal);
+    }
+    mutexUnlock(&encoder->lock);
+
+    for (int i = 0; i < encoder->workerCount; i++)
+    {
+        threadWaitForExit(&encoder->workers[i].thread);
+        threadClose(&encoder->workers[i].thread);
+        deflateEnd(&encoder->workers[i].stream);
+    }
+
+    for (int i = 0; i < PNG_PARALLEL_MAX_WORKERS; i++)
+    {
+        free(encoder->workers[i].input);
+        free(encoder->workers[i].output);
+    }
+
+    free(encoder);
+}
+
+static inline int clamp_worker_count(int workerCount, StripParams *paramsOut)
+{
+    if (workerCount < 2) { workerCount = 2; }
+    else if (workerCount > PNG_PARALLEL_MAX_WORKERS) { workerCount = PNG_PARALLEL_MAX_WORKERS; }
+
+    // Two always fit. Any more only run if each of them still gets a big enough window and strip.
+    while (!choose_strip_params(workerCount, paramsOut) && workerCount > 2) { --workerCount; }
+    return workerCount;
+}
@@ -0,0 +1,392 @@
+#include "png_record.h"
+
+#include "FSFILE.h"
+#include "capture.h"
+#include "config.h"
+#include "encode_arena.h"
+#include "frame_hash.h"
+#include "png_capture.h"
+#include "png_chunk.h"
+#include "png_filter.h"
+#include "png_idat.h"
+
+#include <malloc.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <zlib.h>
+
+// APNG only adds three chunks. acTL says how many frames there are, every frame starts with an fcTL saying where it goes
+// and how long it shows, and frames after the first are fdAT instead of IDAT. Neither the number of frames nor how long one
+// shows is known until later, so both are written as placeholders and patched in the file once they are.
+
+/// @brief Number of columns frames are compared in.
+#define COLUMN_COUNT (CAPTURE_WIDTH / PNG_RECORD_COLUMN_WIDTH)
+
+_Static_assert(PNG_RECORD_COLUMN_WIDTH * 4 == FRAME_HASH_BLOCK_SIZE, "Columns need to be one hash block of RGBA wide.");
+
+/// @brief Size of the acTL data. Number of frames and number of times to play them.
+#define ACTL_SIZE 8
+
+/// @brief Size of the fcTL data.
+#define FCTL_SIZE 26
+
+/// @brief Where the delay starts in the fcTL data. Everything from here to the end of the chunk is rewritten to patch it.
+#define FCTL_DELAY_OFFSET 20
+
+/// @brief What the recording is created at. It grows like any other PNG if that isn't enough.
+static const int64_t RECORD_INITIAL_SIZE = 0x200000;
+
+/// @brief Same block size as still captures.
+static const size_t RECORD_WRITE_BLOCK_SIZE = 0x4000;
+
+/// @brief Part of a frame that changed.
+typedef struct
+{
+    int x, y, width, height;
+} FrameBox;
+
+// clang-format off
+/// @brief State of a recording.
+typedef struct
+{
+    /// @brief File the recording is written to.
+    FSFILE *file;
+
+    /// @brief Where the acTL data and the data of the last fcTL are in the file.
+    int64_t actlOffset, fctlOffset;
+
+    /// @brief Data of the last fcTL.
+    uint8_t fctl[FCTL_SIZE];
+
+    /// @brief Sequence number of the next fcTL or fdAT. The two share one count.
+    uint32_t sequence;
+
+    /// @brief Tick the last frame that was written was taken at.
+    uint64_t frameTick;
+
+    /// @brief Hashes of every row and every column of the last frame.
+    uint64_t rowHashes[CAPTURE_HEIGHT], columnHashes[COLUMN_COUNT];
+
+    /// @brief Columns of the frame being hashed.
+    FrameHash columns[COLUMN_COUNT];
+
+    /// @brief Rows are read into this, readRows at a time.
+    uint8_t *readBuffer;
+
+    /// @brief Rows read from the stream per call.
+    int readRows;
+} Recorder;
+// clang-format on
+
+/// @brief Set by png_record_set_stopped.
+static atomic_bool recordStopped = false;
+
+/// @brief How the last recording went.
+static PngRecordStats recordStats = {0};
+
+// Defined at bottom.
+
+/// @brief Writes the PNG header and an acTL with room for the number of frames.
+static bool record_write_header(Recorder *recorder);
+
+/// @brief Reads and hashes the whole frame and compares it to the last one.
+/// @param recorder Recorder to compare against.
+/// @param boxOut Receives the part of the frame that changed. Width is 0 if nothing did.
+/// @return True on success. False if a read failed.
+static bool record_find_change(Recorder *recorder, FrameBox *boxOut);
+
+/// @brief Writes the part of the frame passed as the next frame of the recording.
+/// @param recorder Recorder to write to.
+/// @param box Part of the frame to write.
+/// @param frameTick Tick the frame was taken at. This is when the last frame stops showing.
+/// @return True on success. False on failure.
+static bool record_write_frame(Recorder *recorder, const FrameBox *box, uint64_t frameTick);
+
+/// @brief Patches how long the last frame written shows.
+/// @param recorder Recorder to patch.
+/// @param untilTick Tick the frame stops showing at.
+/// @return True on success. False on failure.
+static bool record_patch_delay(Recorder *recorder, uint64_t untilTick);
+
+/// @brief Patches the number of frames into the acTL and writes IEND.
+static bool record_finish(Recorder *recorder);
+
+/// @brief Writes the 32-bit value passed big endian.
+static inline void write_big_endian(uint8_t *out, uint32_t value);
+
+bool png_record(FsFileSystem *albumDir, const char *temporaryPath)
+{
+    const uint64_t recordBegin = armGetSystemTick();
+    recordStats                = (PngRecordStats){0};
+
+    // Every frame takes its own arena, which doesn't leave room for the warm stream.
+    idat_writer_warm_release();
+
+    Recorder *recorder = calloc(1, sizeof(Recorder));
+    if (!recorder) { return false; }
+
+    bool recorded          = false;
+    recorder->readRows     = config_read_rows();
+    recorder->readBuffer   = malloc((size_t)recorder->readRows * CAPTURE_ROW_SIZE);
+    recorder->file         = FSFILE_OpenWriteBuffered(albumDir, temporaryPath, RECORD_INITIAL_SIZE, RECORD_WRITE_BLOCK_SIZE);
+    const bool headerReady = recorder->readBuffer && recorder->file && record_write_header(recorder);
+    if (!headerReady) { goto cleanup; }
+
+    // The queue doesn't record with a rate of 0, but a frame a second is a better fallback than dividing by it.
+    const int rate               = config_record_rate() > 0 ? config_record_rate() : 1;
+    const uint64_t intervalTicks = armNsToTicks(1000000000ULL / rate);
+    const uint64_t lengthTicks   = armNsToTicks((uint64_t)config_record_length() * 1000000000ULL);
+
+    uint64_t nextTick = recordBegin;
+    bool stopping     = false;
+    while (!stopping)
+    {
+        const uint64_t waitTick = armGetSystemTick();
+        if (waitTick < nextTick) { svcSleepThread(armTicksToNs(nextTick - waitTick)); }
+
+        // Every frame is a new stream. That's what takes a new capture of the screen.
+        const uint64_t frameTick = armGetSystemTick();
+        if (!capture_open_stream(NULL, NULL)) { goto cleanup; }
+
+        FrameBox box;
+        const bool hashed       = record_find_change(recorder, &box);
+        const uint64_t hashTick = armGetSystemTick();
+        const bool written      = hashed && (box.width == 0 || record_write_frame(recorder, &box, frameTick));
+        capture_close_stream();
+        if (!written) { goto cleanup; }
+
+        const uint64_t doneTick = armGetSystemTick();
+        recordStats.hashTicks += hashTick - frameTick;
+        recordStats.encodeTicks += doneTick - hashTick;
+        ++recordStats.frames;
+
+        // A frame that took too long pushes the next one back rather than having them bunch up to catch up.
+        nextTick += intervalTicks;
+        if (nextTick < doneTick)
+        {
+            nextTick = doneTick;
+            ++recordStats.late;
+        }
+
+        stopping = atomic_load(&recordStopped) || doneTick - recordBegin >= lengthTicks;
+    }
+
+    // The last frame shows until the recording stopped, frames that didn't change included.
+    const bool finished = record_patch_delay(recorder, armGetSystemTick()) && record_finish(recorder);
+    recordStats.size    = FSFILE_Tell(recorder->file);
+    FSFILE_Finalize(recorder->file);
+    recorder->file = NULL;
+
+    // The PNG was created when the button was held down, so that's what it's named after.
+    uint64_t timestamp;
+    recorded = finished && FSFILE_GetTimeStamp(albumDir, temporaryPath, &timestamp) &&
+               png_capture_move_into_place(albumDir, temporaryPath, timestamp, NULL);
+
+cleanup:
+    // Don't leave a broken PNG in the album.
+    FSFILE_Close(recorder->file);
+    if (!recorded) { FSFILE_Delete(albumDir, temporaryPath); }
+
+    free(recorder->readBuffer);
+    free(recorder);
+    recordStats.totalTicks = armGetSystemTick() - recordBegin;
+    return recorded;
+}
+
+void png_record_set_stopped(bool stopped) { atomic_store(&recordStopped, stopped); }
+
+const PngRecordStats *png_record_get_stats(void) { return &recordStats; }
+
+static bool record_write_header(Recorder *recorder)
+{
+    // One frame is a valid placeholder. Playing forever is 0.
+    uint8_t actl[ACTL_SIZE] = {0};
+    write_big_endian(actl, 1);
+
+    if (!png_chunk_write_header(recorder->file)) { return false; }
+
+    recorder->actlOffset = FSFILE_Tell(recorder->file) + PNG_CHUNK_HEADER_SIZE;
+    return png_chunk_write(recorder->file, "acTL", actl, sizeof(actl));
+}
+
+static bool record_find_change(Recorder *recorder, FrameBox *boxOut)
+{
+    for (int i = 0; i < COLUMN_COUNT; i++) { frame_hash_init(&recorder->columns[i]); }
+
+    // Rows are hashed whole. Each column gets the same 64 bytes of every row added to its own hash.
+    int top = CAPTURE_HEIGHT, bottom = -1;
+    for (int y = 0; y < CAPTURE_HEIGHT; y += recorder->readRows)
+    {
+        if (!capture_read_rows(recorder->readBuffer, y, recorder->readRows)) { return false; }
+
+        for (int i = 0; i < recorder->readRows; i++)
+        {
+            const uint8_t *row = recorder->readBuffer + (size_t)i * CAPTURE_ROW_SIZE;
+
+            FrameHash rowHash;
+            frame_hash_init(&rowHash);
+            frame_hash_update(&rowHash, row, CAPTURE_ROW_SIZE);
+            const uint64_t hash = frame_hash_final(&rowHash);
+            if (hash != recorder->rowHashes[y + i])
+            {
+                top    = top < y + i ? top : y + i;
+                bottom = y + i;
+            }
+            recorder->rowHashes[y + i] = hash;
+
+            for (int column = 0; column < COLUMN_COUNT; column++)
+            {
+                frame_hash_update(&recorder->columns[column], row + column * FRAME_HASH_BLOCK_SIZE, FRAME_HASH_BLOCK_SIZE);
+            }
+        }
+    }
+
+    int left = COLUMN_COUNT, right = -1;
+    for (int column = 0; column < COLUMN_COUNT; column++)
+    {
+        const uint64_t hash = frame_hash_final(&recorder->columns[column]);
+        if (hash != recorder->columnHashes[column])
+        {
+            left  = left < column ? left : column;
+            right = column;
+        }
+        recorder->columnHashes[column] = hash;
+    }
+
+    // The first frame is always the whole thing, whatever the zeroed hashes say.
+    if (recordStats.written == 0)
+    {
+        *boxOut = (FrameBox){0, 0, CAPTURE_WIDTH, CAPTURE_HEIGHT};
+        return true;
+    }
+
+    // A changed pixel changes both its row and its column, so either both found something or neither did.
+    if (bottom < 0 || right < 0)
+    {
+        *boxOut = (FrameBox){0};
+        return true;
+    }
+
+    *boxOut = (FrameBox){.x      = left * PNG_RECORD_COLUMN_WIDTH,
+                         .y      = top,
+                         .width  = (right - left + 1) * PNG_RECORD_COLUMN_WIDTH,
+                         .height = bottom - top + 1};
+    return true;
+}
+
+static bool record_write_frame(Recorder *recorder, const FrameBox *box, uint64_t frameTick)
+{
+    // The frame before shows until this one was taken.
+    const bool first = recordStats.written == 0;
+    if (!first && !record_patch_delay(recorder, frameTick)) { return false; }
+
+    // The delay is filled in once the next frame comes along. Nothing is disposed of and the box replaces what's under it,
+    // so everything outside it stays as the last frame left it.
+    uint8_t *fctl = recorder->fctl;
+    memset(fctl, 0, FCTL_SIZE);
+    write_big_endian(fctl, recorder->sequence++);
+    write_big_endian(fctl + 4, box->width);
+    write_big_endian(fctl + 8, box->height);
+    write_big_endian(fctl + 12, box->x);
+    write_big_endian(fctl + 16, box->y);
+
+    recorder->fctlOffset = FSFILE_Tell(recorder->file) + PNG_CHUNK_HEADER_SIZE;
+    recorder->frameTick  = frameTick;
+    if (!png_chunk_write(recorder->file, "fcTL", fctl, FCTL_SIZE)) { return false; }
+
+    // Same settings as still captures. Speed mode sticks to Sub like it does there.
+    const bool speed = config_encode_mode() == PngEncodeSpeed;
+    const int filter = speed ? PngFilterSub : config_row_filter();
+    encode_arena_begin(idat_writer_arena_size(speed));
+
+    // Unfiltered RGB of the current and previous rows, then the filtered row.
+    const size_t rgbSize = (size_t)box->width * 3;
+    uint8_t *rowBuffers  = malloc(rgbSize * 3 + 1);
+    uint32_t *sequence   = first ? NULL : &recorder->sequence;
+    IdatWriter *writer   = idat_writer_open_frame(recorder->file, config_compression_level(), Z_DEFAULT_STRATEGY, speed, sequence);
+    bool written         = false;
+    if (!rowBuffers || !writer) { goto cleanup; }
+
+    uint8_t *currentRow  = rowBuffers;
+    uint8_t *previousRow = rowBuffers + rgbSize;
+    uint8_t *filteredRow = rowBuffers + rgbSize * 2;
+
+    // Only the rows in the box are read again.
+    const int endRow = box->y + box->height;
+    for (int y = box->y; y < endRow; y += recorder->readRows)
+    {
+        const int rowCount = endRow - y < recorder->readRows ? endRow - y : recorder->readRows;
+        if (!capture_read_rows(recorder->readBuffer, y, rowCount)) { goto cleanup; }
+
+        for (int i = 0; i < rowCount; i++)
+        {
+            const uint8_t *rgba     = recorder->readBuffer + (size_t)i * CAPTURE_ROW_SIZE + (size_t)box->x * 4;
+            const uint8_t *previous = y + i > box->y ? previousRow : NULL;
+            if (box->width == CAPTURE_WIDTH) { png_filter_rgba_row(rgba, currentRow, previous, filteredRow, filter); }
+            else
+            {
+                for (size_t j = 0, k = 0; j < rgbSize; j += 3, k += 4) { memcpy(currentRow + j, rgba + k, 3); }
+                png_filter_rgb_span(currentRow, previous, filteredRow, box->width, filter);
+            }
+
+            if (!idat_writer_write_row(writer, filteredRow, rgbSize + 1)) { goto cleanup; }
+
+            uint8_t *swap = previousRow;
+            previousRow   = currentRow;
+            currentRow    = swap;
+        }
+    }
+
+    written = idat_writer_finish(writer);
+    writer  = NULL;
+    ++recordStats.written;
+    recordStats.pixels += (uint64_t)box->width * box->height;
+
+cleanup:
+    idat_writer_abort(writer);
+    free(rowBuffers);
+    encode_arena_end(NULL);
+    return written;
+}
+
+static bool record_patch_delay(Recorder *recorder, uint64_t untilTick)
+{
+    // Milliseconds. A delay of 0 means as fast as the player can go, so anything shorter is still 1.
+    static const uint16_t DELAY_DENOMINATOR = 1000;
+    static const size_t PATCH_DATA_SIZE     = FCTL_SIZE - FCTL_DELAY_OFFSET;
+
+    const uint64_t delay          = armTicksToNs(untilTick - recorder->frameTick) / 1000000;
+    const uint16_t delayNumerator = delay < 1 ? 1 : delay > UINT16_MAX ? UINT16_MAX : delay;
+
+    uint8_t *fctl               = recorder->fctl;
+    fctl[FCTL_DELAY_OFFSET]     = delayNumerator >> 8;
+    fctl[FCTL_DELAY_OFFSET + 1] = delayNumerator;
+    fctl[FCTL_DELAY_OFFSET + 2] = DELAY_DENOMINATOR >> 8;
+    fctl[FCTL_DELAY_OFFSET + 3] = DELAY_DENOMINATOR & 0xFF;
+
+    // The delay runs to the end of the data, so the new CRC goes right behind it.
+    uint8_t patch[FCTL_SIZE - FCTL_DELAY_OFFSET + PNG_CHUNK_CRC_SIZE];
+    const uint32_t crc = png_chunk_crc(png_chunk_crc(0, (const uint8_t *)"fcTL", 4), fctl, FCTL_SIZE);
+    memcpy(patch, fctl + FCTL_DELAY_OFFSET, PATCH_DATA_SIZE);
+    write_big_endian(patch + PATCH_DATA_SIZE, crc);
+
+    return FSFILE_WriteAt(recorder->file, recorder->fctlOffset + FCTL_DELAY_OFFSET, patch, sizeof(patch));
+}
+
+static bool record_finish(Recorder *recorder)
+{
+    // The number of plays stays at 0, which is forever.
+    uint8_t patch[ACTL_SIZE + PNG_CHUNK_CRC_SIZE] = {0};
+    write_big_endian(patch, recordStats.written);
+    write_big_endian(patch + ACTL_SIZE, png_chunk_crc(png_chunk_crc(0, (const uint8_t *)"acTL", 4), patch, ACTL_SIZE));
+
+    return FSFILE_WriteAt(recorder->file, recorder->actlOffset, patch, sizeof(patch)) && png_chunk_write_end(recorder->file);
+}
+
+static inline void write_big_endian(uint8_t *out, uint32_t value)
+{
+    out[0] = value >> 24;
+    out[1] = value >> 16;
+    out[2] = value >> 8;
+    out[3] = value;
+}
@@ -0,0 +1,209 @@
+#include "png_thumbnail.h"
+
+#include "capture.h"
+#include "encode_arena.h"
+#include "png_chunk.h"
+#include "png_filter.h"
+#include "png_idat.h"
+#include "png_palette.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <zlib.h>
+
+#if defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
+/// @brief Size of the output buffer of the thumbnail's writer. The file isn't buffered, so every chunk is a write.
+static const size_t THUMBNAIL_BUFFER_SIZE = IDAT_BUFFER_SIZE;
+
+// clang-format off
+struct PngThumbnail
+{
+    /// @brief File the thumbnail is written to.
+    FSFILE *file;
+
+    /// @brief Writes the thumbnail's IDAT.
+    IdatWriter *writer;
+
+    /// @brief Pixels per side of a block, and the size of the thumbnail.
+    int scale, width, height;
+
+    /// @brief One of PngFilterModes.
+    int rowFilter;
+
+    /// @brief Rows of the capture added to the sums so far, and rows of the thumbnail written.
+    int rowsSummed, rowsWritten;
+
+    /// @brief Sums of every channel of every block in the row in progress. RGB, like the rows.
+    uint16_t *sums;
+
+    /// @brief Averaged RGB of the row being written and the one above it, and the filtered row.
+    uint8_t *current, *previous, *filtered;
+};
+// clang-format on
+
+/// @brief Running average of the size of recent thumbnails. 0 until the first one is written.
+static int64_t thumbnailSizeAverage = 0;
+
+// Defined at bottom.
+
+/// @brief Adds every block's share of the RGBA row passed to its sums.
+static inline void thumbnail_sum_row(uint16_t *sums, const uint8_t *rgba, int scale);
+
+/// @brief Averages the sums into a row, filters and deflates it, and clears the sums for the next one.
+static bool thumbnail_write_row(PngThumbnail *thumbnail);
+
+size_t png_thumbnail_arena_size(void)
+{
+    return ENCODE_ARENA_DEFLATE_SIZE(PNG_THUMBNAIL_WINDOW_BITS, PNG_THUMBNAIL_MEM_LEVEL);
+}
+
+PngThumbnail *png_thumbnail_open(FsFileSystem *filesystem, const char *path, int scale, int level, int rowFilter)
+{
+    PngThumbnail *thumbnail = calloc(1, sizeof(PngThumbnail));
+    if (!thumbnail) { return NULL; }
+
+    thumbnail->scale     = scale;
+    thumbnail->width     = CAPTURE_WIDTH / scale;
+    thumbnail->height    = CAPTURE_HEIGHT / scale;
+    thumbnail->rowFilter = rowFilter;
+
+    // Sums, then the two RGB rows, then the filtered row, in one block.
+    const size_t rowSize = thumbnail->width * 3;
+    thumbnail->sums      = calloc(1, rowSize * sizeof(uint16_t) + rowSize * 2 + rowSize + 1);
+    if (!thumbnail->sums) { goto abort; }
+    thumbnail->current  = (uint8_t *)(thumbnail->sums + rowSize);
+    thumbnail->previous = thumbnail->current + rowSize;
+    thumbnail->filtered = thumbnail->previous + rowSize;
+
+    // Created a quarter over the size of recent ones, or at a quarter of the raw size for the first. Finalize trims it.
+    const int64_t rawSize = rowSize * thumbnail->height;
+    const int64_t size    = thumbnailSizeAverage ? thumbnailSizeAverage + thumbnailSizeAverage / 4 : rawSize / 4;
+    thumbnail->file       = FSFILE_OpenWrite(filesystem, path, size);
+    if (!thumbnail->file) { goto abort; }
+
+    const bool headerWritten =
+        png_chunk_write_header_image(thumbnail->file, thumbnail->width, thumbnail->height, PngColorRGB);
+    if (!headerWritten) { goto abort; }
+
+    thumbnail->writer = idat_writer_open_sized(thumbnail->file,
+                                               level,
+                                               Z_DEFAULT_STRATEGY,
+                                               PNG_THUMBNAIL_WINDOW_BITS,
+                                               PNG_THUMBNAIL_MEM_LEVEL,
+                                               THUMBNAIL_BUFFER_SIZE);
+    if (!thumbnail->writer) { goto abort; }
+
+    return thumbnail;
+
+abort:
+    png_thumbnail_abort(thumbnail);
+    return NULL;
+}
+
+bool png_thumbnail_add_row(PngThumbnail *thumbnail, const uint8_t *rgba)
+{
+    thumbnail_sum_row(thumbnail->sums, rgba, thumbnail->scale);
+    if (++thumbnail->rowsSummed < thumbnail->scale) { return true; }
+
+    thumbnail->rowsSummed = 0;
+    return thumbnail_write_row(thumbnail);
+}
+
+bool png_thumbnail_close(PngThumbnail *thumbnail, int64_t *sizeOut)
+{
+    // This finishes the stream and writes IEND.
+    const bool complete = thumbnail->rowsWritten == thumbnail->height;
+    const bool closed   = complete && idat_writer_close(thumbnail->writer);
+    thumbnail->writer   = NULL;
+
+    const int64_t size = FSFILE_Tell(thumbnail->file);
+    if (closed) { thumbnailSizeAverage = thumbnailSizeAverage ? (thumbnailSizeAverage * 3 + size) / 4 : size; }
+    if (sizeOut) { *sizeOut = closed ? size : 0; }
+
+    FSFILE_Finalize(thumbnail->file);
+    thumbnail->file = NULL;
+    png_thumbnail_abort(thumbnail);
+    return closed;
+}
+
+void png_thumbnail_abort(PngThumbnail *thumbnail)
+{
+    if (!thumbnail) { return; }
+
+    idat_writer_abort(thumbnail->writer);
+    if (thumbnail->file) { FSFILE_Close(thumbnail->file); }
+    free(thumbnail->sums);
+    free(thumbnail);
+}
+
+static inline void thumbnail_sum_row(uint16_t *sums, const uint8_t *rgba, int scale)
+{
+#if defined(__ARM_NEON)
+    // 16 pixels at a time, split into channels as they're loaded. Neighbouring pixels are added in pairs, and for quarter
+    // scale the pairs are added in pairs again. The sums are stored back interleaved.
+    for (int x = 0; x < CAPTURE_WIDTH; x += 16, rgba += 64)
+    {
+        const uint8x16x4_t pixels = vld4q_u8(rgba);
+        if (scale == 2)
+        {
+            uint16x8x3_t blocks = vld3q_u16(sums);
+            blocks.val[0]       = vaddq_u16(blocks.val[0], vpaddlq_u8(pixels.val[0]));
+            blocks.val[1]       = vaddq_u16(blocks.val[1], vpaddlq_u8(pixels.val[1]));
+            blocks.val[2]       = vaddq_u16(blocks.val[2], vpaddlq_u8(pixels.val[2]));
+            vst3q_u16(sums, blocks);
+            sums += 24;
+            continue;
+        }
+
+        const uint16x8_t red   = vpaddlq_u8(pixels.val[0]);
+        const uint16x8_t green = vpaddlq_u8(pixels.val[1]);
+        const uint16x8_t blue  = vpaddlq_u8(pixels.val[2]);
+        uint16x4x3_t blocks    = vld3_u16(sums);
+        blocks.val[0]          = vadd_u16(blocks.val[0], vpadd_u16(vget_low_u16(red), vget_high_u16(red)));
+        blocks.val[1]          = vadd_u16(blocks.val[1], vpadd_u16(vget_low_u16(green), vget_high_u16(green)));
+        blocks.val[2]          = vadd_u16(blocks.val[2], vpadd_u16(vget_low_u16(blue), vget_high_u16(blue)));
+        vst3_u16(sums, blocks);
+        sums += 12;
+    }
+#else
+    for (int x = 0; x < CAPTURE_WIDTH / scale; x++, sums += 3)
+    {
+        for (int i = 0; i < scale; i++, rgba += 4)
+        {
+            sums[0] += rgba[0];
+            sums[1] += rgba[1];
+            sums[2] += rgba[2];
+        }
+    }
+#endif
+}
+
+static bool thumbnail_write_row(PngThumbnail *thumbnail)
+{
+    // A block is 4 or 16 pixels, so the average is a rounding shift.
+    const int rowSize = thumbnail->width * 3;
+#if defined(__ARM_NEON)
+    for (int i = 0; i < rowSize; i += 8)
+    {
+        const uint16x8_t sums = vld1q_u16(thumbnail->sums + i);
+        vst1_u8(thumbnail->current + i, thumbnail->scale == 2 ? vrshrn_n_u16(sums, 2) : vrshrn_n_u16(sums, 4));
+    }
+#else
+    const int shift = thumbnail->scale == 2 ? 2 : 4;
+    for (int i = 0; i < rowSize; i++) { thumbnail->current[i] = (thumbnail->sums[i] + (1 << (shift - 1))) >> shift; }
+#endif
+    memset(thumbnail->sums, 0, rowSize * sizeof(uint16_t));
+
+    const uint8_t *previous = thumbnail->rowsWritten > 0 ? thumbnail->previous : NULL;
+    png_filter_rgb_span(thumbnail->current, previous, thumbnail->filtered, thumbnail->width, thumbnail->rowFilter);
+    ++thumbnail->rowsWritten;
+
+    uint8_t *swap       = thumbnail->previous;
+    thumbnail->previous = thumbnail->current;
+    thumbnail->current  = swap;
+
+    return idat_writer_write_row(thumbnail->writer, thumbnail->filtered, rowSize + 1);
+}
@@ -0,0 +1,153 @@
+#include "png_timelapse.h"
+
+#include "capture_trace.h"
+#include "config.h"
+#include "png_capture.h"
+
+/// @brief Length of time the budgets are for. Milliseconds.
+static const int64_t BUDGET_WINDOW_MS = 60000;
+
+// clang-format off
+typedef struct
+{
+    /// @brief Full size of the CPU and write buckets, in ticks and bytes. Taken from the config on every refill.
+    int64_t cpuBudget, bytesBudget;
+
+    /// @brief CPU ticks and bytes left to spend. Negative when a shot cost more than was left.
+    int64_t cpuLeft, bytesLeft;
+
+    /// @brief Tick the buckets were last refilled at. 0 before the first shot.
+    uint64_t lastRefill;
+
+    /// @brief Running averages of what a shot costs at each effort, indexed by PngTimelapseResults. 0 until one's been
+    /// saved at that effort.
+    int64_t cpuAverage[2], bytesAverage[2];
+} TimelapseBudget;
+// clang-format on
+
+/// @brief The budget. Only the capture worker takes timelapse shots.
+static TimelapseBudget budget = {0};
+
+/// @brief How timelapse captures have gone since boot.
+static PngTimelapseStats timelapseStats = {0};
+
+// Defined at bottom.
+
+/// @brief Tops the buckets up with whatever's been earned since the last shot. They start out full.
+static void timelapse_refill(void);
+
+/// @brief Picks what to do about the shot that's due.
+/// @return One of PngTimelapseResults.
+static int timelapse_plan(void);
+
+/// @brief Returns whether a shot at the effort passed is expected to fit in what's left of both buckets.
+/// @param effort PngTimelapseFull or PngTimelapseReduced.
+static inline bool timelapse_fits(int effort);
+
+/// @brief Returns the CPU time the last capture took.
+static inline int64_t timelapse_cpu_ticks(const PngCaptureStats *captureStats);
+
+/// @brief Adds a sample to a running average of the last few.
+static inline void timelapse_average(int64_t *average, int64_t sample);
+
+int png_timelapse_capture(FsFileSystem *albumDir, const char *temporaryPath)
+{
+    timelapse_refill();
+    ++timelapseStats.due;
+
+    // This is what was left when the shot was picked, so the trace says why it was picked.
+    const uint64_t cpuLeft = budget.cpuLeft > 0 ? budget.cpuLeft : 0;
+    const int result       = timelapse_plan();
+    if (result == PngTimelapseSkipped)
+    {
+        ++timelapseStats.skipped;
+        timelapseStats.cpuLeft   = budget.cpuLeft;
+        timelapseStats.bytesLeft = budget.bytesLeft;
+        capture_trace_record(CaptureTraceTimelapseSkipped, cpuLeft);
+        return result;
+    }
+
+    const bool reduced = result == PngTimelapseReduced;
+    const bool saved   = png_capture_unattended(albumDir, temporaryPath, reduced);
+
+    // Everything's paid for, even duplicates and failures. Only saved shots say what the next one will cost, though.
+    const PngCaptureStats *captureStats = png_capture_get_stats();
+    const int64_t cpuTicks              = timelapse_cpu_ticks(captureStats);
+    budget.cpuLeft -= cpuTicks;
+    budget.bytesLeft -= captureStats->size;
+    if (saved)
+    {
+        timelapse_average(&budget.cpuAverage[result], cpuTicks);
+        timelapse_average(&budget.bytesAverage[result], captureStats->size);
+    }
+
+    if (reduced)
+    {
+        ++timelapseStats.reduced;
+        capture_trace_record(CaptureTraceTimelapseReduced, cpuLeft);
+    }
+    else { ++timelapseStats.full; }
+    timelapseStats.saved += saved ? 1 : 0;
+    timelapseStats.cpuTicks += cpuTicks;
+    timelapseStats.bytes += captureStats->size;
+    timelapseStats.cpuLeft   = budget.cpuLeft;
+    timelapseStats.bytesLeft = budget.bytesLeft;
+    return result;
+}
+
+const PngTimelapseStats *png_timelapse_get_stats(void) { return &timelapseStats; }
+
+static void timelapse_refill(void)
+{
+    budget.cpuBudget   = armNsToTicks((uint64_t)config_timelapse_cpu_budget() * 1000000);
+    budget.bytesBudget = (int64_t)config_timelapse_write_budget() * 1024;
+
+    // Anything over a minute would only fill them past full.
+    const uint64_t now       = armGetSystemTick();
+    const uint64_t elapsedMs = budget.lastRefill ? armTicksToNs(now - budget.lastRefill) / 1000000 : BUDGET_WINDOW_MS;
+    const int64_t earnedMs   = elapsedMs < BUDGET_WINDOW_MS ? (int64_t)elapsedMs : BUDGET_WINDOW_MS;
+    budget.lastRefill        = now;
+
+    budget.cpuLeft += budget.cpuBudget * earnedMs / BUDGET_WINDOW_MS;
+    budget.bytesLeft += budget.bytesBudget * earnedMs / BUDGET_WINDOW_MS;
+    if (budget.cpuLeft > budget.cpuBudget) { budget.cpuLeft = budget.cpuBudget; }
+    if (budget.bytesLeft > budget.bytesBudget) { budget.bytesLeft = budget.bytesBudget; }
+}
+
+static int timelapse_plan(void)
+{
+    // Speed mode is only a step down if captures don't already use it, and only the native encoder has it.
+    const bool canReduce = config_encoder() == PngEncoderNative && config_encode_mode() != PngEncodeSpeed;
+    if (timelapse_fits(PngTimelapseFull)) { return PngTimelapseFull; }
+    else if (canReduce && timelapse_fits(PngTimelapseReduced)) { return PngTimelapseReduced; }
+
+    // Full buckets always buy the cheapest shot there is. Otherwise a shot that costs more than the whole budget would
+    // never be taken again, and the average it's judged by would never come down.
+    const bool full = budget.cpuLeft >= budget.cpuBudget && budget.bytesLeft >= budget.bytesBudget;
+    if (!full) { return PngTimelapseSkipped; }
+    return canReduce ? PngTimelapseReduced : PngTimelapseFull;
+}
+
+static inline bool timelapse_fits(int effort)
+{
+    // An effort that hasn't been tried yet averages 0, so anything left at all is enough for it.
+    return budget.cpuLeft > 0 && budget.bytesLeft > 0 && budget.cpuLeft >= budget.cpuAverage[effort] &&
+           budget.bytesLeft >= budget.bytesAverage[effort];
+}
+
+static inline int64_t timelapse_cpu_ticks(const PngCaptureStats *captureStats)
+{
+    // libpng reads and encodes on the one thread, so all of it counts.
+    if (captureStats->encoder == PngEncoderLibpng) { return captureStats->totalTicks; }
+
+    // The native encoders spend the row loop waiting on the reader as much as working, and waiting isn't CPU time. What
+    // is are the filter, deflate and thumbnail ticks. Filter and deflate are summed across the workers for the parallel
+    // encoder.
+    return captureStats->totalTicks - captureStats->rowTicks + captureStats->filterTicks + captureStats->deflateTicks +
+           captureStats->thumbnailTicks;
+}
+
+static inline void timelapse_average(int64_t *average, int64_t sample)
+{
+    *average = *average ? (*average * 3 + sample) / 4 : sample;
+}
@@ -0,0 +1,404 @@
+#include "raw_spill.h"
+
+#include "FSFILE.h"
+#include "capture.h"
+#include "directory_cache.h"
+#include "fsdir.h"
+#include "png_idat.h"
+
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+/// @brief "PSRW" read as a little endian word.
+#define SPILL_MAGIC 0x57525350
+
+/// @brief Bumped whenever the layout changes.
+#define SPILL_VERSION 1
+
+/// @brief Rows drained per capture_read. This is 60KB at 1280 wide, which the heap has room for when nothing is encoding.
+#define SPILL_CHUNK_ROWS 12
+
+/// @brief Set on an LZ4 row's size when the row didn't compress and was stored as is.
+#define SPILL_ROW_STORED 0x80000000
+
+/// @brief Number of LZ4 hash table entries.
+#define LZ4_HASH_SIZE 0x1000
+
+/// @brief LZ4 needs the last five bytes of a block to be literals and the last match to start 12 bytes before the end.
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MATCH_LIMIT   12
+
+/// @brief Room an LZ4 row can take before it's stored instead.
+#define LZ4_ROW_BOUND(size) ((size) + (size) / 255 + 16)
+
+/// @brief Header at the beginning of every spill.
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t compression;
+    uint32_t width;
+    uint32_t height;
+} SpillHeader;
+
+/// @brief State of the spill being read.
+typedef struct
+{
+    /// @brief The spill.
+    FSFILE *file;
+
+    /// @brief Header of the spill.
+    SpillHeader header;
+
+    /// @brief Size of a row.
+    size_t rowSize;
+
+    /// @brief Frame offset the next read has to start at.
+    size_t nextOffset;
+
+    /// @brief Compressed row buffer for LZ4 spills.
+    uint8_t *compressed;
+} SpillReader;
+
+/// @brief Spill currently open for reading. There's only ever one, same as the stream.
+static SpillReader spillReader = {0};
+
+/// @brief Set by raw_spill_set_cancelled.
+static atomic_bool spillCancelled = false;
+
+// Defined at bottom.
+
+/// @brief Finds a free spill name and writes the .part and .raw paths for it.
+static bool find_free_spill_name(FsFileSystem *albumDir, char *partPath, char *rawPath);
+
+/// @brief Writes LZ4 rows from the chunk passed.
+static bool write_lz4_rows(FSFILE *spill, const uint8_t *rows, int rowCount, size_t rowSize, uint8_t *out, uint16_t *table);
+
+/// @brief Compresses one LZ4 block. Returns the compressed size, or 0 if it didn't fit in capacity.
+static size_t lz4_compress(const uint8_t *source, size_t size, uint8_t *destination, size_t capacity, uint16_t *table);
+
+/// @brief Decompresses one LZ4 block. destinationSize must be exactly the decompressed size.
+static bool lz4_decompress(const uint8_t *source, size_t size, uint8_t *destination, size_t destinationSize);
+
+/// @brief Writes an LZ4 length extension.
+static inline uint8_t *lz4_write_length(uint8_t *out, size_t length);
+
+bool raw_spill_capture(FsFileSystem *albumDir, int compression)
+{
+    FSFILE *spill     = NULL;
+    uint8_t *chunk    = NULL;
+    uint8_t *out      = NULL;
+    uint16_t *table   = NULL;
+    bool streamOpened = false;
+    bool drained      = false;
+
+    char partPath[FS_MAX_PATH], rawPath[FS_MAX_PATH];
+    const bool directoryReady = directory_cache_ensure(albumDir, RAW_SPILL_DIRECTORY);
+    if (!directoryReady || !find_free_spill_name(albumDir, partPath, rawPath)) { return false; }
+
+    uint64_t width, height;
+    streamOpened = capture_open_stream(&width, &height);
+    if (!streamOpened) { return false; }
+
+    // The spill buffers don't fit next to the warm stream. It's set up again when the spill is encoded.
+    idat_writer_warm_release();
+
+    // The file is created at the full raw size up front. LZ4 spills get trimmed when they're finalized.
+    const size_t rowSize   = width * 4;
+    const int64_t fullSize = sizeof(SpillHeader) + rowSize * height;
+    const bool lz4         = compression == RawSpillLZ4;
+    spill                  = FSFILE_OpenWrite(albumDir, partPath, fullSize);
+    chunk                  = malloc(rowSize * SPILL_CHUNK_ROWS);
+    out                    = lz4 ? malloc(LZ4_ROW_BOUND(rowSize) * SPILL_CHUNK_ROWS) : NULL;
+    table                  = lz4 ? malloc(LZ4_HASH_SIZE * sizeof(uint16_t)) : NULL;
+    if (!spill || !chunk || (lz4 && (!out || !table))) { goto cleanup; }
+
+    const SpillHeader header = {.magic       = SPILL_MAGIC,
+                                .version     = SPILL_VERSION,
+                                .compression = lz4 ? RawSpillLZ4 : RawSpillNone,
+                                .width       = width,
+                                .height      = height};
+    if (FSFILE_Write(spill, &header, sizeof(SpillHeader)) != sizeof(SpillHeader)) { goto cleanup; }
+
+    for (uint64_t row = 0; row < height; row += SPILL_CHUNK_ROWS)
+    {
+        const int rowCount = height - row < SPILL_CHUNK_ROWS ? height - row : SPILL_CHUNK_ROWS;
+        const size_t size  = rowSize * rowCount;
+        if (!capture_read(chunk, size, row * rowSize)) { goto cleanup; }
+
+        const bool written = lz4 ? write_lz4_rows(spill, chunk, rowCount, rowSize, out, table)
+                                 : FSFILE_Write(spill, chunk, size) == (ssize_t)size;
+        if (!written) { goto cleanup; }
+    }
+
+    // Let go of the stream before anything else.
+    capture_close_stream();
+    streamOpened = false;
+    drained      = true;
+
+cleanup:
+    if (streamOpened) { capture_close_stream(); }
+    if (spill) { FSFILE_Finalize(spill); }
+    free(chunk);
+    free(out);
+    free(table);
+
+    // Only finished spills get the .raw extension, so a crash can't leave a broken one behind to be encoded.
+    if (!drained)
+    {
+        FSFILE_Delete(albumDir, partPath);
+        return false;
+    }
+
+    return FSFILE_Rename(albumDir, partPath, rawPath);
+}
+
+bool raw_spill_find_pending(FsFileSystem *albumDir, char *pathOut, size_t pathSize)
+{
+    char name[FS_MAX_PATH - sizeof(RAW_SPILL_DIRECTORY)];
+    if (!directory_find_file(albumDir, RAW_SPILL_DIRECTORY, "raw", name, sizeof(name))) { return false; }
+
+    snprintf(pathOut, pathSize, RAW_SPILL_DIRECTORY "/%s", name);
+    return true;
+}
+
+void raw_spill_discard_partial(FsFileSystem *albumDir)
+{
+    char name[FS_MAX_PATH - sizeof(RAW_SPILL_DIRECTORY)], path[FS_MAX_PATH];
+    while (directory_find_file(albumDir, RAW_SPILL_DIRECTORY, "part", name, sizeof(name)))
+    {
+        snprintf(path, sizeof(path), RAW_SPILL_DIRECTORY "/%s", name);
+        if (!FSFILE_Delete(albumDir, path)) { return; }
+    }
+}
+
+bool raw_spill_open(FsFileSystem *albumDir, const char *path, uint64_t *widthOut, uint64_t *heightOut)
+{
+    if (spillReader.file) { return false; }
+
+    SpillReader reader = {0};
+    reader.file        = FSFILE_OpenRead(albumDir, path);
+    if (!reader.file) { return false; }
+
+    const bool headerRead = FSFILE_Read(reader.file, &reader.header, sizeof(SpillHeader)) == sizeof(SpillHeader);
+    const bool valid      = headerRead && reader.header.magic == SPILL_MAGIC && reader.header.version == SPILL_VERSION &&
+                       reader.header.compression <= RawSpillLZ4 && reader.header.width > 0 && reader.header.height > 0;
+    if (!valid) { goto abort; }
+
+    reader.rowSize    = (size_t)reader.header.width * 4;
+    reader.compressed = reader.header.compression == RawSpillLZ4 ? malloc(LZ4_ROW_BOUND(reader.rowSize)) : NULL;
+    if (reader.header.compression == RawSpillLZ4 && !reader.compressed) { goto abort; }
+
+    if (widthOut) { *widthOut = reader.header.width; }
+    if (heightOut) { *heightOut = reader.header.height; }
+
+    spillReader = reader;
+    return true;
+
+abort:
+    FSFILE_Close(reader.file);
+    return false;
+}
+
+bool raw_spill_read(void *buffer, size_t size, size_t offset)
+{
+    SpillReader *reader = &spillReader;
+    if (!reader->file || offset != reader->nextOffset || size % reader->rowSize != 0) { return false; }
+    if (atomic_load(&spillCancelled)) { return false; }
+
+    if (reader->header.compression == RawSpillNone)
+    {
+        const bool read = FSFILE_Read(reader->file, buffer, size) == (ssize_t)size;
+        if (read) { reader->nextOffset += size; }
+        return read;
+    }
+
+    for (uint8_t *row = buffer; row < (uint8_t *)buffer + size; row += reader->rowSize)
+    {
+        uint32_t recordSize;
+        if (FSFILE_Read(reader->file, &recordSize, sizeof(uint32_t)) != sizeof(uint32_t)) { return false; }
+
+        // Stored rows go straight where they belong.
+        const bool stored         = recordSize & SPILL_ROW_STORED;
+        const size_t payloadSize  = recordSize & ~SPILL_ROW_STORED;
+        const size_t expectedSize = stored ? reader->rowSize : payloadSize;
+        if (expectedSize != payloadSize || payloadSize > LZ4_ROW_BOUND(reader->rowSize)) { return false; }
+
+        uint8_t *target = stored ? row : reader->compressed;
+        if (FSFILE_Read(reader->file, target, payloadSize) != (ssize_t)payloadSize) { return false; }
+        if (!stored && !lz4_decompress(reader->compressed, payloadSize, row, reader->rowSize)) { return false; }
+
+        reader->nextOffset += reader->rowSize;
+    }
+
+    return true;
+}
+
+void raw_spill_close(void)
+{
+    if (!spillReader.file) { return; }
+
+    FSFILE_Close(spillReader.file);
+    free(spillReader.compressed);
+    spillReader = (SpillReader){0};
+}
+
+void raw_spill_set_cancelled(bool cancelled) { atomic_store(&spillCancelled, cancelled); }
+
+static bool find_free_spill_name(FsFileSystem *albumDir, char *partPath, char *rawPath)
+{
+    // Plenty. Anything more than a handful means something is stopping spills from being encoded.
+    static const unsigned int MAX_SPILLS = 1000;
+
+    for (unsigned int i = 0; i < MAX_SPILLS; i++)
+    {
+        snprintf(partPath, FS_MAX_PATH, RAW_SPILL_DIRECTORY "/%04u.part", i);
+        snprintf(rawPath, FS_MAX_PATH, RAW_SPILL_DIRECTORY "/%04u.raw", i);
+        if (!FSFILE_Exists(albumDir, partPath) && !FSFILE_Exists(albumDir, rawPath)) { return true; }
+    }
+
+    return false;
+}
+
+static bool write_lz4_rows(FSFILE *spill, const uint8_t *rows, int rowCount, size_t rowSize, uint8_t *out, uint16_t *table)
+{
+    // Every row is its own block so reading one back never needs more than a row of memory.
+    uint8_t *record = out;
+    for (int i = 0; i < rowCount; i++, rows += rowSize)
+    {
+        const size_t compressedSize = lz4_compress(rows, rowSize, record + sizeof(uint32_t), rowSize - 1, table);
+        const uint32_t recordSize   = compressedSize ? compressedSize : rowSize | SPILL_ROW_STORED;
+        if (!compressedSize) { memcpy(record + sizeof(uint32_t), rows, rowSize); }
+
+        memcpy(record, &recordSize, sizeof(uint32_t));
+        record += sizeof(uint32_t) + (recordSize & ~SPILL_ROW_STORED);
+    }
+
+    const size_t size = record - out;
+    return FSFILE_Write(spill, out, size) == (ssize_t)size;
+}
+
+static size_t lz4_compress(const uint8_t *source, size_t size, uint8_t *destination, size_t capacity, uint16_t *table)
+{
+    const uint8_t *input      = source;
+    const uint8_t *anchor     = source;
+    const uint8_t *inputEnd   = source + size;
+    uint8_t *output           = destination;
+    const uint8_t *outputEnd  = destination + capacity;
+    memset(table, 0, LZ4_HASH_SIZE * sizeof(uint16_t));
+
+    if (size > LZ4_MATCH_LIMIT)
+    {
+        const uint8_t *matchLimit = inputEnd - LZ4_MATCH_LIMIT;
+        const uint8_t *lastLiterals = inputEnd - LZ4_LAST_LITERALS;
+        while (input < matchLimit)
+        {
+            uint32_t sequence, candidate;
+            memcpy(&sequence, input, sizeof(uint32_t));
+
+            const uint32_t hash       = (sequence * 2654435761u) >> 20;
+            const uint8_t *reference  = source + table[hash];
+            table[hash]               = input - source;
+            memcpy(&candidate, reference, sizeof(uint32_t));
+            if (reference >= input || input - reference > 0xFFFF || candidate != sequence)
+            {
+                input++;
+                continue;
+            }
+
+            // Extend the match as far as LZ4 allows.
+            const uint8_t *matchEnd = input + 4;
+            const uint8_t *matchRef = reference + 4;
+            while (matchEnd < lastLiterals && *matchEnd == *matchRef) { matchEnd++, matchRef++; }
+
+            const size_t literalLength = input - anchor;
+            const size_t matchLength   = matchEnd - input - 4;
+            if (outputEnd - output < (ptrdiff_t)(literalLength + literalLength / 255 + matchLength / 255 + 5)) { return 0; }
+
+            uint8_t *token = output++;
+            *token         = (literalLength >= 15 ? 15 : literalLength) << 4;
+            if (literalLength >= 15) { output = lz4_write_length(output, literalLength - 15); }
+            memcpy(output, anchor, literalLength);
+            output += literalLength;
+
+            const uint16_t offset = input - reference;
+            *output++             = offset & 0xFF;
+            *output++             = offset >> 8;
+
+            *token |= matchLength >= 15 ? 15 : matchLength;
+            if (matchLength >= 15) { output = lz4_write_length(output, matchLength - 15); }
+
+            input  = matchEnd;
+            anchor = input;
+        }
+    }
+
+    // Whatever's left is literals.
+    const size_t literalLength = inputEnd - anchor;
+    if (outputEnd - output < (ptrdiff_t)(literalLength + literalLength / 255 + 2)) { return 0; }
+
+    *output++ = (literalLength >= 15 ? 15 : literalLength) << 4;
+    if (literalLength >= 15) { output = lz4_write_length(output, literalLength - 15); }
+    memcpy(output, anchor, literalLength);
+    output += literalLength;
+
+    return output - destination;
+}
+
+static bool lz4_decompress(const uint8_t *source, size_t size, uint8_t *destination, size_t destinationSize)
+{
+    const uint8_t *input     = source;
+    const uint8_t *inputEnd  = source + size;
+    uint8_t *output          = destination;
+    const uint8_t *outputEnd = destination + destinationSize;
+
+    while (input < inputEnd)
+    {
+        const uint8_t token = *input++;
+
+        size_t literalLength = token >> 4;
+        for (uint8_t extra = 0xFF; literalLength >= 15 && extra == 0xFF; literalLength += extra)
+        {
+            if (input >= inputEnd) { return false; }
+            extra = *input++;
+        }
+        if (literalLength > (size_t)(inputEnd - input) || literalLength > (size_t)(outputEnd - output)) { return false; }
+
+        memcpy(output, input, literalLength);
+        output += literalLength;
+        input += literalLength;
+
+        // The last sequence is only literals.
+        if (input == inputEnd) { break; }
+        if (inputEnd - input < 2) { return false; }
+
+        const size_t offset = input[0] | (input[1] << 8);
+        input += 2;
+        if (offset == 0 || offset > (size_t)(output - destination)) { return false; }
+
+        size_t matchLength = token & 0x0F;
+        for (uint8_t extra = 0xFF; matchLength >= 15 && extra == 0xFF; matchLength += extra)
+        {
+            if (input >= inputEnd) { return false; }
+            extra = *input++;
+        }
+        matchLength += 4;
+        if (matchLength > (size_t)(outputEnd - output)) { return false; }
+
+        // Byte by byte because the match can overlap what it's writing.
+        const uint8_t *reference = output - offset;
+        for (size_t i = 0; i < matchLength; i++) { output[i] = reference[i]; }
+        output += matchLength;
+    }
+
+    return output == outputEnd;
+}
+
+static inline uint8_t *lz4_write_length(uint8_t *out, size_t length)
+{
+    for (; length >= 255; length -= 255) { *out++ = 255; }
+    *out++ = length;
+    return out;
+}
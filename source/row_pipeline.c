@@ -0,0 +1,209 @@
+#include "row_pipeline.h"
+
+#include "capture.h"
+#include "encode_governor.h"
+
+#include <malloc.h>
+#include <switch.h>
+
+// The ring comes out of the sysmodule heap. 8 rows is 40KB, which still fits next to libpng and zlib in INNER_HEAP_SIZE. The
+// reader's stack is static so it doesn't take from that too. There's only one capture stream, so only one pipeline ever
+// runs at a time.
+
+/// @brief Stack size of the reader thread. It only ever calls capture_read_rows.
+#define READER_STACK_SIZE 0x4000
+
+/// @brief Highest priority of the reader thread. This matches the main thread in PNGShot.json.
+static const int READER_PRIORITY = 0x2C;
+
+// clang-format off
+struct RowPipeline
+{
+    /// @brief Reader thread.
+    Thread reader;
+
+    /// @brief Guards everything below.
+    Mutex lock;
+
+    /// @brief Signalled when a row has been read.
+    CondVar rowRead;
+
+    /// @brief Signalled when a slot has been freed.
+    CondVar slotFreed;
+
+    /// @brief Number of rows read so far.
+    int rowsRead;
+
+    /// @brief Number of rows released so far.
+    int rowsReleased;
+
+    /// @brief Rows read per call and the number of calls made.
+    int blockRows, readCalls;
+
+    /// @brief Set when a read fails.
+    bool readFailed;
+
+    /// @brief Set when the encoder is done, successful or not.
+    bool stopping;
+
+    /// @brief Ticks spent reading.
+    uint64_t readTicks;
+
+    /// @brief Ticks spent waiting for rows.
+    uint64_t stallTicks;
+
+    /// @brief Hash rows are added to. NULL if the frame isn't being hashed.
+    FrameHash *hash;
+
+    /// @brief Ring of ROW_PIPELINE_SLOTS rows.
+    uint8_t *ring;
+};
+// clang-format on
+
+/// @brief Stack of the reader thread.
+static uint8_t readerStack[READER_STACK_SIZE] __attribute__((aligned(0x1000)));
+
+// Defined at bottom.
+
+/// @brief Reader thread function.
+/// @param arg RowPipeline the thread belongs to.
+static void row_pipeline_reader(void *arg);
+
+/// @brief Returns the slot the row passed goes in.
+static inline uint8_t *row_pipeline_slot(RowPipeline *pipeline, int rowIndex);
+
+RowPipeline *row_pipeline_start(FrameHash *hash, int blockRows)
+{
+    // A block has to land in consecutive slots, which only works if blocks never straddle the end of the ring.
+    if (blockRows < 1 || blockRows > ROW_PIPELINE_MAX_BLOCK || ROW_PIPELINE_SLOTS % blockRows != 0) { return NULL; }
+
+    RowPipeline *pipeline = calloc(1, sizeof(RowPipeline));
+    if (!pipeline) { return NULL; }
+    pipeline->hash      = hash;
+    pipeline->blockRows = blockRows;
+
+    pipeline->ring = malloc(ROW_PIPELINE_SLOTS * CAPTURE_ROW_SIZE);
+    if (!pipeline->ring) { goto abort; }
+
+    mutexInit(&pipeline->lock);
+    condvarInit(&pipeline->rowRead);
+    condvarInit(&pipeline->slotFreed);
+
+    // The reader shares the encoder's core and runs at the priority of whoever started it, never above the main thread.
+    // Spills are encoded below the main thread, and their SD reads and LZ4 shouldn't jump ahead of it.
+    int32_t callerPriority = READER_PRIORITY;
+    svcGetThreadPriority(&callerPriority, CUR_THREAD_HANDLE);
+    const int readerPriority = callerPriority > READER_PRIORITY ? callerPriority : READER_PRIORITY;
+
+    const bool created = R_SUCCEEDED(threadCreate(&pipeline->reader,
+                                                  row_pipeline_reader,
+                                                  pipeline,
+                                                  readerStack,
+                                                  READER_STACK_SIZE,
+                                                  readerPriority,
+                                                  encode_governor_core()));
+    if (!created) { goto abort; }
+
+    const bool started = R_SUCCEEDED(threadStart(&pipeline->reader));
+    if (!started)
+    {
+        threadClose(&pipeline->reader);
+        goto abort;
+    }
+
+    return pipeline;
+
+abort:
+    free(pipeline->ring);
+    free(pipeline);
+    return NULL;
+}
+
+uint8_t *row_pipeline_acquire(RowPipeline *pipeline, int rowIndex)
+{
+    const uint64_t waitBegin = armGetSystemTick();
+
+    mutexLock(&pipeline->lock);
+    while (pipeline->rowsRead <= rowIndex && !pipeline->readFailed) { condvarWait(&pipeline->rowRead, &pipeline->lock); }
+    const bool rowReady = pipeline->rowsRead > rowIndex;
+    mutexUnlock(&pipeline->lock);
+
+    pipeline->stallTicks += armGetSystemTick() - waitBegin;
+
+    return rowReady ? row_pipeline_slot(pipeline, rowIndex) : NULL;
+}
+
+void row_pipeline_release(RowPipeline *pipeline)
+{
+    mutexLock(&pipeline->lock);
+    ++pipeline->rowsReleased;
+    condvarWakeOne(&pipeline->slotFreed);
+    mutexUnlock(&pipeline->lock);
+}
+
+void row_pipeline_finish(RowPipeline *pipeline, RowPipelineStats *statsOut)
+{
+    if (!pipeline) { return; }
+
+    // Wake the reader in case it's waiting on a slot that's never coming back.
+    mutexLock(&pipeline->lock);
+    pipeline->stopping = true;
+    condvarWakeOne(&pipeline->slotFreed);
+    mutexUnlock(&pipeline->lock);
+
+    threadWaitForExit(&pipeline->reader);
+    threadClose(&pipeline->reader);
+
+    if (statsOut)
+    {
+        statsOut->readTicks  = pipeline->readTicks;
+        statsOut->stallTicks = pipeline->stallTicks;
+        statsOut->readCalls  = pipeline->readCalls;
+    }
+
+    free(pipeline->ring);
+    free(pipeline);
+}
+
+static void row_pipeline_reader(void *arg)
+{
+    RowPipeline *pipeline = arg;
+
+    for (int i = 0; i < CAPTURE_HEIGHT; i += pipeline->blockRows)
+    {
+        const int remaining = CAPTURE_HEIGHT - i;
+        const int rowCount  = remaining < pipeline->blockRows ? remaining : pipeline->blockRows;
+
+        // Wait for enough free slots for the whole block.
+        mutexLock(&pipeline->lock);
+        while (i + rowCount - pipeline->rowsReleased > ROW_PIPELINE_SLOTS && !pipeline->stopping)
+        {
+            condvarWait(&pipeline->slotFreed, &pipeline->lock);
+        }
+        const bool stopping = pipeline->stopping;
+        mutexUnlock(&pipeline->lock);
+        if (stopping) { return; }
+
+        // The read itself happens without the lock so the encoder can keep going. Hashing here keeps it off the encoder.
+        const uint64_t readBegin = armGetSystemTick();
+        uint8_t *slot            = row_pipeline_slot(pipeline, i);
+        const bool rowsRead      = capture_read_rows(slot, i, rowCount);
+        if (rowsRead && pipeline->hash) { frame_hash_update(pipeline->hash, slot, (size_t)rowCount * CAPTURE_ROW_SIZE); }
+        pipeline->readTicks += armGetSystemTick() - readBegin;
+        ++pipeline->readCalls;
+
+        // The whole block becomes available at once.
+        mutexLock(&pipeline->lock);
+        if (rowsRead) { pipeline->rowsRead += rowCount; }
+        else { pipeline->readFailed = true; }
+        condvarWakeOne(&pipeline->rowRead);
+        mutexUnlock(&pipeline->lock);
+
+        if (!rowsRead) { return; }
+    }
+}
+
+static inline uint8_t *row_pipeline_slot(RowPipeline *pipeline, int rowIndex)
+{
+    return pipeline->ring + (rowIndex % ROW_PIPELINE_SLOTS) * CAPTURE_ROW_SIZE;
+}